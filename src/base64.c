@@ -1,3 +1,4 @@
+#define MEM_AREA MEM_HTTP
 #include "base64.h"
 
 /** @file */
@@ -0,0 +1,873 @@
+#include "main.h"
+#include "idset.h"
+#include "json.h"
+#include "kwset.h"
+#include "namelist.h"
+#include "stats.h"
+#include "status.h"
+#include "tst.h"
+#include "ui.h"
+#include <stdio.h>
+
+/** @file
+ * Offline benchmarks of the JSON and printing paths, run over recorded API
+ * responses. Every result is printed on one line, in the format of the Go
+ * benchmarks, so the outputs of two commits can be compared line by line:
+ *
+ * Benchmark<Name>/<file> <iterations> <ns> ns/op [<MB> MB/s] <n> B/op
+ * <n> allocs/op
+ *
+ * where B/op is the count of bytes requested from the allocator.
+ */
+
+/** The default time (in seconds) a benchmark is run for */
+#define BENCH_TIME 1.0
+
+/** The count of statuses Merge merges, at least */
+#define MERGE_STATUSES 100000
+
+/** The count of names NamelistBuild and NamelistContains are run over */
+#define NAMELIST_NAMES 20000
+
+/** The count of screen names TstInsert and TstComplete are run over, and
+ * the most names a completion lists, as the client does on Tab Tab */
+#define TST_NAMES 100000
+#define TST_LIST 50
+
+/** The count of keywords MuteScan and MuteStrstr look for, a mute list
+ * far longer than anyone writes by hand */
+#define KWSET_KEYWORDS 500
+
+/** The count of IDs of the snapshots IdsetBuild and IdsetDiff are run over,
+ * and the count that differs between the two */
+#define IDSET_IDS 1000000
+#define IDSET_CHURN 20000
+
+/** A recorded response and what has been made of it */
+struct _bench_input {
+
+	/** The raw response */
+	char *text;
+
+	/** The size of the response in bytes */
+	long size;
+
+	/** The parse tree of the response */
+	json_element tree;
+
+	/** The decoded statuses of a timeline, NULL for a list */
+	status_page page;
+
+	/** The created_at strings of a timeline, and their count */
+	char **times;
+	long ntimes;
+
+	/** The pages Merge merges: copies of the timeline, each one
+	 * overlapping its neighbours by a quarter */
+	status_page *pages;
+	int npages;
+
+	/** True if the response is a timeline, false if a user list */
+	int timeline;
+
+	/** The group to filter with when printing, may be NULL */
+	char *group;
+
+	/** Where the printed output goes */
+	FILE *devnull;
+
+	/** The paths of the fields _bench_lookup() looks up: the screen name
+	 * of a user, and the fields of a status */
+	json_path screen_name;
+	json_path status[4];
+
+	/** The screen names of a whole page, with a wildcard */
+	json_path all_screen_names;
+
+	/** The fields the client prints, for the projected parse */
+	json_projection projection;
+
+	/** The names of a long list: the screen names of the list with
+	 * suffixes, and their count */
+	char **names;
+	long nnames;
+
+	/** The set of the names */
+	namelist set;
+
+	/** The tree of the screen names completed, and the one completed
+	 * next */
+	tst names_tree;
+	long next;
+
+	/** The texts of the statuses of a timeline, their count and their
+	 * total length */
+	char **texts;
+	long ntexts;
+	long text_bytes;
+
+	/** The keywords of the mute list, their count and their set */
+	char **keywords;
+	long nkeywords;
+	kwset filter;
+
+	/** The count of texts a keyword was found in, kept so that the
+	 * searches aren't optimized away */
+	long found;
+
+	/** Two snapshots of the IDs of a list, and their sets */
+	unsigned long *ids[2];
+	idset idsets[2];
+};
+
+/** The prototype of the operation that is measured */
+typedef void (*bench_fn) (struct _bench_input * in);
+
+/** How long a benchmark is run for, in seconds */
+static double bench_time = BENCH_TIME;
+
+/** Reads the whole file into memory
+ * @param fname the name of the file
+ * @param size the size of the file is stored here
+ * @return the allocated, NUL terminated content, NULL if failed */
+static char *_read_file(char *fname, long *size);
+
+/** Runs the operation repeatedly for at least bench_time seconds, and
+ * prints the result line
+ * @param name the name of the benchmark
+ * @param fname the name of the input file
+ * @param in the input
+ * @param fn the operation to measure
+ * @param bytes the count of bytes one operation processes, 0 if it doesn't
+ * make sense */
+static void _run(char *name, char *fname, struct _bench_input *in,
+		 bench_fn fn, long bytes);
+
+static void _bench_parse(struct _bench_input *in);
+static void _bench_parse_strict(struct _bench_input *in);
+static void _bench_parse_projected(struct _bench_input *in);
+static void _bench_decode(struct _bench_input *in);
+static void _bench_parse_time(struct _bench_input *in);
+static void _bench_merge(struct _bench_input *in);
+
+/** Prepares the inputs of ParseTime and Merge from a timeline
+ * @param in the input, with the page decoded
+ * @return 0 if succeeded, -1 if out of memory */
+static int _merge_setup(struct _bench_input *in);
+
+/** Frees what _merge_setup() allocated
+ * @param in the input */
+static void _merge_free(struct _bench_input *in);
+
+/** Stores the created_at strings in in->times, a json_path_fn */
+static int _collect_time(json_element elem, void *arg);
+
+static void _bench_namelist_build(struct _bench_input *in);
+static void _bench_namelist_contains(struct _bench_input *in);
+
+/** Prepares the inputs of NamelistBuild and NamelistContains from a list:
+ * NAMELIST_NAMES names made of its screen names, as the pages of a long
+ * list would bring them
+ * @param in the input, with the list parsed
+ * @return 0 if succeeded, -1 if out of memory */
+static int _namelist_setup(struct _bench_input *in);
+
+/** Frees what _namelist_setup() allocated
+ * @param in the input */
+static void _namelist_free(struct _bench_input *in);
+
+static void _bench_tst_insert(struct _bench_input *in);
+static void _bench_tst_complete(struct _bench_input *in);
+
+/** The tst_fn counting the names listed, down from the int given as arg */
+static int _tst_list(char *word, void *arg);
+
+/** Prepares the inputs of TstInsert and TstComplete: TST_NAMES random
+ * screen names and their tree
+ * @param in the input
+ * @return 0 if succeeded, -1 if out of memory */
+static int _tst_setup(struct _bench_input *in);
+
+/** Frees what _tst_setup() allocated
+ * @param in the input */
+static void _tst_free(struct _bench_input *in);
+
+static void _bench_kwset_compile(struct _bench_input *in);
+static void _bench_mute_scan(struct _bench_input *in);
+static void _bench_mute_strstr(struct _bench_input *in);
+
+/** Prepares the inputs of KwsetCompile, MuteScan and MuteStrstr: the texts
+ * of the timeline, and KWSET_KEYWORDS random words, a few of them taken
+ * from the texts so that some match
+ * @param in the timeline, decoded
+ * @retval 0 if succeeded
+ * @retval -1 if out of memory */
+static int _kwset_setup(struct _bench_input *in);
+
+/** Frees what _kwset_setup() allocated
+ * @param in the input */
+static void _kwset_free(struct _bench_input *in);
+
+static void _bench_idset_build(struct _bench_input *in);
+static void _bench_idset_diff(struct _bench_input *in);
+
+/** Prepares the inputs of IdsetBuild and IdsetDiff: two snapshots of
+ * IDSET_IDS IDs, IDSET_CHURN of them replaced in the second
+ * @param in the input
+ * @param range the IDs are picked from [0, range)
+ * @return 0 if succeeded, -1 if out of memory */
+static int _idset_setup(struct _bench_input *in, unsigned long range);
+
+/** Frees what _idset_setup() allocated
+ * @param in the input */
+static void _idset_free(struct _bench_input *in);
+static void _bench_lookup(struct _bench_input *in);
+static void _bench_path_lookup(struct _bench_input *in);
+static void _bench_path_each(struct _bench_input *in);
+static int _count_match(json_element elem, void *arg);
+static void _bench_to_string(struct _bench_input *in);
+static void _bench_render(struct _bench_input *in);
+
+/** Usage: bench [-t seconds] [-c config] file...
+ *
+ * Files whose name contains "timeline" are treated as timelines, the rest
+ * as friend or follower lists. If a config is given, printing is filtered
+ * by its first group. */
+int main(int argc, char **argv)
+{
+	struct _bench_input in;
+	char *fname;
+	char *base;
+	char *timeline_fields[] = { "/*/user/screen_name", "/*/text",
+		"/*/created_at", "/*/in_reply_to_screen_name"
+	};
+	char *list_fields[] = { "/*/screen_name" };
+	int i;
+
+	in.group = NULL;
+	in.screen_name = json_path_compile("/screen_name");
+	in.status[0] = json_path_compile("/user/screen_name");
+	in.status[1] = json_path_compile("/text");
+	in.status[2] = json_path_compile("/created_at");
+	in.status[3] = json_path_compile("/in_reply_to_screen_name");
+	in.devnull = fopen("/dev/null", "w");
+	if (in.devnull == NULL)
+		return 1;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			bench_time = atof(argv[++i]);
+			continue;
+		}
+		if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+			if (ui_read_config(argv[++i]) < 0)
+				return 1;
+			in.group = "friends";
+			continue;
+		}
+
+		fname = argv[i];
+		base = strrchr(fname, '/');
+		base = base == NULL ? fname : base + 1;
+
+		in.text = _read_file(fname, &in.size);
+		if (in.text == NULL) {
+			fprintf(stderr, "ERROR: cannot read %s\n", fname);
+			return 1;
+		}
+		in.timeline = strstr(base, "timeline") != NULL;
+		in.tree = json_parse(in.text);
+
+		_run("Parse", base, &in, _bench_parse, in.size);
+		_run("ParseStrict", base, &in, _bench_parse_strict, in.size);
+		/* what the client prints of the response, see _com_fetch() */
+		in.projection = in.timeline ?
+		    json_projection_compile(timeline_fields, 4) :
+		    json_projection_compile(list_fields, 1);
+		_run("ParseProjected", base, &in, _bench_parse_projected,
+		     in.size);
+		json_projection_free(in.projection);
+		in.page = NULL;
+		if (in.timeline) {
+			_run("Decode", base, &in, _bench_decode, in.size);
+			in.page = status_decode(in.text, in.size, NULL, NULL);
+			if (in.page == NULL || _merge_setup(&in) < 0)
+				return 1;
+			_run("ParseTime", base, &in, _bench_parse_time, 0);
+			_run("Merge", base, &in, _bench_merge, 0);
+			_merge_free(&in);
+			if (_kwset_setup(&in) < 0)
+				return 1;
+			_run("KwsetCompile", base, &in, _bench_kwset_compile,
+			     0);
+			_run("MuteScan", base, &in, _bench_mute_scan,
+			     in.text_bytes);
+			_run("MuteStrstr", base, &in, _bench_mute_strstr,
+			     in.text_bytes);
+			_kwset_free(&in);
+		}
+		else {
+			if (_namelist_setup(&in) < 0)
+				return 1;
+			_run("NamelistBuild", base, &in, _bench_namelist_build,
+			     0);
+			_run("NamelistContains", base, &in,
+			     _bench_namelist_contains, 0);
+			_namelist_free(&in);
+		}
+		_run("Lookup", base, &in, _bench_lookup, 0);
+		_run("PathLookup", base, &in, _bench_path_lookup, 0);
+		in.all_screen_names = json_path_compile(in.timeline ?
+							"/*/user/screen_name" :
+							"/*/screen_name");
+		_run("PathEach", base, &in, _bench_path_each, 0);
+		json_path_free(in.all_screen_names);
+		_run("ToString", base, &in, _bench_to_string, in.size);
+		_run("Render", base, &in, _bench_render, 0);
+
+		json_free(in.tree);
+		status_free(in.page);
+		free(in.text);
+	}
+
+	/* follower IDs spread over the 32 bit range, and packed densely */
+	if (_idset_setup(&in, 0xffffffffUL) < 0)
+		return 1;
+	_run("IdsetBuild", "sparse", &in, _bench_idset_build, 0);
+	_run("IdsetDiff", "sparse", &in, _bench_idset_diff, 0);
+	_idset_free(&in);
+	if (_idset_setup(&in, IDSET_IDS + IDSET_IDS / 20) < 0)
+		return 1;
+	_run("IdsetBuild", "dense", &in, _bench_idset_build, 0);
+	_run("IdsetDiff", "dense", &in, _bench_idset_diff, 0);
+	_idset_free(&in);
+
+	if (_tst_setup(&in) < 0)
+		return 1;
+	_run("TstInsert", "names", &in, _bench_tst_insert, 0);
+	_run("TstComplete", "names", &in, _bench_tst_complete, 0);
+	_tst_free(&in);
+
+	fclose(in.devnull);
+	return 0;
+}
+
+/* ************************************
+ * static functions
+ */
+static char *_read_file(char *fname, long *size)
+{
+	FILE *fp = fopen(fname, "r");
+	char *text;
+
+	if (fp == NULL)
+		return NULL;
+
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	text = malloc(*size + 1);
+	if (text == NULL || fread(text, 1, *size, fp) != (size_t) * size) {
+		free(text);
+		fclose(fp);
+		return NULL;
+	}
+	text[*size] = 0;
+
+	fclose(fp);
+	return text;
+}
+
+static void _run(char *name, char *fname, struct _bench_input *in,
+		 bench_fn fn, long bytes)
+{
+	long iterations = 1;
+	long i;
+	struct mem_stats before;
+	struct mem_stats after;
+	unsigned long allocs;
+	unsigned long bytes_allocd;
+	double start;
+	double elapsed;
+	double scale;
+
+	/* grow the iteration count until the run takes long enough */
+	for (;;) {
+		/* every allocation of the code under test goes through mem.c */
+		mem_get(MEM_AREAS, &before);
+		start = stats_now();
+		for (i = 0; i < iterations; i++)
+			fn(in);
+		elapsed = (stats_now() - start) / 1e6;
+		mem_get(MEM_AREAS, &after);
+		allocs = after.count - before.count;
+		bytes_allocd = after.bytes - before.bytes;
+
+		if (elapsed >= bench_time || iterations >= 1000000000L)
+			break;
+
+		scale = elapsed <= 0 ? 100 : 1.2 * bench_time / elapsed;
+		if (scale > 100)
+			scale = 100;
+		iterations = (long) (iterations * scale) + 1;
+	}
+
+	printf("Benchmark%s/%s\t%10ld\t%12.0f ns/op", name, fname, iterations,
+	       elapsed * 1e9 / iterations);
+	if (bytes > 0)
+		printf("\t%8.2f MB/s", bytes * iterations / elapsed / 1e6);
+	printf("\t%10lu B/op\t%8lu allocs/op\n", bytes_allocd / iterations,
+	       allocs / iterations);
+	fflush(stdout);
+}
+
+static void _bench_parse(struct _bench_input *in)
+{
+	json_free(json_parse(in->text));
+}
+
+static void _bench_parse_strict(struct _bench_input *in)
+{
+	json_free(json_parse_strict(in->text, in->size, NULL, NULL));
+}
+
+static void _bench_parse_projected(struct _bench_input *in)
+{
+	json_free(json_parse_projected(in->text, in->size, in->projection,
+				       NULL, NULL));
+}
+
+static void _bench_decode(struct _bench_input *in)
+{
+	status_free(status_decode(in->text, in->size, NULL, NULL));
+}
+
+static void _bench_parse_time(struct _bench_input *in)
+{
+	long i;
+
+	for (i = 0; i < in->ntimes; i++)
+		status_parse_time(in->times[i], strlen(in->times[i]));
+}
+
+static void _bench_merge(struct _bench_input *in)
+{
+	status_view_free(status_merge(in->pages, in->npages));
+}
+
+static int _merge_setup(struct _bench_input *in)
+{
+	json_path path = json_path_compile("/*/created_at");
+	long stride = in->page->count - in->page->count / 4;
+	long pos;
+	long row;
+	int i;
+
+	in->times = malloc(in->page->count * sizeof(*in->times));
+	in->ntimes = 0;
+	in->npages = MERGE_STATUSES / (stride > 0 ? stride : 1) + 1;
+	in->pages = calloc(in->npages, sizeof(*in->pages));
+	if (path == NULL || in->times == NULL || in->pages == NULL)
+		return -1;
+	json_path_each(in->tree, path, _collect_time, in);
+	json_path_free(path);
+
+	/* the n-th status of the merge is at the same time and has the same
+	 * ID in every page that has it, and the pages are in order */
+	for (i = 0; i < in->npages; i++) {
+		in->pages[i] = status_decode(in->text, in->size, NULL, NULL);
+		if (in->pages[i] == NULL)
+			return -1;
+		for (row = 0; row < in->pages[i]->count; row++) {
+			pos = i * stride + row;
+			in->pages[i]->created_at[row] = 2000000000L - pos * 60;
+			in->pages[i]->id[row] = 3000000000UL - pos;
+		}
+	}
+
+	return 0;
+}
+
+static void _merge_free(struct _bench_input *in)
+{
+	int i;
+
+	for (i = 0; i < in->npages; i++)
+		status_free(in->pages[i]);
+	free(in->pages);
+	free(in->times);
+}
+
+static int _collect_time(json_element elem, void *arg)
+{
+	struct _bench_input *in = arg;
+
+	if (elem->type == JSON_STRING && in->ntimes < in->page->count)
+		in->times[in->ntimes++] = elem->data;
+	return 0;
+}
+
+static void _bench_namelist_build(struct _bench_input *in)
+{
+	namelist_free(namelist_build(in->names, in->nnames));
+}
+
+static void _bench_namelist_contains(struct _bench_input *in)
+{
+	long i;
+
+	for (i = 0; i < in->nnames; i++)
+		namelist_contains(in->set, in->names[i]);
+}
+
+static int _namelist_setup(struct _bench_input *in)
+{
+	json_element current;
+	char *sname;
+	long count = 0;
+	long i;
+
+	for (current = in->tree->data; current != NULL; current = current->next)
+		count++;
+	in->names = calloc(NAMELIST_NAMES, sizeof(*in->names));
+	in->nnames = 0;
+	if (in->names == NULL || count == 0)
+		return -1;
+
+	/* the n-th round of the list gets the suffix _n */
+	for (i = 0; i < NAMELIST_NAMES; i++) {
+		if (i % count == 0)
+			current = in->tree->data;
+		sname = json_path_string(current, in->screen_name);
+		current = current->next;
+		if (sname == NULL)
+			continue;
+
+		in->names[in->nnames] = malloc(strlen(sname) + 16);
+		if (in->names[in->nnames] == NULL)
+			return -1;
+		sprintf(in->names[in->nnames++], "%s_%ld", sname, i / count);
+	}
+
+	in->set = namelist_build(in->names, in->nnames);
+	return in->set == NULL ? -1 : 0;
+}
+
+static void _namelist_free(struct _bench_input *in)
+{
+	long i;
+
+	for (i = 0; i < in->nnames; i++)
+		free(in->names[i]);
+	free(in->names);
+	namelist_free(in->set);
+}
+
+static void _bench_kwset_compile(struct _bench_input *in)
+{
+	kwset k = kwset_create();
+	long i;
+
+	for (i = 0; i < in->nkeywords; i++)
+		kwset_add(k, in->keywords[i], 1);
+	kwset_compile(k);
+	kwset_free(k);
+}
+
+static void _bench_mute_scan(struct _bench_input *in)
+{
+	long i;
+
+	in->found = 0;
+	for (i = 0; i < in->ntexts; i++)
+		if (kwset_scan(in->filter, in->texts[i], strlen(in->texts[i]),
+			       0))
+			in->found++;
+}
+
+static void _bench_mute_strstr(struct _bench_input *in)
+{
+	long i,
+	 j;
+
+	/* what a filter without the automaton does, case sensitive even */
+	in->found = 0;
+	for (i = 0; i < in->ntexts; i++) {
+		for (j = 0; j < in->nkeywords; j++)
+			if (strstr(in->texts[i], in->keywords[j]) != NULL)
+				break;
+		if (j < in->nkeywords)
+			in->found++;
+	}
+}
+
+static int _kwset_setup(struct _bench_input *in)
+{
+	char *text;
+	long len;
+	long i,
+	 j;
+
+	in->texts = calloc(in->page->count + 1, sizeof(*in->texts));
+	in->keywords = calloc(KWSET_KEYWORDS, sizeof(*in->keywords));
+	in->ntexts = 0;
+	in->nkeywords = 0;
+	in->text_bytes = 0;
+	in->filter = NULL;
+	if (in->texts == NULL || in->keywords == NULL)
+		return -1;
+
+	for (i = 0; i < in->page->count; i++) {
+		text = STATUS_STR(in->page, in->page->text[i]);
+		if (text == NULL)
+			continue;
+		in->texts[in->ntexts++] = text;
+		in->text_bytes += strlen(text);
+	}
+	if (in->ntexts == 0)
+		return -1;
+
+	/* the same words every run, 4 to 10 letters; one in fifty is a piece
+	 * of a text */
+	srand(1);
+	for (i = 0; i < KWSET_KEYWORDS; i++) {
+		in->keywords[i] = malloc(11);
+		if (in->keywords[i] == NULL)
+			return -1;
+		in->nkeywords++;
+		len = 4 + rand() % 7;
+		text = in->texts[rand() % in->ntexts];
+		j = strlen(text);
+		if (i % 50 == 0 && j >= len) {
+			memcpy(in->keywords[i], text + rand() % (j - len + 1),
+			       len);
+		}
+		else {
+			for (j = 0; j < len; j++)
+				in->keywords[i][j] = 'a' + rand() % 26;
+		}
+		in->keywords[i][len] = 0;
+	}
+
+	in->filter = kwset_create();
+	if (in->filter == NULL)
+		return -1;
+	for (i = 0; i < in->nkeywords; i++)
+		if (kwset_add(in->filter, in->keywords[i], 1) < 0)
+			return -1;
+	if (kwset_compile(in->filter) < 0)
+		return -1;
+
+	fprintf(stderr, "kwset of %d keywords: %ld bytes\n",
+		kwset_count(in->filter), kwset_size(in->filter));
+	return 0;
+}
+
+static void _kwset_free(struct _bench_input *in)
+{
+	long i;
+
+	for (i = 0; i < in->nkeywords; i++)
+		free(in->keywords[i]);
+	free(in->keywords);
+	free(in->texts);
+	kwset_free(in->filter);
+}
+
+static void _bench_tst_insert(struct _bench_input *in)
+{
+	tst t = tst_create();
+	long i;
+
+	for (i = 0; i < in->nnames; i++)
+		tst_insert(t, in->names[i]);
+	tst_free(t);
+}
+
+static void _bench_tst_complete(struct _bench_input *in)
+{
+	char prefix[3];
+	char buf[TST_WORD_MAX];
+	int unique;
+	int left = TST_LIST;
+
+	/* what Tab and Tab Tab do, after the first two characters */
+	memcpy(prefix, in->names[in->next], 2);
+	prefix[2] = 0;
+	in->next = (in->next + 1) % in->nnames;
+
+	tst_extend(in->names_tree, prefix, buf, sizeof(buf), &unique);
+	tst_each_prefix(in->names_tree, prefix, _tst_list, &left);
+}
+
+static int _tst_list(char *word, void *arg)
+{
+	int *left = arg;
+
+	return --*left <= 0;
+}
+
+static int _tst_setup(struct _bench_input *in)
+{
+	static char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+	long len;
+	long i,
+	 j;
+
+	in->names = calloc(TST_NAMES, sizeof(*in->names));
+	in->nnames = 0;
+	in->next = 0;
+	if (in->names == NULL)
+		return -1;
+
+	/* the same names every run, 3 to 15 characters, starting with a
+	 * letter */
+	srand(1);
+	for (i = 0; i < TST_NAMES; i++) {
+		len = 3 + rand() % 13;
+		in->names[i] = malloc(len + 1);
+		if (in->names[i] == NULL)
+			return -1;
+		in->nnames++;
+		in->names[i][0] = chars[rand() % 26];
+		for (j = 1; j < len; j++)
+			in->names[i][j] = chars[rand() % (sizeof(chars) - 1)];
+		in->names[i][len] = 0;
+	}
+
+	in->names_tree = tst_create();
+	if (in->names_tree == NULL)
+		return -1;
+	for (i = 0; i < in->nnames; i++)
+		if (tst_insert(in->names_tree, in->names[i]) < 0)
+			return -1;
+
+	fprintf(stderr, "tst of %ld names: %ld bytes\n",
+		tst_count(in->names_tree), tst_size(in->names_tree));
+	return 0;
+}
+
+static void _tst_free(struct _bench_input *in)
+{
+	long i;
+
+	for (i = 0; i < in->nnames; i++)
+		free(in->names[i]);
+	free(in->names);
+	tst_free(in->names_tree);
+}
+
+static void _bench_idset_build(struct _bench_input *in)
+{
+	idset_free(idset_build(in->ids[0], IDSET_IDS));
+}
+
+static void _bench_idset_diff(struct _bench_input *in)
+{
+	/* what d does: the gained and the lost */
+	idset_free(idset_difference(in->idsets[1], in->idsets[0]));
+	idset_free(idset_difference(in->idsets[0], in->idsets[1]));
+}
+
+static int _idset_setup(struct _bench_input *in, unsigned long range)
+{
+	unsigned long id;
+	long i;
+
+	in->ids[0] = malloc(IDSET_IDS * sizeof(**in->ids));
+	in->ids[1] = malloc(IDSET_IDS * sizeof(**in->ids));
+	if (in->ids[0] == NULL || in->ids[1] == NULL)
+		return -1;
+
+	/* the same sequence every run */
+	srand(1);
+	for (i = 0; i < IDSET_IDS; i++) {
+		id = ((unsigned long) rand() << 16 ^ rand()) % range;
+		in->ids[0][i] = id;
+		in->ids[1][i] = id;
+	}
+	for (i = 0; i < IDSET_CHURN; i++)
+		in->ids[1][rand() % IDSET_IDS] =
+		    ((unsigned long) rand() << 16 ^ rand()) % range;
+
+	in->idsets[0] = idset_build(in->ids[0], IDSET_IDS);
+	in->idsets[1] = idset_build(in->ids[1], IDSET_IDS);
+	if (in->idsets[0] == NULL || in->idsets[1] == NULL)
+		return -1;
+
+	fprintf(stderr, "idset of %ld IDs in [0, %lu): %ld bytes\n",
+		idset_count(in->idsets[0]), range, idset_size(in->idsets[0]));
+	return 0;
+}
+
+static void _idset_free(struct _bench_input *in)
+{
+	free(in->ids[0]);
+	free(in->ids[1]);
+	idset_free(in->idsets[0]);
+	idset_free(in->idsets[1]);
+}
+
+static void _bench_lookup(struct _bench_input *in)
+{
+	json_element current;
+	json_element tmp;
+
+	for (current = in->tree->data; current != NULL; current = current->next) {
+		if (in->timeline) {
+			tmp = json_get_element_by_name(current, "user");
+			tmp = json_get_element_by_name(tmp, "screen_name");
+			json_get_element_by_name(current, "text");
+			json_get_element_by_name(current, "created_at");
+			json_get_element_by_name(current,
+						 "in_reply_to_screen_name");
+		}
+		else {
+			json_get_element_by_name(current, "screen_name");
+		}
+	}
+}
+
+static void _bench_path_lookup(struct _bench_input *in)
+{
+	json_element current;
+
+	for (current = in->tree->data; current != NULL; current = current->next) {
+		if (in->timeline) {
+			json_path_string(current, in->status[0]);
+			json_path_string(current, in->status[1]);
+			json_path_string(current, in->status[2]);
+			json_path_string(current, in->status[3]);
+		}
+		else {
+			json_path_string(current, in->screen_name);
+		}
+	}
+}
+
+static void _bench_path_each(struct _bench_input *in)
+{
+	long count = 0;
+
+	json_path_each(in->tree, in->all_screen_names, _count_match, &count);
+}
+
+static int _count_match(json_element elem, void *arg)
+{
+	(*(long *) arg)++;
+	return 0;
+}
+
+static void _bench_to_string(struct _bench_input *in)
+{
+	free(json_to_string(in->tree));
+}
+
+static void _bench_render(struct _bench_input *in)
+{
+	if (in->page != NULL)
+		ui_print_timeline(in->page, in->group, in->devnull);
+	else if (!in->timeline)
+		ui_print_list(in->tree, in->group, in->devnull);
+}
@@ -0,0 +1,356 @@
+#include "main.h"
+#include "shmcache.h"
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/** @file
+ * Checks the timeline cache shared by the twitterms of an account against
+ * crashes. Writers publish pages one after the other, and are killed at
+ * random, as a client may die at any time: writing the slots of a page,
+ * switching the header, or with the lock held. Meanwhile the readers check
+ * that every page they read is one a writer made whole:
+ *
+ * - its count of statuses is the one it was made with, SHMCACHE_SLOTS / 2
+ *   at most,
+ * - every status is the one made for its row, its text cut at the start of
+ *   a UTF-8 character if it was too long,
+ *
+ * and the pages they read are counted. At the end, a writer has to get the
+ * lock, and the page it writes has to be read back. Exits with 1 if any of
+ * these fails.
+ *
+ * Usage: cachesim [-t seconds] [-r readers] [-s seed]
+ */
+
+/** The seconds the writers are killed for, and the readers read */
+#define SECONDS 5
+#define READERS 4
+/** The most milliseconds a writer lives */
+#define LIFETIME 20
+/** The most statuses of a page made, more than the cache keeps */
+#define PAGE_MAX (SHMCACHE_SLOTS / 2 + 20)
+/** The longest text made, longer than the room for it */
+#define TEXT_MAX (SHMCACHE_STRINGS + 100)
+
+/** The counts a reader sends back */
+struct _result {
+	long reads;
+	long pages;
+	long statuses;
+	long failures;
+};
+
+/** Makes the page of a base: the base is its user ID, and tells the rest
+ * @param base the base, not 0
+ * @return the page, NULL if out of memory */
+static status_page _make(unsigned long base);
+
+/** Makes the text of a status of a page
+ * @param base the base of the page
+ * @param row the row of the status
+ * @param buf the text is written here, TEXT_MAX + 1 bytes */
+static void _text(unsigned long base, long row, char *buf);
+
+/** Checks a page read against the page of its base
+ * @param page the page
+ * @return the count of failures */
+static long _check(status_page page);
+
+/** Publishes pages until killed
+ * @param file the file of the cache */
+static void _writer(char *file);
+
+/** Reads pages until the time is up, and sends the counts to a pipe
+ * @param file the file of the cache
+ * @param until the time to stop at
+ * @param fd the pipe */
+static void _reader(char *file, time_t until, int fd);
+
+/** Returns a random base, not 0 */
+static unsigned long _base(void);
+
+int main(int argc, char **argv)
+{
+	struct shmcache_meta meta;
+	struct _result result;
+	struct _result total;
+	char file[] = "/tmp/cachesim-XXXXXX";
+	shmcache c;
+	status_page page;
+	unsigned long base;
+	time_t until;
+	long seconds = SECONDS;
+	long writers = 0;
+	long killed = 0;
+	long failures = 0;
+	int readers = READERS;
+	int seed = 1;
+	int fds[2];
+	int status;
+	pid_t pid;
+	int fd;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-t") && i + 1 < argc)
+			seconds = atol(argv[++i]);
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			readers = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			seed = atoi(argv[++i]);
+	}
+	if (seconds < 1)
+		seconds = 1;
+	if (readers < 1)
+		readers = 1;
+	srand(seed);
+
+	fd = mkstemp(file);
+	if (fd < 0 || pipe(fds) < 0) {
+		fprintf(stderr, "cachesim: can't make %s: %s\n", file,
+			strerror(errno));
+		return 1;
+	}
+	close(fd);
+
+	until = time(NULL) + seconds;
+	for (i = 0; i < readers; i++) {
+		if (fork() == 0) {
+			close(fds[0]);
+			_reader(file, until, fds[1]);
+			exit(0);
+		}
+	}
+	close(fds[1]);
+
+	/* a writer is killed wherever it is, or finds the lock of the one
+	 * killed before it dropped */
+	while (time(NULL) < until) {
+		pid = fork();
+		if (pid == 0)
+			_writer(file);
+		if (pid < 0)
+			break;
+		writers++;
+		poll(NULL, 0, rand() % (LIFETIME + 1));
+		kill(pid, SIGKILL);
+		if (waitpid(pid, &status, 0) == pid && WIFSIGNALED(status))
+			killed++;
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < readers; i++) {
+		if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+			printf("FAIL: a reader died\n");
+			failures++;
+			continue;
+		}
+		total.reads += result.reads;
+		total.pages += result.pages;
+		total.statuses += result.statuses;
+		total.failures += result.failures;
+	}
+	while (wait(NULL) > 0) ;
+
+	c = shmcache_open(file);
+	if (c == NULL) {
+		fprintf(stderr, "cachesim: can't open %s\n", file);
+		unlink(file);
+		return 1;
+	}
+	page = shmcache_read(c, &meta);
+	status_free(page);
+	printf("%ld writers, %ld of them killed, %lu pages published\n",
+	       writers, killed, meta.generation);
+	printf("%d readers, %ld reads, %ld pages of %ld statuses checked\n",
+	       readers, total.reads, total.pages, total.statuses);
+	if (total.failures > 0) {
+		printf("FAIL: %ld torn statuses or pages read\n",
+		       total.failures);
+		failures++;
+	}
+
+	base = _base();
+	page = _make(base);
+	if (page == NULL || shmcache_lock(c) < 0
+	    || shmcache_publish(c, page) < 0) {
+		printf("FAIL: the last page couldn't be written\n");
+		failures++;
+	}
+	shmcache_unlock(c);
+	status_free(page);
+	page = shmcache_read(c, &meta);
+	if (page == NULL || page->user_id[0] != base || _check(page) > 0) {
+		printf("FAIL: the last page wasn't read back\n");
+		failures++;
+	}
+	status_free(page);
+
+	shmcache_close(c);
+	unlink(file);
+	return failures > 0;
+}
+
+/* ************************************
+ * static functions
+ */
+static status_page _make(unsigned long base)
+{
+	status_page page = status_create();
+	char name[32];
+	char *text = malloc(TEXT_MAX + 1);
+	long count = 1 + base % PAGE_MAX;
+	long row;
+	long i;
+
+	if (page == NULL || text == NULL) {
+		status_free(page);
+		free(text);
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		row = status_add(page);
+		if (row < 0)
+			break;
+		page->id[row] = base * 1000 + i;
+		page->user_id[row] = base;
+		page->created_at[row] = base % 100000;
+		sprintf(name, "user%lu", base);
+		page->screen_name[row] = status_add_string(page, name);
+		_text(base, i, text);
+		page->text[row] = status_add_string(page, text);
+		if (page->screen_name[row] < 0 || page->text[row] < 0)
+			break;
+		if (i % 2 == 1) {
+			sprintf(name, "reply%ld", i);
+			page->in_reply_to[row] = status_add_string(page, name);
+			page->in_reply_to_id[row] = base * 1000 + i - 1;
+			if (page->in_reply_to[row] < 0)
+				break;
+		}
+	}
+	free(text);
+
+	if (i < count) {
+		status_free(page);
+		return NULL;
+	}
+	return page;
+}
+
+static void _text(unsigned long base, long row, char *buf)
+{
+	long len = (base + row * 37) % TEXT_MAX;
+	long i;
+
+	/* two bytes a character, so that a cut may fall inside one */
+	i = sprintf(buf, "%lu:%ld ", base, row);
+	while (i + 2 <= len) {
+		buf[i++] = (char) 0xc3;
+		buf[i++] = (char) 0xa9;
+	}
+	buf[i] = 0;
+}
+
+static long _check(status_page page)
+{
+	char text[TEXT_MAX + 1];
+	char name[32];
+	unsigned long base = page->count > 0 ? page->user_id[0] : 0;
+	long count = 1 + base % PAGE_MAX;
+	long failures = 0;
+	char *str;
+	long len;
+	long i;
+
+	if (count > SHMCACHE_SLOTS / 2)
+		count = SHMCACHE_SLOTS / 2;
+	if (base == 0 || page->count != count)
+		return 1;
+
+	for (i = 0; i < page->count; i++) {
+		sprintf(name, "user%lu", base);
+		str = STATUS_STR(page, page->screen_name[i]);
+		if (page->id[i] != base * 1000 + i || page->user_id[i] != base
+		    || page->created_at[i] != base % 100000 || str == NULL
+		    || strcmp(str, name)) {
+			failures++;
+			continue;
+		}
+
+		sprintf(name, "reply%ld", i);
+		str = STATUS_STR(page, page->in_reply_to[i]);
+		if (i % 2 == 1 ? str == NULL || strcmp(str, name)
+		    || page->in_reply_to_id[i] != base * 1000 + i - 1
+		    : str != NULL || page->in_reply_to_id[i] != 0) {
+			failures++;
+			continue;
+		}
+
+		/* the text is whole, or cut where a character starts */
+		_text(base, i, text);
+		str = STATUS_STR(page, page->text[i]);
+		len = str != NULL ? strlen(str) : 0;
+		if (str == NULL || strncmp(str, text, len)
+		    || (text[len] != 0 && (text[len] & 0xc0) == 0x80))
+			failures++;
+	}
+	return failures;
+}
+
+static void _writer(char *file)
+{
+	shmcache c = shmcache_open(file);
+	status_page page;
+
+	srand(getpid());
+	if (c == NULL)
+		exit(1);
+
+	for (;;) {
+		page = _make(_base());
+		if (page == NULL || shmcache_lock(c) < 0)
+			exit(1);
+		shmcache_publish(c, page);
+		shmcache_unlock(c);
+		status_free(page);
+	}
+}
+
+static void _reader(char *file, time_t until, int fd)
+{
+	struct shmcache_meta meta;
+	struct _result result;
+	status_page page;
+	shmcache c = shmcache_open(file);
+
+	memset(&result, 0, sizeof(result));
+	if (c == NULL)
+		result.failures++;
+
+	while (c != NULL && time(NULL) < until) {
+		page = shmcache_read(c, &meta);
+		result.reads++;
+		if (page == NULL)
+			continue;
+		result.pages++;
+		result.statuses += page->count;
+		result.failures += _check(page);
+		status_free(page);
+	}
+
+	shmcache_close(c);
+	write(fd, &result, sizeof(result));
+}
+
+static unsigned long _base(void)
+{
+	return 1 + (unsigned long) rand() * 31 + rand() % 31;
+}
@@ -0,0 +1,157 @@
+#include "main.h"
+#include "http.h"
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+/** @file
+ * Checks the resolver cache of the HTTP client against a stand-in
+ * resolver: this file defines getaddrinfo() and freeaddrinfo(), which the
+ * client is linked against instead of those of libc. The stand-in knows one
+ * host, HOST, which it resolves to 127.0.0.1 and the port it's told to,
+ * whatever port is asked for, and counts the lookups. Two mockservers
+ * answer on the two ports given, with bodies of different sizes, which
+ * tells which one a request reached. It checks that:
+ *
+ * - a name is looked up once, and its answer reused,
+ * - the cached answer is still used after the stand-in moved the host,
+ * - after http_flush_dns_cache() the name is looked up again, and the
+ *   requests reach the new address,
+ * - a name that doesn't resolve is remembered as well.
+ *
+ * Exits with 1 if any of these fails.
+ *
+ * Usage: dnstest port port
+ */
+
+/** The host the stand-in resolves, and one it doesn't */
+#define HOST "twitterm.test"
+#define NOWHERE "nowhere.test"
+/** The file requested */
+#define PATH "/statuses/friends_timeline.json"
+
+/** The port the stand-in resolves HOST to */
+static int override_port;
+
+/** The count of calls of the stand-in */
+static long lookups = 0;
+
+/** Sends a request to HOST
+ * @param host the host and port
+ * @param len the length of the body is stored here, -1 if it failed
+ * @return the HTTP status code or a negative enum http_error */
+static int _request(char *host, long *len);
+
+/** Checks a condition, and reports it if it fails
+ * @param ok the condition
+ * @param what what is checked
+ * @return 1 if the check failed, 0 if not */
+static int _expect(int ok, char *what);
+
+int main(int argc, char **argv)
+{
+	long first;
+	long len;
+	int failures = 0;
+	int ret;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: dnstest port port\n");
+		return 1;
+	}
+
+	override_port = atoi(argv[1]);
+	ret = _request(HOST ":80", &first);
+	failures += _expect(ret == 200 && lookups == 1,
+			    "the first request looks the host up");
+	ret = _request(HOST ":80", &len);
+	failures += _expect(ret == 200 && lookups == 1 && len == first,
+			    "the second request reuses the answer");
+
+	/* moved, but the cached answer is still fresh */
+	override_port = atoi(argv[2]);
+	ret = _request(HOST ":80", &len);
+	failures += _expect(ret == 200 && lookups == 1 && len == first,
+			    "the cached answer is used until flushed");
+
+	http_flush_dns_cache();
+	ret = _request(HOST ":80", &len);
+	failures += _expect(ret == 200 && lookups == 2 && len != first,
+			    "the flushed answer is refreshed");
+	ret = _request(HOST ":80", &len);
+	failures += _expect(ret == 200 && lookups == 2 && len != first,
+			    "the refreshed answer is reused");
+
+	ret = _request(NOWHERE ":80", &len);
+	failures += _expect(ret == HTTP_ERR_RESOLVE && lookups == 3,
+			    "an unknown host fails to resolve");
+	ret = _request(NOWHERE ":80", &len);
+	failures += _expect(ret == HTTP_ERR_RESOLVE && lookups == 3,
+			    "the failure is remembered");
+
+	printf("%ld lookups, %d checks failed\n", lookups, failures);
+	return failures > 0;
+}
+
+int getaddrinfo(const char *node, const char *service,
+		const struct addrinfo *hints, struct addrinfo **res)
+{
+	struct addrinfo *ai;
+	struct sockaddr_in *sin;
+
+	lookups++;
+	if (node == NULL || strcmp(node, HOST) != 0)
+		return EAI_NONAME;
+
+	ai = calloc(1, sizeof(*ai));
+	sin = calloc(1, sizeof(*sin));
+	if (ai == NULL || sin == NULL) {
+		free(ai);
+		free(sin);
+		return EAI_MEMORY;
+	}
+
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(override_port);
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ai->ai_family = AF_INET;
+	ai->ai_socktype = SOCK_STREAM;
+	ai->ai_addrlen = sizeof(*sin);
+	ai->ai_addr = (struct sockaddr *) sin;
+	*res = ai;
+	return 0;
+}
+
+void freeaddrinfo(struct addrinfo *res)
+{
+	struct addrinfo *next;
+
+	for (; res != NULL; res = next) {
+		next = res->ai_next;
+		free(res->ai_addr);
+		free(res);
+	}
+}
+
+/* ************************************
+ * static functions
+ */
+static int _request(char *host, long *len)
+{
+	char *output = NULL;
+	int ret;
+
+	ret = http_get_auth(host, PATH, &output, "mock", "mock");
+	*len = output != NULL ? (long) strlen(output) : -1;
+	free(output);
+	return ret;
+}
+
+static int _expect(int ok, char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	return !ok;
+}
@@ -1,152 +1,1368 @@
+#define MEM_AREA MEM_HTTP
 #include "http.h"
 #include "base64.h"
+#include "inflate.h"
+#include "stats.h"
+#include "transport.h"
 
 #include <stdio.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <strings.h>
+#include <time.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <netdb.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 /** @file http.c */
 
 #define NEWLINE "\r\n"
 #define HEADER_END "\r\n\r\n"
-#define SEND_NEWLINE(x) write((x), NEWLINE, 2)
-#define SEND_SPACE(x) write((x), " ", 1)
 #define HTTP_PORT_STR "80"
 
+/** The default deadlines in milliseconds, and the count of retries */
+#define DEFAULT_CONNECT_TIMEOUT 10000
+#define DEFAULT_FIRST_BYTE_TIMEOUT 15000
+#define DEFAULT_TOTAL_TIMEOUT 60000
+#define DEFAULT_RETRIES 2
+
+/** The size of the buffer to use when reading from the server
+	* Note that while the Twitter response header should fit into 1024 bytes,
+	* others may not.
+	*/
+#define BUFSIZE 1024
+
+/** The longest response header read, the buffer grows up to it */
+#define HEADER_MAX 16384
+
+/** The largest first guess of the size of a decompressed body, a larger
+ * one grows as it's written */
+#define INFLATE_GUESS_MAX (1024 * 1024)
+
+/** The time (in milliseconds) http_get_many() and http_get_finish() wait
+ * for the processes beyond the total deadline of their requests */
+#define MANY_GRACE 1000
+
+/** The first and the maximal delay (in milliseconds) between retries */
+#define BACKOFF_BASE 200
+#define BACKOFF_CAP 5000
+
+/** How long (in seconds) a resolved address list is kept in the cache */
+#define DNS_TTL 300
+/** How long (in seconds) a failed lookup is remembered */
+#define DNS_NEGATIVE_TTL 30
+/** The number of host/port pairs the resolver cache can hold */
+#define DNS_CACHE_SIZE 8
+/** The maximum number of addresses raced against each other */
+#define MAX_ADDRS 16
+/** The delay (in milliseconds) before the next address is tried while the
+ * previous attempts are still pending (RFC 6555 recommends 150-250ms) */
+#define CONNECT_STAGGER 250
+
+/** An entry of the resolver cache */
+struct _dns_entry {
+
+	/** The host name, NULL if the slot is free */
+	char *host;
+
+	/** The port (or service name) */
+	char *port;
+
+	/** The addresses returned by getaddrinfo(), NULL for negative entries */
+	struct addrinfo *res;
+
+	/** The monotonic time (in seconds) after which the entry is stale */
+	time_t expires;
+};
+
+/** The resolver cache, looked up linearly since it is tiny */
+static struct _dns_entry dns_cache[DNS_CACHE_SIZE];
+
+/** The rate limit reported with the last response */
+static struct _http_limit last_limit = { -1, 0, 0 };
+
+/** The hook that gets called after every connection attempt */
+static http_connect_hook connect_hook = NULL;
+
+/** The transports, in the order of preference */
+static transport transports[] = { &transport_uring, &transport_posix };
+
+/** The transport the sockets are read and written through, chosen on the
+ * first request unless set */
+static transport tp = NULL;
+
+/** The connection kept for the next request, see http_set_keepalive() */
+static struct _http_kept {
+
+	/** True if connections are kept */
+	int on;
+
+	/** The socket, -1 if none is kept */
+	int sock;
+
+	/** The server it's connected to */
+	char host[256];
+	char port[16];
+
+	/** True if the last response left its connection fit for the next
+	 * request: read to its end, and not closed by the server */
+	int reusable;
+} kept = {
+0, -1, "", "", 0};
+
+/** The deadlines applied to every request */
+static struct _http_timeouts {
+
+	/** Resolving and connecting, in milliseconds */
+	int connect;
+
+	/** From sending the request to the first byte of the response */
+	int first_byte;
+
+	/** The whole request including the retries */
+	int total;
+
+	/** How many times a failed request is repeated */
+	int retries;
+} timeouts = {
+DEFAULT_CONNECT_TIMEOUT, DEFAULT_FIRST_BYTE_TIMEOUT,
+	    DEFAULT_TOTAL_TIMEOUT, DEFAULT_RETRIES};
+
+/** Returns the current value of the monotonic clock in microseconds */
+static long long _now_usec(void);
+
+/** A response body as it arrives, see _body_read() */
+struct _body_source {
+
+	/** The socket the body is read from */
+	int sock;
+
+	/** The bytes received but not consumed yet, initially the part of the
+	 * body that arrived together with the header */
+	char *buf;
+	int inbuf;
+
+	/** The buffer the socket is read into when buf runs dry */
+	char raw[BUFSIZE];
+
+	/** The count of bytes of the body (or of the current chunk) not read
+	 * yet, negative if the body lasts until the server closes */
+	int leftover;
+
+	/** True if the body is sent with Transfer-Encoding: chunked */
+	int chunked;
+
+	/** The count of chunks started */
+	int chunks;
+
+	/** True if the last chunk has been seen */
+	int done;
+
+	/** The monotonic time (usec) to give up at */
+	long long deadline;
+
+	/** The error of the socket, 0 if none */
+	int err;
+};
+
+/** The response body as it's stored, see _body_write() */
+struct _body_sink {
+
+	/** The data, always NUL terminated */
+	char *data;
+
+	/** The count of bytes in data */
+	int len;
+
+	/** The size of the allocated buffer */
+	int size;
+};
+
+/** A request of http_get_many() or http_get_start() in flight */
+struct _http_child {
+
+	/** The request, set by http_get_start() only */
+	http_request req;
+
+	/** The monotonic time (usec) to give up at, set by http_get_start()
+	 * only */
+	long long deadline;
+
+	/** The process sending the request, 0 if none could be started */
+	pid_t pid;
+
+	/** The read end of the pipe the result arrives on, -1 when closed */
+	int fd;
+
+	/** The status code followed by the body, as read so far */
+	char *buf;
+
+	/** The count of bytes in buf */
+	long len;
+
+	/** The size of buf */
+	long size;
+
+	/** True if buf couldn't be grown */
+	int nomem;
+
+	/** The value of STATS_BEGIN() when the request was sent */
+	double timer;
+};
+
+/** Resolves host:port, serving the answer from the cache if possible
+ * @param host the host to resolve
+ * @param port the port to resolve
+ * @return the address list owned by the cache, or NULL if failed */
+static struct addrinfo *_dns_lookup(char *host, char *port);
+
+/** Drops the cached addresses of host:port, eg. when none of them could be
+ * connected to */
+static void _dns_invalidate(char *host, char *port);
+
+/** Races non-blocking connects to the addresses, starting a new attempt
+ * every CONNECT_STAGGER milliseconds until one of them succeeds
+ * @param res the address list to connect to
+ * @param deadline the monotonic time (usec) to give up at
+ * @retval fd a connected, non-blocking socket if succeeded
+ * @retval HTTP_ERR_CONNECT if every address failed
+ * @retval HTTP_ERR_CONNECT_TIMEOUT if the deadline passed */
+static int _socket_race(struct addrinfo *res, long long deadline);
+
 /** Creates a socket and tries to connect to it
  * @param host the host to connect
  * @param port the port to connect (usually HTTP_PORT_STR)
- * @retval fd a file descriptor if succeeded
- * @retval negative value if failed */
-static int _socket_connect(char *host, char *port);
+ * @param deadline the monotonic time (usec) to give up at
+ * @retval fd a non-blocking file descriptor if succeeded
+ * @retval negative value (enum http_error) if failed */
+static int _socket_connect(char *host, char *port, long long deadline);
+
+/** Splits the domain into a host and a port, eg. "localhost:8080" or
+ * "[::1]:8080". The port defaults to HTTP_PORT_STR.
+ * @param domain the domain to split
+ * @param host where the host is copied
+ * @param hostlen the size of host
+ * @param port where the port is copied
+ * @param portlen the size of port */
+static void _split_domain(char *domain, char *host, int hostlen, char *port,
+			  int portlen);
+
+/** Disconnects from a socket.
+ * Just a wrapper to close(), with portability in mind */
+static int _socket_disconnect(int sock);
+
+/** Writes the whole buffer into the non-blocking socket through the
+ * transport, which may hold it back until the next _socket_recv()
+ * @retval 0 if succeeded
+ * @retval HTTP_ERR_SEND or HTTP_ERR_TIMEOUT if failed */
+static int _socket_send(int sock, char *buf, int len, long long deadline);
+
+/** Reads at most len bytes from the non-blocking socket through the
+ * transport, after what's held back of _socket_send()
+ * @param timeout_err the error to return if the deadline passes
+ * @return the count of bytes read, 0 on EOF, or a negative error */
+static int _socket_recv(int sock, char *buf, int len, long long deadline,
+			int timeout_err);
+
+/** Sets the transport up in this process, falling back to the blocking
+ * one if the chosen one can't be used */
+static void _transport_open(void);
+
+/** Writes the HTTP header into the given stream.
+ * @param sock the socket to use
+ * @param host 
+ * @param file the file on the host
+ * @param method the HTTP request type to use: POST, GET
+ * @param deadline the monotonic time (usec) to give up at
+ * @return 0 or a negative error */
+static int _http_header_send(int sock, char *host, char *file, char *method,
+			     long long deadline);
+
+/** Writes the data necessary for authentication into the given socket
+ * @param sock the socket to use
+ * @param user
+ * @param pwd
+ * @param deadline the monotonic time (usec) to give up at
+ * @return 0 or a negative error */
+static int _http_auth_send(int sock, char *user, char *pwd,
+			   long long deadline);
+
+/** Reads the response of the server
+ * @param sock the socket to use
+ * @param output where the body is stored, may be NULL
+ * @param deadline the monotonic time (usec) to give up at
+ * @return the HTTP status code or a negative error */
+static int _http_response_handle(int sock, char **output, long long deadline);
+
+/** Reads the response header, and whatever of the body came with it
+ * @param sock the socket to use
+ * @param head the buffer read into is stored here, NUL terminated; to be
+ * freed even on errors
+ * @param deadline the monotonic time (usec) to give up at
+ * @return the count of bytes read, or a negative error */
+static int _http_header_read(int sock, char **head, long long deadline);
+
+/** Handles the response header read, and reads the body
+ * @param sock the socket to use
+ * @param buf the header read, see _http_header_read()
+ * @param headsize the count of bytes in buf
+ * @param output where the body is stored, may be NULL
+ * @param deadline the monotonic time (usec) to give up at
+ * @return the HTTP status code or a negative error */
+static int _http_response_body(int sock, char *buf, int headsize,
+			       char **output, long long deadline);
+
+/** Looks up a header field in the response header, case insensitively
+ * @param head the response header
+ * @param end the end of the header
+ * @param name the name of the field, with the colon
+ * @return the beginning of the value, or NULL if not found */
+static char *_http_header_value(char *head, char *end, char *name);
+
+/** Reads the rate limit from the response header into last_limit
+ * @param head the response header
+ * @param end the end of the header */
+static void _http_limit_parse(char *head, char *end);
+
+/** Reads a compressed body and decompresses it into output
+ * @param src the compressed body
+ * @param format the format of the compression
+ * @param output where the decompressed body is stored
+ * @retval 0 if succeeded
+ * @retval negative value (enum http_error) if failed */
+static int _http_body_inflate(struct _body_source *src, inflate_format format,
+			      char **output);
+
+/** Reads a body of unknown length (chunked, or until EOF) into output
+ * @param src the body
+ * @param output where the body is stored
+ * @return the size of the body or a negative enum http_error */
+static int _http_body_copy(struct _body_source *src, char **output);
+
+/** Reads at most len bytes of the body, an inflate_read_fn
+ * @return the count of bytes read, 0 at the end of the body, negative on
+ * error (stored in struct _body_source::err) */
+static int _body_read(void *arg, unsigned char *buf, int len);
+
+/** Returns the next byte of the stream (regardless of the chunks)
+ * @return the byte, or -1 with struct _body_source::err set if failed */
+static int _body_getc(struct _body_source *src);
+
+/** Reads the size line of the next chunk
+ * @retval 0 if succeeded
+ * @retval -1 with struct _body_source::err set if failed */
+static int _body_chunk_start(struct _body_source *src);
+
+/** The inflate_write_fn of the decompressed body, see struct _body_sink */
+static int _body_write(void *arg, unsigned char *buf, int len);
+
+/** Returns the length of the content of a part
+ * @param part the part
+ * @return the length, -1 if the file can't be examined */
+static long _part_length(struct _http_part *part);
+
+/** Formats the header of a part of a multipart body
+ * @param part the part
+ * @param boundary the boundary of the parts
+ * @return the allocated header, NULL if out of memory */
+static char *_part_head(struct _http_part *part, char *boundary);
+
+/** Sends the content of a part
+ * @param sock the socket to use
+ * @param part the part
+ * @param len the length of the content
+ * @param deadline the monotonic time (usec) to give up at
+ * @return 0 or a negative error */
+static int _part_send(int sock, struct _http_part *part, long len,
+		      long long deadline);
+
+/** Sends the rest of the header of a POST and its body
+ * @param sock the socket to use
+ * @param parts the parts of the body
+ * @param count the count of parts
+ * @param deadline the monotonic time (usec) to give up at
+ * @return 0 or a negative error */
+static int _http_body_send(int sock, struct _http_part *parts, int count,
+			   long long deadline);
+
+/** Performs a single attempt of a request, the parameters are the same as
+ * those of http_post_parts(), user and parts may be NULL
+ * @return the HTTP status code or a negative error */
+static int _http_attempt(char *domain, char *file, char *method,
+			 char **output, struct _http_part *parts, int count,
+			 char *user, char *pwd, long long deadline);
+
+/** Performs a request, retrying it with exponential backoff as long as
+ * the failure is transient and the total deadline allows
+ * @return the HTTP status code or a negative error */
+static int _http_request(char *domain, char *file, char *method,
+			 char **output, struct _http_part *parts, int count,
+			 char *user, char *pwd);
+
+/** Starts the process that sends the index-th request of http_get_many()
+ * @param req the request
+ * @param kids the processes started so far, whose pipes the new one closes
+ * @param index the index of the request
+ * @retval 0 if succeeded
+ * @retval -1 if no pipe or process is left */
+static int _http_spawn(http_request req, struct _http_child *kids, int index);
+
+/** Sends the request and writes the status code, the rate limit and the
+ * body to fd, run in the process started by _http_spawn(). Never returns. */
+static void _http_child_run(http_request req, int fd);
+
+/** Writes the whole buffer into the pipe
+ * @retval 0 if succeeded
+ * @retval -1 if failed */
+static int _pipe_write(int fd, char *buf, long len);
+
+/** Reads what the pipe of the process has, growing its buffer
+ * @param kid the process
+ * @retval 1 if the pipe is still open
+ * @retval 0 at the end of the result, or if reading failed */
+static int _http_child_read(struct _http_child *kid);
+
+/** Fills in the request from what its process sent
+ * @param req the request
+ * @param kid the process, whose buffer is handed over to the request */
+static void _http_child_result(http_request req, struct _http_child *kid);
+
+/** Collects the result of the process, killing it if it hasn't finished
+ * @param req the request
+ * @param kid the process, nothing is done if none was started */
+static void _http_child_end(http_request req, struct _http_child *kid);
+
+/** Takes the kept connection if it leads to the server and is still open
+ * @param host the host of the server
+ * @param port its port
+ * @return the socket, -1 if there's none to use */
+static int _http_kept_take(char *host, char *port);
+
+/** Keeps a connection for the next request, closing the one kept before
+ * @param host the host of the server
+ * @param port its port
+ * @param sock the socket */
+static void _http_kept_put(char *host, char *port, int sock);
+
+/** Reads the rest of a body, and the end of its chunked framing, so that the
+ * next response can be read from the connection
+ * @param src the body
+ * @retval 0 if the response ended where its framing says
+ * @retval -1 if not, or if it lasts until the server closes */
+static int _body_drain(struct _body_source *src);
+
+void http_set_connect_hook(http_connect_hook hook)
+{
+	connect_hook = hook;
+}
+
+int http_set_transport(char *name)
+{
+	int i;
+
+	for (i = 0; i < sizeof(transports) / sizeof(*transports); i++)
+		if (!strcmp(transports[i]->name, name)) {
+			tp = transports[i];
+			return 0;
+		}
+
+	return -1;
+}
+
+long http_syscalls(void)
+{
+	return transport_syscalls;
+}
+
+void http_set_keepalive(int on)
+{
+	kept.on = on;
+	if (!on && kept.sock >= 0) {
+		_socket_disconnect(kept.sock);
+		kept.sock = -1;
+	}
+}
+
+char *http_urlencode(char *str)
+{
+	static char hex[] = "0123456789ABCDEF";
+	char *ret = malloc(strlen(str) * 3 + 1);
+	char *out = ret;
+	unsigned char c;
+
+	if (ret == NULL)
+		return NULL;
+
+	for (; *str != 0; str++) {
+		c = (unsigned char) *str;
+		if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+			*out++ = c;
+			continue;
+		}
+		*out++ = '%';
+		*out++ = hex[c >> 4];
+		*out++ = hex[c & 15];
+	}
+	*out = 0;
+
+	return ret;
+}
+
+void http_last_limit(struct _http_limit *limit)
+{
+	*limit = last_limit;
+}
+
+void http_flush_dns_cache(void)
+{
+	int i;
+
+	for (i = 0; i < DNS_CACHE_SIZE; i++) {
+		if (dns_cache[i].host == NULL)
+			continue;
+
+		free(dns_cache[i].host);
+		free(dns_cache[i].port);
+		if (dns_cache[i].res != NULL)
+			freeaddrinfo(dns_cache[i].res);
+		dns_cache[i].host = NULL;
+	}
+}
+
+void http_set_timeouts(int connect, int first_byte, int total, int retries)
+{
+	timeouts.connect = connect;
+	timeouts.first_byte = first_byte;
+	timeouts.total = total;
+	timeouts.retries = retries;
+}
+
+char *http_strerror(int code)
+{
+	switch (code) {
+	case HTTP_ERR_RESOLVE:
+		return "could not resolve the host name";
+	case HTTP_ERR_CONNECT:
+		return "could not connect to the server";
+	case HTTP_ERR_CONNECT_TIMEOUT:
+		return "timed out while connecting";
+	case HTTP_ERR_SEND:
+		return "could not send the request";
+	case HTTP_ERR_FIRST_BYTE_TIMEOUT:
+		return "timed out while waiting for the response";
+	case HTTP_ERR_TIMEOUT:
+		return "timed out while transferring";
+	case HTTP_ERR_READ:
+		return "could not read the response";
+	case HTTP_ERR_CLOSED:
+		return "the server closed the connection prematurely";
+	case HTTP_ERR_BAD_RESPONSE:
+		return "malformed response";
+	case HTTP_ERR_NOMEM:
+		return "out of memory";
+	case HTTP_ERR_DECODE:
+		return "could not decompress the response";
+	case HTTP_ERR_BODY:
+		return "could not read the body of the request";
+	case 429:
+		return "the rate limit is exceeded";
+	default:
+		return "unexpected HTTP status code";
+	}
+}
+
+int http_get(char *domain, char *file, char **output)
+{
+	return _http_request(domain, file, "GET", output, NULL, 0, NULL, NULL);
+}
+
+int http_get_auth(char *domain, char *file, char **output, char *user,
+		  char *pwd)
+{
+	return _http_request(domain, file, "GET", output, NULL, 0, user, pwd);
+}
+
+int http_post_auth(char *domain, char *file, char **output, char *data,
+		   char *user, char *pwd)
+{
+	struct _http_part part;
+
+	memset(&part, 0, sizeof(part));
+	part.data = data;
+	part.fd = -1;
+	part.len = -1;
+	return _http_request(domain, file, "POST", output, &part, 1, user,
+			     pwd);
+}
+
+int http_post_parts(char *domain, char *file, char **output,
+		    struct _http_part *parts, int count, char *user,
+		    char *pwd)
+{
+	return _http_request(domain, file, "POST", output, parts, count, user,
+			     pwd);
+}
+
+int http_part_file(struct _http_part *part, char *name, char *file,
+		   char *type)
+{
+	memset(part, 0, sizeof(*part));
+	part->name = name;
+	part->filename = strrchr(file, '/') != NULL ?
+	    strrchr(file, '/') + 1 : file;
+	part->type = type;
+	part->len = -1;
+	part->fd = open(file, O_RDONLY);
+	return part->fd < 0 ? -1 : 0;
+}
+
+void http_part_close(struct _http_part *part)
+{
+	if (part->fd >= 0)
+		close(part->fd);
+	part->fd = -1;
+}
+
+int http_get_many(http_request reqs, int count)
+{
+	struct _http_child *kids;
+	struct pollfd *fds;
+	long long deadline;
+	long long wait;
+	int left = 0;
+	int ok = 0;
+	int i;
+
+	kids = calloc(count > 0 ? count : 1, sizeof(*kids));
+	fds = calloc(count > 0 ? count : 1, sizeof(*fds));
+	if (kids == NULL || fds == NULL) {
+		free(kids);
+		free(fds);
+		for (i = 0; i < count; i++) {
+			reqs[i].status = HTTP_ERR_NOMEM;
+			reqs[i].output = NULL;
+		}
+		return 0;
+	}
+
+	/* the processes give up by the total deadline, and they are given a
+	 * little more to report that */
+	deadline = _now_usec() + (timeouts.total + MANY_GRACE) * 1000LL;
+	for (i = 0; i < count; i++) {
+		reqs[i].output = NULL;
+		reqs[i].limit.limit = -1;
+		kids[i].fd = -1;
+		kids[i].timer = STATS_BEGIN();
+		if (_http_spawn(&reqs[i], kids, i) == 0)
+			left++;
+		fds[i].fd = kids[i].fd;
+		fds[i].events = POLLIN;
+	}
+
+	/* the ones that couldn't get a process of their own */
+	for (i = 0; i < count; i++) {
+		if (kids[i].pid != 0)
+			continue;
+
+		reqs[i].status = http_get_auth(reqs[i].domain, reqs[i].file,
+					       &reqs[i].output, reqs[i].user,
+					       reqs[i].pwd);
+		http_last_limit(&reqs[i].limit);
+	}
+
+	while (left > 0) {
+		wait = (deadline - _now_usec()) / 1000;
+		if (wait <= 0)
+			break;
+		if (poll(fds, count, (int) wait) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		/* poll() skips the negative descriptors of the finished ones */
+		for (i = 0; i < count; i++) {
+			if (fds[i].fd < 0 || fds[i].revents == 0)
+				continue;
+			if (_http_child_read(&kids[i]))
+				continue;
+
+			close(kids[i].fd);
+			kids[i].fd = fds[i].fd = -1;
+			left--;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		_http_child_end(&reqs[i], &kids[i]);
+		ok += reqs[i].status == 200;
+	}
+
+	free(kids);
+	free(fds);
+	return ok;
+}
+
+http_pending http_get_start(http_request req)
+{
+	struct _http_child *kid = calloc(1, sizeof(*kid));
+
+	req->output = NULL;
+	req->limit.limit = -1;
+	if (kid == NULL) {
+		req->status = HTTP_ERR_NOMEM;
+		return NULL;
+	}
+
+	kid->req = req;
+	kid->fd = -1;
+	kid->timer = STATS_BEGIN();
+	kid->deadline = _now_usec() + (timeouts.total + MANY_GRACE) * 1000LL;
+
+	/* without a process to spare, it is sent right away */
+	if (_http_spawn(req, kid, 0) < 0) {
+		req->status = http_get_auth(req->domain, req->file,
+					    &req->output, req->user, req->pwd);
+		http_last_limit(&req->limit);
+	}
+
+	return kid;
+}
+
+int http_get_finish(http_pending pending)
+{
+	struct pollfd fds;
+	long long wait;
+	int ret;
+
+	if (pending == NULL)
+		return HTTP_ERR_NOMEM;	/* http_get_start() stored it */
+
+	while (pending->fd >= 0) {
+		wait = (pending->deadline - _now_usec()) / 1000;
+		if (wait <= 0)
+			break;
+
+		fds.fd = pending->fd;
+		fds.events = POLLIN;
+		ret = poll(&fds, 1, (int) wait);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		if (!_http_child_read(pending)) {
+			close(pending->fd);
+			pending->fd = -1;
+		}
+	}
+
+	_http_child_end(pending->req, pending);
+	ret = pending->req->status;
+	free(pending);
+	return ret;
+}
+
+static int _http_spawn(http_request req, struct _http_child *kids, int index)
+{
+	int fds[2];
+	int i;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	kids[index].pid = fork();
+	if (kids[index].pid < 0) {
+		kids[index].pid = 0;
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (kids[index].pid == 0) {
+		/* the pipes of the others must close when they exit */
+		close(fds[0]);
+		for (i = 0; i < index; i++)
+			if (kids[i].fd >= 0)
+				close(kids[i].fd);
+		_http_child_run(req, fds[1]);
+	}
+
+	close(fds[1]);
+	kids[index].fd = fds[0];
+	return 0;
+}
+
+static void _http_child_run(http_request req, int fd)
+{
+	char *output = NULL;
+	int status;
+
+	/* the kept connection is the parent's */
+	if (kept.sock >= 0) {
+		close(kept.sock);
+		kept.sock = -1;
+	}
+
+	status = http_get_auth(req->domain, req->file, &output, req->user,
+			       req->pwd);
+	http_last_limit(&req->limit);
+
+	if (_pipe_write(fd, (char *) &status, sizeof(status)) == 0
+	    && _pipe_write(fd, (char *) &req->limit, sizeof(req->limit)) == 0
+	    && status == 200 && output != NULL)
+		_pipe_write(fd, output, strlen(output));
+
+	/* not exit(), the buffers of stdio belong to the parent */
+	_exit(0);
+}
+
+static int _pipe_write(int fd, char *buf, long len)
+{
+	long ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int _http_child_read(struct _http_child *kid)
+{
+	char *tmp;
+	long ret;
+
+	/* one byte is kept for the terminating NUL */
+	if (kid->size - kid->len < BUFSIZE + 1) {
+		tmp = realloc(kid->buf, kid->size * 2 + BUFSIZE + 1);
+		if (tmp == NULL) {
+			kid->nomem = 1;
+			return 0;
+		}
+		kid->buf = tmp;
+		kid->size = kid->size * 2 + BUFSIZE + 1;
+	}
+
+	ret = read(kid->fd, kid->buf + kid->len, kid->size - kid->len - 1);
+	if (ret < 0 && (errno == EINTR || errno == EAGAIN))
+		return 1;
+	if (ret <= 0)
+		return 0;
+
+	kid->len += ret;
+	return 1;
+}
+
+static void _http_child_result(http_request req, struct _http_child *kid)
+{
+	long head = sizeof(req->status) + sizeof(req->limit);
+	long body = kid->len - head;
+
+	if (kid->nomem) {
+		req->status = HTTP_ERR_NOMEM;
+	}
+	else if (body < 0) {	/* the process died before reporting */
+		req->status = HTTP_ERR_READ;
+	}
+	else {
+		memcpy(&req->status, kid->buf, sizeof(req->status));
+		memcpy(&req->limit, kid->buf + sizeof(req->status),
+		       sizeof(req->limit));
+		if (req->status == 200) {
+			memmove(kid->buf, kid->buf + head, body);
+			kid->buf[body] = 0;
+			req->output = kid->buf;
+			return;
+		}
+	}
+
+	free(kid->buf);
+}
+
+static void _http_child_end(http_request req, struct _http_child *kid)
+{
+	if (kid->pid == 0)
+		return;
+
+	if (kid->fd >= 0) {	/* out of time */
+		kill(kid->pid, SIGKILL);
+		close(kid->fd);
+		free(kid->buf);
+		req->status = HTTP_ERR_TIMEOUT;
+	}
+	else {
+		_http_child_result(req, kid);
+	}
+	while (waitpid(kid->pid, NULL, 0) < 0 && errno == EINTR) ;
+
+	STATS_END(STATS_REQUEST, kid->timer,
+		  req->output != NULL ? strlen(req->output) : 0);
+}
+
+static int _http_request(char *domain, char *file, char *method,
+			 char **output, struct _http_part *parts, int count,
+			 char *user, char *pwd)
+{
+	static int seeded = 0;
+	long long deadline = _now_usec() + timeouts.total * 1000LL;
+	long long delay;
+	double timer = STATS_BEGIN();
+	int attempt;
+	int ret;
+
+	for (attempt = 0;; attempt++) {
+		ret = _http_attempt(domain, file, method, output, parts,
+				    count, user, pwd, deadline);
+
+		/*
+		 * a POST may only be repeated if it surely didn't reach the
+		 * server, a GET on every transient failure
+		 */
+		if (attempt >= timeouts.retries)
+			break;
+		if (ret != HTTP_ERR_CONNECT && ret != HTTP_ERR_CONNECT_TIMEOUT
+		    && (parts != NULL || (ret != HTTP_ERR_FIRST_BYTE_TIMEOUT
+					 && ret != HTTP_ERR_READ
+					 && ret != HTTP_ERR_CLOSED
+					 && ret != 502 && ret != 503)))
+			break;
+
+		/* exponential backoff with full jitter */
+		if (!seeded) {
+			srand((unsigned) (time(NULL) ^ getpid()));
+			seeded = 1;
+		}
+		delay = BACKOFF_BASE << attempt;
+		if (delay > BACKOFF_CAP)
+			delay = BACKOFF_CAP;
+		delay = rand() % (delay + 1);
+
+		if (_now_usec() + delay * 1000 >= deadline)
+			break;
+		poll(NULL, 0, (int) delay);
+	}
+
+	STATS_END(STATS_REQUEST, timer, 0);
+	return ret;
+}
+
+static int _http_attempt(char *domain, char *file, char *method,
+			 char **output, struct _http_part *parts, int count,
+			 char *user, char *pwd, long long deadline)
+{
+	char host[256];
+	char port[16];
+	long long connect_deadline;
+	int sock;
+	int ret;
+
+	last_limit.limit = -1;	/* until a response reports it */
+	_transport_open();
+	connect_deadline = _now_usec() + timeouts.connect * 1000LL;
+	if (connect_deadline > deadline)
+		connect_deadline = deadline;
+
+	_split_domain(domain, host, sizeof(host), port, sizeof(port));
+	kept.reusable = 0;
+	sock = _http_kept_take(host, port);
+	if (sock < 0)
+		sock = _socket_connect(host, port, connect_deadline);
+	if (sock < 0)
+		return sock;
 
-/** Disconnects from a socket.
- * Just a wrapper to close(), with portability in mind */
-static int _socket_disconnect(int sock);
+	ret = _http_header_send(sock, domain, file, method, deadline);
+	if (ret == 0 && user != NULL)
+		ret = _http_auth_send(sock, user, pwd, deadline);
 
-/** Writes the HTTP header into the given stream.
- * @param sock the socket to use
- * @param host 
- * @param file the file on the host
- * @param method the HTTP request type to use: POST, GET */
-static void _http_header_send(int sock, char *host, char *file, char *method);
+	if (ret == 0 && parts != NULL) {
+		ret = _http_body_send(sock, parts, count, deadline);
+	}
+	else if (ret == 0) {
+		ret = _socket_send(sock, NEWLINE, 2, deadline);
+	}
 
-/** Writes the data necessary for authentication into the given socket
- * @param sock the socket to use
- * @param user
- * @param pwd */
-static void _http_auth_send(int sock, char *user, char *pwd);
+	if (ret == 0)
+		ret = _http_response_handle(sock, output, deadline);
 
-static int _http_response_handle(int sock, char **output);
+	if (ret >= 0 && kept.on && kept.reusable)
+		_http_kept_put(host, port, sock);
+	else
+		_socket_disconnect(sock);
+	return ret;
+}
 
-int http_get(char *domain, char *file, char **output)
+static long _part_length(struct _http_part *part)
 {
-	int sock = _socket_connect(domain, HTTP_PORT_STR);
-	int ret;
+	struct stat st;
 
-	_http_header_send(sock, domain, file, "GET");
-	SEND_NEWLINE(sock);
+	if (part->len >= 0)
+		return part->len;
+	if (part->data != NULL)
+		return strlen(part->data);
+	if (part->fd < 0 || fstat(part->fd, &st) < 0
+	    || !S_ISREG(st.st_mode) || st.st_size < part->offset)
+		return -1;
+	return (long) st.st_size - part->offset;
+}
+
+static char *_part_head(struct _http_part *part, char *boundary)
+{
+	char *ret = malloc(strlen(boundary) + strlen(part->name) +
+			   (part->filename != NULL ? strlen(part->filename) :
+			    0) + (part->type != NULL ? strlen(part->type) :
+				  0) + 100);
 
-	ret = _http_response_handle(sock, output);
-	_socket_disconnect(sock);
+	if (ret == NULL)
+		return NULL;
+
+	sprintf(ret, "--%s" NEWLINE "Content-Disposition: form-data; "
+		"name=\"%s\"", boundary, part->name);
+	if (part->filename != NULL)
+		sprintf(ret + strlen(ret), "; filename=\"%s\"",
+			part->filename);
+	strcat(ret, NEWLINE);
+	if (part->type != NULL)
+		sprintf(ret + strlen(ret), "Content-Type: %s" NEWLINE,
+			part->type);
+	strcat(ret, NEWLINE);
 	return ret;
 }
 
-int http_get_auth(char *domain, char *file, char **output, char *user,
-		  char *pwd)
+static int _part_send(int sock, struct _http_part *part, long len,
+		      long long deadline)
 {
-	int sock = _socket_connect(domain, HTTP_PORT_STR);
-	int ret;
+	char buf[BUFSIZE];
+	off_t off = part->offset;
+	long n;
+	int ret = 0;
+#ifdef __linux__
+	struct timespec zero = { 0, 0 };
+	sigset_t pipe;
+	sigset_t old;
+#endif
+
+	if (part->data != NULL)
+		return _socket_send(sock, part->data, len, deadline);
+
+	/* what the transport holds back goes first */
+	if (part->fd >= 0 && (ret = tp->flush(sock, deadline)) < 0)
+		return ret;
+
+#ifdef __linux__
+	/* sendfile() has no MSG_NOSIGNAL, SIGPIPE is held back meanwhile */
+	sigemptyset(&pipe);
+	sigaddset(&pipe, SIGPIPE);
+	sigprocmask(SIG_BLOCK, &pipe, &old);
+
+	/* straight from the page cache to the socket */
+	while (part->fd >= 0 && len > 0 && ret == 0) {
+		transport_syscalls++;
+		n = sendfile(sock, part->fd, &off, len);
+		if (n > 0) {
+			len -= n;
+		}
+		else if (n == 0) {
+			ret = HTTP_ERR_BODY;	/* the file got shorter */
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if (transport_wait(sock, POLLOUT, deadline) < 0)
+				ret = HTTP_ERR_TIMEOUT;
+		}
+		else if (errno == EINVAL || errno == ENOSYS) {
+			break;	/* copied below */
+		}
+		else if (errno != EINTR) {
+			ret = HTTP_ERR_SEND;
+		}
+	}
+
+	if (!sigismember(&old, SIGPIPE))
+		while (sigtimedwait(&pipe, NULL, &zero) > 0) ;
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	if (ret < 0)
+		return ret;
+#endif
+
+	while (len > 0) {
+		if (part->fd >= 0)
+			n = pread(part->fd, buf, len < BUFSIZE ? len : BUFSIZE,
+				  off);
+		else
+			n = part->read(part->arg, buf,
+				       len < BUFSIZE ? len : BUFSIZE);
+		if (n < 0 && part->fd >= 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return HTTP_ERR_BODY;
 
-	_http_header_send(sock, domain, file, "GET");
-	_http_auth_send(sock, user, pwd);
-	SEND_NEWLINE(sock);
+		ret = _socket_send(sock, buf, n, deadline);
+		if (ret < 0)
+			return ret;
+		off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int _http_body_send(int sock, struct _http_part *parts, int count,
+			   long long deadline)
+{
+	char boundary[40];
+	char header[160];
+	char **heads;
+	long *lens;
+	long total = 0;
+	int multipart = count > 0 && parts[0].name != NULL;
+	int ret = 0;
+	int i;
+
+	heads = calloc(count > 0 ? count : 1, sizeof(*heads));
+	lens = malloc((count > 0 ? count : 1) * sizeof(*lens));
+	if (heads == NULL || lens == NULL) {
+		free(heads);
+		free(lens);
+		return HTTP_ERR_NOMEM;
+	}
+
+	/* the length is sent first, so everything is measured up front */
+	sprintf(boundary, "twitterm-%08lx%08lx", (unsigned long) rand(),
+		(unsigned long) _now_usec());
+	for (i = 0; ret == 0 && i < count; i++) {
+		lens[i] = _part_length(&parts[i]);
+		if (lens[i] < 0)
+			ret = HTTP_ERR_BODY;
+		else if (multipart
+			 && (heads[i] = _part_head(&parts[i], boundary)) == NULL)
+			ret = HTTP_ERR_NOMEM;
+		else
+			total += lens[i] + (multipart ?
+					    strlen(heads[i]) + 2 : 0);
+	}
+
+	if (multipart) {
+		total += strlen(boundary) + 6;
+		sprintf(header, "Content-Type: multipart/form-data; "
+			"boundary=%s" NEWLINE, boundary);
+	}
+	else if (count > 0 && parts[0].type != NULL
+		 && strlen(parts[0].type) < 100) {
+		sprintf(header, "Content-Type: %s" NEWLINE, parts[0].type);
+	}
+	else {
+		header[0] = 0;
+	}
+	sprintf(header + strlen(header), "Content-Length: %ld" HEADER_END,
+		total);
+	if (ret == 0)
+		ret = _socket_send(sock, header, strlen(header), deadline);
+
+	for (i = 0; ret == 0 && i < count; i++) {
+		if (multipart)
+			ret = _socket_send(sock, heads[i], strlen(heads[i]),
+					   deadline);
+		if (ret == 0)
+			ret = _part_send(sock, &parts[i], lens[i], deadline);
+		if (ret == 0 && multipart)
+			ret = _socket_send(sock, NEWLINE, 2, deadline);
+	}
 
-	ret = _http_response_handle(sock, output);
-	_socket_disconnect(sock);
+	if (ret == 0 && multipart) {
+		sprintf(header, "--%s--" NEWLINE, boundary);
+		ret = _socket_send(sock, header, strlen(header), deadline);
+	}
+
+	for (i = 0; i < count; i++)
+		free(heads[i]);
+	free(heads);
+	free(lens);
 	return ret;
 }
 
-int http_post_auth(char *domain, char *file, char **output, char *data,
-		   char *user, char *pwd)
+int _http_response_handle(int sock, char **output, long long deadline)
 {
-	int datalen;		/* the length of data (last param) */
-	char lbuff[10];		/* the string representation of datalen */
-	int sock = _socket_connect(domain, HTTP_PORT_STR);
+	char *head = NULL;
 	int ret;
 
-	_http_header_send(sock, domain, file, "POST");
-	_http_auth_send(sock, user, pwd);
+	ret = _http_header_read(sock, &head, deadline);
+	if (ret > 0)
+		ret = _http_response_body(sock, head, ret, output, deadline);
+	free(head);
+	return ret;
+}
 
-	datalen = strlen(data);
-	sprintf(lbuff, "%d", datalen);	/* convert datalen to string */
+int _http_header_read(int sock, char **head, long long deadline)
+{
+	char *buf;		/* the buffer to read into */
+	char *tmp;
+	long long first_byte;	/* the deadline of the first byte */
+	double timer = STATS_BEGIN();
+	int size = BUFSIZE;	/* the size of the buffer */
+	int headsize;		/* the bytes read */
+	int from = 0;		/* where the end of the header is looked for */
+	int readsize;
 
-	write(sock, "Content-Length: ", 16);
-	write(sock, lbuff, strlen(lbuff));
-	write(sock, HEADER_END, 4);	/* the end of the header */
-	write(sock, data, datalen);	/* the message body */
+	first_byte = _now_usec() + timeouts.first_byte * 1000LL;
+	if (first_byte > deadline)
+		first_byte = deadline;
 
-	ret = _http_response_handle(sock, output);
-	_socket_disconnect(sock);
-	return ret;
+	*head = buf = malloc(size);
+	if (buf == NULL)
+		return HTTP_ERR_NOMEM;
+
+	headsize = _socket_recv(sock, buf, size - 1, first_byte,
+				HTTP_ERR_FIRST_BYTE_TIMEOUT);
+	if (headsize <= 0)
+		return headsize == 0 ? HTTP_ERR_CLOSED : headsize;
+	buf[headsize] = 0;
+
+	STATS_END(STATS_FIRST_BYTE, timer, 0);
+
+	/* the header may arrive in several fragments, and outgrow the buffer */
+	while (strstr(buf + from, HEADER_END) == NULL) {
+		if (headsize == size - 1) {
+			if (size >= HEADER_MAX)
+				return HTTP_ERR_BAD_RESPONSE;
+			tmp = realloc(buf, size * 2);
+			if (tmp == NULL)
+				return HTTP_ERR_NOMEM;
+			*head = buf = tmp;
+			size *= 2;
+		}
+
+		/* the end may be split between two fragments */
+		from = headsize > 3 ? headsize - 3 : 0;
+		readsize = _socket_recv(sock, buf + headsize,
+					size - 1 - headsize, deadline,
+					HTTP_ERR_TIMEOUT);
+		if (readsize <= 0)
+			return readsize == 0 ? HTTP_ERR_CLOSED : readsize;
+		headsize += readsize;
+		buf[headsize] = 0;
+	}
+
+	return headsize;
 }
 
-/** The size of the buffer to use when reading from the server
-	* Note that while the Twitter response header should fit into 1024 bytes,
-	* others may not.
-	*/
-#define BUFSIZE 1024
-int _http_response_handle(int sock, char **output)
+int _http_response_body(int sock, char *buf, int headsize, char **output,
+			long long deadline)
 {
-	char buf[BUFSIZE];	/* the buffer to read into */
 	char *ptr = NULL;	/* pointer with multiple uses */
+	char *hend;		/* the end of the header */
+	double timer = STATS_BEGIN();
+	struct _body_source src;
 
 	int errcode;		/* HTTP error code */
 	int readsize;		/* read size */
-	int headsize;		/* header size */
 	int bodysize;		/* body size */
 	int bodyinbuf;
 	int leftover;
+	int keep;		/* true unless the server closes */
 
-	/*
-	 * read the header, and get the HTTP return code
-	 */
-	memset(buf, 0, BUFSIZE);
-	headsize = read(sock, buf, BUFSIZE);
+	hend = strstr(buf, HEADER_END);
+	if (strncmp(buf, "HTTP/", 5) != 0)
+		return HTTP_ERR_BAD_RESPONSE;
 
 	ptr = buf + 9;		/* skip the "HTTP/1.1 " part */
 	errcode = atoi(ptr);
-	if (errcode != 200 || output == NULL)
-		return errcode;
+	_http_limit_parse(buf, hend);	/* errors report it, too */
+	keep = strncmp(buf, "HTTP/1.0", 8) != 0
+	    && ((ptr = _http_header_value(buf, hend, "Connection:")) == NULL
+		|| strncasecmp(ptr, "close", 5) != 0);
 
-	ptr = strstr(buf, "Content-Length:");
-	if (ptr == NULL)
-		return -1;
+	/*
+	 * seek to the beginning of the content (in the stream) 
+	 */
+	ptr = hend + 4;
+
+	src.sock = sock;
+	src.buf = ptr;
+	src.inbuf = headsize - ((ptr - buf) * sizeof(char));
+	src.leftover = -1;	/* until the server closes */
+	src.chunked = 0;
+	src.chunks = 0;
+	src.done = 0;
+	src.deadline = deadline;
+	src.err = 0;
+
+	if ((ptr = _http_header_value(buf, hend, "Transfer-Encoding:")) != NULL
+	    && strncasecmp(ptr, "chunked", 7) == 0) {
+		src.chunked = 1;
+		src.leftover = 0;	/* the size of the first chunk is next */
+	}
+	else if ((ptr = _http_header_value(buf, hend, "Content-Length:"))
+		 != NULL && (src.leftover = atoi(ptr)) < 0)
+		return HTTP_ERR_BAD_RESPONSE;
+	bodysize = src.leftover;
 
-	ptr += 15;		/* skip the "Content-Length " part */
-	bodysize = atoi(ptr);
+	/* the body isn't needed, but read if the connection is kept */
+	if (errcode != 200 || output == NULL) {
+		kept.reusable = kept.on && keep && _body_drain(&src) == 0;
+		return errcode;
+	}
 
 	/*
-	 * seek to the beginning of the content (in the stream) 
+	 * a compressed body is decompressed while it's being downloaded
 	 */
-	ptr = strstr(buf, HEADER_END);
-	if (ptr == NULL)
-		return -1;
+	if ((ptr = _http_header_value(buf, hend, "Content-Encoding:")) != NULL
+	    && strncasecmp(ptr, "identity", 8) != 0) {
+		if (!strncasecmp(ptr, "gzip", 4)
+		    || !strncasecmp(ptr, "x-gzip", 6))
+			readsize = _http_body_inflate(&src, INFLATE_GZIP, output);
+		else if (!strncasecmp(ptr, "deflate", 7))
+			readsize = _http_body_inflate(&src, INFLATE_DEFLATE,
+						      output);
+		else
+			readsize = HTTP_ERR_DECODE;	/* not what we asked for */
+
+		/* the decompressor may stop before the framing ends */
+		kept.reusable = readsize >= 0 && kept.on && keep
+		    && _body_drain(&src) == 0;
+		STATS_END(STATS_TRANSFER, timer, bodysize);
+		return readsize < 0 ? readsize : errcode;
+	}
 
-	ptr += 4;
+	/* the length isn't known in advance, the buffer has to grow */
+	if (bodysize < 0 || src.chunked) {
+		readsize = _http_body_copy(&src, output);
+
+		kept.reusable = readsize >= 0 && kept.on && keep
+		    && _body_drain(&src) == 0;
+		STATS_END(STATS_TRANSFER, timer, readsize);
+		return readsize < 0 ? readsize : errcode;
+	}
 
 	/*
 	 * this is the size of the body in the buffer
 	 */
-	bodyinbuf = headsize - ((ptr - buf) * sizeof(char));
+	ptr = src.buf;
+	bodyinbuf = src.inbuf;
+	if (bodyinbuf > bodysize)
+		bodyinbuf = bodysize;
 
 	/*
 	 * copy the response body into the allocated memory
 	 */
 	*output = malloc(bodysize * sizeof(**output) + 1);
+	if (*output == NULL)
+		return HTTP_ERR_NOMEM;
 	(*output)[bodysize] = 0;	/* it's gonna be a string! */
 	memcpy(*output, ptr, bodyinbuf);	/* copy the remnants over from buffer */
 
@@ -155,25 +1371,35 @@ int _http_response_handle(int sock, char **output)
 	 */
 	ptr = (*output) + bodyinbuf;	/* skip the downloaded part */
 	leftover = bodysize - bodyinbuf;
-	while ((readsize = read(sock, ptr, leftover)) > 0) {
+	while (leftover > 0) {
+		readsize = _socket_recv(sock, ptr, leftover, deadline,
+					HTTP_ERR_TIMEOUT);
+		if (readsize <= 0)
+			break;
+
 		leftover -= readsize;
 		ptr += readsize;
 	}
 
 	/* connection failed, return with NULL */
-	if (readsize == -1) {
+	if (leftover > 0) {
 		free(*output);
-		return -1;
+		*output = NULL;
+		return readsize == 0 ? HTTP_ERR_CLOSED : readsize;
 	}
 
+	/* more than the body arrived, the connection is out of step */
+	kept.reusable = kept.on && keep && src.inbuf <= bodysize;
+	STATS_END(STATS_TRANSFER, timer, bodysize);
 	return errcode;
 }
 
-void _http_auth_send(int sock, char *user, char *pwd)
+int _http_auth_send(int sock, char *user, char *pwd, long long deadline)
 {
 	char *authstr = NULL;
 	char *basestr = NULL;
 	int authlen;
+	int ret;
 
 	authlen = strlen(user) + strlen(pwd) + 2;
 	/*
@@ -182,7 +1408,7 @@ void _http_auth_send(int sock, char *user, char *pwd)
 	 */
 	authstr = calloc(authlen, sizeof(*authstr));
 	if (authstr == NULL)
-		return;
+		return HTTP_ERR_NOMEM;
 
 	/*
 	 * construct the string which later will be base64 encoded 
@@ -196,57 +1422,559 @@ void _http_auth_send(int sock, char *user, char *pwd)
 	/*
 	 * write out the stuff 
 	 */
-	write(sock, "Authorization: Basic ", 21);
-	write(sock, basestr, strlen(basestr));
-	SEND_NEWLINE(sock);
+	ret = _socket_send(sock, "Authorization: Basic ", 21, deadline);
+	if (ret == 0)
+		ret = _socket_send(sock, basestr, strlen(basestr), deadline);
+	if (ret == 0)
+		ret = _socket_send(sock, NEWLINE, 2, deadline);
 	free(basestr);
+	return ret;
+}
+
+int _http_header_send(int sock, char *host, char *file, char *method,
+		      long long deadline)
+{
+	char *header;
+	int len;
+	int ret;
+
+	/* assembled in one piece, so that it leaves in one segment */
+	len = strlen(method) + strlen(file) + strlen(host) + 100;
+	header = malloc(len * sizeof(*header));
+	if (header == NULL)
+		return HTTP_ERR_NOMEM;
+
+	sprintf(header, "%s %s HTTP/1.1" NEWLINE "Host: %s" NEWLINE
+		"Accept-Encoding: gzip, deflate" NEWLINE
+		"Connection: %s" NEWLINE, method, file, host,
+		kept.on ? "keep-alive" : "close");
+	ret = _socket_send(sock, header, strlen(header), deadline);
+	free(header);
+	return ret;
 }
 
-void _http_header_send(int sock, char *host, char *file, char *method)
+static char *_http_header_value(char *head, char *end, char *name)
 {
-	write(sock, method, strlen(method));
-	SEND_SPACE(sock);
-	write(sock, file, strlen(file));
-	SEND_SPACE(sock);
-	write(sock, "HTTP/1.1" NEWLINE "Host: ", 16);
-	write(sock, host, strlen(host));
-	write(sock, NEWLINE "Connection: close" NEWLINE, 21);
+	int len = strlen(name);
+	char *ptr;
+
+	/* every field starts right after a line break */
+	for (ptr = strstr(head, NEWLINE); ptr != NULL && ptr < end;
+	     ptr = strstr(ptr + 2, NEWLINE)) {
+		if (strncasecmp(ptr + 2, name, len) != 0)
+			continue;
+
+		for (ptr += 2 + len; *ptr == ' ' || *ptr == '\t'; ptr++) ;
+		return ptr;
+	}
+
+	return NULL;
 }
 
-static int _socket_connect(char *host, char *portn)
+static void _http_limit_parse(char *head, char *end)
+{
+	char *limit = _http_header_value(head, end, "X-RateLimit-Limit:");
+	char *remaining = _http_header_value(head, end,
+					     "X-RateLimit-Remaining:");
+	char *reset = _http_header_value(head, end, "X-RateLimit-Reset:");
+
+	/* all three or nothing, a partial report can't be planned with */
+	if (limit == NULL || remaining == NULL || reset == NULL)
+		return;
+
+	last_limit.limit = atol(limit);
+	last_limit.remaining = atol(remaining);
+	last_limit.reset = atol(reset);
+	if (last_limit.limit < 0 || last_limit.remaining < 0)
+		last_limit.limit = -1;
+}
+
+static int _http_body_inflate(struct _body_source *src, inflate_format format,
+			      char **output)
+{
+	struct _body_sink sink;
+	int ret;
+
+	/* JSON usually shrinks to a tenth or so, start with a guess */
+	if (src->leftover > INFLATE_GUESS_MAX / 8)
+		sink.size = INFLATE_GUESS_MAX;
+	else
+		sink.size = (src->leftover < 1024 ? 1024 : src->leftover) * 8;
+	sink.len = 0;
+	sink.data = malloc(sink.size * sizeof(*sink.data));
+	if (sink.data == NULL)
+		return HTTP_ERR_NOMEM;
+	sink.data[0] = 0;
+
+	ret = inflate_stream(format, _body_read, src, _body_write, &sink);
+	if (ret == 0) {
+		*output = sink.data;
+		return 0;
+	}
+
+	free(sink.data);
+	if (ret == INFLATE_ERR_INPUT)	/* the socket failed, or ran dry */
+		return src->err != 0 ? src->err : HTTP_ERR_CLOSED;
+	if (ret == INFLATE_ERR_OUTPUT)
+		return HTTP_ERR_NOMEM;
+	return ret == INFLATE_ERR_NOMEM ? HTTP_ERR_NOMEM : HTTP_ERR_DECODE;
+}
+
+static int _http_body_copy(struct _body_source *src, char **output)
+{
+	struct _body_sink sink;
+	int ret;
+
+	sink.size = BUFSIZE * 16;
+	sink.len = 0;
+	sink.data = malloc(sink.size * sizeof(*sink.data));
+	if (sink.data == NULL)
+		return HTTP_ERR_NOMEM;
+
+	for (;;) {
+		/* read straight into the buffer, growing it when it's full */
+		if (_body_write(&sink, NULL, BUFSIZE) < 0) {
+			ret = HTTP_ERR_NOMEM;
+			break;
+		}
+
+		ret = _body_read(src, (unsigned char *) sink.data + sink.len,
+				 sink.size - sink.len - 1);
+		if (ret <= 0)
+			break;
+		sink.len += ret;
+	}
+
+	if (ret == 0 && (src->leftover > 0 || (src->chunked && !src->done)))
+		ret = HTTP_ERR_CLOSED;	/* ended before it should have */
+	else if (ret < 0 && src->err != 0)
+		ret = src->err;
+
+	if (ret < 0) {
+		free(sink.data);
+		return ret;
+	}
+
+	sink.data[sink.len] = 0;
+	*output = sink.data;
+	return sink.len;
+}
+
+static int _body_read(void *arg, unsigned char *buf, int len)
+{
+	struct _body_source *src = arg;
+	int ret;
+
+	if (src->chunked && src->leftover == 0 && !src->done
+	    && _body_chunk_start(src) < 0)
+		return -1;
+
+	if (src->done || src->leftover == 0)
+		return 0;
+	if (src->leftover > 0 && len > src->leftover)
+		len = src->leftover;
+
+	if (src->inbuf > 0) {	/* the buffered bytes first */
+		if (len > src->inbuf)
+			len = src->inbuf;
+		memcpy(buf, src->buf, len);
+		src->buf += len;
+		src->inbuf -= len;
+		ret = len;
+	}
+	else {
+		ret = _socket_recv(src->sock, (char *) buf, len, src->deadline,
+				   HTTP_ERR_TIMEOUT);
+		if (ret < 0) {
+			src->err = ret;
+			return ret;
+		}
+	}
+
+	if (src->leftover > 0)
+		src->leftover -= ret;
+	return ret;
+}
+
+static int _body_drain(struct _body_source *src)
+{
+	unsigned char scratch[BUFSIZE];
+	int len;
+	int c;
+
+	if (src->leftover < 0 && !src->chunked)
+		return -1;
+
+	while ((len = _body_read(src, scratch, sizeof(scratch))) > 0);
+	if (len < 0 || src->leftover > 0 || (src->chunked && !src->done))
+		return -1;
+
+	/* the last chunk is followed by the trailers, and an empty line */
+	if (src->chunked) {
+		do {
+			for (len = 0; (c = _body_getc(src)) != '\n'; len++)
+				if (c < 0)
+					return -1;
+		} while (len > 1);
+	}
+
+	return src->inbuf == 0 ? 0 : -1;
+}
+
+static int _body_getc(struct _body_source *src)
 {
-	int sock;
 	int ret;
+
+	if (src->inbuf == 0) {
+		ret = _socket_recv(src->sock, src->raw, BUFSIZE, src->deadline,
+				   HTTP_ERR_TIMEOUT);
+		if (ret <= 0) {
+			src->err = ret == 0 ? HTTP_ERR_CLOSED : ret;
+			return -1;
+		}
+		src->buf = src->raw;
+		src->inbuf = ret;
+	}
+
+	src->inbuf--;
+	return (unsigned char) *src->buf++;
+}
+
+static int _body_chunk_start(struct _body_source *src)
+{
+	int c;
+	int digits = 0;
+	long size = 0;
+
+	/* the data of the previous chunk is followed by a line break */
+	if (src->chunks > 0) {
+		while ((c = _body_getc(src)) != '\n')
+			if (c < 0)
+				return -1;
+	}
+
+	/* the size is in hex, optionally followed by extensions */
+	while ((c = _body_getc(src)) >= 0 && isxdigit(c)) {
+		size = size * 16 + (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+		if (++digits > 7) {
+			src->err = HTTP_ERR_BAD_RESPONSE;
+			return -1;
+		}
+	}
+	while (c >= 0 && c != '\n')
+		c = _body_getc(src);
+	if (c < 0)
+		return -1;
+	if (digits == 0) {
+		src->err = HTTP_ERR_BAD_RESPONSE;
+		return -1;
+	}
+
+	/* the trailers after the last chunk are of no interest */
+	src->chunks++;
+	src->leftover = (int) size;
+	src->done = size == 0;
+	return 0;
+}
+
+static int _body_write(void *arg, unsigned char *buf, int len)
+{
+	struct _body_sink *sink = arg;
+	char *tmp;
+
+	while (sink->len + len + 1 > sink->size) {
+		tmp = realloc(sink->data, sink->size * 2 * sizeof(*tmp));
+		if (tmp == NULL)
+			return -1;
+		sink->data = tmp;
+		sink->size *= 2;
+	}
+
+	if (buf == NULL)	/* only make room */
+		return 0;
+
+	memcpy(sink->data + sink->len, buf, len);
+	sink->len += len;
+	sink->data[sink->len] = 0;
+	return 0;
+}
+
+static int _socket_send(int sock, char *buf, int len, long long deadline)
+{
+	return tp->send(sock, buf, len, deadline);
+}
+
+static int _socket_recv(int sock, char *buf, int len, long long deadline,
+			int timeout_err)
+{
+	return tp->recv(sock, buf, len, deadline, timeout_err);
+}
+
+static void _transport_open(void)
+{
+	if (tp == NULL)
+		tp = transports[0];
+	if (tp->open() < 0)
+		tp = &transport_posix;
+}
+
+static void _split_domain(char *domain, char *host, int hostlen, char *port,
+			  int portlen)
+{
+	char *colon = strrchr(domain, ':');
+	int len;
+
+	/* a bare IPv6 address has colons but no port */
+	if (colon != NULL && strchr(domain, ':') != colon && domain[0] != '[')
+		colon = NULL;
+	if (colon != NULL && domain[0] == '[' && colon[-1] != ']')
+		colon = NULL;
+
+	len = colon == NULL ? strlen(domain) : colon - domain;
+	if (domain[0] == '[' && colon != NULL) {
+		domain++;	/* strip the brackets */
+		len -= 2;
+	}
+	if (len >= hostlen)
+		len = hostlen - 1;
+	memcpy(host, domain, len);
+	host[len] = 0;
+
+	strncpy(port, colon == NULL ? HTTP_PORT_STR : colon + 1, portlen - 1);
+	port[portlen - 1] = 0;
+}
+
+static int _socket_connect(char *host, char *portn, long long deadline)
+{
+	int sock;
+	long long start = _now_usec();
+	double timer = STATS_BEGIN();
+	struct addrinfo *res;
+
+	res = _dns_lookup(host, portn);
+	STATS_END(STATS_DNS, timer, 0);
+
+	timer = STATS_BEGIN();
+	if (res == NULL)
+		sock = HTTP_ERR_RESOLVE;
+	else if ((sock = _socket_race(res, deadline)) == HTTP_ERR_CONNECT)
+		_dns_invalidate(host, portn);	/* the addresses may be stale */
+	if (sock >= 0)
+		STATS_END(STATS_CONNECT, timer, 0);
+
+	if (connect_hook != NULL)
+		connect_hook(host, (long) (_now_usec() - start), sock >= 0);
+
+	return sock;
+}
+
+static int _http_kept_take(char *host, char *port)
+{
+	struct pollfd fds;
+	int sock = kept.sock;
+
+	if (sock < 0)
+		return -1;
+	kept.sock = -1;
+
+	/* an idle connection has nothing to say, unless it's been closed */
+	fds.fd = sock;
+	fds.events = POLLIN;
+	if (strcmp(kept.host, host) != 0 || strcmp(kept.port, port) != 0
+	    || poll(&fds, 1, 0) != 0) {
+		_socket_disconnect(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static void _http_kept_put(char *host, char *port, int sock)
+{
+	if (kept.sock >= 0)
+		_socket_disconnect(kept.sock);
+
+	kept.sock = sock;
+	strncpy(kept.host, host, sizeof(kept.host) - 1);
+	strncpy(kept.port, port, sizeof(kept.port) - 1);
+}
+
+static long long _now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct addrinfo *_dns_lookup(char *host, char *port)
+{
+	int i;
+	int victim = 0;		/* the slot to (re)use on a miss */
+	time_t now = (time_t) (_now_usec() / 1000000);
 	struct addrinfo hints;
 	struct addrinfo *res;
-	struct addrinfo *ptr;
+	struct _dns_entry *entry;
+
+	for (i = 0; i < DNS_CACHE_SIZE; i++) {
+		entry = &dns_cache[i];
+		if (entry->host == NULL) {
+			victim = i;
+			continue;
+		}
+		if (strcmp(entry->host, host) || strcmp(entry->port, port)) {
+			if (dns_cache[victim].host != NULL
+			    && entry->expires < dns_cache[victim].expires)
+				victim = i;	/* evict the one closest to expiry */
+			continue;
+		}
+
+		if (entry->expires > now)
+			return entry->res;	/* hit, positive or negative */
+
+		victim = i;	/* stale, refresh it in place */
+		break;
+	}
 
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
 
-	ret = getaddrinfo(host, portn, &hints, &res);
-	if (ret != 0)
-		return -1;
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+		res = NULL;
+
+	entry = &dns_cache[victim];
+	if (entry->host != NULL) {
+		free(entry->host);
+		free(entry->port);
+		if (entry->res != NULL)
+			freeaddrinfo(entry->res);
+	}
+
+	entry->host = mystrdup(host);
+	entry->port = mystrdup(port);
+	entry->res = res;
+	entry->expires = now + (res == NULL ? DNS_NEGATIVE_TTL : DNS_TTL);
+
+	return res;
+}
+
+static void _dns_invalidate(char *host, char *port)
+{
+	int i;
+
+	for (i = 0; i < DNS_CACHE_SIZE; i++) {
+		if (dns_cache[i].host != NULL && !strcmp(dns_cache[i].host, host)
+		    && !strcmp(dns_cache[i].port, port)) {
+			dns_cache[i].expires = 0;
+			return;
+		}
+	}
+}
+
+static int _socket_race(struct addrinfo *res, long long deadline)
+{
+	struct addrinfo *addrs[MAX_ADDRS];
+	struct pollfd fds[MAX_ADDRS];
+	struct addrinfo *ptr;
+	int naddrs = 0;
+	int nfds = 0;		/* the count of attempts started */
+	int pending = 0;	/* the count of attempts still in progress */
+	int sock = -1;
+	int i,
+	 j,
+	 err;
+	long long left;		/* the milliseconds left until the deadline */
+	socklen_t errlen;
+
+	/*
+	 * interleave the address families, so that a broken IPv6 (or IPv4)
+	 * route only costs one stagger delay and not one per address
+	 */
+	for (ptr = res; ptr != NULL && naddrs < MAX_ADDRS; ptr = ptr->ai_next)
+		if (ptr->ai_family == res->ai_family)
+			addrs[naddrs++] = ptr;
+	for (ptr = res, j = 1; ptr != NULL && naddrs < MAX_ADDRS;
+	     ptr = ptr->ai_next) {
+		if (ptr->ai_family == res->ai_family)
+			continue;
 
-	for (ptr = res; ptr != NULL; ptr = ptr->ai_next) {
-		sock =
-		    socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-		if (sock == -1)
-			continue;	/* not supported socket type */
+		/* insert after the j-th address of the preferred family */
+		memmove(addrs + j + 1, addrs + j, (naddrs - j) * sizeof(*addrs));
+		addrs[j] = ptr;
+		naddrs++;
+		j = j + 2 < naddrs ? j + 2 : naddrs;
+	}
 
-		ret = connect(sock, ptr->ai_addr, ptr->ai_addrlen);
-		if (ret != -1)
+	for (i = 0; sock < 0 && (i < naddrs || pending > 0);) {
+		left = (deadline - _now_usec() + 999) / 1000;
+		if (left <= 0) {
+			sock = HTTP_ERR_CONNECT_TIMEOUT;
 			break;
-		else
-			close(sock);
+		}
+
+		/* start the next attempt */
+		if (i < naddrs) {
+			ptr = addrs[i++];
+			fds[nfds].fd =
+			    socket(ptr->ai_family, ptr->ai_socktype,
+				   ptr->ai_protocol);
+			if (fds[nfds].fd == -1)
+				continue;	/* not supported socket type */
+
+			fcntl(fds[nfds].fd, F_SETFL,
+			      fcntl(fds[nfds].fd, F_GETFL) | O_NONBLOCK);
+			fds[nfds].events = POLLOUT;
+
+			if (connect(fds[nfds].fd, ptr->ai_addr, ptr->ai_addrlen)
+			    == 0) {
+				sock = fds[nfds++].fd;
+				break;
+			}
+			if (errno != EINPROGRESS) {
+				close(fds[nfds].fd);
+				continue;
+			}
+			nfds++;
+			pending++;
+		}
+
+		/* wait for any of the pending ones, but only for a while if
+		 * there are more addresses to try */
+		if (pending > 0 && i < naddrs && left > CONNECT_STAGGER)
+			left = CONNECT_STAGGER;
+		if (poll(fds, nfds, pending == 0 ? 0 : (int) left) <= 0)
+			continue;
+
+		for (j = 0; j < nfds; j++) {
+			if (fds[j].fd < 0 || fds[j].revents == 0)
+				continue;
+
+			errlen = sizeof(err);
+			if (getsockopt(fds[j].fd, SOL_SOCKET, SO_ERROR, &err,
+				       &errlen) == 0 && err == 0) {
+				sock = fds[j].fd;
+				break;
+			}
+
+			close(fds[j].fd);
+			fds[j].fd = -1;	/* poll() ignores negative fds */
+			pending--;
+		}
 	}
 
-	freeaddrinfo(res);
-	return sock;
+	/* we have a winner (or not), cancel the rest */
+	for (j = 0; j < nfds; j++) {
+		if (fds[j].fd >= 0 && fds[j].fd != sock)
+			close(fds[j].fd);
+	}
+
+	return sock == -1 ? HTTP_ERR_CONNECT : sock;
 }
 
 static int _socket_disconnect(int socket)
 {
+	if (tp != NULL)
+		tp->drop(socket);
 	return close(socket);
 }
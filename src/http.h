@@ -4,10 +4,104 @@
 
 /** @file */
 
+/** The error codes returned by the request functions instead of an HTTP
+ * status code when the request couldn't be completed */
+enum http_error {
+	HTTP_ERR_RESOLVE = -1,
+	HTTP_ERR_CONNECT = -2,
+	HTTP_ERR_CONNECT_TIMEOUT = -3,
+	HTTP_ERR_SEND = -4,
+	HTTP_ERR_FIRST_BYTE_TIMEOUT = -5,
+	HTTP_ERR_TIMEOUT = -6,
+	HTTP_ERR_READ = -7,
+	HTTP_ERR_CLOSED = -8,
+	HTTP_ERR_BAD_RESPONSE = -9,
+	HTTP_ERR_NOMEM = -10,
+	HTTP_ERR_DECODE = -11,
+	HTTP_ERR_BODY = -12
+};
+
+/** The rate limit of an endpoint, as reported with a response */
+struct _http_limit {
+
+	/** The count of requests allowed in a window, -1 if not reported */
+	long limit;
+
+	/** The count of requests left in the current window */
+	long remaining;
+
+	/** The time the window ends, in seconds since the epoch */
+	long reset;
+};
+
+/** Sets the deadlines of the requests. Transient failures are retried with
+ * exponential backoff as long as the total deadline allows it.
+ * @param connect the time allowed for resolving and connecting (ms)
+ * @param first_byte the time allowed between sending the request and the
+ * first byte of the response (ms)
+ * @param total the time allowed for the whole request, retries included (ms)
+ * @param retries how many times a failed request may be repeated */
+void http_set_timeouts(int connect, int first_byte, int total, int retries);
+
+/** Returns the description of an error code
+ * @param code a value of enum http_error or an HTTP status code
+ * @return a static string */
+char *http_strerror(int code);
+
+/** The prototype of the function that is called after each connection
+ * attempt, eg. to measure connect latency
+ * @param host the host that was connected to
+ * @param usec the time spent resolving and connecting, in microseconds
+ * @param ok true if the connection was established */
+typedef void (*http_connect_hook) (char *host, long usec, int ok);
+
+/** Sets the hook that is called after each connection attempt
+ * @param hook the function to call, or NULL to disable */
+void http_set_connect_hook(http_connect_hook hook);
+
+/** Chooses how the sockets are read and written: "uring" (the default) goes
+ * through io_uring on Linux 5.7 and later, "posix" with send(), recv() and
+ * poll(). If io_uring can't be used, "posix" is.
+ * @param name the name of the transport
+ * @retval 0 if succeeded
+ * @retval -1 if there is no such transport */
+int http_set_transport(char *name);
+
+/** Returns the count of system calls made for the I/O of the requests in
+ * this process, to compare the transports
+ * @return the count of system calls */
+long http_syscalls(void);
+
+/** Keeps the connection of a request open for the next request to the same
+ * server, instead of closing it after the response. One connection is kept:
+ * it is closed when a request goes elsewhere, and replaced when the server
+ * has closed it meanwhile. Off by default.
+ * @param on true to keep connections, false to close the kept one */
+void http_set_keepalive(int on);
+
+/** Percent-encodes a string for a URL or an
+ * application/x-www-form-urlencoded body: everything but the letters,
+ * digits and "-._~" is encoded
+ * @param str the string
+ * @return the encoded string allocated on the heap, NULL if out of memory */
+char *http_urlencode(char *str);
+
+/** Returns the rate limit reported with the last response (of the last
+ * attempt, if the request was retried), read from the X-RateLimit-Limit,
+ * -Remaining and -Reset header fields
+ * @param limit where the limit is stored, its limit field is -1 if the
+ * response didn't report one */
+void http_last_limit(struct _http_limit *limit);
+
+/** Empties the resolver cache, so that the next requests call
+ * getaddrinfo() again */
+void http_flush_dns_cache(void);
+
 /** Sends an HTTP GET request to the server w/o authentication
  * @param domain the name of the server
  * @param file the file to request
- * @return the content of file (sans HTTP header)
+ * @return the HTTP status code or a negative enum http_error, the content
+ * of file (sans HTTP header) is stored in output
  */
 int http_get(char *domain, char *file, char **output);
 
@@ -16,7 +110,8 @@ int http_get(char *domain, char *file, char **output);
  * @param file the file to request
  * @param user: username
  * @param pwd: password
- * @return the content of file (sans HTTP header)
+ * @return the HTTP status code or a negative enum http_error, the content
+ * of file (sans HTTP header) is stored in output
  */
 int http_get_auth(char *domain, char *file, char **output, char *user,
 		  char *pwd);
@@ -27,9 +122,140 @@ int http_get_auth(char *domain, char *file, char **output, char *user,
  * @param user username
  * @param pwd password
  * @param data the message body
- * @return the content of file (sans HTTP header)
+ * @return the HTTP status code or a negative enum http_error, the content
+ * of file (sans HTTP header) is stored in output
  */
 int http_post_auth(char *domain, char *file, char **output, char *data,
 		   char *user, char *pwd);
 
+/** The prototype of the function a part of a body is read from
+ * @param arg the argument given with the part
+ * @param buf where to read
+ * @param len the size of buf
+ * @return the count of bytes read, 0 at the end, negative on error */
+typedef int (*http_read_fn) (void *arg, char *buf, int len);
+
+/** A part of the body of http_post_parts(). Its content comes from data if
+ * not NULL, else from fd if not negative, else from read. */
+struct _http_part {
+
+	/** The name of the form field, NULL if the body isn't
+	 * multipart/form-data */
+	char *name;
+
+	/** The file name reported with the field, may be NULL */
+	char *filename;
+
+	/** The content type, may be NULL */
+	char *type;
+
+	/** The content in memory */
+	char *data;
+
+	/** A regular file the content is sent from, by sendfile() where
+	 * available, without copying it to the user space */
+	int fd;
+
+	/** The offset in fd the content starts at */
+	long offset;
+
+	/** The function the content is read from, and its argument */
+	http_read_fn read;
+	void *arg;
+
+	/** The length of the content: -1 for the length of data, or the rest
+	 * of fd; the function has to give exactly this many bytes */
+	long len;
+};
+
+/** Sends an HTTP POST with a body made of parts, using constant memory
+ * whatever their size. If the parts have names, the body is
+ * multipart/form-data, else the parts follow each other, with the type of
+ * the first one. The request is only repeated if it couldn't connect,
+ * before the parts are read, so a function is read through once.
+ * @param domain the name of the server
+ * @param file the file to request
+ * @param output the body of the response is stored here, may be NULL
+ * @param parts the parts
+ * @param count the count of parts
+ * @param user username
+ * @param pwd password
+ * @return the HTTP status code or a negative enum http_error */
+int http_post_parts(char *domain, char *file, char **output,
+		    struct _http_part *parts, int count, char *user,
+		    char *pwd);
+
+/** Fills a part in with the content of a file, sent from the file
+ * @param part the part
+ * @param name the name of the form field
+ * @param file the name of the file, its last component is the file name
+ * reported
+ * @param type the content type, may be NULL
+ * @retval 0 if succeeded
+ * @retval -1 if the file couldn't be opened */
+int http_part_file(struct _http_part *part, char *name, char *file,
+		   char *type);
+
+/** Closes the file of a part filled in by http_part_file()
+ * @param part the part */
+void http_part_close(struct _http_part *part);
+
+/** A GET request of http_get_many() */
+typedef struct _http_request *http_request;
+
+/** A request sent by http_get_many() and its result */
+struct _http_request {
+
+	/** The name of the server */
+	char *domain;
+
+	/** The file to request */
+	char *file;
+
+	/** The username, NULL for no authentication */
+	char *user;
+
+	/** The password */
+	char *pwd;
+
+	/** The HTTP status code or a negative enum http_error, set by
+	 * http_get_many() */
+	int status;
+
+	/** The content of the file if status is 200, NULL otherwise. Set by
+	 * http_get_many(), to be freed by the caller. */
+	char *output;
+
+	/** The rate limit reported with the response, see http_last_limit() */
+	struct _http_limit limit;
+};
+
+/** Sends GET requests concurrently, so that they take about as long as the
+ * slowest one instead of the sum of them. Each is done like
+ * http_get_auth() does it (with the same deadlines and retries), in a
+ * process of its own, and the responses are collected through pipes.
+ * A request no process can be started for is sent by the calling process
+ * while the others are in flight.
+ * @param reqs the requests, the results are stored in them
+ * @param count the count of requests
+ * @return the count of requests that returned 200 */
+int http_get_many(http_request reqs, int count);
+
+/** A request sent in the background, see http_get_start() */
+typedef struct _http_child *http_pending;
+
+/** Sends a GET request in the background, the way http_get_many() sends
+ * each of its requests, so that the caller can go on (eg. render the
+ * previous page) while it's in flight
+ * @param req the request, left alone until http_get_finish() returns
+ * @return the handle to wait for it with, NULL if out of memory */
+http_pending http_get_start(http_request req);
+
+/** Waits for a request sent by http_get_start(), and stores the result in
+ * the request
+ * @param pending the handle, which is freed
+ * @return the HTTP status code or a negative enum http_error, as stored in
+ * the request */
+int http_get_finish(http_pending pending);
+
 #endif
@@ -0,0 +1,617 @@
+#define MEM_AREA MEM_LIST
+#include "idset.h"
+#include "store.h"
+
+/** @file */
+
+/** The first line of a saved set */
+#define IDSET_MAGIC "twitterm idset 1\n"
+/** The bits of a word of a bitmap */
+#define WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+/** The count of words of a bitmap */
+#define BITMAP_WORDS (65536 / WORD_BITS)
+/** The size of a bitmap as it's stored */
+#define BITMAP_BYTES 8192
+
+/** Tests the bit of the lowest 16 bits of an ID in a bitmap */
+#define BIT_TEST(words, low) \
+	((words)[(low) / WORD_BITS] >> ((low) % WORD_BITS) & 1)
+
+/** The IDs of the set sharing the bits above the lowest 16 */
+struct _idset_container {
+
+	/** The bits above the lowest 16 */
+	unsigned long key;
+
+	/** The count of IDs */
+	long card;
+
+	/** True if the IDs are held as a bitmap, false if as an array */
+	int bitmap;
+
+	/** The offset of the array in lows, or of the bitmap in words */
+	long off;
+};
+
+/** The set. The containers are sorted by their keys, for a binary search.
+ * Their arrays are packed one after the other into lows, and their bitmaps
+ * into words, each found by the offset of its container. */
+struct _idset {
+
+	/** The count of IDs */
+	long count;
+
+	/** The containers, and their count */
+	struct _idset_container *conts;
+	long nconts;
+
+	/** The arrays of the containers, and the count of shorts used */
+	unsigned short *lows;
+	long nlows;
+
+	/** The bitmaps of the containers, and the count of words used */
+	unsigned long *words;
+	long nwords;
+};
+
+/** Compares two IDs for qsort() */
+static int _id_cmp(const void *a, const void *b);
+
+/** Counts the bits set in a word */
+static long _popcount(unsigned long w);
+
+/** Allocates a set with room for the containers given
+ * @param nconts the count of containers
+ * @param nlows the count of shorts of their arrays
+ * @param nwords the count of words of their bitmaps
+ * @return the empty set, NULL if out of memory */
+static idset _idset_alloc(long nconts, long nlows, long nwords);
+
+/** Appends an empty container to a set, which must have room for it
+ * @param set the set
+ * @param key the key of the container, greater than the last one's
+ * @param bitmap true if its IDs are held as a bitmap
+ * @return the container */
+static struct _idset_container *_idset_add(idset set, unsigned long key,
+					   int bitmap);
+
+/** Adds an ID to the last container of a set, greater than the ones it has
+ * @param set the set
+ * @param c the last container
+ * @param low the lowest 16 bits of the ID */
+static void _idset_put(idset set, struct _idset_container *c,
+		       unsigned int low);
+
+/** Stores the lowest 16 bits of the IDs of a container in order
+ * @param set the set
+ * @param c the container
+ * @param out where to store them, c->card shorts
+ */
+static void _idset_lows(idset set, struct _idset_container *c,
+			unsigned short *out);
+
+/** Stores the IDs of a container of a that aren't in the container of b
+ * with the same key into the last container of ret */
+static void _diff_container(idset ret, struct _idset_container *c,
+			    idset a, struct _idset_container *ca,
+			    idset b, struct _idset_container *cb);
+
+/** Writes the containers of a set, see store_fn */
+static int _idset_save(FILE * fp, void *arg);
+
+/** Checks the containers saved by idset_write(), and decodes them into the
+ * set if there is one
+ * @param set the set with room for the containers, NULL to only check and
+ * size them
+ * @param ptr the saved containers, after the magic
+ * @param end the end of the data
+ * @param nconts the count of containers is stored here
+ * @param nlows the count of shorts of the arrays is stored here
+ * @param nbitmaps the count of bitmaps is stored here
+ * @retval 0 if succeeded
+ * @retval -1 if the data is malformed */
+static int _idset_decode(idset set, unsigned char *ptr, unsigned char *end,
+			 long *nconts, long *nlows, long *nbitmaps);
+
+idset idset_build(unsigned long *ids, long count)
+{
+	unsigned long *sorted = malloc((count > 0 ? count : 1) *
+				       sizeof(*sorted));
+	struct _idset_container *c;
+	idset ret;
+	long nconts = 0;
+	long nlows = 0;
+	long nbitmaps = 0;
+	long i;
+	long j;
+
+	if (sorted == NULL)
+		return NULL;
+	memcpy(sorted, ids, count * sizeof(*sorted));
+	qsort(sorted, count, sizeof(*sorted), _id_cmp);
+
+	/* each ID is kept once */
+	for (i = j = 0; i < count; i++)
+		if (j == 0 || sorted[j - 1] != sorted[i])
+			sorted[j++] = sorted[i];
+	count = j;
+
+	/* the containers are sized first, and filled once allocated */
+	for (i = 0; i < count; i = j) {
+		for (j = i; j < count && sorted[j] >> 16 == sorted[i] >> 16;)
+			j++;
+		nconts++;
+		if (j - i > IDSET_ARRAY_MAX)
+			nbitmaps++;
+		else
+			nlows += j - i;
+	}
+
+	ret = _idset_alloc(nconts, nlows, nbitmaps * BITMAP_WORDS);
+	for (i = 0; ret != NULL && i < count; i = j) {
+		for (j = i; j < count && sorted[j] >> 16 == sorted[i] >> 16;)
+			j++;
+		c = _idset_add(ret, sorted[i] >> 16, j - i > IDSET_ARRAY_MAX);
+		for (; i < j; i++)
+			_idset_put(ret, c, sorted[i] & 0xffff);
+	}
+
+	free(sorted);
+	return ret;
+}
+
+void idset_free(idset set)
+{
+	if (set == NULL)
+		return;
+
+	free(set->conts);
+	free(set->lows);
+	free(set->words);
+	free(set);
+}
+
+long idset_count(idset set)
+{
+	return set->count;
+}
+
+long idset_size(idset set)
+{
+	return set->nconts * sizeof(*set->conts) +
+	    set->nlows * sizeof(*set->lows) +
+	    set->nwords * sizeof(*set->words);
+}
+
+int idset_contains(idset set, unsigned long id)
+{
+	struct _idset_container *c;
+	unsigned short *lows;
+	unsigned long key = id >> 16;
+	unsigned int low = id & 0xffff;
+	long lo = 0;
+	long hi = set->nconts - 1;
+	long mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		c = &set->conts[mid];
+		if (c->key < key) {
+			lo = mid + 1;
+			continue;
+		}
+		if (c->key > key) {
+			hi = mid - 1;
+			continue;
+		}
+
+		if (c->bitmap)
+			return BIT_TEST(set->words + c->off, low);
+
+		lows = set->lows + c->off;
+		for (lo = 0, hi = c->card - 1; lo <= hi;) {
+			mid = (lo + hi) / 2;
+			if (lows[mid] == low)
+				return 1;
+			if (lows[mid] < low)
+				lo = mid + 1;
+			else
+				hi = mid - 1;
+		}
+		return 0;
+	}
+
+	return 0;
+}
+
+idset idset_difference(idset a, idset b)
+{
+	idset ret = _idset_alloc(a->nconts, a->nlows, a->nwords);
+	struct _idset_container *ca;
+	struct _idset_container *cb;
+	struct _idset_container *c;
+	long i;
+	long j = 0;
+
+	if (ret == NULL)
+		return NULL;
+
+	/* the keys are sorted in both, so the containers are merged; the
+	 * result of a container is no bigger than it, so ret has room */
+	for (i = 0; i < a->nconts; i++) {
+		ca = &a->conts[i];
+		while (j < b->nconts && b->conts[j].key < ca->key)
+			j++;
+		cb = j < b->nconts && b->conts[j].key == ca->key ?
+		    &b->conts[j] : NULL;
+
+		c = _idset_add(ret, ca->key, ca->bitmap);
+		_diff_container(ret, c, a, ca, b, cb);
+
+		/* an emptied container is dropped */
+		if (c->card == 0) {
+			if (c->bitmap)
+				ret->nwords = c->off;
+			else
+				ret->nlows = c->off;
+			ret->nconts--;
+		}
+	}
+
+	return ret;
+}
+
+int idset_each(idset set, idset_fn fn, void *arg)
+{
+	struct _idset_container *c;
+	unsigned long w;
+	unsigned long base;
+	long i;
+	long k;
+	int ret = 0;
+
+	for (i = 0; ret == 0 && i < set->nconts; i++) {
+		c = &set->conts[i];
+		base = c->key << 16;
+
+		if (!c->bitmap) {
+			for (k = 0; ret == 0 && k < c->card; k++)
+				ret = fn(base | set->lows[c->off + k], arg);
+			continue;
+		}
+
+		for (k = 0; ret == 0 && k < (long) BITMAP_WORDS; k++) {
+			w = set->words[c->off + k];
+			for (base = (c->key << 16) + k * WORD_BITS;
+			     ret == 0 && w != 0; w >>= 1, base++)
+				if (w & 1)
+					ret = fn(base, arg);
+		}
+	}
+
+	return ret;
+}
+
+int idset_write(idset set, char *file)
+{
+	return store_write(file, IDSET_MAGIC, _idset_save, set);
+}
+
+idset idset_read(char *file)
+{
+	unsigned char *data;
+	idset ret = NULL;
+	long size;
+	long nconts;
+	long nlows;
+	long nbitmaps;
+
+	data = store_read(file, IDSET_MAGIC, &size);
+	if (data == NULL)
+		return NULL;
+
+	/* checked and sized first, decoded once allocated */
+	if (_idset_decode(NULL, data, data + size, &nconts, &nlows,
+			  &nbitmaps) == 0)
+		ret = _idset_alloc(nconts, nlows, nbitmaps * BITMAP_WORDS);
+	if (ret != NULL)
+		_idset_decode(ret, data, data + size, &nconts, &nlows,
+			      &nbitmaps);
+
+	free(data);
+	return ret;
+}
+
+/* ************************************
+ * static functions
+ */
+static int _id_cmp(const void *a, const void *b)
+{
+	unsigned long x = *(unsigned long *) a;
+	unsigned long y = *(unsigned long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static long _popcount(unsigned long w)
+{
+	unsigned long v;
+	long n = 0;
+
+	/* 32 bits at a time, however long a long is */
+	for (; w != 0; w = w >> 16 >> 16) {
+		v = w & 0xffffffffUL;
+		v = v - ((v >> 1) & 0x55555555UL);
+		v = (v & 0x33333333UL) + ((v >> 2) & 0x33333333UL);
+		v = (v + (v >> 4)) & 0x0f0f0f0fUL;
+		n += (long) (((v * 0x01010101UL) & 0xffffffffUL) >> 24);
+	}
+
+	return n;
+}
+
+static idset _idset_alloc(long nconts, long nlows, long nwords)
+{
+	idset ret = calloc(1, sizeof(*ret));
+
+	if (ret == NULL)
+		return NULL;
+
+	ret->conts = malloc((nconts > 0 ? nconts : 1) * sizeof(*ret->conts));
+	ret->lows = malloc((nlows > 0 ? nlows : 1) * sizeof(*ret->lows));
+	ret->words = malloc((nwords > 0 ? nwords : 1) * sizeof(*ret->words));
+	if (ret->conts == NULL || ret->lows == NULL || ret->words == NULL) {
+		idset_free(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+static struct _idset_container *_idset_add(idset set, unsigned long key,
+					   int bitmap)
+{
+	struct _idset_container *c = &set->conts[set->nconts++];
+
+	c->key = key;
+	c->card = 0;
+	c->bitmap = bitmap;
+	if (bitmap) {
+		c->off = set->nwords;
+		memset(set->words + c->off, 0,
+		       BITMAP_WORDS * sizeof(*set->words));
+		set->nwords += BITMAP_WORDS;
+	}
+	else {
+		c->off = set->nlows;
+	}
+
+	return c;
+}
+
+static void _idset_put(idset set, struct _idset_container *c,
+		       unsigned int low)
+{
+	if (c->bitmap)
+		set->words[c->off + low / WORD_BITS] |=
+		    1UL << (low % WORD_BITS);
+	else
+		set->lows[set->nlows++] = (unsigned short) low;
+	c->card++;
+	set->count++;
+}
+
+static void _idset_lows(idset set, struct _idset_container *c,
+			unsigned short *out)
+{
+	unsigned long w;
+	long n = 0;
+	long k;
+	long bit;
+
+	if (!c->bitmap) {
+		memcpy(out, set->lows + c->off, c->card * sizeof(*out));
+		return;
+	}
+
+	for (k = 0; k < (long) BITMAP_WORDS && n < c->card; k++)
+		for (w = set->words[c->off + k], bit = 0; w != 0;
+		     w >>= 1, bit++)
+			if (w & 1)
+				out[n++] = (unsigned short) (k * WORD_BITS +
+							     bit);
+}
+
+static void _diff_container(idset ret, struct _idset_container *c,
+			    idset a, struct _idset_container *ca,
+			    idset b, struct _idset_container *cb)
+{
+	unsigned short *la = a->lows + ca->off;
+	unsigned short *lb;
+	unsigned long *wa = a->words + ca->off;
+	unsigned long *wb;
+	unsigned long *out = ret->words + c->off;
+	unsigned long w;
+	long i;
+	long j = 0;
+	long lo;
+	long hi;
+	long mid;
+
+	if (cb == NULL) {
+		if (ca->bitmap) {
+			memcpy(out, wa, BITMAP_WORDS * sizeof(*out));
+		}
+		else {
+			memcpy(ret->lows + c->off, la, ca->card * sizeof(*la));
+			ret->nlows += ca->card;
+		}
+		c->card = ca->card;
+		ret->count += ca->card;
+		return;
+	}
+
+	lb = b->lows + cb->off;
+	wb = b->words + cb->off;
+
+	/* 64 (or 32) IDs at a time */
+	if (ca->bitmap && cb->bitmap) {
+		for (i = 0; i < (long) BITMAP_WORDS; i++) {
+			w = wa[i] & ~wb[i];
+			out[i] = w;
+			c->card += _popcount(w);
+		}
+		ret->count += c->card;
+		return;
+	}
+
+	if (ca->bitmap) {
+		memcpy(out, wa, BITMAP_WORDS * sizeof(*out));
+		c->card = ca->card;
+		for (i = 0; i < cb->card; i++) {
+			if (!BIT_TEST(out, lb[i]))
+				continue;
+			out[lb[i] / WORD_BITS] &= ~(1UL << (lb[i] % WORD_BITS));
+			c->card--;
+		}
+		ret->count += c->card;
+		return;
+	}
+
+	if (cb->bitmap) {
+		for (i = 0; i < ca->card; i++)
+			if (!BIT_TEST(wb, la[i]))
+				_idset_put(ret, c, la[i]);
+		return;
+	}
+
+	/* the few are looked up in the many, the rest is merged */
+	if (cb->card > 16 * ca->card) {
+		for (i = 0; i < ca->card; i++) {
+			lo = j;
+			hi = cb->card - 1;
+			while (lo <= hi) {
+				mid = (lo + hi) / 2;
+				if (lb[mid] < la[i])
+					lo = mid + 1;
+				else
+					hi = mid - 1;
+			}
+			j = lo;
+			if (j == cb->card || lb[j] != la[i])
+				_idset_put(ret, c, la[i]);
+		}
+		return;
+	}
+
+	for (i = 0; i < ca->card; i++) {
+		while (j < cb->card && lb[j] < la[i])
+			j++;
+		if (j == cb->card || lb[j] != la[i])
+			_idset_put(ret, c, la[i]);
+	}
+}
+
+static int _idset_save(FILE * fp, void *arg)
+{
+	unsigned short lows[IDSET_ARRAY_MAX];
+	struct _idset_container *c;
+	idset set = arg;
+	unsigned long w;
+	long i;
+	long k;
+
+	store_write_varint(fp, set->nconts);
+	for (i = 0; i < set->nconts; i++) {
+		c = &set->conts[i];
+		store_write_varint(fp, i == 0 ? c->key :
+				   c->key - set->conts[i - 1].key);
+		store_write_varint(fp, c->card - 1);
+
+		/* the size tells the form, not the way it's held */
+		if (c->card > IDSET_ARRAY_MAX) {
+			for (k = 0; k < BITMAP_BYTES; k++) {
+				w = set->words[c->off + k * 8 / WORD_BITS];
+				fputc((int) (w >> (k * 8 % WORD_BITS) & 0xff),
+				      fp);
+			}
+			continue;
+		}
+
+		_idset_lows(set, c, lows);
+		for (k = 0; k < c->card; k++)
+			store_write_varint(fp, k == 0 ? lows[0] :
+					   lows[k] - lows[k - 1]);
+	}
+
+	return 0;
+}
+
+static int _idset_decode(idset set, unsigned char *ptr, unsigned char *end,
+			 long *nconts, long *nlows, long *nbitmaps)
+{
+	struct _idset_container *c = NULL;
+	unsigned long count;
+	unsigned long key = 0;
+	unsigned long delta;
+	unsigned long card;
+	unsigned long low;
+	unsigned long i;
+	long k;
+	long bits;
+
+	*nlows = 0;
+	*nbitmaps = 0;
+	if (store_get_varint(&ptr, end, &count) < 0
+	    || count > (unsigned long) (end - ptr) / 2)
+		return -1;	/* a container takes 2 bytes at least */
+	*nconts = count;
+
+	for (i = 0; i < count; i++) {
+		/* the keys are increasing, and fit */
+		if (store_get_varint(&ptr, end, &delta) < 0
+		    || (i > 0 && delta == 0)
+		    || delta > (ULONG_MAX >> 16) - key
+		    || store_get_varint(&ptr, end, &card) < 0 || card >= 65536)
+			return -1;
+		key += delta;
+		card++;
+
+		if (set != NULL)
+			c = _idset_add(set, key, card > IDSET_ARRAY_MAX);
+
+		if (card > IDSET_ARRAY_MAX) {
+			if (end - ptr < BITMAP_BYTES)
+				return -1;
+			for (k = 0, bits = 0; k < BITMAP_BYTES; k++) {
+				bits += _popcount(ptr[k]);
+				if (set != NULL)
+					set->words[c->off + k * 8 / WORD_BITS]
+					    |= (unsigned long) ptr[k] <<
+					    (k * 8 % WORD_BITS);
+			}
+			if (bits != (long) card)
+				return -1;
+			if (set != NULL) {
+				c->card = card;
+				set->count += card;
+			}
+			ptr += BITMAP_BYTES;
+			(*nbitmaps)++;
+			continue;
+		}
+
+		/* the lows are increasing, and fit */
+		for (k = 0, low = 0; k < (long) card; k++) {
+			if (store_get_varint(&ptr, end, &delta) < 0
+			    || (k > 0 && delta == 0) || delta > 0xffff - low)
+				return -1;
+			low += delta;
+			if (set != NULL)
+				_idset_put(set, c, low);
+		}
+		*nlows += card;
+	}
+
+	return ptr == end ? 0 : -1;
+}
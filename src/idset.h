@@ -0,0 +1,79 @@
+#ifndef __IDSET_H
+#define __IDSET_H
+#include "main.h"
+
+/** @file */
+
+/** The most IDs a container holds as an array, see idset_build() */
+#define IDSET_ARRAY_MAX 4096
+
+/** A sorted set of IDs, see idset_build() */
+typedef struct _idset *idset;
+
+/** The prototype of the function idset_each() calls for the IDs
+ * @param id the ID
+ * @param arg the argument given to idset_each()
+ * @return 0 to go on, anything else to stop */
+typedef int (*idset_fn) (unsigned long id, void *arg);
+
+/** Builds a set of the IDs. The IDs are split by their bits above the
+ * lowest 16 into containers, the way roaring bitmaps are: a container holds
+ * the lowest 16 bits of its IDs as a sorted array of shorts if it has at
+ * most IDSET_ARRAY_MAX of them, and as a bitmap of 8 kB otherwise. So an ID
+ * takes at most 2 bytes, and a dense run of them 1 bit.
+ * @param ids the IDs, in any order, duplicates allowed
+ * @param count the count of IDs
+ * @return the set, NULL if out of memory */
+idset idset_build(unsigned long *ids, long count);
+
+/** Frees a set
+ * @param set the set to free, may be NULL */
+void idset_free(idset set);
+
+/** Returns the count of IDs in the set
+ * @param set the set
+ * @return the count of IDs */
+long idset_count(idset set);
+
+/** Returns the memory the IDs of the set take
+ * @param set the set
+ * @return the size in bytes */
+long idset_size(idset set);
+
+/** Looks an ID up
+ * @param set the set
+ * @param id the ID
+ * @return true if the ID is in the set */
+int idset_contains(idset set, unsigned long id);
+
+/** Returns the IDs of a set that aren't in another one. Each pair of
+ * containers is compared at once: the bitmaps a word at a time, the arrays
+ * by merging them, or by looking the few up in the many.
+ * @param a the set the IDs are taken from
+ * @param b the set of the IDs left out
+ * @return the new set, NULL if out of memory */
+idset idset_difference(idset a, idset b);
+
+/** Calls fn for every ID of the set in ascending order, until fn returns
+ * non-zero
+ * @param set the set
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @return the non-zero value fn returned, 0 if it never did */
+int idset_each(idset set, idset_fn fn, void *arg);
+
+/** Saves the set into a file: the arrays delta encoded, the bitmaps as they
+ * are
+ * @param set the set
+ * @param file the name of the file
+ * @retval 0 if succeeded
+ * @retval -1 if the file couldn't be written */
+int idset_write(idset set, char *file);
+
+/** Loads a set saved by idset_write(), checking that it is well formed
+ * @param file the name of the file
+ * @return the set, NULL if the file is missing, malformed or out of
+ * memory */
+idset idset_read(char *file);
+
+#endif
@@ -0,0 +1,661 @@
+#define MEM_AREA MEM_HTTP
+#include "inflate.h"
+
+/** @file
+ * A streaming decompressor for the deflate format, based on the structure
+ * of Mark Adler's puff.c, extended with a sliding window, table driven
+ * decoding of the short codes and the checks of the zlib and gzip wrappers.
+ */
+
+/** The maximal length of a Huffman code */
+#define MAXBITS 15
+/** The count of literal/length symbols */
+#define MAXLCODES 286
+/** The count of distance symbols */
+#define MAXDCODES 30
+/** The count of symbols in the fixed literal/length code */
+#define FIXLCODES 288
+/** Codes at most this long are decoded with one table lookup */
+#define FAST_BITS 9
+
+/** The size of the sliding window, the maximal distance of a match */
+#define WSIZE 32768
+/** The size of the input buffer */
+#define INBUFSIZE 4096
+
+/** A canonical Huffman code */
+struct _huffman {
+
+	/** The count of symbols for each code length */
+	short count[MAXBITS + 1];
+
+	/** The symbols ordered by their code */
+	short symbol[FIXLCODES];
+
+	/** The symbol and the length (len << 9 | symbol) of the codes at most
+	 * FAST_BITS long, indexed by the next FAST_BITS bits of the input.
+	 * 0 if the code is longer. */
+	unsigned short fast[1 << FAST_BITS];
+};
+
+/** The state of a decompression */
+struct _inflate {
+
+	/** The input function and its argument */
+	inflate_read_fn read;
+	void *rarg;
+
+	/** The output function and its argument */
+	inflate_write_fn write;
+	void *warg;
+
+	/** The input buffer */
+	unsigned char in[INBUFSIZE];
+	int inpos;
+	int inlen;
+
+	/** The bits read but not consumed yet, LSB first */
+	unsigned long bitbuf;
+	int bitcnt;
+
+	/** The last WSIZE bytes of output */
+	unsigned char win[WSIZE];
+	unsigned int wpos;
+
+	/** True if the window has been filled at least once */
+	int wrapped;
+
+	/** The running checksums and length of the output */
+	unsigned long crc;
+	unsigned long adler;
+	unsigned long total;
+
+	/** The first error that occurred, 0 if none */
+	int err;
+};
+
+/** The lookup table of the CRC-32, filled by _crc_init() */
+static unsigned long crc_table[256];
+
+/** The fixed codes, built on first use */
+static struct _huffman fixed_lencode;
+static struct _huffman fixed_distcode;
+static int fixed_built = 0;
+
+/** Base lengths and extra bits of the length symbols 257..285 */
+static const short length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const short length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/** Base distances and extra bits of the distance symbols 0..29 */
+static const short dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+static const short dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/** Fills the CRC-32 lookup table */
+static void _crc_init(void);
+
+/** Tops the bit buffer up to at least need bits if the input allows
+ * @param s the state
+ * @param need the count of bits wanted (max 24) */
+static void _fill(struct _inflate *s, int need);
+
+/** Consumes need bits of input
+ * @param s the state
+ * @param need the count of bits (max 16)
+ * @return the bits, 0 with s->err set if the input ended */
+static int _bits(struct _inflate *s, int need);
+
+/** Appends a byte to the output, flushing the window if it got full */
+static void _put(struct _inflate *s, unsigned char byte);
+
+/** Passes the bytes written since the last flush to the output function
+ * and updates the checksums */
+static void _flush(struct _inflate *s);
+
+/** Builds a canonical Huffman code from the code lengths
+ * @param h the code to build
+ * @param length the code lengths of the symbols
+ * @param n the count of symbols
+ * @retval 0 if the code is complete
+ * @retval positive if the code is incomplete
+ * @retval negative if the code is over-subscribed */
+static int _construct(struct _huffman *h, const short *length, int n);
+
+/** Decodes a symbol of the code
+ * @return the symbol, negative with s->err set if failed */
+static int _decode(struct _inflate *s, const struct _huffman *h);
+
+/** Decompresses a stored block */
+static void _stored(struct _inflate *s);
+
+/** Decompresses the literals and matches of a compressed block */
+static void _codes(struct _inflate *s, const struct _huffman *lencode,
+		   const struct _huffman *distcode);
+
+/** Reads the code lengths of a dynamic block, and decompresses it */
+static void _dynamic(struct _inflate *s);
+
+/** Skips the gzip header */
+static void _gzip_header(struct _inflate *s);
+
+int inflate_stream(inflate_format format, inflate_read_fn in, void *inarg,
+		   inflate_write_fn out, void *outarg)
+{
+	struct _inflate *s;
+	unsigned long check;
+	int last;
+	int ret;
+
+	s = malloc(sizeof(*s));
+	if (s == NULL)
+		return INFLATE_ERR_NOMEM;
+
+	s->read = in;
+	s->rarg = inarg;
+	s->write = out;
+	s->warg = outarg;
+	s->inpos = s->inlen = 0;
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+	s->wpos = 0;
+	s->wrapped = 0;
+	s->crc = 0xffffffffUL;
+	s->adler = 1;
+	s->total = 0;
+	s->err = 0;
+
+	_crc_init();
+
+	/*
+	 * "deflate" is supposed to be zlib, but raw deflate is common too. A
+	 * zlib header is a multiple of 31 and says method 8, a raw block
+	 * header practically never is both.
+	 */
+	if (format == INFLATE_DEFLATE) {
+		_fill(s, 16);
+		format = (s->bitbuf & 0x0f) == 8 &&
+		    ((s->bitbuf & 0xff) << 8 | (s->bitbuf >> 8 & 0xff)) % 31 == 0 ?
+		    INFLATE_ZLIB : INFLATE_RAW;
+	}
+
+	if (format == INFLATE_GZIP) {
+		_gzip_header(s);
+	}
+	else if (format == INFLATE_ZLIB) {
+		if ((_bits(s, 8) & 0x0f) != 8 || (_bits(s, 8) & 0x20) != 0)
+			s->err = INFLATE_ERR_DATA;	/* not deflate, or dictionary */
+	}
+
+	do {
+		last = _bits(s, 1);
+		switch (_bits(s, 2)) {
+		case 0:
+			_stored(s);
+			break;
+		case 1:
+			if (!fixed_built) {
+				short lengths[FIXLCODES];
+				int i;
+
+				for (i = 0; i < 144; i++)
+					lengths[i] = 8;
+				for (; i < 256; i++)
+					lengths[i] = 9;
+				for (; i < 280; i++)
+					lengths[i] = 7;
+				for (; i < FIXLCODES; i++)
+					lengths[i] = 8;
+				_construct(&fixed_lencode, lengths, FIXLCODES);
+
+				for (i = 0; i < MAXDCODES; i++)
+					lengths[i] = 5;
+				_construct(&fixed_distcode, lengths, MAXDCODES);
+				fixed_built = 1;
+			}
+			_codes(s, &fixed_lencode, &fixed_distcode);
+			break;
+		case 2:
+			_dynamic(s);
+			break;
+		default:
+			if (!s->err)
+				s->err = INFLATE_ERR_DATA;
+		}
+	} while (!last && !s->err);
+
+	_flush(s);
+
+	/* the trailers are byte aligned */
+	s->bitbuf >>= s->bitcnt & 7;
+	s->bitcnt &= ~7;
+
+	if (!s->err && format == INFLATE_GZIP) {
+		check = _bits(s, 16);
+		check |= (unsigned long) _bits(s, 16) << 16;
+		if (!s->err && check != (s->crc ^ 0xffffffffUL))
+			s->err = INFLATE_ERR_CHECK;
+
+		check = _bits(s, 16);
+		check |= (unsigned long) _bits(s, 16) << 16;
+		if (!s->err && check != (s->total & 0xffffffffUL))
+			s->err = INFLATE_ERR_CHECK;
+	}
+	else if (!s->err && format == INFLATE_ZLIB) {
+		check = (unsigned long) _bits(s, 8) << 24;
+		check |= (unsigned long) _bits(s, 8) << 16;
+		check |= (unsigned long) _bits(s, 8) << 8;
+		check |= _bits(s, 8);
+		if (!s->err && check != s->adler)
+			s->err = INFLATE_ERR_CHECK;
+	}
+
+	ret = s->err;
+	free(s);
+	return ret;
+}
+
+unsigned long inflate_crc32(unsigned long crc, unsigned char *buf, long len)
+{
+	long i;
+
+	_crc_init();
+	crc ^= 0xffffffffUL;
+	for (i = 0; i < len; i++)
+		crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffffUL;
+}
+
+/* ************************************
+ * static functions
+ */
+static void _crc_init(void)
+{
+	unsigned long c;
+	int n,
+	 k;
+
+	if (crc_table[1] != 0)
+		return;
+
+	for (n = 0; n < 256; n++) {
+		c = (unsigned long) n;
+		for (k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+		crc_table[n] = c;
+	}
+}
+
+static void _fill(struct _inflate *s, int need)
+{
+	while (s->bitcnt < need) {
+		if (s->inpos == s->inlen) {
+			s->inlen = s->read(s->rarg, s->in, INBUFSIZE);
+			s->inpos = 0;
+			if (s->inlen <= 0) {
+				s->inlen = 0;
+				return;
+			}
+		}
+
+		s->bitbuf |= (unsigned long) s->in[s->inpos++] << s->bitcnt;
+		s->bitcnt += 8;
+	}
+}
+
+static int _bits(struct _inflate *s, int need)
+{
+	int val;
+
+	_fill(s, need);
+	if (s->bitcnt < need) {
+		if (!s->err)
+			s->err = INFLATE_ERR_INPUT;
+		return 0;
+	}
+
+	val = (int) (s->bitbuf & ((1UL << need) - 1));
+	s->bitbuf >>= need;
+	s->bitcnt -= need;
+	return val;
+}
+
+static void _put(struct _inflate *s, unsigned char byte)
+{
+	s->win[s->wpos++] = byte;
+	if (s->wpos == WSIZE) {
+		_flush(s);
+		s->wpos = 0;
+		s->wrapped = 1;
+	}
+}
+
+static void _flush(struct _inflate *s)
+{
+	/* the window is flushed whenever it gets full, so the unflushed part
+	 * always starts at the beginning of it */
+	unsigned char *ptr = s->win;
+	unsigned long a = s->adler & 0xffff;
+	unsigned long b = s->adler >> 16;
+	unsigned long c = s->crc;
+	unsigned int len = s->wpos;
+	unsigned int i;
+
+	if (len == 0 || s->err)
+		return;
+
+	for (i = 0; i < len; i++) {
+		c = crc_table[(c ^ ptr[i]) & 0xff] ^ (c >> 8);
+		a += ptr[i];
+		b += a;
+		if ((i & 4095) == 4095) {	/* 4096 * 255 * 4096 fits 32 bits */
+			a %= 65521;
+			b %= 65521;
+		}
+	}
+	s->adler = (b % 65521) << 16 | (a % 65521);
+	s->crc = c;
+	s->total += len;
+
+	if (s->write(s->warg, ptr, (int) len) < 0)
+		s->err = INFLATE_ERR_OUTPUT;
+}
+
+static int _construct(struct _huffman *h, const short *length, int n)
+{
+	short offs[MAXBITS + 1];
+	int symbol;
+	int len;
+	int left;
+	int code;
+	int index;
+	int i;
+	int rev;
+
+	for (len = 0; len <= MAXBITS; len++)
+		h->count[len] = 0;
+	for (symbol = 0; symbol < n; symbol++)
+		h->count[length[symbol]]++;
+	memset(h->fast, 0, sizeof(h->fast));
+
+	if (h->count[0] == n)	/* no codes, complete but useless */
+		return 0;
+
+	left = 1;
+	for (len = 1; len <= MAXBITS; len++) {
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return left;	/* over-subscribed */
+	}
+
+	offs[1] = 0;
+	for (len = 1; len < MAXBITS; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (symbol = 0; symbol < n; symbol++)
+		if (length[symbol] != 0)
+			h->symbol[offs[length[symbol]]++] = symbol;
+
+	/*
+	 * the codes are assigned in canonical order, but the stream holds
+	 * them MSB first, so the table is indexed by the reversed code
+	 */
+	code = 0;
+	index = 0;
+	for (len = 1; len <= FAST_BITS; len++) {
+		for (i = 0; i < h->count[len]; i++, code++, index++) {
+			for (rev = 0, symbol = 0; symbol < len; symbol++)
+				rev |= (code >> symbol & 1) << (len - 1 - symbol);
+			for (; rev < (1 << FAST_BITS); rev += 1 << len)
+				h->fast[rev] =
+				    (unsigned short) (len << 9 | h->symbol[index]);
+		}
+		code <<= 1;
+	}
+
+	return left;
+}
+
+static int _decode(struct _inflate *s, const struct _huffman *h)
+{
+	int entry;
+	int code;
+	int first;
+	int count;
+	int index;
+	int len;
+
+	_fill(s, FAST_BITS);	/* may stop short at the end of the input */
+	entry = h->fast[s->bitbuf & ((1 << FAST_BITS) - 1)];
+	if (entry != 0 && (entry >> 9) <= s->bitcnt) {
+		s->bitbuf >>= entry >> 9;
+		s->bitcnt -= entry >> 9;
+		return entry & 0x1ff;
+	}
+
+	/* a long code, decode it bit by bit */
+	code = first = index = 0;
+	for (len = 1; len <= MAXBITS; len++) {
+		code |= _bits(s, 1);
+		if (s->err)
+			return -1;
+
+		count = h->count[len];
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+
+	s->err = INFLATE_ERR_DATA;	/* ran out of codes */
+	return -1;
+}
+
+static void _stored(struct _inflate *s)
+{
+	unsigned int len;
+
+	s->bitbuf >>= s->bitcnt & 7;	/* discard the rest of the byte */
+	s->bitcnt &= ~7;
+
+	len = _bits(s, 16);
+	if ((_bits(s, 16) ^ 0xffff) != len) {
+		if (!s->err)
+			s->err = INFLATE_ERR_DATA;
+		return;
+	}
+
+	while (len-- > 0 && !s->err)
+		_put(s, (unsigned char) _bits(s, 8));
+}
+
+static void _codes(struct _inflate *s, const struct _huffman *lencode,
+		   const struct _huffman *distcode)
+{
+	int symbol;
+	int len;
+	unsigned int dist;
+	unsigned int from;
+
+	for (;;) {
+		symbol = _decode(s, lencode);
+		if (symbol < 0)
+			return;
+
+		if (symbol < 256) {	/* literal */
+			_put(s, (unsigned char) symbol);
+			continue;
+		}
+		if (symbol == 256)	/* end of block */
+			return;
+
+		symbol -= 257;
+		if (symbol >= 29) {
+			s->err = INFLATE_ERR_DATA;
+			return;
+		}
+		len = length_base[symbol] + _bits(s, length_extra[symbol]);
+
+		symbol = _decode(s, distcode);
+		if (symbol < 0)
+			return;
+		if (symbol >= 30) {
+			s->err = INFLATE_ERR_DATA;
+			return;
+		}
+		dist = dist_base[symbol] + _bits(s, dist_extra[symbol]);
+		if (s->err)
+			return;
+		if (!s->wrapped && dist > s->wpos) {
+			s->err = INFLATE_ERR_DATA;	/* before the start */
+			return;
+		}
+
+		/* the copy may overlap itself, so go byte by byte */
+		from = (s->wpos - dist) & (WSIZE - 1);
+		while (len-- > 0) {
+			_put(s, s->win[from]);
+			from = (from + 1) & (WSIZE - 1);
+		}
+	}
+}
+
+static void _dynamic(struct _inflate *s)
+{
+	static const short order[19] = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+	};
+	short lengths[MAXLCODES + MAXDCODES];
+	struct _huffman lencode;
+	struct _huffman distcode;
+	int nlen;
+	int ndist;
+	int ncode;
+	int index;
+	int symbol;
+	int len;
+	int err;
+
+	nlen = _bits(s, 5) + 257;
+	ndist = _bits(s, 5) + 1;
+	ncode = _bits(s, 4) + 4;
+	if (nlen > MAXLCODES || ndist > MAXDCODES) {
+		s->err = INFLATE_ERR_DATA;
+		return;
+	}
+
+	/* the lengths of the code length code */
+	for (index = 0; index < ncode; index++)
+		lengths[order[index]] = (short) _bits(s, 3);
+	for (; index < 19; index++)
+		lengths[order[index]] = 0;
+	if (s->err || _construct(&lencode, lengths, 19) != 0) {
+		if (!s->err)
+			s->err = INFLATE_ERR_DATA;	/* must be complete */
+		return;
+	}
+
+	/* the literal/length and distance code lengths */
+	for (index = 0; index < nlen + ndist;) {
+		symbol = _decode(s, &lencode);
+		if (symbol < 0)
+			return;
+
+		if (symbol < 16) {
+			lengths[index++] = (short) symbol;
+			continue;
+		}
+
+		len = 0;	/* the length to repeat */
+		if (symbol == 16) {
+			if (index == 0) {
+				s->err = INFLATE_ERR_DATA;
+				return;
+			}
+			len = lengths[index - 1];
+			symbol = 3 + _bits(s, 2);
+		}
+		else if (symbol == 17) {
+			symbol = 3 + _bits(s, 3);
+		}
+		else {
+			symbol = 11 + _bits(s, 7);
+		}
+
+		if (index + symbol > nlen + ndist) {
+			s->err = INFLATE_ERR_DATA;
+			return;
+		}
+		while (symbol-- > 0)
+			lengths[index++] = (short) len;
+	}
+	if (s->err)
+		return;
+
+	if (lengths[256] == 0) {	/* no end of block code */
+		s->err = INFLATE_ERR_DATA;
+		return;
+	}
+
+	/* incomplete codes are only allowed if there's a single length */
+	err = _construct(&lencode, lengths, nlen);
+	if (err < 0 || (err > 0 && nlen - lencode.count[0] != 1)) {
+		s->err = INFLATE_ERR_DATA;
+		return;
+	}
+	err = _construct(&distcode, lengths + nlen, ndist);
+	if (err < 0 || (err > 0 && ndist - distcode.count[0] != 1)) {
+		s->err = INFLATE_ERR_DATA;
+		return;
+	}
+
+	_codes(s, &lencode, &distcode);
+}
+
+/** The flags of the gzip header */
+#define GZ_FHCRC 0x02
+#define GZ_FEXTRA 0x04
+#define GZ_FNAME 0x08
+#define GZ_FCOMMENT 0x10
+
+static void _gzip_header(struct _inflate *s)
+{
+	int flags;
+	int len;
+
+	if (_bits(s, 8) != 0x1f || _bits(s, 8) != 0x8b || _bits(s, 8) != 8) {
+		if (!s->err)
+			s->err = INFLATE_ERR_DATA;
+		return;
+	}
+
+	flags = _bits(s, 8);
+	_bits(s, 16);		/* mtime */
+	_bits(s, 16);
+	_bits(s, 16);		/* extra flags, operating system */
+
+	if (flags & GZ_FEXTRA) {
+		len = _bits(s, 16);
+		while (len-- > 0 && !s->err)
+			_bits(s, 8);
+	}
+	if (flags & GZ_FNAME)
+		while (_bits(s, 8) != 0 && !s->err) ;
+	if (flags & GZ_FCOMMENT)
+		while (_bits(s, 8) != 0 && !s->err) ;
+	if (flags & GZ_FHCRC)
+		_bits(s, 16);
+}
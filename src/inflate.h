@@ -0,0 +1,67 @@
+#ifndef __INFLATE_H
+#define __INFLATE_H
+#include "main.h"
+
+/** @file */
+
+/** The container formats inflate_stream() understands */
+typedef enum _inflate_format {
+
+	/** Raw deflate stream (RFC 1951) */
+	INFLATE_RAW,
+
+	/** zlib stream (RFC 1950) */
+	INFLATE_ZLIB,
+
+	/** gzip member (RFC 1952), as sent with Content-Encoding: gzip */
+	INFLATE_GZIP,
+
+	/** Either zlib or raw deflate, as sent with Content-Encoding: deflate
+	 * (servers disagree on which one that means) */
+	INFLATE_DEFLATE
+} inflate_format;
+
+/** The error codes returned by inflate_stream() */
+enum inflate_error {
+	INFLATE_ERR_INPUT = -1,
+	INFLATE_ERR_DATA = -2,
+	INFLATE_ERR_CHECK = -3,
+	INFLATE_ERR_OUTPUT = -4,
+	INFLATE_ERR_NOMEM = -5
+};
+
+/** The prototype of the function the compressed data is pulled from
+ * @param arg the argument given to inflate_stream()
+ * @param buf where the data has to be copied
+ * @param len the size of buf
+ * @return the count of bytes read, 0 on EOF, negative on error */
+typedef int (*inflate_read_fn) (void *arg, unsigned char *buf, int len);
+
+/** The prototype of the function the decompressed data is pushed to
+ * @param arg the argument given to inflate_stream()
+ * @param buf the decompressed data, only valid during the call
+ * @param len the count of bytes in buf
+ * @return 0 to continue, negative to abort the decompression */
+typedef int (*inflate_write_fn) (void *arg, unsigned char *buf, int len);
+
+/** Decompresses a stream, pulling the input through in and pushing the
+ * output through out in chunks of at most 32KiB, as soon as they're
+ * decoded. Neither side is ever held in memory as a whole.
+ * @param format the container format of the input
+ * @param in the function to read the compressed data with
+ * @param inarg the argument passed to in
+ * @param out the function to write the decompressed data with
+ * @param outarg the argument passed to out
+ * @retval 0 if succeeded
+ * @retval negative value (enum inflate_error) if failed */
+int inflate_stream(inflate_format format, inflate_read_fn in, void *inarg,
+		   inflate_write_fn out, void *outarg);
+
+/** Updates the CRC-32 gzip checks its members with
+ * @param crc the CRC of the data so far, 0 to start
+ * @param buf the data that follows
+ * @param len the count of bytes in buf
+ * @return the CRC of the data so far and buf */
+unsigned long inflate_crc32(unsigned long crc, unsigned char *buf, long len);
+
+#endif
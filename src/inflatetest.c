@@ -0,0 +1,223 @@
+#include "main.h"
+#include "inflate.h"
+#include <stdio.h>
+
+/** @file
+ * Checks the decompressor against known vectors: gzip, zlib and raw
+ * deflate streams of stored, fixed and dynamic blocks, which have to
+ * decompress to the files they were made from, and truncated streams, bad
+ * checksums and corrupt Huffman codes, which have to fail with the error
+ * expected. The vectors are listed in a file, see inflate/vectors. Each
+ * one is fed to inflate_stream() in pieces of random sizes, as a socket
+ * would. Exits with 1 if any of them fails.
+ *
+ * Usage: inflatetest [-s seed] vectors
+ */
+
+/** The longest line of the list, and of a name in it */
+#define LINE_MAX 512
+/** The most bytes a read hands over */
+#define PIECE_MAX 97
+
+/** A file read whole, and how much of it was read back */
+struct _file {
+	unsigned char *data;
+	long size;
+	long pos;
+};
+
+/** Reads a file whole
+ * @param dir the directory of the file, with its slash, or ""
+ * @param name the name of the file
+ * @param f the file is stored here
+ * @retval 0 if succeeded
+ * @retval -1 if the file couldn't be read */
+static int _load(char *dir, char *name, struct _file *f);
+
+/** Hands over the next piece of a file, see inflate_read_fn */
+static int _read(void *arg, unsigned char *buf, int len);
+
+/** Appends the output to a file, see inflate_write_fn */
+static int _write(void *arg, unsigned char *buf, int len);
+
+/** Checks a vector
+ * @param dir the directory of the files, with its slash, or ""
+ * @param name the compressed file
+ * @param format the format it's read as
+ * @param expected the file its output has to equal, or the error expected
+ * @retval 0 if it passed
+ * @retval -1 if not */
+static int _check(char *dir, char *name, char *format, char *expected);
+
+int main(int argc, char **argv)
+{
+	char line[LINE_MAX];
+	char name[LINE_MAX];
+	char format[LINE_MAX];
+	char expected[LINE_MAX];
+	char dir[LINE_MAX];
+	char *list = NULL;
+	char *slash;
+	FILE *fp;
+	long checked = 0;
+	long failures = 0;
+	int i;
+
+	srand(1);
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			srand(atoi(argv[++i]));
+		else
+			list = argv[i];
+	}
+	if (list == NULL || strlen(list) >= LINE_MAX) {
+		fprintf(stderr, "usage: inflatetest [-s seed] vectors\n");
+		return 1;
+	}
+
+	/* the files are next to the list */
+	strcpy(dir, list);
+	slash = strrchr(dir, '/');
+	if (slash != NULL)
+		slash[1] = 0;
+	else
+		dir[0] = 0;
+
+	fp = fopen(list, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "inflatetest: can't open %s\n", list);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#' || sscanf(line, "%s %s %s", name, format,
+					     expected) != 3)
+			continue;
+		checked++;
+		if (_check(dir, name, format, expected) < 0)
+			failures++;
+	}
+	fclose(fp);
+
+	printf("%ld vectors checked, %ld failed\n", checked, failures);
+	return checked == 0 || failures > 0;
+}
+
+/* ************************************
+ * static functions
+ */
+static int _load(char *dir, char *name, struct _file *f)
+{
+	char path[2 * LINE_MAX];
+	FILE *fp;
+
+	sprintf(path, "%s%s", dir, name);
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return -1;
+
+	fseek(fp, 0, SEEK_END);
+	f->size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	f->pos = 0;
+
+	/* exactly its size, so that a sanitizer catches the reads past it */
+	f->data = malloc(f->size > 0 ? f->size : 1);
+	if (f->data == NULL
+	    || fread(f->data, 1, f->size, fp) != (size_t) f->size) {
+		free(f->data);
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+static int _read(void *arg, unsigned char *buf, int len)
+{
+	struct _file *f = arg;
+	long n = 1 + rand() % PIECE_MAX;
+
+	if (n > len)
+		n = len;
+	if (n > f->size - f->pos)
+		n = f->size - f->pos;
+
+	memcpy(buf, f->data + f->pos, n);
+	f->pos += n;
+	return n;
+}
+
+static int _write(void *arg, unsigned char *buf, int len)
+{
+	struct _file *f = arg;
+	unsigned char *tmp;
+
+	tmp = realloc(f->data, f->size + len + 1);
+	if (tmp == NULL)
+		return -1;
+
+	f->data = tmp;
+	memcpy(f->data + f->size, buf, len);
+	f->size += len;
+	return 0;
+}
+
+static int _check(char *dir, char *name, char *format, char *expected)
+{
+	static const char *errors[] = { "input", "data", "check" };
+	struct _file in;
+	struct _file out;
+	struct _file want;
+	inflate_format fmt;
+	int ret;
+	int err = 0;
+	int i;
+
+	if (!strcmp(format, "raw"))
+		fmt = INFLATE_RAW;
+	else if (!strcmp(format, "zlib"))
+		fmt = INFLATE_ZLIB;
+	else if (!strcmp(format, "gzip"))
+		fmt = INFLATE_GZIP;
+	else if (!strcmp(format, "deflate"))
+		fmt = INFLATE_DEFLATE;
+	else {
+		printf("FAIL: %s: unknown format %s\n", name, format);
+		return -1;
+	}
+
+	/* INFLATE_ERR_INPUT, INFLATE_ERR_DATA and INFLATE_ERR_CHECK */
+	for (i = 0; i < 3; i++)
+		if (!strcmp(expected, errors[i]))
+			err = -1 - i;
+
+	if (_load(dir, name, &in) < 0
+	    || (err == 0 && _load(dir, expected, &want) < 0)) {
+		printf("FAIL: %s: can't read the files\n", name);
+		return -1;
+	}
+
+	out.data = NULL;
+	out.size = 0;
+	ret = inflate_stream(fmt, _read, &in, _write, &out);
+	free(in.data);
+
+	if (err != 0) {
+		free(out.data);
+		if (ret == err)
+			return 0;
+		printf("FAIL: %s: returned %d instead of %d (%s)\n", name,
+		       ret, err, expected);
+		return -1;
+	}
+
+	i = ret == 0 && out.size == want.size
+	    && (want.size == 0 || !memcmp(out.data, want.data, want.size));
+	if (!i)
+		printf("FAIL: %s: returned %d, %ld bytes instead of %ld of %s\n",
+		       name, ret, out.size, want.size, expected);
+	free(out.data);
+	free(want.data);
+	return i ? 0 : -1;
+}
@@ -18,8 +18,67 @@ typedef enum _json_type {
 	JSON_OBJECT = '{'
 } json_type;
 
+/** The errors json_parse_strict() reports */
+enum json_error {
+	JSON_OK = 0,
+	JSON_ERR_EOF = -1,
+	JSON_ERR_SYNTAX = -2,
+	JSON_ERR_STRING = -3,
+	JSON_ERR_NUMBER = -4,
+	JSON_ERR_DEPTH = -5,
+	JSON_ERR_NOMEM = -6,
+	JSON_ERR_TRAILING = -7
+};
+
 typedef struct _json_element *json_element;
 
+/** A compiled path, see json_path_compile() */
+typedef struct _json_path *json_path;
+
+/** A set of paths a parse is restricted to, see json_parse_projected() */
+typedef struct _json_projection *json_projection;
+
+/** A value found by json_parse_fields() */
+typedef struct _json_field *json_field;
+
+/** The prototype of the function json_path_each() calls for the matches
+ * @param elem the element matched
+ * @param arg the argument given to json_path_each()
+ * @return 0 to go on, anything else to stop */
+typedef int (*json_path_fn) (json_element elem, void *arg);
+
+/** A value json_parse_fields() found at the end of a path */
+struct _json_field {
+
+	/** The index of the path, in the order given to
+	 * json_projection_compile() */
+	int path;
+
+	/** The index of the element of the outermost array the value is in,
+	 * the root or the first one on its path, -1 if there's none */
+	long record;
+
+	/** The type of the value */
+	json_type type;
+
+	/** The unescaped string, the text of a number or literal, or the raw
+	 * text of an array or object. Not terminated, and only valid during
+	 * the call. */
+	char *str;
+
+	/** The length of str */
+	long len;
+
+	/** The value of a number, 0 otherwise */
+	double num;
+};
+
+/** The prototype of the function json_parse_fields() calls for the values
+ * @param field the value found
+ * @param arg the argument given to json_parse_fields()
+ * @return 0 to go on, a negative value to stop the parse with */
+typedef int (*json_field_fn) (json_field field, void *arg);
+
 /** A node of a linked list */
 struct _json_element {
 
@@ -29,6 +88,9 @@ struct _json_element {
 	/** The name (or key) of the element. May be NULL if empty */
 	char *name;
 
+	/** The json_hash() of the name, 0 if not known */
+	unsigned long hash;
+
 	/** The data. It may be double, char *, NULL, json_element */
 	void *data;
 
@@ -70,19 +132,156 @@ json_element json_create_string(char *key, char *value);
 json_element json_create_numeric(char *key, double value);
 
 /** Returns the element with the given name or NULL if not found among the elements of the JSON_OBJECT
- * @param obj the object in which to search
+ * @param obj the object in which to search, may be NULL
  * @param name the name to look for
  * @return the json_element, or NULL if not found */
 json_element json_get_element_by_name(json_element obj, char *name);
 
+/** Returns the hash of a name, as stored in the hash field of the elements
+ * @param name the name
+ * @return the hash, never 0 */
+unsigned long json_hash(char *name);
+
+/** Compiles a path (a JSON pointer, RFC 6901) into a sequence of steps
+ * whose names are hashed already, so that it can be evaluated against any
+ * number of trees cheaply.
+ *
+ * Eg. "/user/screen_name" or "/0/text". A step of "*" matches every member
+ * of an array or object, so a "*" step followed by "/user/screen_name"
+ * reaches every screen name of a timeline. "" is the element itself, ~0 and
+ * ~1 stand for ~ and / in names.
+ * @param path the path
+ * @return the compiled path, NULL if the path is malformed */
+json_path json_path_compile(char *path);
+
+/** Frees a compiled path
+ * @param path the path to free, may be NULL */
+void json_path_free(json_path path);
+
+/** Returns the first element the path leads to from elem
+ * @param elem the element the path starts from, may be NULL
+ * @param path the compiled path, NULL (a failed compile) matches nothing
+ * @return the element, NULL if not found */
+json_element json_path_get(json_element elem, json_path path);
+
+/** Returns the string the path leads to from elem
+ * @param elem the element the path starts from, may be NULL
+ * @param path the compiled path
+ * @return the string, NULL if not found or not a JSON_STRING */
+char *json_path_string(json_element elem, json_path path);
+
+/** Looks up the number the path leads to from elem
+ * @param elem the element the path starts from, may be NULL
+ * @param path the compiled path
+ * @param num the number is stored here if found
+ * @return 0 if found, -1 if not found or not a JSON_NUM */
+int json_path_number(json_element elem, json_path path, double *num);
+
+/** Calls fn for every element the path leads to from elem, in document
+ * order, until fn returns non-zero
+ * @param elem the element the path starts from, may be NULL
+ * @param path the compiled path
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @return the non-zero value fn returned, 0 if it never did */
+int json_path_each(json_element elem, json_path path, json_path_fn fn,
+		   void *arg);
+
+/** Compiles a set of paths (see json_path_compile()) into a projection: a
+ * tree of the steps, in which a path that ends keeps the whole value
+ * there. Paths that overlap are merged, a wildcard and a name at the same
+ * level aren't: the one compiled first takes the members it matches.
+ * @param paths the paths
+ * @param count the count of paths
+ * @return the projection, NULL if a path is malformed */
+json_projection json_projection_compile(char **paths, int count);
+
+/** Frees a projection
+ * @param proj the projection to free, may be NULL */
+void json_projection_free(json_projection proj);
+
+/** Returns the part of the projection that applies to a member, used by
+ * json_parse_projected()
+ * @param proj the projection of the container
+ * @param name the key of the member of an object, need not be terminated,
+ * NULL for the element of an array
+ * @param len the length of the key
+ * @param index the index of the element of an array
+ * @return the projection of the member, NULL if it isn't needed */
+json_projection json_projection_child(json_projection proj, char *name,
+				      long len, long index);
+
+/** Tells whether a path ends at this point of the projection
+ * @param proj the projection, may be NULL
+ * @return true if the whole value is needed, which a NULL projection does */
+int json_projection_whole(json_projection proj);
+
+/** Tells which path ends at this point of the projection
+ * @param proj the projection, may be NULL
+ * @return the index of the path (the first, if several end here), -1 if
+ * none does, 0 for a NULL projection */
+int json_projection_path(json_projection proj);
+
 /** Parses a json string and returns with the parse tree.
  *
- * IT DOESN'T DO VALIDATION!!
+ * IT DOESN'T DO VALIDATION!! The arrays found in the string are parsed into
+ * a chain, whatever is around them is ignored, and if the input is
+ * malformed, the tree built so far is returned. Use json_parse_strict() for
+ * untrusted input.
  * @param str the string to parse
  * @return the root element of the parse tree generated
  */
 json_element json_parse(char *str);
 
+/** Parses exactly one JSON value from the buffer, which needn't be
+ * terminated, and fails on anything that isn't valid JSON
+ * @param str the buffer to parse
+ * @param len the length of the buffer
+ * @param error the json_error is stored here if not NULL, JSON_OK if
+ * succeeded
+ * @param errpos the offset of the error in str is stored here if not NULL,
+ * -1 if succeeded
+ * @return the element holding the value, NULL if failed
+ */
+json_element json_parse_strict(char *str, long len, int *error, long *errpos);
+
+/** Parses like json_parse_strict(), but only materializes the values the
+ * projection leads to: everything else is skipped over without
+ * allocating, checking only that its brackets and strings are well formed.
+ * Arrays keep the elements matched in their order, objects the members
+ * matched.
+ * @param str the buffer to parse
+ * @param len the length of the buffer
+ * @param proj the projection, NULL (a failed json_projection_compile()) to
+ * keep everything
+ * @param error the json_error is stored here if not NULL
+ * @param errpos the offset of the error in str is stored here if not NULL,
+ * -1 if succeeded
+ * @return the element holding the value, NULL if failed
+ */
+json_element json_parse_projected(char *str, long len, json_projection proj,
+				  int *error, long *errpos);
+
+/** Parses like json_parse_projected(), but builds no tree: fn is called
+ * with every value a path of the projection ends at, in the order of the
+ * input. Everything else is skipped, and so are the scalars where the
+ * projection expects a container.
+ * @param str the buffer to parse
+ * @param len the length of the buffer
+ * @param proj the projection, NULL to report the whole value as path 0
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @param errpos the offset of the error in str is stored here if not NULL,
+ * -1 if succeeded
+ * @return JSON_OK, a json_error, or the negative value fn stopped with */
+int json_parse_fields(char *str, long len, json_projection proj,
+		      json_field_fn fn, void *arg, long *errpos);
+
+/** Returns the description of an error code
+ * @param code a value of enum json_error
+ * @return a static string */
+char *json_strerror(int code);
+
 /** Formats the json_element into a JSON string
  * @param elem the json_element to process
  * @return a string allocated on the heap
@@ -0,0 +1,167 @@
+#include "main.h"
+#include "json.h"
+#include "status.h"
+#include <stdio.h>
+
+/** @file
+ * The fuzzing harness of the JSON reader. Built with
+ * -DJSON_FUZZ_LIBFUZZER it is a libFuzzer target, otherwise it runs the
+ * same checks over the files given (or stdin), which is what AFL and the
+ * corpus replay need:
+ *
+ * afl-fuzz -i ../fuzz/json -o findings -- ./json_fuzz @@
+ *
+ * The input is copied to a buffer of its exact size, so that a sanitizer
+ * catches the reads past its end.
+ */
+
+/** The size of the buffer stdin is read with */
+#define BUFSIZE 4096
+
+/** The projection the projected parse is checked with, see _projection() */
+static json_projection projection = NULL;
+
+/** Returns the projection of the fields of the statuses, compiled on the
+ * first call */
+static json_projection _projection(void);
+
+/** Parses the input in every mode, and aborts if the results contradict
+ * each other
+ * @param data the input
+ * @param size the size of the input
+ * @return 0 */
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	json_element tree;
+	status_page page;
+	char *buf;
+	long errpos;
+	int error;
+	int perror;
+
+	/* the strict mode gets exactly the bytes, without a terminator */
+	buf = malloc(size > 0 ? size : 1);
+	if (buf == NULL)
+		return 0;
+	memcpy(buf, data, size);
+
+	tree = json_parse_strict(buf, (long) size, &error, &errpos);
+	if ((tree == NULL) != (error != JSON_OK)
+	    || (error == JSON_OK ? errpos != -1 : errpos < 0
+		|| errpos > (long) size))
+		abort();
+
+	/* so does the status decoder, which takes the arrays only */
+	page = status_decode(buf, (long) size, &perror, &errpos);
+	if ((page == NULL) != (perror != JSON_OK)
+	    || (tree != NULL && tree->type == JSON_ARRAY && page == NULL))
+		abort();
+	status_free(page);
+	json_free(tree);
+
+	/* the projected one skips over most of the input, checking less: it
+	 * may accept more, but never reject what the strict one accepts */
+	tree = json_parse_projected(buf, (long) size, _projection(), &perror,
+				    &errpos);
+	if ((tree == NULL) != (perror != JSON_OK)
+	    || (error == JSON_OK && perror != JSON_OK))
+		abort();
+	json_free(tree);
+	free(buf);
+
+	/* the lenient one a terminated string */
+	buf = malloc(size + 1);
+	if (buf == NULL)
+		return 0;
+	memcpy(buf, data, size);
+	buf[size] = 0;
+
+	json_free(json_parse(buf));
+	free(buf);
+
+	return 0;
+}
+
+static json_projection _projection(void)
+{
+	static char *fields[] = { "/*/user/screen_name", "/*/text",
+		"/*/created_at", "/*/entities/urls/0/url"
+	};
+
+	if (projection == NULL)
+		projection = json_projection_compile(fields, sizeof(fields) /
+						     sizeof(*fields));
+	return projection;
+}
+
+#ifndef JSON_FUZZ_LIBFUZZER
+/** Reads the stream to the end
+ * @param fp the stream
+ * @param size the size of the content is stored here
+ * @return the allocated content, NULL if failed */
+static unsigned char *_read_all(FILE * fp, size_t * size);
+
+/** Usage: json_fuzz [file...]
+ *
+ * Runs the harness over every file, and tells whether the file is valid
+ * JSON, and if not, why. */
+int main(int argc, char **argv)
+{
+	unsigned char *data;
+	size_t size;
+	long errpos;
+	int error;
+	FILE *fp;
+	int i;
+
+	for (i = 1; i < argc || i == 1; i++) {
+		fp = i < argc ? fopen(argv[i], "rb") : stdin;
+		if (fp == NULL) {
+			fprintf(stderr, "ERROR: cannot open %s\n", argv[i]);
+			return 1;
+		}
+		data = _read_all(fp, &size);
+		if (fp != stdin)
+			fclose(fp);
+		if (data == NULL)
+			return 1;
+
+		LLVMFuzzerTestOneInput(data, size);
+
+		json_free(json_parse_strict((char *) data, (long) size, &error,
+					    &errpos));
+		if (error == JSON_OK)
+			printf("%s: valid\n", i < argc ? argv[i] : "-");
+		else
+			printf("%s: %s at %ld\n", i < argc ? argv[i] : "-",
+			       json_strerror(error), errpos);
+
+		free(data);
+	}
+
+	return 0;
+}
+
+static unsigned char *_read_all(FILE * fp, size_t * size)
+{
+	unsigned char *data = NULL;
+	unsigned char *tmp;
+	size_t len;
+
+	*size = 0;
+	do {
+		tmp = realloc(data, *size + BUFSIZE);
+		if (tmp == NULL) {
+			free(data);
+			return NULL;
+		}
+		data = tmp;
+		len = fread(data + *size, 1, BUFSIZE, fp);
+		*size += len;
+	} while (len == BUFSIZE);
+
+	return data;
+}
+#endif
@@ -0,0 +1,425 @@
+#define MEM_AREA MEM_JSON
+#include "json.h"
+
+/** @file */
+
+/** The index of a step that matches by name only */
+#define STEP_NAME -1
+/** The index of a step that matches every member */
+#define STEP_ANY -2
+
+/** A step of a path: one level down the tree */
+struct _json_step {
+
+	/** The unescaped name to match in objects, NULL for a wildcard */
+	char *name;
+
+	/** The json_hash() of the name */
+	unsigned long hash;
+
+	/** The index to match in arrays if the name is a number, STEP_NAME or
+	 * STEP_ANY otherwise */
+	long index;
+};
+
+/** A compiled path */
+struct _json_path {
+
+	/** The steps, from the root down */
+	struct _json_step *steps;
+
+	/** The count of steps */
+	int count;
+
+	/** True if a step is a wildcard, so the path may lead to several
+	 * elements */
+	int wildcard;
+};
+
+/** A node of a projection: the members matched by its step, and what is
+ * needed of them */
+struct _json_projection {
+
+	/** The step that leads here from the parent, unused at the root */
+	struct _json_step step;
+
+	/** The length of the name of the step */
+	long len;
+
+	/** The index of the path that ends here, so the whole value is
+	 * kept, -1 if none does */
+	int path;
+
+	/** The first child */
+	struct _json_projection *children;
+
+	/** The next sibling */
+	struct _json_projection *next;
+};
+
+/** Returns true if the member (the index-th child of a container of the
+ * given type) is matched by the step
+ * @param step the step
+ * @param member the member
+ * @param index the position of the member in the container
+ * @param type the type of the container
+ * @return true if matched */
+static int _step_matches(struct _json_step *step, json_element member,
+			 long index, json_type type);
+
+/** Calls fn for the elements the remaining steps lead to
+ * @param elem the element the steps start from
+ * @param step the first step
+ * @param left the count of steps left
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @return the non-zero value fn returned, 0 if it never did */
+static int _json_path_walk(json_element elem, struct _json_step *step,
+			   int left, json_path_fn fn, void *arg);
+
+/** Follows the steps of a path without wildcards from the given one on
+ * @param elem the element the steps start from
+ * @param path the path
+ * @param first the index of the first step to take
+ * @return the element reached, NULL if not found */
+static json_element _json_path_follow(json_element elem, json_path path,
+				      int first);
+
+/** Finds the child of the projection node for the step, or adds one
+ * @param node the node
+ * @param step the step
+ * @return the child, NULL if out of memory */
+static json_projection _projection_add(json_projection node,
+				       struct _json_step *step);
+
+/** A json_path_fn that stores the element and stops the walk */
+static int _json_path_first(json_element elem, void *arg);
+
+json_path json_path_compile(char *path)
+{
+	json_path ret;
+	struct _json_step *step;
+	char *ptr;
+	char *out;
+	int count = 0;
+
+	if (*path != 0 && *path != '/')
+		return NULL;
+
+	for (ptr = path; *ptr != 0; ptr++)
+		if (*ptr == '/')
+			count++;
+
+	ret = malloc(sizeof(*ret));
+	if (ret == NULL)
+		return NULL;
+	ret->count = 0;
+	ret->wildcard = 0;
+	ret->steps = malloc((count > 0 ? count : 1) * sizeof(*ret->steps));
+	if (ret->steps == NULL) {
+		free(ret);
+		return NULL;
+	}
+
+	for (ptr = path; *ptr == '/';) {
+		step = &ret->steps[ret->count];
+
+		/* the unescaped name is never longer than the raw one */
+		step->name = malloc(strcspn(ptr + 1, "/") + 1);
+		if (step->name == NULL) {
+			json_path_free(ret);
+			return NULL;
+		}
+		ret->count++;	/* json_path_free() frees the names counted */
+
+		for (ptr++, out = step->name; *ptr != 0 && *ptr != '/'; ptr++) {
+			if (*ptr != '~') {
+				*out++ = *ptr;
+				continue;
+			}
+
+			ptr++;
+			if (*ptr != '0' && *ptr != '1') {
+				json_path_free(ret);
+				return NULL;
+			}
+			*out++ = *ptr == '0' ? '~' : '/';
+		}
+		*out = 0;
+
+		step->hash = json_hash(step->name);
+		step->index = STEP_NAME;
+
+		if (!strcmp(step->name, "*")) {
+			free(step->name);
+			step->name = NULL;
+			step->index = STEP_ANY;
+			ret->wildcard = 1;
+		}
+		else if (strspn(step->name, "0123456789") == strlen(step->name)
+			 && *step->name != 0 && strlen(step->name) < 10
+			 && (*step->name != '0' || step->name[1] == 0)) {
+			step->index = atol(step->name);
+		}
+	}
+
+	return ret;
+}
+
+void json_path_free(json_path path)
+{
+	int i;
+
+	if (path == NULL)
+		return;
+
+	for (i = 0; i < path->count; i++)
+		free(path->steps[i].name);
+	free(path->steps);
+	free(path);
+}
+
+json_element json_path_get(json_element elem, json_path path)
+{
+	json_element found = NULL;
+
+	if (path == NULL)
+		return NULL;	/* json_path_compile() failed */
+
+	if (path->wildcard) {
+		_json_path_walk(elem, path->steps, path->count,
+				_json_path_first, &found);
+		return found;
+	}
+
+	return _json_path_follow(elem, path, 0);
+}
+
+char *json_path_string(json_element elem, json_path path)
+{
+	elem = json_path_get(elem, path);
+
+	if (elem == NULL || elem->type != JSON_STRING)
+		return NULL;
+	return elem->data;
+}
+
+int json_path_number(json_element elem, json_path path, double *num)
+{
+	elem = json_path_get(elem, path);
+
+	if (elem == NULL || elem->type != JSON_NUM || elem->data == NULL)
+		return -1;
+
+	*num = *(double *) elem->data;
+	return 0;
+}
+
+int json_path_each(json_element elem, json_path path, json_path_fn fn,
+		   void *arg)
+{
+	if (path == NULL)
+		return 0;
+	return _json_path_walk(elem, path->steps, path->count, fn, arg);
+}
+
+json_projection json_projection_compile(char **paths, int count)
+{
+	json_projection root = calloc(1, sizeof(*root));
+	json_projection node;
+	json_path path;
+	int i;
+	int j;
+
+	if (root == NULL)
+		return NULL;
+	root->path = -1;
+
+	for (i = 0; i < count; i++) {
+		path = json_path_compile(paths[i]);
+		if (path == NULL) {
+			json_projection_free(root);
+			return NULL;
+		}
+
+		for (j = 0, node = root; j < path->count && node != NULL; j++)
+			node = _projection_add(node, &path->steps[j]);
+
+		json_path_free(path);
+		if (node == NULL) {
+			json_projection_free(root);
+			return NULL;
+		}
+		if (node->path < 0)
+			node->path = i;
+	}
+
+	return root;
+}
+
+void json_projection_free(json_projection proj)
+{
+	json_projection next;
+
+	for (; proj != NULL; proj = next) {
+		next = proj->next;
+		json_projection_free(proj->children);
+		free(proj->step.name);
+		free(proj);
+	}
+}
+
+json_projection json_projection_child(json_projection proj, char *name,
+				      long len, long index)
+{
+	json_projection child;
+
+	for (child = proj->children; child != NULL; child = child->next) {
+		if (child->step.index == STEP_ANY)
+			return child;
+		if (name == NULL ? child->step.index == index :
+		    child->len == len && !memcmp(child->step.name, name, len))
+			return child;
+	}
+
+	return NULL;
+}
+
+int json_projection_whole(json_projection proj)
+{
+	return proj == NULL || proj->path >= 0;
+}
+
+int json_projection_path(json_projection proj)
+{
+	return proj == NULL ? 0 : proj->path;
+}
+
+/* ************************************
+ * static functions
+ */
+static json_projection _projection_add(json_projection node,
+				       struct _json_step *step)
+{
+	json_projection child;
+	json_projection last = NULL;
+
+	for (child = node->children; child != NULL; child = child->next) {
+		if (child->step.index == step->index
+		    && (step->name == NULL || !strcmp(child->step.name,
+						      step->name)))
+			return child;
+		last = child;
+	}
+
+	child = calloc(1, sizeof(*child));
+	if (child == NULL)
+		return NULL;
+
+	child->step = *step;
+	child->path = -1;
+	if (step->name != NULL) {
+		child->step.name = mystrdup(step->name);
+		child->len = strlen(step->name);
+	}
+
+	/* the order of the paths is kept, see json_projection_compile() */
+	if (last == NULL)
+		node->children = child;
+	else
+		last->next = child;
+
+	return child;
+}
+
+static json_element _json_path_follow(json_element elem, json_path path,
+				      int first)
+{
+	struct _json_step *step;
+	json_element current;
+	long index;
+	int i;
+
+	/* the tests of _step_matches() are inlined, since this is the loop
+	 * that runs for every member */
+	for (i = first; i < path->count && elem != NULL; i++) {
+		step = &path->steps[i];
+		current = elem->data;
+
+		if (elem->type == JSON_OBJECT) {
+			for (; current != NULL; current = current->next) {
+				if ((current->hash == step->hash
+				     || current->hash == 0)
+				    && current->name != NULL
+				    && !strcmp(current->name, step->name))
+					break;
+			}
+		}
+		else if (elem->type == JSON_ARRAY) {
+			for (index = 0; current != NULL && index < step->index;
+			     index++)
+				current = current->next;
+			if (step->index < 0)
+				current = NULL;
+		}
+		else {
+			return NULL;
+		}
+		elem = current;
+	}
+
+	return elem;
+}
+
+static int _step_matches(struct _json_step *step, json_element member,
+			 long index, json_type type)
+{
+	if (step->index == STEP_ANY)
+		return 1;
+
+	if (type == JSON_ARRAY)
+		return step->index == index;
+
+	/* the hash rules out almost every other member without a strcmp() */
+	if (member->name == NULL
+	    || (member->hash != 0 && member->hash != step->hash))
+		return 0;
+	return !strcmp(member->name, step->name);
+}
+
+static int _json_path_walk(json_element elem, struct _json_step *step,
+			   int left, json_path_fn fn, void *arg)
+{
+	json_element current;
+	long index;
+	int ret;
+
+	if (elem == NULL)
+		return 0;
+	if (left == 0)
+		return fn(elem, arg);
+	if (elem->type != JSON_OBJECT && elem->type != JSON_ARRAY)
+		return 0;
+
+	for (current = elem->data, index = 0; current != NULL;
+	     current = current->next, index++) {
+		if (!_step_matches(step, current, index, elem->type))
+			continue;
+
+		ret = _json_path_walk(current, step + 1, left - 1, fn, arg);
+		if (ret != 0)
+			return ret;
+
+		/* a name or an index matches once */
+		if (step->index != STEP_ANY)
+			break;
+	}
+
+	return 0;
+}
+
+static int _json_path_first(json_element elem, void *arg)
+{
+	*(json_element *) arg = elem;
+	return 1;
+}
@@ -1,59 +1,275 @@
+#define MEM_AREA MEM_JSON
 #include "json.h"
+#include "stats.h"
 #include <stdio.h>
-#include <ctype.h>
 
 /** @file */
 
-/** Parses a JSON_OBJECT type element beginning from *str to the closing bracket
+/** The deepest nesting accepted, so that hostile input can't exhaust the
+ * stack */
+#define JSON_MAX_DEPTH 512
+
+/** Numbers up to this many digits are converted without strtod() */
+#define EXACT_DIGITS 15
+
+/** The size of the buffer a number is copied to for strtod() */
+#define NUM_BUFSIZE 64
+
+/** True if c is a decimal digit (isdigit() depends on the locale and the
+ * sign of char) */
+#define _IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/** The strings are scanned a word at a time: ONES has 1 in every byte, and
+ * _HAS_LESS(w, n) is non-zero if any byte of w is less than n (n <= 128) */
+#define ONES (~0UL / 255)
+#define _HAS_LESS(w, n) (((w) - ONES * (n)) & ~(w) & ONES * 0x80)
+/** Non-zero if any byte of w is c */
+#define _HAS_BYTE(w, c) _HAS_LESS((w) ^ (ONES * (c)), 1)
+/** Non-zero if any byte of w ends a run of plain characters in a string:
+ * a quotation mark, a backslash or a control character */
+#define _HAS_SPECIAL(w) \
+	(_HAS_BYTE(w, '"') | _HAS_BYTE(w, '\\') | _HAS_LESS(w, 0x20))
+
+/** The character substituted for lone surrogates in the lenient mode */
+#define REPLACEMENT_CHAR 0xfffd
+
+/** The state of a parse */
+struct _json_reader {
+
+	/** The next character to read */
+	char *ptr;
+
+	/** One past the last character of the input */
+	char *end;
+
+	/** True if only valid JSON is accepted */
+	int strict;
+
+	/** The current nesting of arrays and objects */
+	int depth;
+
+	/** The first error met, a json_error, 0 if none */
+	int error;
+
+	/** Where the error was met */
+	char *errptr;
+};
+
+/** The state of json_parse_fields() */
+struct _json_scan {
+
+	/** The function to call with the fields */
+	json_field_fn fn;
+
+	/** Passed to fn */
+	void *arg;
+
+	/** The field being reported */
+	struct _json_field field;
+
+	/** The depth of the array field.record counts the elements of, 0
+	 * outside of it */
+	int record_depth;
+
+	/** Where the strings with escapes are unescaped, reused */
+	char *scratch;
+
+	/** The size of scratch */
+	long size;
+};
+
+/** Parses a JSON_OBJECT type element beginning from r->ptr to the closing
+ * bracket
  *
  * The children are in a linked list in the ->data field
- * @param str the pointer where the object starts
- * @return an allocated json_element, type JSON_OBJECT */
-static json_element _json_parse_object(char **str);
+ * @param r the reader, positioned at the opening bracket
+ * @return the chain of children, which may be incomplete if r->error is
+ * set */
+static json_element _json_parse_object(struct _json_reader *r);
 
-/** Parses a JSON_ARRAY type element beginning from *str to the closing bracket
+/** Parses a JSON_ARRAY type element beginning from r->ptr to the closing
+ * bracket
  *
  * The children are in a linked list in the ->data field
- * @param str the pointer where the object starts
- * @return an allocated json_element, type JSON_ARRAY */
-static json_element _json_parse_array(char **str);
+ * @param r the reader, positioned at the opening bracket
+ * @return the chain of children, which may be incomplete if r->error is
+ * set */
+static json_element _json_parse_array(struct _json_reader *r);
 
 /** Parses a key-value pair in an object.
  *
  * The children can be of any type, and are the ->data field
- * @param str the pointer where the object starts
- * @return an allocated json_element of any type */
-static json_element _json_parse_pair(char **str);
+ * @param r the reader, positioned at the quotation mark of the key
+ * @param elem the element to set the name and the value of
+ * @return 0 if succeeded, a json_error otherwise */
+static int _json_parse_pair(struct _json_reader *r, json_element elem);
 
-/** Determines the type of the value given, and sets the ->data field in the json_element accordingly
- * @param str the pointer where the object starts
+/** Determines the type of the value at r->ptr (after whitespace), and sets
+ * the ->type and ->data fields of the json_element accordingly
+ * @param r the reader
  * @param elem the of element to set the value of
- * @return elem */
-static json_element _json_set_value(char **str, json_element elem);
+ * @return 0 if succeeded, a json_error otherwise */
+static int _json_set_value(struct _json_reader *r, json_element elem);
 
-/** Parses the number beginning at *str into a double
- * @param str the pointer where the number starts
- * @return the double value of the string */
-static double *_get_num(char **str);
+/** Sets the value at r->ptr like _json_set_value(), but only what the
+ * projection leads to
+ * @param r the reader
+ * @param elem the element to set the value of
+ * @param proj the projection of the value
+ * @return 0 if succeeded, a json_error otherwise */
+static int _json_set_projected(struct _json_reader *r, json_element elem,
+			       json_projection proj);
 
-/** Parses the string beginning at *str into a char *
- *
- * The function handles the different escape sequences used by the JSON protocol
- * @param str the pointer where the string starts
- * @return the allocated string */
-static char *_get_string(char **str);
+/** Parses the members of the object at r->ptr the projection leads to,
+ * and skips the rest
+ * @param r the reader, positioned at the opening bracket
+ * @param proj the projection of the object
+ * @return the chain of the members kept */
+static json_element _json_project_object(struct _json_reader *r,
+					 json_projection proj);
+
+/** Parses the elements of the array at r->ptr the projection leads to,
+ * and skips the rest
+ * @param r the reader, positioned at the opening bracket
+ * @param proj the projection of the array
+ * @return the chain of the elements kept */
+static json_element _json_project_array(struct _json_reader *r,
+					json_projection proj);
 
-/** Converts the escaped unicode-32 character to an utf-8 equivalent
+/** Reads the key of a member and the colon after it, and finds the
+ * projection of the member
+ * @param r the reader, positioned before the quotation mark of the key
+ * @param proj the projection of the object
+ * @param child the projection of the member is stored here, NULL if the
+ * member isn't needed
+ * @param name if not NULL, the allocated key of a member needed is stored
+ * here
+ * @return 0 if succeeded, a json_error otherwise */
+static int _json_project_key(struct _json_reader *r, json_projection proj,
+			     json_projection *child, char **name);
+
+/** Skips the comma after a member of a container, or its closing bracket
+ * @param r the reader
+ * @param close the closing bracket of the container
+ * @return 1 if another member follows, 0 if the container is closed, a
+ * json_error otherwise */
+static int _next_member(struct _json_reader *r, char close);
+
+/** Reports the values the projection leads to in the value at r->ptr
+ * @param r the reader
+ * @param proj the projection of the value
+ * @param scan the state of the scan
+ * @return 0 if succeeded, a json_error (or what the callback stopped
+ * with) otherwise */
+static int _scan_value(struct _json_reader *r, json_projection proj,
+		       struct _json_scan *scan);
+
+/** Reports the values the projection leads to in the array at r->ptr
+ * @param r the reader, positioned at the opening bracket
+ * @param proj the projection of the array
+ * @param scan the state of the scan
+ * @return 0 if succeeded, an error otherwise, see _scan_value() */
+static int _scan_array(struct _json_reader *r, json_projection proj,
+		       struct _json_scan *scan);
+
+/** Reports the values the projection leads to in the object at r->ptr
+ * @param r the reader, positioned at the opening bracket
+ * @param proj the projection of the object
+ * @param scan the state of the scan
+ * @return 0 if succeeded, an error otherwise, see _scan_value() */
+static int _scan_object(struct _json_reader *r, json_projection proj,
+			struct _json_scan *scan);
+
+/** Reads the value at r->ptr into the field, and calls the callback
+ * @param r the reader
+ * @param path the index of the path that ends at the value
+ * @param scan the state of the scan
+ * @return 0 if succeeded, an error otherwise, see _scan_value() */
+static int _scan_field(struct _json_reader *r, int path,
+		       struct _json_scan *scan);
+
+/** Skips the value at r->ptr without allocating. Only the brackets and the
+ * strings are checked.
+ * @param r the reader
+ * @return 0 if succeeded, a json_error otherwise */
+static int _skip_value(struct _json_reader *r);
+
+/** Checks that the literal (true, false or null) is at r->ptr and skips it
+ * @param r the reader
+ * @param word the literal
+ * @return 0 if found, a json_error otherwise */
+static int _get_literal(struct _json_reader *r, const char *word);
+
+/** Parses the number beginning at r->ptr into a double
+ * @param r the reader
+ * @return the allocated double value of the string, NULL if failed */
+static double *_get_num(struct _json_reader *r);
+
+/** Parses the number beginning at r->ptr, like _get_num(), but into the
+ * given double
+ * @param r the reader
+ * @param num the value is stored here
+ * @return 0 if succeeded, a json_error otherwise */
+static int _read_num(struct _json_reader *r, double *num);
+
+/** Finds the closing quotation mark of the string at r->ptr, a word at a
+ * time
+ * @param r the reader, positioned at the opening quotation mark
+ * @param escaped set to true if the string has escape sequences
+ * @return the closing quotation mark, NULL if failed */
+static char *_find_close(struct _json_reader *r, int *escaped);
+
+/** Parses the string beginning at r->ptr into a char *
  *
- * Note 1: only uses the first 3 bytes
+ * The function handles the different escape sequences used by the JSON
+ * protocol
+ * @param r the reader, positioned at the opening quotation mark
+ * @return the allocated string, NULL if failed */
+static char *_get_string(struct _json_reader *r);
+
+/** Unescapes the string at r->ptr up to its closing quotation mark into
+ * out, and terminates it
+ * @param r the reader, positioned at the opening quotation mark, r->ptr is
+ * set to the error if failed
+ * @param close the closing quotation mark, see _find_close()
+ * @param escaped true if the string has escape sequences
+ * @param out the buffer to write to, at least close - r->ptr long
+ * @return the length of the result, -1 if failed */
+static long _decode_string(struct _json_reader *r, char *close, int escaped,
+			   char *out);
+
+/** Decodes the \u escape (or surrogate pair of escapes) at ptr
+ * @param r the reader, r->ptr is set to the error if failed
+ * @param ptr the position of the u
+ * @param close the end of the string
+ * @param u32 the code point is stored here
+ * @return the count of characters consumed after the u, -1 if failed */
+static int _get_escaped_char(struct _json_reader *r, char *ptr, char *close,
+			     unsigned long *u32);
+
+/** Returns the value of 4 hexadecimal digits
+ * @param str the digits
+ * @return the value, -1 if not all 4 characters are hex digits */
+static long _get_hex4(char *str);
+
+/** Converts the unicode-32 character to an utf-8 equivalent
  *
- * Note 2: based on reference implementation:
+ * Note: based on reference implementation:
  *
  * http://www.unicode.org/Public/PROGRAMS/CVTUTF/ConvertUTF.c
- * @param u32 the 4 bytes to convert
+ * @param u32 the code point to convert
  * @param arr the character array to append the result to
- * @return the count of actual bytes written (max 3) */
-static char _get_unicode_char(unsigned int u32, char *arr);
+ * @return the count of bytes written (max 4) */
+static int _get_unicode_char(unsigned long u32, char *arr);
+
+/** Records the error at r->ptr, unless an error has been recorded already
+ * @param r the reader
+ * @param error the json_error
+ * @return the first error recorded */
+static int _fail(struct _json_reader *r, int error);
+
+/** Skips the whitespace at r->ptr */
+static void _skip_space(struct _json_reader *r);
 
 json_element json_alloc()
 {
@@ -63,6 +279,7 @@ json_element json_alloc()
 
 	elem->type = JSON_UNSET;
 	elem->name = NULL;
+	elem->hash = 0;
 	elem->data = NULL;
 	elem->next = NULL;
 
@@ -128,6 +345,7 @@ json_element json_create_string(char *key, char *value)
 	json_element elem = json_create_element(JSON_STRING);
 
 	elem->name = mystrdup(key);
+	elem->hash = json_hash(key);
 	elem->data = mystrdup(value);
 
 	return elem;
@@ -138,17 +356,33 @@ json_element json_create_numeric(char *key, double value)
 	json_element elem = json_create_element(JSON_NUM);
 
 	elem->name = mystrdup(key);
+	elem->hash = json_hash(key);
 	elem->data = malloc(sizeof(double));
 	*(double *) (elem->data) = value;
 
 	return elem;
 }
 
+unsigned long json_hash(char *name)
+{
+	unsigned long hash = 2166136261UL;
+
+	/* FNV-1a, 32 bits whatever the size of long is */
+	for (; *name != 0; name++)
+		hash = ((hash ^ (unsigned char) *name) * 16777619UL) &
+		    0xffffffffUL;
+
+	return hash == 0 ? 1 : hash;
+}
+
 json_element json_get_element_by_name(json_element obj, char *name)
 {
-	json_element current = obj->data;
+	json_element current;
+
+	if (obj == NULL)
+		return NULL;
 
-	for (; current != NULL; current = current->next) {
+	for (current = obj->data; current != NULL; current = current->next) {
 		if (!(current->name == NULL || strcmp(name, current->name)))
 			return current;
 	}
@@ -158,185 +392,1088 @@ json_element json_get_element_by_name(json_element obj, char *name)
 
 json_element json_parse(char *str)
 {
+	struct _json_reader r;
 	json_element root = NULL;
 	json_element current = NULL;
 	json_element new = NULL;
+	double timer = STATS_BEGIN();
 
-	while (*str != 0) {
-		if (*str == JSON_ARRAY) {
+	memset(&r, 0, sizeof(r));
+	r.ptr = str;
+	r.end = str + strlen(str);
+
+	/* the arrays in the string are collected, whatever is between them is
+	 * ignored, and an error only stops the parse: what has been read so
+	 * far is returned */
+	while (r.ptr < r.end && !r.error) {
+		if (*r.ptr == JSON_ARRAY) {
 			new = json_alloc();
+			if (new == NULL)
+				break;
 			new->type = JSON_ARRAY;
-			new->data = _json_parse_array(&str);
-
 			current = json_append_or_set(current, new, &root);
+			new->data = _json_parse_array(&r);
 		}
 		else {
-			str++;
+			r.ptr++;
 		}
 	}
 
+	STATS_END(STATS_PARSE, timer, r.ptr - str);
+	return root;
+}
+
+json_element json_parse_strict(char *str, long len, int *error, long *errpos)
+{
+	struct _json_reader r;
+	json_element root;
+	double timer = STATS_BEGIN();
+
+	memset(&r, 0, sizeof(r));
+	r.ptr = str;
+	r.end = str + len;
+	r.strict = 1;
+
+	root = json_alloc();
+	if (root == NULL)
+		_fail(&r, JSON_ERR_NOMEM);
+	else if (_json_set_value(&r, root) == 0) {
+		_skip_space(&r);
+		if (r.ptr < r.end)
+			_fail(&r, JSON_ERR_TRAILING);
+	}
+
+	if (error != NULL)
+		*error = r.error;
+	if (errpos != NULL)
+		*errpos = r.error ? r.errptr - str : -1;
+
+	if (r.error) {
+		json_free(root);
+		return NULL;
+	}
+
+	STATS_END(STATS_PARSE, timer, len);
 	return root;
 }
 
+json_element json_parse_projected(char *str, long len, json_projection proj,
+				  int *error, long *errpos)
+{
+	struct _json_reader r;
+	json_element root;
+	double timer = STATS_BEGIN();
+
+	memset(&r, 0, sizeof(r));
+	r.ptr = str;
+	r.end = str + len;
+	r.strict = 1;
+
+	root = json_alloc();
+	if (root == NULL)
+		_fail(&r, JSON_ERR_NOMEM);
+	else if (_json_set_projected(&r, root, proj) == 0) {
+		_skip_space(&r);
+		if (r.ptr < r.end)
+			_fail(&r, JSON_ERR_TRAILING);
+	}
+
+	if (error != NULL)
+		*error = r.error;
+	if (errpos != NULL)
+		*errpos = r.error ? r.errptr - str : -1;
+
+	if (r.error) {
+		json_free(root);
+		return NULL;
+	}
+
+	STATS_END(STATS_PARSE, timer, len);
+	return root;
+}
+
+int json_parse_fields(char *str, long len, json_projection proj,
+		      json_field_fn fn, void *arg, long *errpos)
+{
+	struct _json_reader r;
+	struct _json_scan scan;
+	double timer = STATS_BEGIN();
+
+	memset(&r, 0, sizeof(r));
+	r.ptr = str;
+	r.end = str + len;
+	r.strict = 1;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.fn = fn;
+	scan.arg = arg;
+	scan.field.record = -1;
+	scan.record_depth = 0;
+
+	if (_scan_value(&r, proj, &scan) == 0) {
+		_skip_space(&r);
+		if (r.ptr < r.end)
+			_fail(&r, JSON_ERR_TRAILING);
+	}
+	free(scan.scratch);
+
+	if (errpos != NULL)
+		*errpos = r.error ? r.errptr - str : -1;
+
+	if (r.error == 0)
+		STATS_END(STATS_PARSE, timer, len);
+	return r.error;
+}
+
+char *json_strerror(int code)
+{
+	switch (code) {
+	case JSON_OK:
+		return "no error";
+	case JSON_ERR_EOF:
+		return "unexpected end of input";
+	case JSON_ERR_SYNTAX:
+		return "unexpected character";
+	case JSON_ERR_STRING:
+		return "invalid character or escape sequence in a string";
+	case JSON_ERR_NUMBER:
+		return "malformed number";
+	case JSON_ERR_DEPTH:
+		return "too deeply nested";
+	case JSON_ERR_NOMEM:
+		return "out of memory";
+	case JSON_ERR_TRAILING:
+		return "garbage after the value";
+	default:
+		return "unknown error";
+	}
+}
+
 /* ************************************
  * static functions
  */
-static json_element _json_parse_array(char **str)
+static json_element _json_parse_array(struct _json_reader *r)
 {
 	json_element root = NULL;
 	json_element current = NULL;
 	json_element new = NULL;
 
+	if (++r->depth > JSON_MAX_DEPTH) {
+		_fail(r, JSON_ERR_DEPTH);
+		return NULL;
+	}
+
 	/* increment the pointer, since the type has already been determined */
-	for ((*str)++; **str != 0 && **str != ']'; (*str)++) {
+	r->ptr++;
+	_skip_space(r);
+	if (r->ptr < r->end && *r->ptr == ']') {
+		r->ptr++;
+		r->depth--;
+		return NULL;
+	}
+
+	for (;;) {
 		new = json_alloc();
-		_json_set_value(str, new);
+		if (new == NULL) {
+			_fail(r, JSON_ERR_NOMEM);
+			break;
+		}
+		current = json_append_or_set(current, new, &root);
+
+		if (_json_set_value(r, new) < 0)
+			break;
+
+		_skip_space(r);
+		if (r->ptr >= r->end) {
+			_fail(r, JSON_ERR_EOF);
+			break;
+		}
+		if (*r->ptr == ']') {
+			r->ptr++;
+			break;
+		}
+		if (*r->ptr != ',') {
+			_fail(r, JSON_ERR_SYNTAX);
+			break;
+		}
+		r->ptr++;
+	}
 
+	r->depth--;
+	return root;
+}
+
+static json_element _json_parse_object(struct _json_reader *r)
+{
+	json_element root = NULL;
+	json_element current = NULL;
+	json_element new = NULL;
+
+	if (++r->depth > JSON_MAX_DEPTH) {
+		_fail(r, JSON_ERR_DEPTH);
+		return NULL;
+	}
+
+	r->ptr++;		/* skip the type */
+	_skip_space(r);
+	if (r->ptr < r->end && *r->ptr == '}') {
+		r->ptr++;
+		r->depth--;
+		return NULL;
+	}
+
+	for (;;) {
+		_skip_space(r);
+		if (r->ptr >= r->end) {
+			_fail(r, JSON_ERR_EOF);
+			break;
+		}
+		if (*r->ptr != JSON_STRING) {
+			_fail(r, JSON_ERR_SYNTAX);
+			break;
+		}
+
+		new = json_alloc();
+		if (new == NULL) {
+			_fail(r, JSON_ERR_NOMEM);
+			break;
+		}
 		current = json_append_or_set(current, new, &root);
+
+		if (_json_parse_pair(r, new) < 0)
+			break;
+
+		_skip_space(r);
+		if (r->ptr >= r->end) {
+			_fail(r, JSON_ERR_EOF);
+			break;
+		}
+		if (*r->ptr == '}') {
+			r->ptr++;
+			break;
+		}
+		if (*r->ptr != ',') {
+			_fail(r, JSON_ERR_SYNTAX);
+			break;
+		}
+		r->ptr++;
 	}
 
+	r->depth--;
 	return root;
 }
 
-static json_element _json_parse_object(char **str)
+static int _json_parse_pair(struct _json_reader *r, json_element val)
+{
+	val->name = _get_string(r);
+	if (val->name == NULL)
+		return r->error;
+	val->hash = json_hash(val->name);
+
+	_skip_space(r);
+	if (r->ptr >= r->end)
+		return _fail(r, JSON_ERR_EOF);
+	if (*r->ptr != ':')
+		return _fail(r, JSON_ERR_SYNTAX);
+	r->ptr++;
+
+	return _json_set_value(r, val);
+}
+
+static int _json_set_value(struct _json_reader *r, json_element val)
+{
+	_skip_space(r);
+	if (r->ptr >= r->end)
+		return _fail(r, JSON_ERR_EOF);
+
+	switch (*r->ptr) {
+	case JSON_ARRAY:
+		val->type = JSON_ARRAY;
+		val->data = _json_parse_array(r);
+		break;
+	case JSON_OBJECT:
+		val->type = JSON_OBJECT;
+		val->data = _json_parse_object(r);
+		break;
+	case JSON_STRING:
+		val->type = JSON_STRING;
+		val->data = _get_string(r);
+		break;
+	case JSON_TRUE:
+		val->type = JSON_TRUE;
+		return _get_literal(r, "true");
+	case JSON_FALSE:
+		val->type = JSON_FALSE;
+		return _get_literal(r, "false");
+	case JSON_NULL:
+		val->type = JSON_NULL;
+		return _get_literal(r, "null");
+	default:
+		val->type = JSON_NUM;
+		val->data = (void *) _get_num(r);
+	}
+
+	return r->error;
+}
+
+static int _json_set_projected(struct _json_reader *r, json_element val,
+			       json_projection proj)
+{
+	if (json_projection_whole(proj))
+		return _json_set_value(r, val);
+
+	_skip_space(r);
+	if (r->ptr >= r->end)
+		return _fail(r, JSON_ERR_EOF);
+
+	switch (*r->ptr) {
+	case JSON_ARRAY:
+		val->type = JSON_ARRAY;
+		val->data = _json_project_array(r, proj);
+		return r->error;
+	case JSON_OBJECT:
+		val->type = JSON_OBJECT;
+		val->data = _json_project_object(r, proj);
+		return r->error;
+	default:
+		/* the paths lead further down, but there's nothing below a
+		 * scalar: it's kept, it costs little */
+		return _json_set_value(r, val);
+	}
+}
+
+static json_element _json_project_array(struct _json_reader *r,
+					json_projection proj)
 {
 	json_element root = NULL;
 	json_element current = NULL;
 	json_element new = NULL;
+	json_projection child;
+	long index;
+	int ret;
 
-	(**str)++; /* skip the type */
-	while (**str && **str != '}') {
-		if (**str == JSON_STRING) {
-			new = _json_parse_pair(str);
+	if (++r->depth > JSON_MAX_DEPTH) {
+		_fail(r, JSON_ERR_DEPTH);
+		return NULL;
+	}
 
-			current = json_append_or_set(current, new, &root);
+	r->ptr++;		/* skip the bracket */
+	_skip_space(r);
+	if (r->ptr < r->end && *r->ptr == ']') {
+		r->ptr++;
+		r->depth--;
+		return NULL;
+	}
+
+	for (index = 0, ret = 1; ret > 0; index++) {
+		child = json_projection_child(proj, NULL, 0, index);
+		if (child == NULL) {
+			ret = _skip_value(r);
 		}
 		else {
-			(*str)++;
+			new = json_alloc();
+			if (new == NULL) {
+				_fail(r, JSON_ERR_NOMEM);
+				break;
+			}
+			current = json_append_or_set(current, new, &root);
+			ret = _json_set_projected(r, new, child);
 		}
+
+		if (ret == 0)
+			ret = _next_member(r, ']');
 	}
 
-	(*str)++;
+	r->depth--;
 	return root;
 }
 
-static json_element _json_parse_pair(char **str)
+static json_element _json_project_object(struct _json_reader *r,
+					 json_projection proj)
 {
-	json_element val = json_alloc();
-	val->name = _get_string(str);
+	json_element root = NULL;
+	json_element current = NULL;
+	json_element new = NULL;
+	json_projection child;
+	char *name;
+	int ret;
+
+	if (++r->depth > JSON_MAX_DEPTH) {
+		_fail(r, JSON_ERR_DEPTH);
+		return NULL;
+	}
 
-	/* advance the pointer, because _json_set_value() expects a pointer
-	 * that starts at a command character
-	 */
-	(*str)++;
+	r->ptr++;		/* skip the type */
+	_skip_space(r);
+	if (r->ptr < r->end && *r->ptr == '}') {
+		r->ptr++;
+		r->depth--;
+		return NULL;
+	}
 
-	return _json_set_value(str, val);
+	for (ret = 1; ret > 0;) {
+		ret = _json_project_key(r, proj, &child, &name);
+		if (ret == 0 && child == NULL) {
+			ret = _skip_value(r);
+		}
+		else if (ret == 0) {
+			new = json_alloc();
+			if (new == NULL) {
+				free(name);
+				_fail(r, JSON_ERR_NOMEM);
+				break;
+			}
+			current = json_append_or_set(current, new, &root);
+
+			new->name = name;
+			new->hash = json_hash(name);
+			ret = _json_set_projected(r, new, child);
+		}
+
+		if (ret == 0)
+			ret = _next_member(r, '}');
+	}
+
+	r->depth--;
+	return root;
 }
 
-json_element _json_set_value(char **str, json_element val)
+static int _json_project_key(struct _json_reader *r, json_projection proj,
+			     json_projection *child, char **name)
 {
-	val->type = **str;
+	char *open;
+	char *close;
+	char *key = NULL;
+	int escaped;
+
+	_skip_space(r);
+	if (r->ptr >= r->end)
+		return _fail(r, JSON_ERR_EOF);
+	if (*r->ptr != JSON_STRING)
+		return _fail(r, JSON_ERR_SYNTAX);
+
+	/* the key is matched in place, it's only decoded if kept (or if it
+	 * has escapes, which Twitter's keys don't) */
+	open = r->ptr;
+	close = _find_close(r, &escaped);
+	if (close == NULL)
+		return r->error;
+	if (escaped) {
+		key = _get_string(r);
+		if (key == NULL)
+			return r->error;
+		*child = json_projection_child(proj, key, strlen(key), -1);
+	}
+	else {
+		*child = json_projection_child(proj, open + 1,
+					       close - open - 1, -1);
+	}
+
+	if (*child == NULL || name == NULL) {
+		free(key);
+		key = NULL;
+	}
+	else if (key == NULL) {
+		key = _get_string(r);
+		if (key == NULL)
+			return r->error;
+	}
+
+	r->ptr = close + 1;
+	_skip_space(r);
+	if (r->ptr >= r->end || *r->ptr != ':') {
+		free(key);
+		return _fail(r, r->ptr >= r->end ? JSON_ERR_EOF :
+			     JSON_ERR_SYNTAX);
+	}
+	r->ptr++;
+
+	if (name != NULL)
+		*name = key;
+	return 0;
+}
 
-	switch (**str) {
+static int _next_member(struct _json_reader *r, char close)
+{
+	_skip_space(r);
+	if (r->ptr >= r->end)
+		return _fail(r, JSON_ERR_EOF);
+	if (*r->ptr == close) {
+		r->ptr++;
+		return 0;
+	}
+	if (*r->ptr != ',')
+		return _fail(r, JSON_ERR_SYNTAX);
+
+	r->ptr++;
+	return 1;
+}
+
+static int _scan_value(struct _json_reader *r, json_projection proj,
+		       struct _json_scan *scan)
+{
+	_skip_space(r);
+	if (r->ptr >= r->end)
+		return _fail(r, JSON_ERR_EOF);
+
+	if (json_projection_whole(proj))
+		return _scan_field(r, json_projection_path(proj), scan);
+
+	switch (*r->ptr) {
 	case JSON_ARRAY:
-		val->data = _json_parse_array(str);
+		return _scan_array(r, proj, scan);
+	case JSON_OBJECT:
+		return _scan_object(r, proj, scan);
+	default:
+		return _skip_value(r);
+	}
+}
+
+static int _scan_array(struct _json_reader *r, json_projection proj,
+		       struct _json_scan *scan)
+{
+	json_projection child;
+	long index;
+	int ret;
+
+	if (++r->depth > JSON_MAX_DEPTH)
+		return _fail(r, JSON_ERR_DEPTH);
+
+	r->ptr++;		/* skip the bracket */
+	_skip_space(r);
+	if (r->ptr < r->end && *r->ptr == ']') {
+		r->ptr++;
+		r->depth--;
+		return 0;
+	}
+
+	if (scan->record_depth == 0)
+		scan->record_depth = r->depth;
+
+	for (index = 0, ret = 1; ret > 0; index++) {
+		if (r->depth == scan->record_depth)
+			scan->field.record = index;
+
+		child = json_projection_child(proj, NULL, 0, index);
+		ret = child == NULL ? _skip_value(r) :
+		    _scan_value(r, child, scan);
+		if (ret == 0)
+			ret = _next_member(r, ']');
+	}
+
+	if (r->depth == scan->record_depth) {
+		scan->record_depth = 0;
+		scan->field.record = -1;
+	}
+	r->depth--;
+	return ret;
+}
+
+static int _scan_object(struct _json_reader *r, json_projection proj,
+			struct _json_scan *scan)
+{
+	json_projection child;
+	int ret;
+
+	if (++r->depth > JSON_MAX_DEPTH)
+		return _fail(r, JSON_ERR_DEPTH);
+
+	r->ptr++;		/* skip the type */
+	_skip_space(r);
+	if (r->ptr < r->end && *r->ptr == '}') {
+		r->ptr++;
+		r->depth--;
+		return 0;
+	}
+
+	for (ret = 1; ret > 0;) {
+		ret = _json_project_key(r, proj, &child, NULL);
+		if (ret == 0)
+			ret = child == NULL ? _skip_value(r) :
+			    _scan_value(r, child, scan);
+		if (ret == 0)
+			ret = _next_member(r, '}');
+	}
+
+	r->depth--;
+	return ret;
+}
+
+static int _scan_field(struct _json_reader *r, int path,
+		       struct _json_scan *scan)
+{
+	json_field field = &scan->field;
+	char *start = r->ptr;
+	char *close;
+	char *tmp;
+	int escaped;
+	int ret;
+
+	field->path = path;
+	field->type = *r->ptr;
+	field->str = r->ptr;
+	field->num = 0;
+
+	switch (*r->ptr) {
+	case JSON_STRING:
+		close = _find_close(r, &escaped);
+		if (close == NULL)
+			return r->error;
+
+		if (!escaped) {
+			field->str = r->ptr + 1;
+			field->len = close - r->ptr - 1;
+			r->ptr = close + 1;
+			break;
+		}
+
+		if (close - r->ptr > scan->size) {
+			tmp = realloc(scan->scratch, close - r->ptr);
+			if (tmp == NULL)
+				return _fail(r, JSON_ERR_NOMEM);
+			scan->scratch = tmp;
+			scan->size = close - r->ptr;
+		}
+		field->str = scan->scratch;
+		field->len = _decode_string(r, close, escaped, scan->scratch);
+		if (field->len < 0)
+			return r->error;
+		r->ptr = close + 1;
 		break;
+	case JSON_ARRAY:
 	case JSON_OBJECT:
-		val->data = _json_parse_object(str);
+		ret = _skip_value(r);
+		if (ret < 0)
+			return ret;
 		break;
-	case JSON_STRING:
-		val->data = _get_string(str);
+	case JSON_TRUE:
+		ret = _get_literal(r, "true");
+		if (ret < 0)
+			return ret;
+		break;
+	case JSON_FALSE:
+		ret = _get_literal(r, "false");
+		if (ret < 0)
+			return ret;
+		break;
+	case JSON_NULL:
+		ret = _get_literal(r, "null");
+		if (ret < 0)
+			return ret;
 		break;
 	default:
-		if (isdigit(**str)) {
-			val->type = JSON_NUM;
-			val->data = (void *) _get_num(str);
-		}		/* type has already been set if it's not a digit! */
+		field->type = JSON_NUM;
+		ret = _read_num(r, &field->num);
+		if (ret < 0)
+			return ret;
 	}
+	if (field->type != JSON_STRING)
+		field->len = r->ptr - start;
 
-	return val;
+	ret = scan->fn(field, scan->arg);
+	return ret < 0 ? _fail(r, ret) : 0;
 }
 
-static double *_get_num(char **str)
+static int _skip_value(struct _json_reader *r)
 {
-	double *num = malloc(sizeof(*num));
-	if (num == NULL)
+	char closers[JSON_MAX_DEPTH];	/* the brackets expected, innermost last */
+	char *close;
+	int depth = 0;
+	int escaped;
+
+	_skip_space(r);
+
+	do {
+		if (r->ptr >= r->end)
+			return _fail(r, JSON_ERR_EOF);
+
+		switch (*r->ptr) {
+		case '"':
+			close = _find_close(r, &escaped);
+			if (close == NULL)
+				return r->error;
+			r->ptr = close + 1;
+			continue;
+		case '[':
+		case '{':
+			if (r->depth + depth >= JSON_MAX_DEPTH)
+				return _fail(r, JSON_ERR_DEPTH);
+			closers[depth++] = *r->ptr + 2;	/* ] and } follow [ and { */
+			break;
+		case ']':
+		case '}':
+			if (depth == 0 || closers[--depth] != *r->ptr)
+				return _fail(r, JSON_ERR_SYNTAX);
+			break;
+		default:
+			if (depth == 0) {
+				/* a scalar on its own: up to the delimiter */
+				close = r->ptr;
+				while (r->ptr < r->end && *r->ptr != ','
+				       && *r->ptr != ']' && *r->ptr != '}'
+				       && *r->ptr != ' ' && *r->ptr != '\n'
+				       && *r->ptr != '\r' && *r->ptr != '\t')
+					r->ptr++;
+				return r->ptr == close ?
+				    _fail(r, JSON_ERR_SYNTAX) : 0;
+			}
+		}
+		r->ptr++;
+	} while (depth > 0);
+
+	return 0;
+}
+
+static int _get_literal(struct _json_reader *r, const char *word)
+{
+	long len = strlen(word);
+	long left = r->end - r->ptr;
+
+	if (left < len) {
+		if (memcmp(r->ptr, word, left))
+			return _fail(r, JSON_ERR_SYNTAX);
+		r->ptr = r->end;
+		return _fail(r, JSON_ERR_EOF);
+	}
+	if (memcmp(r->ptr, word, len))
+		return _fail(r, JSON_ERR_SYNTAX);
+
+	r->ptr += len;
+	return 0;
+}
+
+static double *_get_num(struct _json_reader *r)
+{
+	double *num;
+	double value;
+
+	if (_read_num(r, &value) < 0)
 		return NULL;
 
-	*num = strtod(*str, str);
+	num = malloc(sizeof(*num));
+	if (num == NULL) {
+		_fail(r, JSON_ERR_NOMEM);
+		return NULL;
+	}
+
+	*num = value;
 	return num;
 }
 
-static char *_get_string(char **str)
+static int _read_num(struct _json_reader *r, double *num)
 {
-	int length = 0;
-	unsigned int u32;	/* where the utf32 encoded char is stored */
-	char *ptr;		/* ptr is the default working pointer */
-	char *ret;
+	char buf[NUM_BUFSIZE];
+	char *tmp = buf;
+	char *ptr = r->ptr;
+	double value = 0;
+	int digits = 0;
+	int exact = 1;
 
-	if (**str == '"')
-		(*str)++;
+	/* validate, and compute the value of short integers on the way */
+	if (ptr < r->end && *ptr == '-')
+		ptr++;
 
-	for (ptr = *str; *ptr && *ptr != '"'; ptr++) {
-		if (*ptr == '\\')
+	if (ptr < r->end && *ptr == '0') {
+		ptr++;
+	}
+	else if (ptr < r->end && _IS_DIGIT(*ptr)) {
+		for (; ptr < r->end && _IS_DIGIT(*ptr); ptr++, digits++)
+			value = value * 10 + (*ptr - '0');
+	}
+	else {
+		/* a lone minus sign is a malformed number, anything else is
+		 * not a value at all */
+		digits = ptr == r->ptr ? JSON_ERR_SYNTAX : JSON_ERR_NUMBER;
+		r->ptr = ptr;
+		return _fail(r, ptr == r->end ? JSON_ERR_EOF : digits);
+	}
+
+	if (ptr < r->end && *ptr == '.') {
+		exact = 0;
+		if (++ptr == r->end || !_IS_DIGIT(*ptr)) {
+			r->ptr = ptr;
+			return _fail(r, ptr == r->end ? JSON_ERR_EOF :
+				     JSON_ERR_NUMBER);
+		}
+		while (ptr < r->end && _IS_DIGIT(*ptr))
 			ptr++;
+	}
 
-		length++;
+	if (ptr < r->end && (*ptr == 'e' || *ptr == 'E')) {
+		exact = 0;
+		if (++ptr < r->end && (*ptr == '+' || *ptr == '-'))
+			ptr++;
+		if (ptr == r->end || !_IS_DIGIT(*ptr)) {
+			r->ptr = ptr;
+			return _fail(r, ptr == r->end ? JSON_ERR_EOF :
+				     JSON_ERR_NUMBER);
+		}
+		while (ptr < r->end && _IS_DIGIT(*ptr))
+			ptr++;
 	}
-	ret = malloc((length + 1) * sizeof(*ret));
 
-	for (ptr = ret; **str != '"'; ptr++, (*str)++) {
-		/* we need to handle characters beginning with \ differently */
-		if (**str == '\\') {
-			(*str)++;
-			switch (**str) {
-				/* these actually are just string representations */
-			case 'n':
-				*ptr = '\n';
-				break;
-			case 'r':
-				*ptr = '\r';
-				break;
-			case 't':
-				*ptr = '\t';
-				break;
-			case 'b':
-				*ptr = '\b';
-				break;
-			case 'f':
-				*ptr = '\f';
+	if (!exact || digits > EXACT_DIGITS) {
+		/* the input isn't terminated right after the number, so strtod()
+		 * gets a copy */
+		if (ptr - r->ptr >= NUM_BUFSIZE) {
+			tmp = malloc(ptr - r->ptr + 1);
+			if (tmp == NULL)
+				return _fail(r, JSON_ERR_NOMEM);
+		}
+		memcpy(tmp, r->ptr, ptr - r->ptr);
+		tmp[ptr - r->ptr] = 0;
+		value = strtod(tmp, NULL);
+		if (tmp != buf)
+			free(tmp);
+	}
+	else if (*r->ptr == '-') {
+		value = -value;
+	}
+
+	*num = value;
+	r->ptr = ptr;
+	return 0;
+}
+
+static char *_find_close(struct _json_reader *r, int *escaped)
+{
+	unsigned long word;
+	char *close;
+
+	*escaped = 0;
+	for (close = r->ptr + 1;; close++) {
+		/* skip the plain characters a word at a time */
+		while (r->end - close >= (long) sizeof(word)) {
+			memcpy(&word, close, sizeof(word));
+			if (_HAS_SPECIAL(word))
 				break;
-			case 'u':
-				sscanf(++*str, "%4x", &u32);
-				*str += 3;
-				ptr += _get_unicode_char(u32, ptr);
+			close += sizeof(word);
+		}
+
+		if (close >= r->end || *close == '"')
+			break;
+		if (*close == '\\') {
+			*escaped = 1;
+			if (++close == r->end)
 				break;
-			default:
-				/* special characters that need to be escaped: \ " / */
-				*ptr = **str;
-			}
 		}
-		else {
-			*ptr = **str;
+		else if ((unsigned char) *close < 0x20 && r->strict) {
+			r->ptr = close;
+			_fail(r, JSON_ERR_STRING);
+			return NULL;
 		}
 	}
+	if (close >= r->end) {
+		r->ptr = r->end;
+		_fail(r, JSON_ERR_EOF);
+		return NULL;
+	}
+
+	return close;
+}
+
+static char *_get_string(struct _json_reader *r)
+{
+	char *close;		/* the closing quotation mark */
+	char *ret;
+	int escaped;
+
+	/* find the end first: escapes only shrink, so the raw length is
+	 * enough for the result */
+	close = _find_close(r, &escaped);
+	if (close == NULL)
+		return NULL;
 
-	*ptr = 0;		/* terminate the string just created */
-	(*str)++;		/* set position to after the processed block */
+	ret = malloc(close - r->ptr);
+	if (ret == NULL) {
+		_fail(r, JSON_ERR_NOMEM);
+		return NULL;
+	}
+
+	if (_decode_string(r, close, escaped, ret) < 0) {
+		free(ret);
+		return NULL;
+	}
+
+	r->ptr = close + 1;	/* set position to after the processed block */
 	return ret;
 }
 
-static char _get_unicode_char(unsigned int u32, char *arr)
+static long _decode_string(struct _json_reader *r, char *close, int escaped,
+			   char *out)
+{
+	unsigned long u32;	/* where the utf32 encoded char is stored */
+	char *ptr;		/* ptr is the default working pointer */
+	char *run;
+	char *start = out;
+	int len;
+
+	ptr = r->ptr + 1;
+	if (!escaped) {
+		memcpy(out, ptr, close - ptr);
+		out += close - ptr;
+		ptr = close;
+	}
+
+	while (ptr < close) {
+		/* copy the run up to the next escape in one go */
+		run = memchr(ptr, '\\', close - ptr);
+		if (run == NULL)
+			run = close;
+		memcpy(out, ptr, run - ptr);
+		out += run - ptr;
+		ptr = run;
+		if (ptr == close)
+			break;
+
+		/* we need to handle characters beginning with \ differently */
+		switch (*++ptr) {
+			/* these actually are just string representations */
+		case 'n':
+			*out++ = '\n';
+			break;
+		case 'r':
+			*out++ = '\r';
+			break;
+		case 't':
+			*out++ = '\t';
+			break;
+		case 'b':
+			*out++ = '\b';
+			break;
+		case 'f':
+			*out++ = '\f';
+			break;
+		case 'u':
+			len = _get_escaped_char(r, ptr, close, &u32);
+			if (len < 0)
+				return -1;
+			ptr += len;
+			out += _get_unicode_char(u32, out);
+			break;
+		case '\\':
+		case '"':
+		case '/':
+			*out++ = *ptr;
+			break;
+		default:
+			if (r->strict) {
+				r->ptr = ptr;
+				_fail(r, JSON_ERR_STRING);
+				return -1;
+			}
+			*out++ = *ptr;
+		}
+		ptr++;
+	}
+
+	*out = 0;		/* terminate the string just created */
+	return out - start;
+}
+
+static int _get_escaped_char(struct _json_reader *r, char *ptr, char *close,
+			     unsigned long *u32)
+{
+	long high = close - ptr > 4 ? _get_hex4(ptr + 1) : -1;
+	long low;
+
+	if (high < 0) {
+		r->ptr = ptr;
+		_fail(r, JSON_ERR_STRING);
+		return -1;
+	}
+
+	/* characters above the BMP are written as a surrogate pair, eg.
+	 * \ud83d\ude00 */
+	if (high < 0xd800 || high > 0xdfff) {
+		*u32 = high;
+		return 4;
+	}
+
+	low = high <= 0xdbff && close - ptr > 10 && ptr[5] == '\\'
+	    && ptr[6] == 'u' ? _get_hex4(ptr + 7) : -1;
+	if (low >= 0xdc00 && low <= 0xdfff) {
+		*u32 = 0x10000 + ((high - 0xd800) << 10) + (low - 0xdc00);
+		return 10;
+	}
+
+	/* a lone surrogate isn't a character */
+	if (r->strict) {
+		r->ptr = ptr;
+		_fail(r, JSON_ERR_STRING);
+		return -1;
+	}
+	*u32 = REPLACEMENT_CHAR;
+	return 4;
+}
+
+static long _get_hex4(char *str)
+{
+	/* the values of the hex digits, -1 for the other characters */
+	static const signed char hexval[256] = {
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1,
+		-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+	};
+	const unsigned char *u = (const unsigned char *) str;
+	long a = hexval[u[0]];
+	long b = hexval[u[1]];
+	long c = hexval[u[2]];
+	long d = hexval[u[3]];
+
+	/* one test for the 4 digits: an invalid one makes the OR negative */
+	if ((a | b | c | d) < 0)
+		return -1;
+
+	return a << 12 | b << 8 | c << 4 | d;
+}
+
+static int _fail(struct _json_reader *r, int error)
+{
+	if (r->error == 0) {
+		r->error = error;
+		r->errptr = r->ptr;
+	}
+
+	return r->error;
+}
+
+static void _skip_space(struct _json_reader *r)
+{
+	while (r->ptr < r->end && (*r->ptr == ' ' || *r->ptr == '\n' ||
+				   *r->ptr == '\r' || *r->ptr == '\t'))
+		r->ptr++;
+}
+
+static int _get_unicode_char(unsigned long u32, char *arr)
 {
 	const short int firstbyte[] = { 0x00, 0xc0, 0xe0, 0xf0 };
-	int length = 2;		/* how many bytes the output will be - 1 */
+	int length = 3;		/* how many bytes the output will be - 1 */
 
 	if (u32 < 0x80)
 		length = 0;
 	else if (u32 < 0x800)
 		length = 1;
+	else if (u32 < 0x10000)
+		length = 2;
 
 	switch (length) {
+	case 3:
+		arr[3] = (char) ((u32 | 0x80) & 0xbf);
+		u32 >>= 6;
 	case 2:
 		arr[2] = (char) ((u32 | 0x80) & 0xbf);
 		u32 >>= 6;
@@ -344,8 +1481,8 @@ static char _get_unicode_char(unsigned int u32, char *arr)
 		arr[1] = (char) ((u32 | 0x80) & 0xbf);
 		u32 >>= 6;
 	case 0:
-		*arr = (char) u32 | firstbyte[length];
+		*arr = (char) (u32 | firstbyte[length]);
 	}
 
-	return length;
+	return length + 1;
 }
@@ -1,3 +1,4 @@
+#define MEM_AREA MEM_JSON
 #include "json.h"
 #include "main.h"
 #include <stdio.h>
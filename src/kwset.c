@@ -0,0 +1,342 @@
+#define MEM_AREA MEM_UI
+#include "kwset.h"
+
+/** @file */
+
+/** The set */
+struct _kwset {
+
+	/** The keywords, their lengths and their flags, in the order added */
+	char **keywords;
+	long *lengths;
+	int *kflags;
+
+	/** The count of keywords, and the count there is room for */
+	int count;
+	int size;
+
+	/** The class of each byte, the column of the table it goes to; 0 for
+	 * the bytes in no keyword */
+	unsigned char cls[256];
+
+	/** The count of classes, the width of the table */
+	int ncls;
+
+	/** The count of states, 0 until compiled */
+	int nstates;
+
+	/** The transitions: the entry of a state and a class is the row of
+	 * the next state, that is its number times ncls, or -1 minus that if
+	 * a keyword ends at the next state */
+	int *table;
+
+	/** The flags of the keywords ending at each state, or at the states
+	 * of its suffixes */
+	int *flags;
+
+	/** The keyword ending at each state, -1 if none */
+	int *out;
+
+	/** The state of the longest proper suffix of each state a keyword ends
+	 * at, -1 if none */
+	int *dict;
+};
+
+/** Returns the ASCII lower case of a byte
+ * @param c the byte
+ * @return its lower case */
+static unsigned char _kwset_fold(unsigned char c);
+
+/** Builds the trie of the keywords, numbered in the order built
+ * @param k the set, with the classes set
+ * @param trie the transitions are stored here, -1 where there is none
+ * @param out the keyword ending at each state is stored here
+ * @param flags the flags of the keyword ending at each state
+ * @return the count of states */
+static int _kwset_trie(kwset k, int *trie, int *out, int *flags);
+
+kwset kwset_create(void)
+{
+	return calloc(1, sizeof(struct _kwset));
+}
+
+void kwset_free(kwset k)
+{
+	int i;
+
+	if (k == NULL)
+		return;
+
+	for (i = 0; i < k->count; i++)
+		free(k->keywords[i]);
+	free(k->keywords);
+	free(k->lengths);
+	free(k->kflags);
+	free(k->table);
+	free(k->flags);
+	free(k->out);
+	free(k->dict);
+	free(k);
+}
+
+int kwset_add(kwset k, char *keyword, int flags)
+{
+	long len = strlen(keyword);
+	char **keywords;
+	long *lengths;
+	int *kflags;
+	int size;
+
+	if (len == 0 || flags == 0 || k->nstates > 0)
+		return -1;
+
+	if (k->count == k->size) {
+		size = k->size > 0 ? k->size * 2 : 16;
+		keywords = realloc(k->keywords, size * sizeof(*keywords));
+		if (keywords != NULL)
+			k->keywords = keywords;
+		lengths = keywords == NULL ? NULL :
+		    realloc(k->lengths, size * sizeof(*lengths));
+		if (lengths != NULL)
+			k->lengths = lengths;
+		kflags = lengths == NULL ? NULL :
+		    realloc(k->kflags, size * sizeof(*kflags));
+		if (kflags == NULL)
+			return -1;
+		k->kflags = kflags;
+		k->size = size;
+	}
+
+	k->keywords[k->count] = malloc(len + 1);
+	if (k->keywords[k->count] == NULL)
+		return -1;
+	memcpy(k->keywords[k->count], keyword, len + 1);
+	k->lengths[k->count] = len;
+	k->kflags[k->count] = flags;
+	return k->count++;
+}
+
+int kwset_compile(kwset k)
+{
+	int *trie = NULL;
+	int *out = NULL;
+	int *flags = NULL;
+	int *fail = NULL;
+	int *order = NULL;
+	int *number = NULL;
+	long max = 1;
+	int head = 0;
+	int tail = 1;
+	int n;
+	int s;
+	int t;
+	int c;
+	int i;
+	int ret = -1;
+
+	/* the columns, the upper case of a letter goes where the lower does */
+	memset(k->cls, 0, sizeof(k->cls));
+	k->ncls = 1;
+	for (i = 0; i < k->count; i++) {
+		max += k->lengths[i];
+		for (n = 0; n < k->lengths[i]; n++) {
+			c = _kwset_fold(k->keywords[i][n]);
+			if (k->cls[c] == 0 && k->ncls < 256)
+				k->cls[c] = k->ncls++;
+		}
+	}
+	for (c = 'A'; c <= 'Z'; c++)
+		k->cls[c] = k->cls[c - 'A' + 'a'];
+
+	trie = malloc(max * k->ncls * sizeof(*trie));
+	out = malloc(max * sizeof(*out));
+	flags = calloc(max, sizeof(*flags));
+	fail = malloc(max * sizeof(*fail));
+	order = malloc(max * sizeof(*order));
+	number = malloc(max * sizeof(*number));
+	if (trie == NULL || out == NULL || flags == NULL || fail == NULL
+	    || order == NULL || number == NULL)
+		goto done;
+	n = _kwset_trie(k, trie, out, flags);
+
+	/* breadth first, so that the failure state of a state, which is less
+	 * deep, is complete by the time it's needed: the transitions missing
+	 * are those of the failure state */
+	order[0] = 0;
+	fail[0] = 0;
+	while (head < tail) {
+		s = order[head++];
+		for (c = 0; c < k->ncls; c++) {
+			t = trie[s * k->ncls + c];
+			if (t >= 0) {
+				fail[t] = s == 0 ? 0 : trie[fail[s] * k->ncls + c];
+				order[tail++] = t;
+			}
+			else {
+				trie[s * k->ncls + c] = s == 0 ? 0 :
+				    trie[fail[s] * k->ncls + c];
+			}
+		}
+	}
+
+	k->table = malloc((long) n * k->ncls * sizeof(*k->table));
+	k->flags = malloc(n * sizeof(*k->flags));
+	k->out = malloc(n * sizeof(*k->out));
+	k->dict = malloc(n * sizeof(*k->dict));
+	if (k->table == NULL || k->flags == NULL || k->out == NULL
+	    || k->dict == NULL)
+		goto done;
+
+	/* the states are numbered in that order, the suffixes are done before
+	 * the states they are the suffixes of */
+	for (i = 0; i < n; i++)
+		number[order[i]] = i;
+	k->flags[0] = 0;
+	k->out[0] = -1;
+	k->dict[0] = -1;
+	for (i = 1; i < n; i++) {
+		s = order[i];
+		t = number[fail[s]];
+		k->flags[i] = flags[s] | k->flags[t];
+		k->out[i] = out[s];
+		k->dict[i] = k->out[t] >= 0 ? t : k->dict[t];
+	}
+	for (i = 0; i < n; i++) {
+		s = order[i];
+		for (c = 0; c < k->ncls; c++) {
+			t = number[trie[s * k->ncls + c]];
+			k->table[i * k->ncls + c] = k->flags[t] ?
+			    -1 - t * k->ncls : t * k->ncls;
+		}
+	}
+
+	k->nstates = n;
+	ret = 0;
+
+      done:
+	free(trie);
+	free(out);
+	free(flags);
+	free(fail);
+	free(order);
+	free(number);
+	return ret;
+}
+
+int kwset_count(kwset k)
+{
+	return k->count;
+}
+
+long kwset_length(kwset k, int keyword)
+{
+	return k->lengths[keyword];
+}
+
+int kwset_flags(kwset k, int keyword)
+{
+	return k->kflags[keyword];
+}
+
+long kwset_size(kwset k)
+{
+	return (long) k->nstates * (k->ncls + 3) * sizeof(int);
+}
+
+int kwset_scan(kwset k, char *text, long len, int stop)
+{
+	unsigned char *p = (unsigned char *) text;
+	unsigned char *end = p + len;
+	int *table = k->table;
+	int s = 0;
+	int ret = 0;
+
+	if (k->nstates == 0)
+		return 0;
+
+	while (p < end) {
+		s = table[s + k->cls[*p++]];
+		if (s < 0) {
+			s = -1 - s;
+			ret |= k->flags[s / k->ncls];
+			if (ret & stop)
+				return ret;
+		}
+	}
+
+	return ret;
+}
+
+int kwset_match(kwset k, char *text, long len, kwset_fn fn, void *arg)
+{
+	unsigned char *p = (unsigned char *) text;
+	unsigned char *end = p + len;
+	int *table = k->table;
+	int s = 0;
+	int st;
+	int ret;
+
+	if (k->nstates == 0)
+		return 0;
+
+	while (p < end) {
+		s = table[s + k->cls[*p++]];
+		if (s >= 0)
+			continue;
+
+		s = -1 - s;
+		st = s / k->ncls;
+		if (k->out[st] < 0)
+			st = k->dict[st];
+		for (; st >= 0; st = k->dict[st]) {
+			ret = fn(k->out[st], (long) (p - (unsigned char *) text),
+				 arg);
+			if (ret != 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* ************************************
+ * static functions
+ */
+static unsigned char _kwset_fold(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static int _kwset_trie(kwset k, int *trie, int *out, int *flags)
+{
+	int n = 1;
+	int *next;
+	int s;
+	int i;
+	long j;
+
+	memset(trie, 0xff, k->ncls * sizeof(*trie));
+	out[0] = -1;
+
+	for (i = 0; i < k->count; i++) {
+		s = 0;
+		for (j = 0; j < k->lengths[i]; j++) {
+			next = &trie[s * k->ncls +
+				     k->cls[(unsigned char) k->keywords[i][j]]];
+			if (*next < 0) {
+				*next = n;
+				memset(&trie[n * k->ncls], 0xff,
+				       k->ncls * sizeof(*trie));
+				out[n++] = -1;
+			}
+			s = *next;
+		}
+
+		/* a keyword added twice is reported as the first one */
+		if (out[s] < 0)
+			out[s] = i;
+		flags[s] |= k->kflags[i];
+	}
+
+	return n;
+}
@@ -0,0 +1,89 @@
+#ifndef __KWSET_H
+#define __KWSET_H
+#include "main.h"
+
+/** @file */
+
+/** A set of keywords searched for in a text in one pass, however many
+ * there are, see kwset_create() */
+typedef struct _kwset *kwset;
+
+/** The prototype of the function kwset_match() calls for the matches
+ * @param keyword the index of the keyword, in the order they were added
+ * @param end the offset in the text after the match
+ * @param arg the argument given to kwset_match()
+ * @return 0 to go on, anything else to stop */
+typedef int (*kwset_fn) (int keyword, long end, void *arg);
+
+/** Creates an empty set. The keywords are added with kwset_add(), then
+ * kwset_compile() makes an Aho-Corasick automaton of them: a state for
+ * every prefix of a keyword, and a transition for every state and byte,
+ * so that a text is matched one byte at a time without going back. The
+ * bytes not in any keyword share a column of the table, so do the upper
+ * and lower case of an ASCII letter, which keeps the table small, and the
+ * states are numbered by their depth, so that the ones a text visits most
+ * are next to each other.
+ * @return the set, NULL if out of memory */
+kwset kwset_create(void);
+
+/** Frees a set
+ * @param k the set, may be NULL */
+void kwset_free(kwset k);
+
+/** Adds a keyword, matched anywhere in a text regardless of the case of
+ * the ASCII letters. Can't be called once the set is compiled.
+ * @param k the set
+ * @param keyword the keyword, not empty
+ * @param flags the flags kwset_scan() returns if the keyword matches, not 0
+ * @return the index of the keyword, -1 if out of memory, or the keyword or
+ * the flags are empty */
+int kwset_add(kwset k, char *keyword, int flags);
+
+/** Makes the automaton of the keywords added, once
+ * @param k the set
+ * @retval 0 if succeeded
+ * @retval -1 if out of memory */
+int kwset_compile(kwset k);
+
+/** Returns the count of keywords in a set
+ * @param k the set
+ * @return the count */
+int kwset_count(kwset k);
+
+/** Returns the length of a keyword
+ * @param k the set
+ * @param keyword the index of the keyword
+ * @return the length in bytes */
+long kwset_length(kwset k, int keyword);
+
+/** Returns the flags of a keyword
+ * @param k the set
+ * @param keyword the index of the keyword
+ * @return the flags given to kwset_add() */
+int kwset_flags(kwset k, int keyword);
+
+/** Returns the memory the automaton takes
+ * @param k the compiled set
+ * @return the size in bytes */
+long kwset_size(kwset k);
+
+/** Returns the flags of the keywords in a text
+ * @param k the compiled set
+ * @param text the text
+ * @param len its length
+ * @param stop the search stops at the first keyword with any of these
+ * flags, 0 to search the whole text
+ * @return the flags of the keywords found, OR-ed */
+int kwset_scan(kwset k, char *text, long len, int stop);
+
+/** Calls fn for every keyword in a text, in the order they end, the
+ * longer first if several end at the same place
+ * @param k the compiled set
+ * @param text the text
+ * @param len its length
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @return the non-zero value fn returned, 0 if it never did */
+int kwset_match(kwset k, char *text, long len, kwset_fn fn, void *arg);
+
+#endif
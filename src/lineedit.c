@@ -0,0 +1,639 @@
+#define MEM_AREA MEM_UI
+#include "lineedit.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+/** @file */
+
+/** The characters a word to complete starts after */
+#define LINEEDIT_SEPARATORS " \t,@"
+
+/** The longest completion taken */
+#define LINEEDIT_COMPLETION 256
+
+/** The control keys */
+#define _CTRL(x) ((x) & 0x1f)
+
+/** True for the bytes continuing a character in UTF-8 */
+#define _CONT(c) (((c) & 0xc0) == 0x80)
+
+/** The milliseconds the rest of an escape sequence is waited for, a lone
+ * Esc is dropped after them */
+#define LINEEDIT_ESCAPE 50
+
+/** The longest parameters of an escape sequence kept, longer ones are
+ * read and dropped */
+#define LINEEDIT_PARAMS 16
+
+struct _lineedit {
+
+	/** The lines read, the latest one last */
+	char **history;
+
+	/** The count of lines in the history, and the most kept */
+	int count;
+	int max;
+
+	/** The function completing a word, NULL if none, and its argument */
+	lineedit_fn fn;
+	void *arg;
+};
+
+/** The line being edited */
+struct _edit {
+
+	/** The line editor */
+	lineedit le;
+
+	/** The prompt, and its width */
+	char *prompt;
+	int prompt_width;
+
+	/** The line, its size, its length and the offset of the cursor */
+	char *buf;
+	int size;
+	int len;
+	int pos;
+
+	/** The line of the history shown, le->count for the one edited */
+	int hist;
+
+	/** The line edited while one of the history is shown, NULL if none */
+	char *saved;
+
+	/** True if the last key was a Tab completing nothing */
+	int tabbed;
+
+	/** The buffer the line is drawn in, its size is out_size */
+	char *out;
+	int out_size;
+};
+
+/** The modes of the terminal while a line is read, and the ones it had */
+static struct termios _raw_mode;
+static struct termios _orig_mode;
+
+/** The actions of the signals the terminal sends, while a line is read */
+static struct sigaction _old_tstp;
+static struct sigaction _old_quit;
+
+/** Reads a line from the terminal in raw mode
+ * @param e the line
+ * @retval 0 if a line was read
+ * @retval -1 at the end of the input */
+static int _edit(struct _edit *e);
+
+/** Handles an escape sequence, the arrows and Home, End and Delete; the
+ * others are read and ignored
+ * @param e the line */
+static void _edit_escape(struct _edit *e);
+
+/** Reads a byte of an escape sequence, waiting LINEEDIT_ESCAPE
+ * milliseconds at most
+ * @param c the byte is stored here
+ * @retval 0 if a byte was read
+ * @retval -1 if none came */
+static int _escape_byte(unsigned char *c);
+
+/** Gives the terminal back for Ctrl-Z and Ctrl-\, and takes it again if
+ * the process goes on
+ * @param sig the signal */
+static void _edit_signal(int sig);
+
+/** Completes the word before the cursor, see lineedit_fn
+ * @param e the line */
+static void _edit_complete(struct _edit *e);
+
+/** Inserts characters at the cursor
+ * @param e the line
+ * @param s the characters
+ * @param n their count
+ * @retval 0 if inserted
+ * @retval -1 if there is no room for them */
+static int _edit_insert(struct _edit *e, char *s, int n);
+
+/** Deletes characters
+ * @param e the line
+ * @param from the offset of the first one
+ * @param to the offset after the last one */
+static void _edit_delete(struct _edit *e, int from, int to);
+
+/** Shows another line of the history
+ * @param e the line
+ * @param dir -1 for an older one, 1 for a newer one */
+static void _edit_history(struct _edit *e, int dir);
+
+/** Draws the line, scrolled sideways so that the cursor is on the screen
+ * @param e the line */
+static void _edit_refresh(struct _edit *e);
+
+/** Returns the offset of the character before or after an offset
+ * @param e the line
+ * @param pos the offset
+ * @param dir -1 for the one before, 1 for the one after
+ * @return the offset */
+static int _edit_step(struct _edit *e, int pos, int dir);
+
+/** Returns the count of characters in a UTF-8 string, taken as its width
+ * @param s the string
+ * @param n its length in bytes
+ * @return the width */
+static int _width(char *s, int n);
+
+/** Writes a string to the terminal
+ * @param s the string */
+static void _out(char *s);
+
+/** Adds a line to the history
+ * @param le the line editor
+ * @param line the line, without the newline */
+static void _history_add(lineedit le, char *line);
+
+lineedit lineedit_create(int history)
+{
+	lineedit ret = calloc(1, sizeof(*ret));
+
+	if (ret == NULL)
+		return NULL;
+
+	ret->max = history > 0 ? history : 1;
+	ret->history = calloc(ret->max, sizeof(char *));
+	if (ret->history == NULL) {
+		free(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+void lineedit_free(lineedit le)
+{
+	int i;
+
+	if (le == NULL)
+		return;
+
+	for (i = 0; i < le->count; i++)
+		free(le->history[i]);
+	free(le->history);
+	free(le);
+}
+
+void lineedit_complete(lineedit le, lineedit_fn fn, void *arg)
+{
+	le->fn = fn;
+	le->arg = arg;
+}
+
+int lineedit_terminal(void)
+{
+	return isatty(STDOUT_FILENO);
+}
+
+char *lineedit_read(lineedit le, char *prompt, char *buf, int size)
+{
+	struct sigaction sa;
+	struct _edit e;
+	int ret;
+
+	fputs(prompt, stdout);
+	fflush(stdout);
+
+	/* piped input is read as it comes */
+	if (size < 3 || !isatty(STDIN_FILENO)
+	    || tcgetattr(STDIN_FILENO, &_orig_mode) < 0)
+		return fgets(buf, size, stdin);
+
+	/* a character at a time, with no echo; Ctrl-C is a key, Ctrl-Z and
+	 * Ctrl-\ still send their signals */
+	_raw_mode = _orig_mode;
+	_raw_mode.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	_raw_mode.c_lflag &= ~(ECHO | ICANON | IEXTEN);
+	_raw_mode.c_cc[VINTR] = _POSIX_VDISABLE;
+	_raw_mode.c_cc[VMIN] = 1;
+	_raw_mode.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSADRAIN, &_raw_mode) < 0)
+		return fgets(buf, size, stdin);
+
+	/* no SA_RESTART, the line is drawn again when the process goes on */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _edit_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTSTP, &sa, &_old_tstp);
+	sigaction(SIGQUIT, &sa, &_old_quit);
+
+	memset(&e, 0, sizeof(e));
+	e.le = le;
+	e.prompt = prompt;
+	e.prompt_width = _width(prompt, strlen(prompt));
+	e.buf = buf;
+	e.size = size;
+	e.hist = le->count;
+	e.out_size = strlen(prompt) + size + 32;
+	e.out = malloc(e.out_size);
+	buf[0] = 0;
+
+	ret = e.out != NULL ? _edit(&e) : -1;
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &_orig_mode);
+	sigaction(SIGTSTP, &_old_tstp, NULL);
+	sigaction(SIGQUIT, &_old_quit, NULL);
+
+	free(e.out);
+	free(e.saved);
+	if (ret < 0)
+		return NULL;
+
+	_history_add(le, buf);
+	buf[e.len] = '\n';
+	buf[e.len + 1] = 0;
+	return buf;
+}
+
+/* ************************************
+ * static functions
+ */
+static int _edit(struct _edit *e)
+{
+	unsigned char c;
+	char ch;
+	int tabbed;
+	int from;
+	int n;
+
+	for (;;) {
+		n = read(STDIN_FILENO, &c, 1);
+		if (n < 0 && errno == EINTR) {
+			/* back from Ctrl-Z */
+			_edit_refresh(e);
+			continue;
+		}
+		if (n <= 0)
+			return -1;
+
+		tabbed = e->tabbed;
+		e->tabbed = 0;
+
+		switch (c) {
+		case '\r':
+		case '\n':
+			e->pos = e->len;
+			_edit_refresh(e);
+			_out("\n");
+			return 0;
+		case _CTRL('C'):
+			_out("^C\n");
+			e->len = e->pos = 0;
+			e->buf[0] = 0;
+			e->hist = e->le->count;
+			break;
+		case _CTRL('D'):
+			if (e->len == 0) {
+				_out("\n");
+				return -1;
+			}
+			_edit_delete(e, e->pos, _edit_step(e, e->pos, 1));
+			break;
+		case 127:
+		case _CTRL('H'):
+			_edit_delete(e, _edit_step(e, e->pos, -1), e->pos);
+			break;
+		case '\t':
+			e->tabbed = tabbed;
+			_edit_complete(e);
+			break;
+		case _CTRL('A'):
+			e->pos = 0;
+			break;
+		case _CTRL('E'):
+			e->pos = e->len;
+			break;
+		case _CTRL('B'):
+			e->pos = _edit_step(e, e->pos, -1);
+			break;
+		case _CTRL('F'):
+			e->pos = _edit_step(e, e->pos, 1);
+			break;
+		case _CTRL('U'):
+			_edit_delete(e, 0, e->pos);
+			break;
+		case _CTRL('K'):
+			_edit_delete(e, e->pos, e->len);
+			break;
+		case _CTRL('W'):
+			from = e->pos;
+			while (from > 0 && e->buf[from - 1] == ' ')
+				from--;
+			while (from > 0 && e->buf[from - 1] != ' ')
+				from--;
+			_edit_delete(e, from, e->pos);
+			break;
+		case _CTRL('L'):
+			_out("\x1b[H\x1b[2J");
+			break;
+		case _CTRL('P'):
+			_edit_history(e, -1);
+			break;
+		case _CTRL('N'):
+			_edit_history(e, 1);
+			break;
+		case 27:
+			_edit_escape(e);
+			break;
+		default:
+			/* the other control keys are ignored, UTF-8 is taken */
+			ch = c;
+			if (c < ' ' || _edit_insert(e, &ch, 1) < 0)
+				_out("\a");
+			break;
+		}
+
+		_edit_refresh(e);
+	}
+}
+
+static void _edit_escape(struct _edit *e)
+{
+	char params[LINEEDIT_PARAMS];
+	unsigned char c;
+	unsigned char kind;
+	int len = 0;
+	int key;
+
+	/* a lone Esc, or Alt with a key, is dropped */
+	if (_escape_byte(&kind) < 0 || (kind != '[' && kind != 'O'))
+		return;
+
+	/* CSI: parameters and intermediates, up to the final byte */
+	for (;;) {
+		if (_escape_byte(&c) < 0)
+			return;
+		if (kind == 'O' || (c >= 0x40 && c <= 0x7e))
+			break;
+		if (c < 0x20 || c > 0x3f)
+			return;
+		if (len < LINEEDIT_PARAMS - 1)
+			params[len++] = c;
+	}
+	params[len] = 0;
+
+	/* the modifiers after a ';' are ignored: Ctrl-Right moves as Right */
+	switch (c) {
+	case '~':
+		key = atoi(params);
+		if (key == 1 || key == 7)
+			e->pos = 0;
+		else if (key == 4 || key == 8)
+			e->pos = e->len;
+		else if (key == 3)
+			_edit_delete(e, e->pos, _edit_step(e, e->pos, 1));
+		break;
+	case 'A':
+		_edit_history(e, -1);
+		break;
+	case 'B':
+		_edit_history(e, 1);
+		break;
+	case 'C':
+		e->pos = _edit_step(e, e->pos, 1);
+		break;
+	case 'D':
+		e->pos = _edit_step(e, e->pos, -1);
+		break;
+	case 'H':
+		e->pos = 0;
+		break;
+	case 'F':
+		e->pos = e->len;
+		break;
+	}
+}
+
+static int _escape_byte(unsigned char *c)
+{
+	struct pollfd pfd;
+
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, LINEEDIT_ESCAPE) <= 0)
+		return -1;
+	return read(STDIN_FILENO, c, 1) == 1 ? 0 : -1;
+}
+
+static void _edit_signal(int sig)
+{
+	struct sigaction sa;
+	sigset_t set;
+	int err = errno;
+
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &_orig_mode);
+
+	/* the signal is sent again, with its default action */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_DFL;
+	sigemptyset(&sa.sa_mask);
+	sigaction(sig, &sa, NULL);
+	sigemptyset(&set);
+	sigaddset(&set, sig);
+	raise(sig);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
+
+	/* stopped until here, unless Ctrl-\ quit */
+	sa.sa_handler = _edit_signal;
+	sigaction(sig, &sa, NULL);
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &_raw_mode);
+	errno = err;
+}
+
+static void _edit_complete(struct _edit *e)
+{
+	char ext[LINEEDIT_COMPLETION];
+	char c;
+	int start = e->pos;
+	long n;
+
+	while (start > 0
+	       && strchr(LINEEDIT_SEPARATORS, e->buf[start - 1]) == NULL)
+		start--;
+	if (e->le->fn == NULL || start == e->pos) {
+		_out("\a");
+		return;
+	}
+
+	/* the word is cut at the cursor while the function looks at it */
+	c = e->buf[e->pos];
+	e->buf[e->pos] = 0;
+	if (e->tabbed) {
+		_out("\n");
+		e->le->fn(e->buf + start, ext, sizeof(ext), 1, e->le->arg);
+		fflush(stdout);
+		n = 0;
+	}
+	else {
+		n = e->le->fn(e->buf + start, ext, sizeof(ext), 0, e->le->arg);
+	}
+	e->buf[e->pos] = c;
+
+	if (n > 0 && _edit_insert(e, ext, n) < 0)
+		n = -1;
+
+	/* unless the word is complete, Tab again lists what it could be */
+	if (e->tabbed || (n > 0 && ext[n - 1] == ' ')) {
+		e->tabbed = 0;
+	}
+	else {
+		_out("\a");
+		e->tabbed = n >= 0;
+	}
+}
+
+static int _edit_insert(struct _edit *e, char *s, int n)
+{
+	/* room for the newline and the terminator */
+	if (e->len + n + 2 > e->size)
+		return -1;
+
+	memmove(e->buf + e->pos + n, e->buf + e->pos, e->len - e->pos + 1);
+	memcpy(e->buf + e->pos, s, n);
+	e->len += n;
+	e->pos += n;
+	return 0;
+}
+
+static void _edit_delete(struct _edit *e, int from, int to)
+{
+	if (from >= to)
+		return;
+
+	memmove(e->buf + from, e->buf + to, e->len - to + 1);
+	e->len -= to - from;
+	if (e->pos >= to)
+		e->pos -= to - from;
+	else if (e->pos > from)
+		e->pos = from;
+}
+
+static void _edit_history(struct _edit *e, int dir)
+{
+	lineedit le = e->le;
+	char *line;
+	int hist = e->hist + dir;
+
+	if (hist < 0 || hist > le->count)
+		return;
+
+	/* the line edited is kept until it's shown again */
+	if (e->hist == le->count) {
+		free(e->saved);
+		e->saved = malloc(e->len + 1);
+		if (e->saved == NULL)
+			return;
+		memcpy(e->saved, e->buf, e->len + 1);
+	}
+
+	line = hist < le->count ? le->history[hist] : e->saved;
+	e->len = 0;
+	if (line != NULL) {
+		e->len = strlen(line);
+		if (e->len + 2 > e->size)
+			e->len = e->size - 2;
+		memcpy(e->buf, line, e->len);
+	}
+	e->buf[e->len] = 0;
+	e->pos = e->len;
+	e->hist = hist;
+}
+
+static void _edit_refresh(struct _edit *e)
+{
+	struct winsize ws;
+	int cols = 80;
+	int start = 0;
+	int end = e->len;
+	int n;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+		cols = ws.ws_col;
+
+	/* the line scrolls left until the cursor fits, and is cut on the
+	 * right where the screen ends */
+	while (start < e->pos && e->prompt_width
+	       + _width(e->buf + start, e->pos - start) >= cols)
+		start = _edit_step(e, start, 1);
+	while (end > e->pos
+	       && e->prompt_width + _width(e->buf + start, end - start) >= cols)
+		end = _edit_step(e, end, -1);
+
+	n = sprintf(e->out, "\r%s", e->prompt);
+	memcpy(e->out + n, e->buf + start, end - start);
+	n += end - start;
+	n += sprintf(e->out + n, "\x1b[K\r");
+	if (e->prompt_width + _width(e->buf + start, e->pos - start) > 0)
+		sprintf(e->out + n, "\x1b[%dC", e->prompt_width
+			+ _width(e->buf + start, e->pos - start));
+	_out(e->out);
+}
+
+static int _edit_step(struct _edit *e, int pos, int dir)
+{
+	if (dir < 0) {
+		while (pos > 0 && _CONT(e->buf[--pos]))
+			;
+	}
+	else if (pos < e->len) {
+		while (++pos < e->len && _CONT(e->buf[pos]))
+			;
+	}
+
+	return pos;
+}
+
+static int _width(char *s, int n)
+{
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!_CONT(s[i]))
+			ret++;
+
+	return ret;
+}
+
+static void _out(char *s)
+{
+	long len = strlen(s);
+	long ret;
+
+	while (len > 0 && (ret = write(STDOUT_FILENO, s, len)) > 0) {
+		s += ret;
+		len -= ret;
+	}
+}
+
+static void _history_add(lineedit le, char *line)
+{
+	char *copy;
+
+	if (line[0] == 0
+	    || (le->count > 0 && strcmp(le->history[le->count - 1], line) == 0))
+		return;
+
+	copy = malloc(strlen(line) + 1);
+	if (copy == NULL)
+		return;
+	strcpy(copy, line);
+
+	if (le->count == le->max) {
+		free(le->history[0]);
+		memmove(le->history, le->history + 1,
+			(le->max - 1) * sizeof(char *));
+		le->count--;
+	}
+	le->history[le->count++] = copy;
+}
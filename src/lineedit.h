@@ -0,0 +1,59 @@
+#ifndef __LINEEDIT_H
+#define __LINEEDIT_H
+#include "main.h"
+
+/** @file */
+
+/** The count of lines kept in the history by default */
+#define LINEEDIT_HISTORY 100
+
+/** Reads lines from the terminal with editing, a history and completion,
+ * see lineedit_create() */
+typedef struct _lineedit *lineedit;
+
+/** The prototype of the function completing a word, see lineedit_complete()
+ * @param word the word before the cursor, without a leading '@'
+ * @param buf the characters completing the word are stored here, with a
+ * space after them if the word is complete
+ * @param size the size of buf
+ * @param list true if the completions are to be printed instead, one per
+ * line: Tab was pressed twice
+ * @param arg the argument given to lineedit_complete()
+ * @return the count of characters stored, -1 if nothing completes the
+ * word */
+typedef long (*lineedit_fn) (char *word, char *buf, long size, int list,
+			     void *arg);
+
+/** Creates a line editor. It works on the terminal stdin and stdout are
+ * connected to, the terminal is put into raw mode while a line is read
+ * only. If stdin isn't a terminal, the lines are read as they come.
+ * @param history the count of lines kept in the history
+ * @return the line editor, NULL if out of memory */
+lineedit lineedit_create(int history);
+
+/** Frees a line editor with its history
+ * @param le the line editor, may be NULL */
+void lineedit_free(lineedit le);
+
+/** Sets the function completing the word before the cursor on Tab
+ * @param le the line editor
+ * @param fn the function, NULL for none
+ * @param arg passed to fn */
+void lineedit_complete(lineedit le, lineedit_fn fn, void *arg);
+
+/** Tells if stdout is a terminal, which takes escape sequences
+ * @return true if it is */
+int lineedit_terminal(void);
+
+/** Reads a line, the way fgets() does: the line ends with '\\n' unless it's
+ * too long for buf. Ctrl-C drops the line and reads another, Ctrl-D on an
+ * empty line is the end of the input. The lines read are added to the
+ * history.
+ * @param le the line editor
+ * @param prompt printed before the line
+ * @param buf the line is stored here
+ * @param size the size of buf
+ * @return buf, NULL at the end of the input */
+char *lineedit_read(lineedit le, char *prompt, char *buf, int size);
+
+#endif
@@ -0,0 +1,234 @@
+#include "main.h"
+#include "http.h"
+#include "stats.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/** @file
+ * Drives the HTTP client with concurrent requests, to measure it against
+ * mockserver (or anything else that speaks the API). Every worker is a
+ * process of its own running the unchanged blocking client, and reports
+ * every request through a pipe, so that the histograms are built in one
+ * place.
+ *
+ * Usage: loadtest [-h host:port] [-c concurrency] [-n requests] [-p path]
+ * [-t transport] [-d deadline]
+ *
+ * The system calls the transport made are counted per request, so that
+ * "posix" and "uring" can be compared with -t.
+ *
+ * With -d ms, every request is given that long, retries included, and a
+ * quarter of it to connect and to get the first byte of each attempt: run
+ * against a server that stalls (mockserver -s), the p99 of the time the
+ * requests took, failed ones included, has to stay within the deadline,
+ * and no more than 1 in FAILED_MAX of them may fail.
+ */
+
+/** The defaults */
+#define DEFAULT_HOST "127.0.0.1:8642"
+#define DEFAULT_PATH "/statuses/friends_timeline.json"
+#define DEFAULT_CONCURRENCY 8
+#define DEFAULT_REQUESTS 1000
+
+/** With -d, one request in FAILED_MAX may fail, all of its attempts
+ * stalled */
+#define FAILED_MAX 100
+
+/** The report of one request, small enough to be written atomically */
+struct _record {
+
+	/** The time the request took, in microseconds */
+	double usec;
+
+	/** The HTTP status code or the negative enum http_error */
+	int status;
+
+	/** The size of the response body */
+	long bytes;
+
+	/** The count of system calls made for the I/O */
+	long syscalls;
+};
+
+/** Sends the requests and reports them to the pipe, run in the workers
+ * @param fd the write end of the pipe
+ * @param host the server
+ * @param path the file to request
+ * @param requests the count of requests to send */
+static void _worker(int fd, char *host, char *path, int requests);
+
+/** Compares two times for qsort() */
+static int _usec_cmp(const void *a, const void *b);
+
+int main(int argc, char **argv)
+{
+	struct _record rec;
+	char *host = DEFAULT_HOST;
+	char *path = DEFAULT_PATH;
+	int concurrency = DEFAULT_CONCURRENCY;
+	int requests = DEFAULT_REQUESTS;
+	int deadline = 0;
+	double *times;
+	double p99;
+	long done = 0;
+	long errors = 0;
+	double bytes = 0;
+	double syscalls = 0;
+	double start;
+	double elapsed;
+	int fds[2];
+	int opt;
+	int ret;
+	int i;
+
+	while ((opt = getopt(argc, argv, "h:c:n:p:t:d:")) != -1) {
+		switch (opt) {
+		case 'h':
+			host = optarg;
+			break;
+		case 'c':
+			concurrency = atoi(optarg);
+			break;
+		case 'n':
+			requests = atoi(optarg);
+			break;
+		case 'p':
+			path = optarg;
+			break;
+		case 't':
+			if (http_set_transport(optarg) == 0)
+				break;
+			fprintf(stderr, "loadtest: no transport %s\n", optarg);
+			return 1;
+		case 'd':
+			deadline = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-h host:port] "
+				"[-c concurrency] [-n requests] [-p path] "
+				"[-t transport] [-d deadline]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (requests < 1)
+		requests = 1;
+	if (concurrency < 1)
+		concurrency = 1;
+	if (concurrency > requests)
+		concurrency = requests;
+	if (deadline > 0)
+		http_set_timeouts(deadline / 4, deadline / 4, deadline, 2);
+
+	times = malloc(requests * sizeof(*times));
+	if (times == NULL || pipe(fds) < 0) {
+		perror("loadtest");
+		return 1;
+	}
+
+	start = stats_now();
+	for (i = 0; i < concurrency; i++) {
+		switch (fork()) {
+		case -1:
+			perror("loadtest");
+			return 1;
+		case 0:
+			close(fds[0]);
+			/* the first workers take the remainder */
+			_worker(fds[1], host, path, requests / concurrency +
+				(i < requests % concurrency));
+			_exit(0);
+		}
+	}
+	close(fds[1]);
+
+	/* the pipe is closed once every worker has exited */
+	for (;;) {
+		ret = read(fds[0], &rec, sizeof(rec));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret != sizeof(rec))
+			break;
+
+		if (done < requests)
+			times[done] = rec.usec;
+		done++;
+		syscalls += rec.syscalls;
+		if (rec.status != 200) {
+			errors++;
+			continue;
+		}
+		bytes += rec.bytes;
+		stats_record(STATS_REQUEST, rec.usec, rec.bytes);
+	}
+	elapsed = (stats_now() - start) / 1e6;
+
+	while (wait(NULL) > 0) ;
+
+	printf("requests %ld, errors %ld, %.1f req/s, %.2f MB/s, "
+	       "%.1f syscalls/req\n", done, errors,
+	       elapsed > 0 ? done / elapsed : 0,
+	       elapsed > 0 ? bytes / elapsed / 1e6 : 0,
+	       done > 0 ? syscalls / done : 0);
+	stats_dump(stdout);
+
+	if (done != requests || deadline <= 0) {
+		free(times);
+		return done == requests && errors == 0 ? 0 : 1;
+	}
+
+	/* the stalls cost time, but no more than the deadline */
+	qsort(times, done, sizeof(*times), _usec_cmp);
+	p99 = times[(done * 99 - 1) / 100];
+	printf("p99 %.0f us, max %.0f us, deadline %d ms\n", p99,
+	       times[done - 1], deadline);
+	free(times);
+	if (p99 > deadline * 1000.0) {
+		printf("FAIL: the p99 is over the deadline\n");
+		return 1;
+	}
+	if (errors * FAILED_MAX > done) {
+		printf("FAIL: %ld requests failed\n", errors);
+		return 1;
+	}
+	return 0;
+}
+
+/* ************************************
+ * static functions
+ */
+static void _worker(int fd, char *host, char *path, int requests)
+{
+	struct _record rec;
+	char *output;
+	double start;
+	long syscalls;
+	int i;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < requests; i++) {
+		output = NULL;
+		start = stats_now();
+		syscalls = http_syscalls();
+		rec.status = http_get_auth(host, path, &output, "mock", "mock");
+		rec.syscalls = http_syscalls() - syscalls;
+		rec.usec = stats_now() - start;
+		rec.bytes = output == NULL ? 0 : (long) strlen(output);
+		free(output);
+
+		if (write(fd, &rec, sizeof(rec)) != sizeof(rec))
+			return;
+	}
+}
+
+static int _usec_cmp(const void *a, const void *b)
+{
+	double x = *(double *) a;
+	double y = *(double *) b;
+
+	return x < y ? -1 : x > y;
+}
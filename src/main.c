@@ -1,4 +1,6 @@
+#define MEM_AREA MEM_UI
 #include "main.h"
+#include "stats.h"
 #include "ui.h"
 #include <stdio.h>
 
@@ -16,6 +18,9 @@ char *mystrdup(char *str)
 /** The main() function doesn't do much, just calls the ui */
 int main(int argc, char **argv)
 {
+	mem_init();
+	stats_init();
+
 	if (argc < 2)
 		init_ui(NULL);
 	else
@@ -2,6 +2,7 @@
 #define __MAIN_H
 #include <stdlib.h>
 #include <string.h>
+#include "mem.h"
 
 /** @file */
 
@@ -0,0 +1,393 @@
+#define MEM_IMPL
+#include "mem.h"
+#include <string.h>
+
+/** @file */
+
+/** The name of the environment variable naming the file the leaks are
+ * written to */
+#define MEM_ENV "TWITTERM_MEMDEBUG"
+
+/** The marks in the header of a block: allocated without the place,
+ * allocated with it, and freed */
+#define MEM_PLAIN 0xa110
+#define MEM_SITED 0xa115
+#define MEM_FREED 0xdead
+
+/** The header before every block, as large as the strictest alignment */
+union _mem_head {
+	struct {
+
+		/** The size asked for */
+		size_t size;
+
+		/** The enum mem_area the block is accounted to */
+		unsigned short area;
+
+		/** MEM_PLAIN, MEM_SITED or MEM_FREED */
+		unsigned short mark;
+	} h;
+	long double align_ld;
+	void *align_p;
+	long align_l;
+};
+
+/** The place a block was allocated at, before its header if the places
+ * are recorded. The blocks are linked into a ring. */
+union _mem_site {
+	struct {
+		union _mem_site *prev;
+		union _mem_site *next;
+		char *file;
+		int line;
+	} s;
+	long double align_ld;
+	void *align_p;
+};
+
+/** The counters of the areas, and of all of them at the end */
+static struct mem_stats areas[MEM_AREAS + 1];
+
+/** The names of the areas, as printed */
+static char *area_names[MEM_AREAS + 1] = {
+	"other", "json", "http", "status", "list", "spool", "ui", "total"
+};
+
+/** The ring of the blocks with their place, the head of it */
+static union _mem_site sites = { {&sites, &sites, NULL, 0} };
+
+/** True if the places are recorded */
+static int recording = 0;
+
+/** The file the leaks are written to at exit */
+static char *leak_file = NULL;
+
+/** Sets the header of a new block up, and accounts it
+ * @param raw the memory the block is in
+ * @param area the enum mem_area
+ * @param size the size asked for
+ * @param mark MEM_PLAIN or MEM_SITED
+ * @param file the place, if mark is MEM_SITED
+ * @param line the place, if mark is MEM_SITED
+ * @return the block */
+static void *_mem_attach(void *raw, int area, size_t size, int mark,
+			 char *file, int line);
+
+/** Removes a block from the accounts
+ * @param head the header of the block */
+static void _mem_detach(union _mem_head *head);
+
+/** Returns the header of a block, aborts if it's not a block allocated
+ * here and not freed yet
+ * @param ptr the block
+ * @return the header */
+static union _mem_head *_mem_head(void *ptr);
+
+/** Returns the memory a block is in
+ * @param head the header of the block
+ * @return what malloc() returned */
+static void *_mem_raw(union _mem_head *head);
+
+/** Adds to the counters of an area and of the total
+ * @param area the enum mem_area
+ * @param bytes the bytes to add, negative for freed ones
+ * @param blocks the blocks to add */
+static void _mem_count(int area, long bytes, long blocks);
+
+/** Compares the places of two blocks for qsort() */
+static int _mem_site_cmp(const void *a, const void *b);
+
+/** Writes the leaks to leak_file, registered with atexit() */
+static void _mem_write(void);
+
+void mem_init(void)
+{
+	char *env = getenv(MEM_ENV);
+
+	if (env == NULL || *env == 0)
+		return;
+
+	leak_file = env;
+	recording = 1;
+	atexit(_mem_write);
+}
+
+void *mem_malloc(int area, size_t size, char *file, int line)
+{
+	int mark = recording ? MEM_SITED : MEM_PLAIN;
+	size_t extra = sizeof(union _mem_head) +
+	    (mark == MEM_SITED ? sizeof(union _mem_site) : 0);
+	void *raw;
+
+	if (size > (size_t) -1 - extra || (raw = malloc(size + extra)) == NULL)
+		return NULL;
+
+	areas[area].count++;
+	areas[area].bytes += size;
+	return _mem_attach(raw, area, size, mark, file, line);
+}
+
+void *mem_calloc(int area, size_t nmemb, size_t size, char *file,
+		 int line)
+{
+	int mark = recording ? MEM_SITED : MEM_PLAIN;
+	size_t extra = sizeof(union _mem_head) +
+	    (mark == MEM_SITED ? sizeof(union _mem_site) : 0);
+	void *raw;
+
+	if (size != 0 && nmemb > ((size_t) -1 - extra) / size)
+		return NULL;
+
+	/* not malloc() and memset(), calloc() knows fresh pages are zero */
+	raw = calloc(1, nmemb * size + extra);
+	if (raw == NULL)
+		return NULL;
+
+	areas[area].count++;
+	areas[area].bytes += nmemb * size;
+	return _mem_attach(raw, area, nmemb * size, mark, file, line);
+}
+
+void *mem_realloc(int area, void *ptr, size_t size, char *file, int line)
+{
+	union _mem_head *head;
+	union _mem_site *site;
+	size_t extra;
+	void *raw;
+	char *old_file = NULL;
+	int old_line = 0;
+	int old_area;
+	size_t old_size;
+	int mark;
+
+	if (ptr == NULL)
+		return mem_malloc(area, size, file, line);
+	if (size == 0) {
+		mem_free(ptr);
+		return NULL;
+	}
+
+	/* the block may move, so it leaves the ring until it's settled */
+	head = _mem_head(ptr);
+	mark = head->h.mark;
+	old_area = head->h.area;
+	old_size = head->h.size;
+	if (mark == MEM_SITED) {
+		site = _mem_raw(head);
+		old_file = site->s.file;
+		old_line = site->s.line;
+	}
+	extra = sizeof(union _mem_head) +
+	    (mark == MEM_SITED ? sizeof(union _mem_site) : 0);
+	_mem_detach(head);
+
+	raw = size <= (size_t) -1 - extra ?
+	    realloc(_mem_raw(head), size + extra) : NULL;
+	if (raw == NULL) {
+		_mem_attach(_mem_raw(head), old_area, old_size, mark, old_file,
+			    old_line);
+		return NULL;
+	}
+
+	areas[area].count++;
+	areas[area].bytes += size;
+	return _mem_attach(raw, area, size, mark, file, line);
+}
+
+void mem_free(void *ptr)
+{
+	union _mem_head *head;
+	void *raw;
+
+	if (ptr == NULL)
+		return;
+
+	head = _mem_head(ptr);
+	raw = _mem_raw(head);
+	_mem_detach(head);
+	head->h.mark = MEM_FREED;
+	free(raw);
+}
+
+void mem_get(int area, struct mem_stats *stats)
+{
+	int i;
+
+	*stats = areas[area];
+	if (area != MEM_AREAS)
+		return;
+
+	/* the total of the allocations is summed when asked */
+	stats->count = 0;
+	stats->bytes = 0;
+	for (i = 0; i < MEM_AREAS; i++) {
+		stats->count += areas[i].count;
+		stats->bytes += areas[i].bytes;
+	}
+}
+
+char *mem_area_name(int area)
+{
+	return area_names[area];
+}
+
+void mem_dump(FILE * fp)
+{
+	struct mem_stats stats;
+	int i;
+
+	fprintf(fp, "%-12s %12s %12s %10s %10s %14s\n", "area", "live",
+		"peak", "blocks", "allocs", "bytes");
+
+	for (i = 0; i <= MEM_AREAS; i++) {
+		mem_get(i, &stats);
+		fprintf(fp, "%-12s %12ld %12ld %10ld %10lu %14lu\n",
+			area_names[i], stats.live, stats.peak, stats.blocks,
+			stats.count, stats.bytes);
+	}
+}
+
+long mem_leaks(FILE * fp)
+{
+	union _mem_site **all;
+	union _mem_site *site;
+	union _mem_head *head;
+	long count = 0;
+	long blocks;
+	long bytes;
+	long total = 0;
+	long i;
+
+	for (site = sites.s.next; site != &sites; site = site->s.next)
+		count++;
+	if (count == 0) {
+		fprintf(fp, "0 bytes in 0 blocks not freed\n");
+		return 0;
+	}
+
+	all = malloc(count * sizeof(*all));
+	if (all == NULL) {
+		fprintf(fp, "%ld blocks not freed\n", count);
+		return count;
+	}
+	count = 0;
+	for (site = sites.s.next; site != &sites; site = site->s.next)
+		all[count++] = site;
+
+	/* summed up by the place, the ones of a place are next to each other
+	 * once sorted */
+	qsort(all, count, sizeof(*all), _mem_site_cmp);
+	for (i = 0; i < count; i += blocks) {
+		bytes = 0;
+		for (blocks = 0; i + blocks < count
+		     && _mem_site_cmp(&all[i], &all[i + blocks]) == 0; blocks++) {
+			head = (union _mem_head *) (all[i + blocks] + 1);
+			bytes += head->h.size;
+		}
+		head = (union _mem_head *) (all[i] + 1);
+		fprintf(fp, "%s:%d: %ld bytes in %ld blocks (%s)\n",
+			all[i]->s.file, all[i]->s.line, bytes, blocks,
+			area_names[head->h.area]);
+		total += bytes;
+	}
+	fprintf(fp, "%ld bytes in %ld blocks not freed\n", total, count);
+
+	free(all);
+	return count;
+}
+
+/* ************************************
+ * static functions
+ */
+static void *_mem_attach(void *raw, int area, size_t size, int mark,
+			 char *file, int line)
+{
+	union _mem_site *site = raw;
+	union _mem_head *head = raw;
+
+	if (mark == MEM_SITED) {
+		site->s.file = file;
+		site->s.line = line;
+		site->s.prev = sites.s.prev;
+		site->s.next = &sites;
+		sites.s.prev->s.next = site;
+		sites.s.prev = site;
+		head = (union _mem_head *) (site + 1);
+	}
+
+	head->h.size = size;
+	head->h.area = area;
+	head->h.mark = mark;
+	_mem_count(area, (long) size, 1);
+	return head + 1;
+}
+
+static void _mem_detach(union _mem_head *head)
+{
+	union _mem_site *site;
+
+	if (head->h.mark == MEM_SITED) {
+		site = _mem_raw(head);
+		site->s.prev->s.next = site->s.next;
+		site->s.next->s.prev = site->s.prev;
+	}
+
+	_mem_count(head->h.area, -(long) head->h.size, -1);
+}
+
+static union _mem_head *_mem_head(void *ptr)
+{
+	union _mem_head *head = (union _mem_head *) ptr - 1;
+
+	if (head->h.mark != MEM_PLAIN && head->h.mark != MEM_SITED) {
+		fprintf(stderr, "mem: %p was %s\n", ptr,
+			head->h.mark == MEM_FREED ? "freed already" :
+			"not allocated by mem_malloc()");
+		abort();
+	}
+
+	return head;
+}
+
+static void *_mem_raw(union _mem_head *head)
+{
+	if (head->h.mark == MEM_SITED)
+		return (union _mem_site *) head - 1;
+	return head;
+}
+
+static void _mem_count(int area, long bytes, long blocks)
+{
+	struct mem_stats *stats = &areas[area];
+
+	stats->live += bytes;
+	stats->blocks += blocks;
+	if (stats->live > stats->peak)
+		stats->peak = stats->live;
+
+	stats = &areas[MEM_AREAS];
+	stats->live += bytes;
+	stats->blocks += blocks;
+	if (stats->live > stats->peak)
+		stats->peak = stats->live;
+}
+
+static int _mem_site_cmp(const void *a, const void *b)
+{
+	union _mem_site *x = *(union _mem_site **) a;
+	union _mem_site *y = *(union _mem_site **) b;
+	int ret = strcmp(x->s.file, y->s.file);
+
+	return ret != 0 ? ret : x->s.line - y->s.line;
+}
+
+static void _mem_write(void)
+{
+	FILE *fp = fopen(leak_file, "w");
+
+	if (fp == NULL)
+		return;
+
+	mem_leaks(fp);
+	fclose(fp);
+}
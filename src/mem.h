@@ -0,0 +1,108 @@
+#ifndef __MEM_H
+#define __MEM_H
+#include <stdio.h>
+#include <stdlib.h>
+
+/** @file
+ * The allocations of every module go through here, so that the memory of
+ * each area of the client is known. A module names its area by defining
+ * MEM_AREA before including anything:
+ *
+ * #define MEM_AREA MEM_JSON
+ *
+ * and its calls of malloc(), calloc(), realloc() and free() are turned
+ * into the functions below by the macros at the end. The blocks of one
+ * area can be freed by any module.
+ */
+
+/** The areas the allocations are accounted to */
+enum mem_area {
+	MEM_OTHER,
+	MEM_JSON,
+	MEM_HTTP,
+	MEM_STATUS,
+	MEM_LIST,
+	MEM_SPOOL,
+	MEM_UI,
+	MEM_AREAS
+};
+
+/** The counters of an area, see mem_get() */
+struct mem_stats {
+
+	/** The bytes of the blocks allocated and not freed yet, and the
+	 * most there were */
+	long live;
+	long peak;
+
+	/** The count of the blocks not freed yet */
+	long blocks;
+
+	/** The count of allocations, reallocations included, and the bytes
+	 * they asked for */
+	unsigned long count;
+	unsigned long bytes;
+};
+
+/** Reads the TWITTERM_MEMDEBUG environment variable: if it names a file,
+ * the place every block is allocated at is recorded from now on, and the
+ * blocks not freed by the time the client exits are written to the file,
+ * by the place they were allocated at. Called before anything is
+ * allocated. */
+void mem_init(void);
+
+/** Allocates a block, see malloc()
+ * @param area the enum mem_area the block is accounted to
+ * @param size the size of the block
+ * @param file the source file the block is allocated in
+ * @param line the line of it
+ * @return the block, NULL if out of memory */
+void *mem_malloc(int area, size_t size, char *file, int line);
+
+/** Allocates a block of zeros, see calloc() and mem_malloc() */
+void *mem_calloc(int area, size_t nmemb, size_t size, char *file,
+		 int line);
+
+/** Resizes a block, see realloc() and mem_malloc(). The block is accounted
+ * to the area given from now on. */
+void *mem_realloc(int area, void *ptr, size_t size, char *file, int line);
+
+/** Frees a block allocated by the functions above, aborts if it wasn't
+ * @param ptr the block, may be NULL */
+void mem_free(void *ptr);
+
+/** Returns the counters of an area
+ * @param area the enum mem_area, MEM_AREAS for the sum of them
+ * @param stats the counters are stored here */
+void mem_get(int area, struct mem_stats *stats);
+
+/** Returns the name of an area
+ * @param area the enum mem_area
+ * @return the name */
+char *mem_area_name(int area);
+
+/** Prints the counters of every area as a table
+ * @param fp the stream to print to */
+void mem_dump(FILE * fp);
+
+/** Prints the blocks not freed yet that were allocated while the places
+ * were recorded, summed up by the place, see mem_init()
+ * @param fp the stream to print to
+ * @return the count of the blocks not freed */
+long mem_leaks(FILE * fp);
+
+/* the modules of the client allocate from their own area, mem.c itself
+ * doesn't */
+#ifndef MEM_IMPL
+#ifndef MEM_AREA
+#define MEM_AREA MEM_OTHER
+#endif
+#define malloc(size) mem_malloc(MEM_AREA, (size), __FILE__, __LINE__)
+#define calloc(nmemb, size) \
+	mem_calloc(MEM_AREA, (nmemb), (size), __FILE__, __LINE__)
+#define realloc(ptr, size) \
+	mem_realloc(MEM_AREA, (ptr), (size), __FILE__, __LINE__)
+#define free(ptr) mem_free(ptr)
+#endif
+
+#endif
@@ -0,0 +1,1053 @@
+#include "main.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <strings.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/** @file
+ * A stand-in for the Twitter API, serving generated responses on the
+ * endpoints twitterm uses, so that the client can be tested and loaded
+ * without the network. Every connection is handled by one poll() loop, so
+ * hundreds of slow (latency injected) connections cost nothing.
+ *
+ * Usage: mockserver [options]
+ * - -p port: the port to listen on (8642)
+ * - -n count: statuses or users per response (20)
+ * - -l ms: latency before the response, -j ms: random extra latency
+ * - -f bytes: send the response in fragments of this size,
+ *   -g ms: the gap between the fragments
+ * - -c: chunked transfer encoding
+ * - -z: gzip content encoding (stored blocks)
+ * - -e percent: answer with 503, -d percent: drop the connection halfway,
+ *   -s percent: never answer
+ * - -u users: the count of users in the friend and follower lists, paged
+ *   by -n when asked with a cursor (as many as -n by default)
+ * - -r count: the rate limit, requests per window of each user and GET
+ *   endpoint, refused with 429 beyond it (0, unlimited, by default),
+ *   -w seconds: the length of the window (3600)
+ * - -o file: append the bodies of the posts taken to the file, each
+ *   followed by a newline; a body larger than a request is passed through
+ *   as it arrives, so uploads of any size take no memory
+ *
+ * Every third status of the timeline replies to the one three older, in
+ * conversations of nine; the statuses older than the timeline are served
+ * by /statuses/lookup.json?id=..., as many as asked for at once.
+ */
+
+/** The maximal count of connections handled at once */
+#define MAX_CONNS 1024
+/** The maximal size of a request */
+#define REQSIZE 8192
+/** The default port */
+#define DEFAULT_PORT 8642
+/** The cursor of the second page of a list, the ones after it follow.
+ * Beyond 2^53, so a client that reads it as a double gets it wrong. */
+#define CURSOR_BASE 1300000000000000001LL
+/** The maximal count of user and endpoint pairs rate limited */
+#define MAX_LIMITS 256
+/** The ID of the newest status, the n-th one is STATUS_STEP less */
+#define STATUS_BASE 1240000000L
+#define STATUS_STEP 997L
+/** The count of statuses the lookup finds */
+#define STATUS_MAX 100000
+
+/** The endpoints served */
+enum _endpoint {
+	EP_TIMELINE,
+	EP_FRIENDS,
+	EP_FOLLOWERS,
+	EP_VERIFY,
+	EP_UPDATE,
+	EP_IMAGE,
+	EP_LOOKUP,
+	EP_COUNT
+};
+
+/** The paths of the endpoints, in the order of enum _endpoint */
+static const char *paths[EP_COUNT] = {
+	"/statuses/friends_timeline.json",
+	"/statuses/friends.json",
+	"/statuses/followers.json",
+	"/account/verify_credentials.json",
+	"/statuses/update.xml",
+	"/account/update_profile_image.json",
+	"/statuses/lookup.json"
+};
+
+/** The rate limit window of a user at an endpoint */
+struct _limit {
+
+	/** The hash of the Authorization header, 0 if the slot is free */
+	unsigned long user;
+
+	/** The endpoint */
+	int endpoint;
+
+	/** The time (in seconds since the epoch) the window ends */
+	long reset;
+
+	/** The count of requests served in the window */
+	long used;
+};
+
+/** A growing string */
+struct _buf {
+	char *data;
+	int len;
+	int size;
+};
+
+/** The state of a connection */
+struct _conn {
+
+	/** The socket, -1 if the slot is free */
+	int fd;
+
+	/** The request received so far */
+	char req[REQSIZE];
+	int reqlen;
+
+	/** The response header */
+	char head[512];
+	int headlen;
+
+	/** The response body, owned by the fixtures */
+	char *body;
+	int bodylen;
+
+	/** The count of bytes of head + body sent */
+	int sent;
+
+	/** The monotonic time (ms) the next fragment may be sent at, 0 while
+	 * reading the request */
+	long long send_at;
+
+	/** Close the connection after this many bytes, -1 if not */
+	int drop_at;
+
+	/** True if the connection is to be closed after the response */
+	int close_after;
+
+	/** True if the connection is stalled forever */
+	int stalled;
+
+	/** The bytes of a large body still to be passed through, the
+	 * response is held back until then */
+	long streaming;
+
+	/** The delay (ms) of the response held back */
+	long long held;
+
+	/** True if the body passed through is recorded by -o */
+	int recording;
+
+	/** The body of a lookup, generated for the request */
+	struct _buf lookup;
+};
+
+/** The options */
+static int port = DEFAULT_PORT;
+static int count = 20;
+static int latency = 0;
+static int jitter = 0;
+static int fragment = 0;
+static int gap = 0;
+static int chunked = 0;
+static int gzipped = 0;
+static int error_rate = 0;
+static int drop_rate = 0;
+static int stall_rate = 0;
+static int users = 0;
+static long rate_limit = 0;
+static long rate_window = 3600;
+static FILE *posts = NULL;
+
+/** The rate limit windows */
+static struct _limit limits[MAX_LIMITS];
+
+/** The encoded response bodies of the endpoints */
+static struct _buf bodies[EP_COUNT];
+
+/** The connections */
+static struct _conn conns[MAX_CONNS];
+
+/** Returns the monotonic time in milliseconds */
+static long long _now_ms(void);
+
+/** Appends formatted text to the buffer */
+static void _buf_printf(struct _buf *buf, const char *fmt, ...);
+
+/** Appends bytes to the buffer */
+static void _buf_append(struct _buf *buf, const char *data, int len);
+
+/** Generates the JSON of a status, with or without its user */
+static void _gen_status(struct _buf *buf, int i, int with_user);
+
+/** Generates the JSON of a user, with or without its last status */
+static void _gen_user(struct _buf *buf, int i, int with_status);
+
+/** Generates the body of the endpoint, and encodes it as requested */
+static void _gen_body(int endpoint);
+
+/** Returns the page of the friend or follower list at the cursor,
+ * generating it on the first request
+ * @param endpoint EP_FRIENDS or EP_FOLLOWERS
+ * @param cursor the cursor, -1 for the first page
+ * @return the encoded body, NULL if the cursor is invalid */
+static struct _buf *_gen_page(int endpoint, long long cursor);
+
+/** Generates the body of a lookup into the buffer of the connection, the
+ * statuses not found left out, the way the API does
+ * @param conn the connection
+ * @param ids the IDs asked for, separated by commas (or "%2C")
+ * @return the encoded body */
+static struct _buf *_gen_lookup(struct _conn *conn, char *ids);
+
+/** Wraps the buffer into a gzip member made of stored blocks */
+static void _gzip(struct _buf *buf);
+
+/** Frames the buffer into chunks */
+static void _chunk(struct _buf *buf);
+
+/** Accepts the pending connections */
+static void _accept(int listener);
+
+/** Reads from the connection, and prepares the response once the request
+ * has arrived in full */
+static void _conn_read(struct _conn *conn);
+
+/** Reads the rest of a large body, and releases the response held back
+ * once it has arrived */
+static void _conn_stream(struct _conn *conn);
+
+/** Looks a header up in the request
+ * @param req the request
+ * @param end the end of the header of the request
+ * @param name the name of the header, matched case insensitively
+ * @return the value of the header, NULL if not present */
+static char *_header(char *req, char *end, const char *name);
+
+/** Sends the next fragment of the response */
+static void _conn_write(struct _conn *conn);
+
+/** Closes the connection */
+static void _conn_close(struct _conn *conn);
+
+/** Counts the request against the rate limit of the user at the endpoint
+ * @param auth the value of the Authorization header
+ * @param endpoint the endpoint
+ * @return the window, NULL if there's no limit */
+static struct _limit *_limit_count(char *auth, int endpoint);
+
+/** Returns true with the given percent of probability */
+static int _chance(int percent);
+
+int main(int argc, char **argv)
+{
+	struct pollfd fds[MAX_CONNS + 1];
+	struct _conn *map[MAX_CONNS + 1];
+	struct sockaddr_in addr;
+	long long now;
+	long long wake;
+	int listener;
+	int nfds;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "p:n:l:j:f:g:cze:d:s:u:r:w:o:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'l':
+			latency = atoi(optarg);
+			break;
+		case 'j':
+			jitter = atoi(optarg);
+			break;
+		case 'f':
+			fragment = atoi(optarg);
+			break;
+		case 'g':
+			gap = atoi(optarg);
+			break;
+		case 'c':
+			chunked = 1;
+			break;
+		case 'z':
+			gzipped = 1;
+			break;
+		case 'e':
+			error_rate = atoi(optarg);
+			break;
+		case 'd':
+			drop_rate = atoi(optarg);
+			break;
+		case 's':
+			stall_rate = atoi(optarg);
+			break;
+		case 'u':
+			users = atoi(optarg);
+			break;
+		case 'r':
+			rate_limit = atol(optarg);
+			break;
+		case 'w':
+			rate_window = atol(optarg);
+			break;
+		case 'o':
+			posts = fopen(optarg, "a");
+			if (posts == NULL) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-n count] [-l ms] "
+				"[-j ms] [-f bytes] [-g ms] [-c] [-z] "
+				"[-e %%] [-d %%] [-s %%] [-u users] [-r count] "
+				"[-w seconds] [-o file]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	srand((unsigned) time(NULL));
+	if (users <= 0)
+		users = count;
+
+	for (i = 0; i < EP_COUNT; i++)
+		_gen_body(i);
+	for (i = 0; i < MAX_CONNS; i++)
+		conns[i].fd = -1;
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	opt = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	    || listen(listener, 512) < 0) {
+		perror("mockserver");
+		return 1;
+	}
+	fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+	fprintf(stderr, "mockserver: listening on 127.0.0.1:%d\n", port);
+
+	for (;;) {
+		now = _now_ms();
+		wake = -1;
+
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		nfds = 1;
+
+		for (i = 0; i < MAX_CONNS; i++) {
+			if (conns[i].fd < 0 || conns[i].stalled)
+				continue;
+
+			fds[nfds].fd = conns[i].fd;
+			if (conns[i].send_at == 0) {
+				fds[nfds].events = POLLIN;
+			}
+			else if (conns[i].send_at <= now) {
+				fds[nfds].events = POLLOUT;
+			}
+			else {	/* sleeping, only wake up for the timer */
+				fds[nfds].events = 0;
+				if (wake < 0 || conns[i].send_at - now < wake)
+					wake = conns[i].send_at - now;
+			}
+			map[nfds++] = &conns[i];
+		}
+
+		if (poll(fds, nfds, (int) wake) < 0 && errno != EINTR) {
+			perror("mockserver");
+			return 1;
+		}
+
+		if (fds[0].revents & POLLIN)
+			_accept(listener);
+
+		now = _now_ms();
+		for (i = 1; i < nfds; i++) {
+			if (fds[i].revents & (POLLERR | POLLHUP)
+			    && map[i]->send_at == 0)
+				_conn_close(map[i]);
+			else if (fds[i].revents & POLLIN)
+				_conn_read(map[i]);
+			else if (map[i]->send_at != 0 && map[i]->send_at <= now)
+				_conn_write(map[i]);
+		}
+	}
+}
+
+/* ************************************
+ * static functions
+ */
+static long long _now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void _buf_append(struct _buf *buf, const char *data, int len)
+{
+	while (buf->len + len + 1 > buf->size) {
+		buf->size = buf->size == 0 ? 4096 : buf->size * 2;
+		buf->data = realloc(buf->data, buf->size);
+		if (buf->data == NULL) {
+			perror("mockserver");
+			exit(1);
+		}
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	buf->data[buf->len] = 0;
+}
+
+static void _buf_printf(struct _buf *buf, const char *fmt, ...)
+{
+	char tmp[2048];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+	va_end(ap);
+
+	_buf_append(buf, tmp, len < (int) sizeof(tmp) ? len : sizeof(tmp) - 1);
+}
+
+/** Words the texts are made of, some of them escaped the way Twitter does */
+static const char *words[] = {
+	"the", "a", "to", "of", "and", "in", "is", "it", "you", "that",
+	"party", "tonight", "coffee", "#json", "#c", "@alice", "@bob",
+	"http://bit.ly/a1b2c3", "caf\\u00e9", "\\u65e5\\u672c",
+	"\\ud83d\\ude00", "\\\"quoted\\\"", "back\\/slash", "\\u2764"
+};
+
+/** Screen names, the groups in the configs usually refer to the first ones */
+static const char *names[] = {
+	"alice", "bob", "carol", "dave", "eve", "mallory", "trent", "peggy",
+	"victor", "walter"
+};
+
+#define NWORDS (sizeof(words) / sizeof(*words))
+#define NNAMES (sizeof(names) / sizeof(*names))
+
+static void _gen_status(struct _buf *buf, int i, int with_user)
+{
+	static const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu",
+		"Fri", "Sat"
+	};
+	static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May",
+		"Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+	};
+	long id = STATUS_BASE - i * STATUS_STEP;
+	time_t t = 1240000000 - i * 61;
+	struct tm *tm = gmtime(&t);
+	int reply = i % 3 == 0 && i % 27 != 24;
+	int nwords = 4 + (i * 7) % 15;
+	int w;
+
+	_buf_printf(buf, "{\"created_at\":\"%s %s %02d %02d:%02d:%02d +0000 "
+		    "%d\",\"id\":%ld,\"text\":\"", days[tm->tm_wday],
+		    months[tm->tm_mon], tm->tm_mday, tm->tm_hour, tm->tm_min,
+		    tm->tm_sec, tm->tm_year + 1900, id);
+	for (w = 0; w < nwords; w++)
+		_buf_printf(buf, "%s%s", w == 0 ? "" : " ",
+			    words[(i * 31 + w * 17) % NWORDS]);
+	_buf_printf(buf, "\",\"source\":\"web\",\"truncated\":false,"
+		    "\"in_reply_to_status_id\":");
+	if (reply)
+		_buf_printf(buf, "%ld,\"in_reply_to_user_id\":%d,"
+			    "\"favorited\":false,\"in_reply_to_screen_name\":"
+			    "\"%s\"", id - STATUS_STEP * 3, 1000 + (i + 3) % NNAMES,
+			    names[(i + 3) % NNAMES]);
+	else
+		_buf_printf(buf, "null,\"in_reply_to_user_id\":null,"
+			    "\"favorited\":false,"
+			    "\"in_reply_to_screen_name\":null");
+
+	if (with_user) {
+		_buf_printf(buf, ",\"user\":");
+		_gen_user(buf, i % NNAMES, 0);
+	}
+	_buf_printf(buf, "}");
+}
+
+static void _gen_user(struct _buf *buf, int i, int with_status)
+{
+	const char *name = names[i % NNAMES];
+	int n = i / NNAMES;
+
+	_buf_printf(buf, "{\"id\":%d,\"name\":\"%s %d\",\"screen_name\":"
+		    "\"%s%s%.0d\",\"location\":\"Budapest\",\"description\":"
+		    "\"just another mock user\",\"profile_image_url\":"
+		    "\"http://s3.amazonaws.com/twitter_production/"
+		    "profile_images/%d/avatar_normal.png\",\"url\":null,"
+		    "\"protected\":false,\"followers_count\":%d,"
+		    "\"friends_count\":%d,\"created_at\":\"Wed Jan 10 "
+		    "12:00:00 +0000 2007\",\"favourites_count\":0,"
+		    "\"utc_offset\":3600,\"time_zone\":\"Budapest\","
+		    "\"statuses_count\":%d,\"following\":true",
+		    1000 + i, name, n, name, n > 0 ? "_" : "", n, 50000 + i,
+		    (i * 37) % 5000, (i * 13) % 800, (i * 101) % 20000);
+
+	if (with_status) {
+		_buf_printf(buf, ",\"status\":");
+		_gen_status(buf, i, 0);
+	}
+	_buf_printf(buf, "}");
+}
+
+static void _gen_body(int endpoint)
+{
+	struct _buf *buf = &bodies[endpoint];
+	int i;
+
+	switch (endpoint) {
+	case EP_TIMELINE:
+	case EP_FRIENDS:
+	case EP_FOLLOWERS:
+		_buf_append(buf, "[", 1);
+		for (i = 0; i < count; i++) {
+			if (i > 0)
+				_buf_append(buf, ",", 1);
+			if (endpoint == EP_TIMELINE)
+				_gen_status(buf, i, 1);
+			else
+				_gen_user(buf, endpoint == EP_FRIENDS ?
+					  i : i + 3, 1);
+		}
+		_buf_append(buf, "]", 1);
+		break;
+	case EP_VERIFY:
+		_gen_user(buf, 0, 1);
+		break;
+	case EP_IMAGE:
+		_gen_user(buf, 0, 0);
+		break;
+	case EP_LOOKUP:
+		_buf_append(buf, "[]", 2);
+		break;
+	case EP_UPDATE:
+		_buf_printf(buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			    "<status>\n  <id>1240000001</id>\n"
+			    "  <text>mock</text>\n</status>\n");
+		break;
+	}
+
+	if (gzipped)
+		_gzip(buf);
+	if (chunked)
+		_chunk(buf);
+}
+
+static struct _buf *_gen_page(int endpoint, long long cursor)
+{
+	static struct _buf *pages[2];
+	struct _buf *buf;
+	int list = endpoint == EP_FOLLOWERS;
+	long long npages = count > 0 ? (users + count - 1) / count : 0;
+	long long next;
+	long long prev;
+	long long p = cursor == -1 ? 0 : cursor - CURSOR_BASE + 1;
+	int i;
+
+	if (p < 0 || p >= npages)
+		return NULL;
+
+	if (pages[list] == NULL) {
+		pages[list] = calloc(npages, sizeof(**pages));
+		if (pages[list] == NULL) {
+			perror("mockserver");
+			exit(1);
+		}
+	}
+	buf = &pages[list][p];
+	if (buf->data != NULL)
+		return buf;
+
+	_buf_append(buf, "{\"users\":[", 10);
+	for (i = p * count; i < (p + 1) * count && i < users; i++) {
+		if (i > p * count)
+			_buf_append(buf, ",", 1);
+		_gen_user(buf, list ? i + 3 : i, 1);
+	}
+
+	next = p + 1 < npages ? CURSOR_BASE + p : 0;
+	prev = p > 0 ? -(CURSOR_BASE + p - 2) : 0;
+	_buf_printf(buf, "],\"next_cursor\":%lld,\"next_cursor_str\":\"%lld\","
+		    "\"previous_cursor\":%lld,\"previous_cursor_str\":"
+		    "\"%lld\"}", next, next, prev, prev);
+
+	if (gzipped)
+		_gzip(buf);
+	if (chunked)
+		_chunk(buf);
+	return buf;
+}
+
+static struct _buf *_gen_lookup(struct _conn *conn, char *ids)
+{
+	struct _buf *buf = &conn->lookup;
+	char *ptr = ids;
+	long id;
+	long i;
+	int first = 1;
+
+	free(buf->data);
+	memset(buf, 0, sizeof(*buf));
+
+	_buf_append(buf, "[", 1);
+	while (*ptr >= '0' && *ptr <= '9') {
+		id = strtol(ptr, &ptr, 10);
+		i = (STATUS_BASE - id) / STATUS_STEP;
+		if (id <= STATUS_BASE && (STATUS_BASE - id) % STATUS_STEP == 0
+		    && i < STATUS_MAX) {
+			if (!first)
+				_buf_append(buf, ",", 1);
+			_gen_status(buf, i, 1);
+			first = 0;
+		}
+
+		if (*ptr == ',')
+			ptr++;
+		else if (!strncasecmp(ptr, "%2C", 3))
+			ptr += 3;
+		else
+			break;
+	}
+	_buf_append(buf, "]", 1);
+
+	if (gzipped)
+		_gzip(buf);
+	if (chunked)
+		_chunk(buf);
+	return buf;
+}
+
+static void _gzip(struct _buf *buf)
+{
+	static const char header[10] = { 0x1f, (char) 0x8b, 8, 0, 0, 0, 0, 0,
+		0, 3
+	};
+	struct _buf out;
+	unsigned long crc = 0xffffffffUL;
+	unsigned long table[256];
+	unsigned long c;
+	unsigned char block[5];
+	unsigned char trailer[8];
+	int pos;
+	int len;
+	int n;
+	int k;
+
+	for (n = 0; n < 256; n++) {
+		c = (unsigned long) n;
+		for (k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+		table[n] = c;
+	}
+	for (pos = 0; pos < buf->len; pos++)
+		crc = table[(crc ^ (unsigned char) buf->data[pos]) & 0xff] ^
+		    (crc >> 8);
+	crc ^= 0xffffffffUL;
+
+	memset(&out, 0, sizeof(out));
+	_buf_append(&out, header, 10);
+
+	/* stored blocks: no compression, but a valid deflate stream */
+	pos = 0;
+	do {
+		len = buf->len - pos > 65535 ? 65535 : buf->len - pos;
+		block[0] = pos + len == buf->len;	/* BFINAL, BTYPE 00 */
+		block[1] = len & 0xff;
+		block[2] = len >> 8;
+		block[3] = ~len & 0xff;
+		block[4] = (~len >> 8) & 0xff;
+		_buf_append(&out, (char *) block, 5);
+		_buf_append(&out, buf->data + pos, len);
+		pos += len;
+	} while (pos < buf->len);
+
+	for (k = 0; k < 4; k++) {
+		trailer[k] = (crc >> (8 * k)) & 0xff;
+		trailer[4 + k] = ((unsigned long) buf->len >> (8 * k)) & 0xff;
+	}
+	_buf_append(&out, (char *) trailer, 8);
+
+	free(buf->data);
+	*buf = out;
+}
+
+static void _chunk(struct _buf *buf)
+{
+	struct _buf out;
+	int size = fragment > 0 ? fragment : 4096;
+	int pos;
+	int len;
+
+	memset(&out, 0, sizeof(out));
+	for (pos = 0; pos < buf->len; pos += len) {
+		len = buf->len - pos > size ? size : buf->len - pos;
+		_buf_printf(&out, "%x\r\n", len);
+		_buf_append(&out, buf->data + pos, len);
+		_buf_append(&out, "\r\n", 2);
+	}
+	_buf_append(&out, "0\r\n\r\n", 5);
+
+	free(buf->data);
+	*buf = out;
+}
+
+static void _accept(int listener)
+{
+	int fd;
+	int i;
+
+	while ((fd = accept(listener, NULL, NULL)) >= 0) {
+		for (i = 0; i < MAX_CONNS && conns[i].fd >= 0; i++) ;
+		if (i == MAX_CONNS) {
+			close(fd);	/* full */
+			continue;
+		}
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		memset(&conns[i], 0, sizeof(conns[i]));
+		conns[i].fd = fd;
+		conns[i].drop_at = -1;
+	}
+}
+
+static void _conn_read(struct _conn *conn)
+{
+	char *end;
+	char *ptr;
+	char path[4096];
+	char *cursor = NULL;
+	char *ids = NULL;
+	struct _buf *page = NULL;
+	struct _limit *limit = NULL;
+	int endpoint;
+	int status;
+	long bodylen = 0;
+	long inbuf;
+	int ret;
+
+	if (conn->streaming > 0) {
+		_conn_stream(conn);
+		return;
+	}
+
+	ret = recv(conn->fd, conn->req + conn->reqlen,
+		   REQSIZE - 1 - conn->reqlen, 0);
+	if (ret <= 0) {
+		if (ret == 0 || (errno != EAGAIN && errno != EINTR))
+			_conn_close(conn);
+		return;
+	}
+	conn->reqlen += ret;
+	conn->req[conn->reqlen] = 0;
+
+	end = strstr(conn->req, "\r\n\r\n");
+	if (end == NULL) {
+		if (conn->reqlen == REQSIZE - 1)
+			_conn_close(conn);	/* too large */
+		return;
+	}
+
+	/* a POST is only answered once its body has arrived */
+	ptr = _header(conn->req, end, "Content-Length");
+	if (ptr != NULL)
+		bodylen = atol(ptr);
+	inbuf = conn->reqlen - (end + 4 - conn->req);
+	if (bodylen < 0
+	    || (inbuf < bodylen && end + 4 - conn->req + bodylen < REQSIZE))
+		return;
+
+	if (sscanf(conn->req, "%*s %4095s", path) != 1)
+		path[0] = 0;
+	if ((ptr = strchr(path, '?')) != NULL) {
+		*ptr = 0;	/* only the cursor and the IDs matter */
+		cursor = strstr(ptr + 1, "cursor=");
+		if (cursor != NULL && cursor != ptr + 1 && cursor[-1] != '&')
+			cursor = NULL;
+		ids = strstr(ptr + 1, "id=");
+		if (ids != NULL && ids != ptr + 1 && ids[-1] != '&')
+			ids = NULL;
+	}
+
+	for (endpoint = 0; endpoint < EP_COUNT; endpoint++)
+		if (!strcmp(path, paths[endpoint]))
+			break;
+
+	ptr = _header(conn->req, end, "Connection");
+	conn->close_after = ptr != NULL && !strncasecmp(ptr, "close", 5);
+
+	/* inject the failures */
+	if (_chance(stall_rate)) {
+		conn->stalled = 1;
+		return;
+	}
+
+	if (endpoint == EP_COUNT) {
+		status = 404;
+	}
+	else if ((ptr = _header(conn->req, end, "Authorization")) == NULL) {
+		status = 401;
+	}
+	else if (_chance(error_rate)) {
+		status = 503;	/* overloaded, before counting the request */
+	}
+	else if ((limit = _limit_count(ptr, endpoint)) != NULL
+		 && limit->used > rate_limit) {
+		status = 429;
+	}
+	else {
+		status = 200;
+	}
+
+	if (status == 200 && cursor != NULL
+	    && (endpoint == EP_FRIENDS || endpoint == EP_FOLLOWERS)) {
+		page = _gen_page(endpoint, atoll(cursor + 7));
+		if (page == NULL)
+			status = 400;
+	}
+	if (status == 200 && ids != NULL && endpoint == EP_LOOKUP)
+		page = _gen_lookup(conn, ids + 3);
+
+	if (status == 200 && posts != NULL && bodylen > 0) {
+		fwrite(end + 4, 1, inbuf < bodylen ? inbuf : bodylen, posts);
+		if (inbuf >= bodylen)
+			fputc('\n', posts);
+		fflush(posts);
+	}
+
+	if (status == 200) {
+		if (page == NULL)
+			page = &bodies[endpoint];
+		conn->body = page->data;
+		conn->bodylen = page->len;
+	}
+	else {
+		conn->body = "";
+		conn->bodylen = 0;
+	}
+
+	conn->headlen = sprintf(conn->head, "HTTP/1.1 %d %s\r\n"
+				"Content-Type: application/json\r\n",
+				status, status == 200 ? "OK" : "Error");
+	if (limit != NULL)
+		conn->headlen += sprintf(conn->head + conn->headlen,
+					 "X-RateLimit-Limit: %ld\r\n"
+					 "X-RateLimit-Remaining: %ld\r\n"
+					 "X-RateLimit-Reset: %ld\r\n", rate_limit,
+					 limit->used < rate_limit ?
+					 rate_limit - limit->used : 0,
+					 limit->reset);
+	if (status == 200 && gzipped)
+		conn->headlen += sprintf(conn->head + conn->headlen,
+					 "Content-Encoding: gzip\r\n");
+	if (conn->close_after)
+		conn->headlen += sprintf(conn->head + conn->headlen,
+					 "Connection: close\r\n");
+	if (status == 200 && chunked)
+		conn->headlen += sprintf(conn->head + conn->headlen,
+					 "Transfer-Encoding: chunked\r\n\r\n");
+	else
+		conn->headlen += sprintf(conn->head + conn->headlen,
+					 "Content-Length: %d\r\n\r\n",
+					 conn->bodylen);
+
+	if (_chance(drop_rate))
+		conn->drop_at = (conn->headlen + conn->bodylen) / 2;
+
+	conn->sent = 0;
+	conn->send_at = _now_ms() + latency +
+	    (jitter > 0 ? rand() % (jitter + 1) : 0);
+	if (conn->send_at == 0)
+		conn->send_at = 1;
+
+	/* the rest of a large body comes before the response */
+	if (inbuf < bodylen) {
+		conn->streaming = bodylen - inbuf;
+		conn->recording = status == 200 && posts != NULL;
+		conn->held = conn->send_at - _now_ms();
+		conn->send_at = 0;
+		conn->reqlen = 0;
+		conn->req[0] = 0;
+		conn->drop_at = -1;
+		return;
+	}
+
+	/* keep whatever followed the request (pipelining) */
+	ret = end + 4 + bodylen - conn->req;
+	memmove(conn->req, conn->req + ret, conn->reqlen - ret + 1);
+	conn->reqlen -= ret;
+}
+
+static void _conn_stream(struct _conn *conn)
+{
+	static char buf[65536];
+	int ret;
+
+	ret = recv(conn->fd, buf, conn->streaming < (long) sizeof(buf) ?
+		   conn->streaming : (long) sizeof(buf), 0);
+	if (ret <= 0) {
+		if (ret == 0 || (errno != EAGAIN && errno != EINTR))
+			_conn_close(conn);
+		return;
+	}
+
+	if (conn->recording)
+		fwrite(buf, 1, ret, posts);
+	conn->streaming -= ret;
+	if (conn->streaming > 0)
+		return;
+
+	if (conn->recording) {
+		fputc('\n', posts);
+		fflush(posts);
+	}
+	conn->send_at = _now_ms() + conn->held;
+	if (conn->send_at == 0)
+		conn->send_at = 1;
+}
+
+static char *_header(char *req, char *end, const char *name)
+{
+	int len = strlen(name);
+	char *line;
+
+	for (line = strstr(req, "\r\n"); line != NULL && line < end;
+	     line = strstr(line + 2, "\r\n")) {
+		if (!strncasecmp(line + 2, name, len) && line[2 + len] == ':')
+			return line + 3 + len + strspn(line + 3 + len, " \t");
+	}
+
+	return NULL;
+}
+
+static void _conn_write(struct _conn *conn)
+{
+	int total = conn->headlen + conn->bodylen;
+	int len;
+	int ret;
+
+	for (;;) {
+		len = total - conn->sent;
+		if (fragment > 0 && len > fragment)
+			len = fragment;
+		if (conn->drop_at >= 0 && conn->sent + len > conn->drop_at)
+			len = conn->drop_at - conn->sent;
+
+		if (len <= 0)
+			break;
+
+		if (conn->sent < conn->headlen) {
+			if (len > conn->headlen - conn->sent)
+				len = conn->headlen - conn->sent;
+			ret = send(conn->fd, conn->head + conn->sent, len, 0);
+		}
+		else {
+			ret = send(conn->fd,
+				   conn->body + conn->sent - conn->headlen, len,
+				   0);
+		}
+
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				_conn_close(conn);
+			return;	/* poll() will tell when there's room */
+		}
+		conn->sent += ret;
+
+		if (fragment > 0 && gap > 0 && conn->sent < total) {
+			conn->send_at = _now_ms() + gap;
+			return;
+		}
+	}
+
+	if (conn->drop_at >= 0 || conn->close_after) {
+		_conn_close(conn);
+		return;
+	}
+
+	conn->send_at = 0;	/* keep-alive, wait for the next request */
+	if (conn->reqlen > 0 && strstr(conn->req, "\r\n\r\n") != NULL)
+		_conn_read(conn);
+}
+
+static void _conn_close(struct _conn *conn)
+{
+	close(conn->fd);
+	conn->fd = -1;
+	free(conn->lookup.data);
+	memset(&conn->lookup, 0, sizeof(conn->lookup));
+}
+
+static struct _limit *_limit_count(char *auth, int endpoint)
+{
+	unsigned long user = 5381;
+	long now = (long) time(NULL);
+	int victim = 0;
+	int i;
+
+	/* the posts aren't limited, as with the API */
+	if (rate_limit <= 0 || endpoint == EP_UPDATE || endpoint == EP_IMAGE)
+		return NULL;
+
+	for (; *auth != '\r' && *auth != 0; auth++)
+		user = user * 33 + (unsigned char) *auth;
+	if (user == 0)
+		user = 1;
+
+	/* the pair is looked up, or the slot of the oldest window taken */
+	for (i = 0; i < MAX_LIMITS; i++) {
+		if (limits[i].user == user && limits[i].endpoint == endpoint)
+			break;
+		if (limits[i].reset < limits[victim].reset)
+			victim = i;
+	}
+	if (i == MAX_LIMITS) {
+		i = victim;
+		limits[i].user = user;
+		limits[i].endpoint = endpoint;
+		limits[i].reset = 0;
+	}
+
+	/* a window starts with the first request after the last one ended */
+	if (now >= limits[i].reset) {
+		limits[i].reset = now + rate_window;
+		limits[i].used = 0;
+	}
+	limits[i].used++;
+	return &limits[i];
+}
+
+static int _chance(int percent)
+{
+	return percent > 0 && rand() % 100 < percent;
+}
@@ -0,0 +1,334 @@
+#define MEM_AREA MEM_LIST
+#include "namelist.h"
+#include "store.h"
+
+/** @file */
+
+/** The first line of a saved set */
+#define NAMELIST_MAGIC "twitterm namelist 1\n"
+
+/** The set. The names are stored one after the other, each as the length
+ * of the prefix shared with the previous one, the length of the rest, and
+ * the rest, the lengths as varints, see store_put_varint(). */
+struct _namelist {
+
+	/** The count of names */
+	long count;
+
+	/** The names as they are stored */
+	unsigned char *data;
+
+	/** The size of data */
+	long size;
+
+	/** The offsets of the names stored whole, the (n * NAMELIST_RESTART)-th
+	 * ones */
+	long *restarts;
+
+	/** The count of restarts */
+	long nrestarts;
+
+	/** The length of the longest name */
+	long longest;
+
+	/** The buffer a name is decoded into by namelist_contains(), longer
+	 * than the longest name */
+	char *buf;
+};
+
+/** Compares two names for qsort() */
+static int _name_cmp(const void *a, const void *b);
+
+/** Writes the names of a set, see store_fn */
+static int _namelist_save(FILE * fp, void *arg);
+
+/** Decodes the next name, advancing the pointer. Only for names checked by
+ * _namelist_index() already.
+ * @param ptr the pointer to the name
+ * @param buf holds the previous name, the name is decoded into it
+ * @param len the length of the previous name, the length of the name is
+ * stored here */
+static void _namelist_next(unsigned char **ptr, char *buf, long *len);
+
+/** Checks the data of the set, and counts and indexes the names
+ * @param list the set with the data filled in
+ * @retval 0 if succeeded
+ * @retval -1 if the data is malformed (or the names aren't sorted), or
+ * out of memory */
+static int _namelist_index(namelist list);
+
+namelist namelist_build(char **names, long count)
+{
+	namelist ret = calloc(1, sizeof(*ret));
+	char **sorted = malloc((count > 0 ? count : 1) * sizeof(*sorted));
+	char *prev = NULL;
+	unsigned char *out;
+	long total = 0;
+	long shared;
+	long len;
+	long i;
+
+	for (i = 0; i < count; i++)
+		total += strlen(names[i]) + 2 * STORE_VARINT_MAX;
+	if (ret != NULL)
+		ret->data = malloc(total > 0 ? total : 1);
+	if (ret == NULL || sorted == NULL || ret->data == NULL) {
+		namelist_free(ret);
+		free(sorted);
+		return NULL;
+	}
+
+	memcpy(sorted, names, count * sizeof(*sorted));
+	qsort(sorted, count, sizeof(*sorted), _name_cmp);
+
+	/* the duplicates are next to each other once sorted */
+	for (i = 0, out = ret->data; i < count; i++) {
+		if (prev != NULL && !strcmp(prev, sorted[i]))
+			continue;
+
+		len = strlen(sorted[i]);
+		shared = 0;
+		if (ret->count++ % NAMELIST_RESTART != 0)
+			while (prev[shared] != 0
+			       && prev[shared] == sorted[i][shared])
+				shared++;
+
+		out += store_put_varint(out, shared);
+		out += store_put_varint(out, len - shared);
+		memcpy(out, sorted[i] + shared, len - shared);
+		out += len - shared;
+		prev = sorted[i];
+	}
+	ret->size = out - ret->data;
+	free(sorted);
+
+	/* indexed the same way as a set read from a file */
+	if (_namelist_index(ret) < 0) {
+		namelist_free(ret);
+		return NULL;
+	}
+	return ret;
+}
+
+void namelist_free(namelist list)
+{
+	if (list == NULL)
+		return;
+
+	free(list->data);
+	free(list->restarts);
+	free(list->buf);
+	free(list);
+}
+
+long namelist_count(namelist list)
+{
+	return list->count;
+}
+
+long namelist_size(namelist list)
+{
+	return list->size;
+}
+
+int namelist_contains(namelist list, char *name)
+{
+	unsigned char *ptr;
+	unsigned char *end;
+	unsigned long shared;
+	unsigned long len;
+	long namelen = strlen(name);
+	long lo = 0;
+	long hi = list->nrestarts - 1;
+	long mid;
+	int cmp;
+
+	/* the last name stored whole that isn't greater than the one looked
+	 * for, the rest of the block is scanned from there */
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		ptr = list->data + list->restarts[mid];
+		store_get_varint(&ptr, list->data + list->size, &shared);
+		store_get_varint(&ptr, list->data + list->size, &len);
+
+		cmp = memcmp(ptr, name, (long) len < namelen ? len : namelen);
+		if (cmp < 0 || (cmp == 0 && (long) len <= namelen))
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	if (list->nrestarts == 0)
+		return 0;
+
+	ptr = list->data + list->restarts[lo];
+	end = lo + 1 < list->nrestarts ? list->data + list->restarts[lo + 1] :
+	    list->data + list->size;
+	while (ptr < end) {
+		_namelist_next(&ptr, list->buf, &mid);
+		cmp = strcmp(list->buf, name);
+		if (cmp >= 0)
+			return cmp == 0;
+	}
+
+	return 0;
+}
+
+int namelist_each(namelist list, namelist_fn fn, void *arg)
+{
+	unsigned char *ptr;
+	char *buf = malloc(list->longest + 1);
+	long len;
+	int ret = 0;
+
+	if (buf == NULL)
+		return -1;
+
+	for (ptr = list->data; ret == 0 && ptr < list->data + list->size;) {
+		_namelist_next(&ptr, buf, &len);
+		ret = fn(buf, arg);
+	}
+
+	free(buf);
+	return ret;
+}
+
+int namelist_write(namelist list, char *file)
+{
+	return store_write(file, NAMELIST_MAGIC, _namelist_save, list);
+}
+
+namelist namelist_read(char *file)
+{
+	namelist ret = calloc(1, sizeof(*ret));
+
+	if (ret == NULL)
+		return NULL;
+
+	ret->data = store_read(file, NAMELIST_MAGIC, &ret->size);
+	if (ret->data == NULL || _namelist_index(ret) < 0) {
+		namelist_free(ret);
+		return NULL;
+	}
+	return ret;
+}
+
+/* ************************************
+ * static functions
+ */
+static int _name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char **) a, *(char **) b);
+}
+
+static int _namelist_save(FILE * fp, void *arg)
+{
+	namelist list = arg;
+
+	return fwrite(list->data, 1, list->size, fp) == (size_t) list->size
+	    ? 0 : -1;
+}
+
+static void _namelist_next(unsigned char **ptr, char *buf, long *len)
+{
+	unsigned long shared;
+	unsigned long rest;
+
+	/* the end was checked by _namelist_index() */
+	store_get_varint(ptr, *ptr + STORE_VARINT_MAX, &shared);
+	store_get_varint(ptr, *ptr + STORE_VARINT_MAX, &rest);
+
+	memcpy(buf + shared, *ptr, rest);
+	*ptr += rest;
+	*len = shared + rest;
+	buf[*len] = 0;
+}
+
+static int _namelist_index(namelist list)
+{
+	unsigned char *ptr = list->data;
+	unsigned char *end = list->data + list->size;
+	unsigned char *start;
+	unsigned long shared;
+	unsigned long rest;
+	char *prev = NULL;
+	char *cur = NULL;
+	char *tmp;
+	long prevlen = 0;
+	long len;
+	long size = 0;
+	long nalloc = 0;
+	long *restarts;
+	int bad = 0;
+
+	list->count = 0;
+	list->nrestarts = 0;
+	list->longest = 0;
+
+	while (ptr < end && !bad) {
+		start = ptr;
+		if (store_get_varint(&ptr, end, &shared) < 0
+		    || store_get_varint(&ptr, end, &rest) < 0
+		    || rest > (unsigned long) (end - ptr)
+		    || shared > (unsigned long) prevlen
+		    || (list->count % NAMELIST_RESTART == 0 && shared != 0)
+		    || memchr(ptr, 0, rest) != NULL) {
+			bad = 1;
+			break;
+		}
+		len = shared + rest;
+
+		/* both buffers are kept longer than any name so far */
+		if (len >= size) {
+			size = len * 2 + 1;
+			tmp = realloc(prev, size);
+			if (tmp != NULL)
+				prev = tmp;
+			tmp = tmp == NULL ? NULL : realloc(cur, size);
+			if (tmp == NULL) {
+				bad = 1;
+				break;
+			}
+			cur = tmp;
+		}
+
+		if (shared > 0)
+			memcpy(cur, prev, shared);
+		memcpy(cur + shared, ptr, rest);
+		cur[len] = 0;
+		ptr += rest;
+
+		/* sorted, and each once */
+		if (list->count > 0 && strcmp(prev, cur) >= 0) {
+			bad = 1;
+			break;
+		}
+
+		if (list->count % NAMELIST_RESTART == 0) {
+			if (list->nrestarts == nalloc) {
+				nalloc = nalloc > 0 ? nalloc * 2 : 64;
+				restarts = realloc(list->restarts,
+						   nalloc * sizeof(*restarts));
+				if (restarts == NULL) {
+					bad = 1;
+					break;
+				}
+				list->restarts = restarts;
+			}
+			list->restarts[list->nrestarts++] = start - list->data;
+		}
+		list->count++;
+		if (len > list->longest)
+			list->longest = len;
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+		prevlen = len;
+	}
+
+	/* the lookups decode into one of them */
+	free(cur);
+	list->buf = prev != NULL ? prev : malloc(1);
+	return bad || list->buf == NULL ? -1 : 0;
+}
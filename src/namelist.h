@@ -0,0 +1,70 @@
+#ifndef __NAMELIST_H
+#define __NAMELIST_H
+#include "main.h"
+
+/** @file */
+
+/** Every NAMELIST_RESTART-th name is stored whole, see namelist_build() */
+#define NAMELIST_RESTART 16
+
+/** A sorted set of names, see namelist_build() */
+typedef struct _namelist *namelist;
+
+/** The prototype of the function namelist_each() calls for the names
+ * @param name the name, only valid during the call
+ * @param arg the argument given to namelist_each()
+ * @return 0 to go on, anything else to stop */
+typedef int (*namelist_fn) (char *name, void *arg);
+
+/** Builds a set of the names: they are sorted, each is kept once, and they
+ * are front coded: a name is stored as the length of the prefix it shares
+ * with the previous one, and the rest of it. Every NAMELIST_RESTART-th is
+ * stored whole, so a lookup is a binary search over those and a scan of
+ * at most NAMELIST_RESTART names.
+ * @param names the names, in any order, duplicates allowed
+ * @param count the count of names
+ * @return the set, NULL if out of memory */
+namelist namelist_build(char **names, long count);
+
+/** Frees a set
+ * @param list the set to free, may be NULL */
+void namelist_free(namelist list);
+
+/** Returns the count of names in the set
+ * @param list the set
+ * @return the count of names */
+long namelist_count(namelist list);
+
+/** Returns the size of the names as they are stored
+ * @param list the set
+ * @return the size in bytes */
+long namelist_size(namelist list);
+
+/** Looks a name up
+ * @param list the set
+ * @param name the name
+ * @return true if the name is in the set */
+int namelist_contains(namelist list, char *name);
+
+/** Calls fn for every name of the set in order, until fn returns non-zero
+ * @param list the set
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @return the non-zero value fn returned, 0 if it never did, -1 if out of
+ * memory */
+int namelist_each(namelist list, namelist_fn fn, void *arg);
+
+/** Saves the set into a file, as it's stored in memory
+ * @param list the set
+ * @param file the name of the file
+ * @retval 0 if succeeded
+ * @retval -1 if the file couldn't be written */
+int namelist_write(namelist list, char *file);
+
+/** Loads a set saved by namelist_write(), checking that it is well formed
+ * @param file the name of the file
+ * @return the set, NULL if the file is missing, malformed or out of
+ * memory */
+namelist namelist_read(char *file);
+
+#endif
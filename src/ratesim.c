@@ -0,0 +1,290 @@
+#include "main.h"
+#include "sched.h"
+#include <stdio.h>
+
+/** @file
+ * Runs the scheduler against a stand-in of the server that enforces the
+ * rate limits the way the API (and mockserver -r) does: a window of
+ * WINDOW seconds starts with the first request after the previous one
+ * ended, and the requests beyond LIMIT in it are refused with 429.
+ *
+ * The clock is simulated, so hours of traffic run in a second: several
+ * accounts poll their timelines as fast as the scheduler lets them, the
+ * m command fetches them all every BULK_PERIOD seconds, and commands are
+ * typed in at random. The responses take a random time to arrive, so
+ * that requests are in flight while others are scheduled. The windows
+ * are half or all but one used up by an earlier run already, which the
+ * scheduler can't know about. (Had one been used up wholly, its first
+ * request would be refused, since only the response tells the limit.)
+ *
+ * Exits with 1 if the server refused a request.
+ *
+ * Usage: ratesim [-h hours] [-s seed]
+ */
+
+/** The rate limit of the stand-in: requests per window */
+#define LIMIT 150
+/** The length of the window in seconds */
+#define WINDOW 3600
+/** The accounts */
+#define ACCOUNTS 3
+/** The endpoints per account: the timeline and the friends */
+#define ENDPOINTS 2
+#define KEYS (ACCOUNTS * ENDPOINTS)
+/** The seconds between two m commands */
+#define BULK_PERIOD 600
+/** The mean time between two commands typed in, in seconds */
+#define UI_PERIOD 45
+/** The maximal time a response takes, in seconds */
+#define MAX_LATENCY 3.0
+/** The step of the clock, in seconds */
+#define STEP 0.05
+/** The maximal count of requests in flight */
+#define MAX_FLIGHT 64
+/** The time the simulation starts at, in seconds since the epoch */
+#define EPOCH 1240000000.0
+
+/** The window of a key at the stand-in */
+struct _window {
+
+	/** The time the window ends */
+	long reset;
+
+	/** The count of requests served in it */
+	long used;
+};
+
+/** A request in flight */
+struct _flight {
+
+	/** The key */
+	int key;
+
+	/** The priority */
+	int priority;
+
+	/** The time the stand-in handles it, and the time the response
+	 * arrives */
+	double handled;
+	double arrives;
+
+	/** True once handled */
+	int done;
+
+	/** The response */
+	int status;
+	long limit;
+	long remaining;
+	long reset;
+};
+
+/** The names of the priorities */
+static char *priorities[] = { "ui", "bulk", "poll" };
+
+/** The simulated clock */
+static double now = EPOCH;
+
+/** The windows of the stand-in */
+static struct _window windows[KEYS];
+
+/** The requests in flight */
+static struct _flight flights[MAX_FLIGHT];
+static int inflight = 0;
+
+/** The counts of requests sent, deferred by the scheduler, and refused by
+ * the stand-in, per priority */
+static long sent[3];
+static long deferred[3];
+static long refused[3];
+
+/** The sched_clock_fn of the simulated clock */
+static double _clock(void *arg);
+
+/** Returns the key of the bucket of the index-th key, eg. "user1 /timeline" */
+static char *_key(int key);
+
+/** Asks the scheduler, and sends the request if it may be sent
+ * @return the return value of sched_take() */
+static double _send(sched s, int key, int priority);
+
+/** Handles the requests the stand-in has received by now */
+static void _serve(void);
+
+/** Delivers the responses arrived by now to the scheduler */
+static void _deliver(sched s);
+
+/** Returns a random number in [0, 1) */
+static double _random(void);
+
+int main(int argc, char **argv)
+{
+	sched s;
+	double end;
+	double next_ui = EPOCH;
+	double next_bulk = EPOCH;
+	double next_poll[ACCOUNTS];
+	double hours = 24;
+	long total = 0;
+	long allowed;
+	int i;
+
+	srand(1);
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-h") && i + 1 < argc)
+			hours = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			srand(atoi(argv[++i]));
+	}
+	end = EPOCH + hours * 3600;
+
+	/* an earlier run left the windows used */
+	for (i = 0; i < KEYS; i++) {
+		windows[i].reset = (long) EPOCH + WINDOW / (i + 2);
+		windows[i].used = i % 2 ? LIMIT - 1 : LIMIT / 2;
+	}
+	for (i = 0; i < ACCOUNTS; i++)
+		next_poll[i] = EPOCH;
+
+	s = sched_create(_clock, NULL);
+	if (s == NULL) {
+		fprintf(stderr, "ratesim: out of memory\n");
+		return 1;
+	}
+
+	for (; now < end; now += STEP) {
+		_serve();
+		_deliver(s);
+
+		/* the pollers ask again as soon as they are allowed to */
+		for (i = 0; i < ACCOUNTS; i++)
+			if (now >= next_poll[i])
+				next_poll[i] = now + _send(s, i * ENDPOINTS,
+							   SCHED_POLL);
+
+		if (now >= next_bulk) {
+			for (i = 0; i < ACCOUNTS; i++)
+				_send(s, i * ENDPOINTS, SCHED_BULK);
+			next_bulk += BULK_PERIOD;
+		}
+
+		/* the commands arrive at random, the user doesn't wait */
+		if (now >= next_ui) {
+			_send(s, rand() % KEYS, SCHED_UI);
+			next_ui += 2 * UI_PERIOD * _random();
+		}
+	}
+	sched_free(s);
+
+	printf("simulated %.1f hours, %d accounts, %d requests per %d s\n",
+	       hours, ACCOUNTS, LIMIT, WINDOW);
+	printf("priority        sent   deferred    refused\n");
+	for (i = 0; i < 3; i++) {
+		printf("%-8s  %10ld %10ld %10ld\n", priorities[i], sent[i],
+		       deferred[i], refused[i]);
+		total += sent[i];
+	}
+
+	allowed = (long) (hours * 3600 / WINDOW + 1) * LIMIT * KEYS;
+	printf("%ld requests sent of the at most %ld allowed\n", total,
+	       allowed);
+
+	if (refused[SCHED_UI] + refused[SCHED_BULK] + refused[SCHED_POLL]) {
+		printf("FAIL: the server refused requests\n");
+		return 1;
+	}
+	return 0;
+}
+
+/* ************************************
+ * static functions
+ */
+static double _clock(void *arg)
+{
+	return now;
+}
+
+static char *_key(int key)
+{
+	static char buf[64];
+
+	sprintf(buf, "user%d %s", key / ENDPOINTS,
+		key % ENDPOINTS ? "/friends" : "/timeline");
+	return buf;
+}
+
+static double _send(sched s, int key, int priority)
+{
+	struct _flight *f;
+	double wait;
+
+	if (inflight == MAX_FLIGHT)
+		return STEP;
+
+	wait = sched_take(s, _key(key), priority);
+	if (wait > 0) {
+		/* a poller asking again isn't counted */
+		if (priority != SCHED_POLL)
+			deferred[priority]++;
+		return wait;
+	}
+
+	f = &flights[inflight++];
+	f->key = key;
+	f->priority = priority;
+	f->done = 0;
+	f->arrives = now + MAX_LATENCY * _random();
+	f->handled = now + (f->arrives - now) * _random();
+	sent[priority]++;
+	return 0;
+}
+
+static void _serve(void)
+{
+	struct _window *w;
+	struct _flight *f;
+	int i;
+
+	for (i = 0; i < inflight; i++) {
+		f = &flights[i];
+		if (f->done || f->handled > now)
+			continue;
+
+		w = &windows[f->key];
+		if (now >= w->reset) {
+			w->reset = (long) now + WINDOW;
+			w->used = 0;
+		}
+
+		f->status = w->used < LIMIT ? 200 : 429;
+		if (f->status == 200)
+			w->used++;
+		else
+			refused[f->priority]++;
+
+		f->limit = LIMIT;
+		f->remaining = LIMIT - w->used;
+		f->reset = w->reset;
+		f->done = 1;
+	}
+}
+
+static void _deliver(sched s)
+{
+	struct _flight *f;
+	int i;
+
+	for (i = 0; i < inflight; i++) {
+		f = &flights[i];
+		if (!f->done || f->arrives > now)
+			continue;
+
+		sched_done(s, _key(f->key), f->limit, f->remaining, f->reset,
+			   f->status == 429);
+		flights[i--] = flights[--inflight];
+	}
+}
+
+static double _random(void)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
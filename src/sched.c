@@ -0,0 +1,202 @@
+#define MEM_AREA MEM_UI
+#include "sched.h"
+
+/** @file */
+
+/** The seconds a window is taken to last beyond the reset time reported,
+ * since the clocks of the client and the server differ a little */
+#define SCHED_SLACK 2
+/** The seconds to wait for the response that tells the limit */
+#define SCHED_PROBE_WAIT 1
+/** The seconds nothing is sent for after a refusal that didn't tell when
+ * the window ends */
+#define SCHED_REFUSED_WAIT 60
+
+/** The rate limit of a key */
+struct _sched_bucket {
+
+	/** The key */
+	char *key;
+
+	/** True if the server reported the limit of the current window */
+	int known;
+
+	/** The count of requests allowed in a window */
+	long limit;
+
+	/** The count of requests left in the window, less the ones sent
+	 * since it was reported */
+	long remaining;
+
+	/** The time the window ends, in seconds since the epoch */
+	long reset;
+
+	/** The count of requests let through and not done yet */
+	int inflight;
+
+	/** The time the last SCHED_POLL request was let through */
+	double last_poll;
+
+	/** The next bucket */
+	struct _sched_bucket *next;
+};
+
+/** The scheduler */
+struct _sched {
+
+	/** The clock and its argument */
+	sched_clock_fn clock;
+	void *arg;
+
+	/** The buckets, looked up linearly since there's one per account
+	 * and endpoint */
+	struct _sched_bucket *buckets;
+};
+
+/** Returns the bucket of the key, adding it if it isn't there yet
+ * @param s the scheduler
+ * @param key the key
+ * @return the bucket, NULL if out of memory */
+static struct _sched_bucket *_sched_bucket(sched s, char *key);
+
+sched sched_create(sched_clock_fn clock, void *arg)
+{
+	sched ret = malloc(sizeof(*ret));
+
+	if (ret == NULL)
+		return NULL;
+
+	ret->clock = clock;
+	ret->arg = arg;
+	ret->buckets = NULL;
+	return ret;
+}
+
+void sched_free(sched s)
+{
+	struct _sched_bucket *next;
+
+	if (s == NULL)
+		return;
+
+	for (; s->buckets != NULL; s->buckets = next) {
+		next = s->buckets->next;
+		free(s->buckets->key);
+		free(s->buckets);
+	}
+	free(s);
+}
+
+double sched_take(sched s, char *key, int priority)
+{
+	struct _sched_bucket *b = _sched_bucket(s, key);
+	double now = s->clock(s->arg);
+	double wait;
+	long reserve = 0;
+
+	if (b == NULL)
+		return SCHED_PROBE_WAIT;
+
+	/* the window is over, the next response tells the new one */
+	if (b->known && now >= b->reset + SCHED_SLACK)
+		b->known = 0;
+
+	if (!b->known) {
+		if (b->inflight > 0)
+			return SCHED_PROBE_WAIT;
+	}
+	else {
+		if (priority == SCHED_BULK)
+			reserve = b->limit / SCHED_BULK_RESERVE;
+		else if (priority == SCHED_POLL)
+			reserve = b->limit / SCHED_POLL_RESERVE;
+
+		if (b->remaining <= reserve)
+			return b->reset + SCHED_SLACK - now;
+
+		/* polling is spread over the rest of the window, so that it
+		 * doesn't run the bucket dry in a burst */
+		if (priority == SCHED_POLL) {
+			wait = b->last_poll - now + (b->reset + SCHED_SLACK -
+						     now) / (b->remaining -
+							     reserve);
+			if (wait > 0)
+				return wait;
+		}
+		b->remaining--;
+	}
+
+	if (priority == SCHED_POLL)
+		b->last_poll = now;
+	b->inflight++;
+	return 0;
+}
+
+void sched_done(sched s, char *key, long limit, long remaining, long reset,
+		int refused)
+{
+	struct _sched_bucket *b = _sched_bucket(s, key);
+	double now = s->clock(s->arg);
+
+	if (b == NULL)
+		return;
+	if (b->inflight > 0)
+		b->inflight--;
+
+	if (refused) {
+		b->known = 1;
+		b->remaining = 0;
+		if (limit >= 0 && reset > now) {
+			b->limit = limit;
+			b->reset = reset;
+		}
+		else {
+			b->reset = (long) now + SCHED_REFUSED_WAIT;
+		}
+		return;
+	}
+
+	if (limit < 0)
+		return;		/* nothing learnt */
+
+	/* the ones in flight may not have been counted by the server yet */
+	remaining -= b->inflight;
+	if (remaining < 0)
+		remaining = 0;
+
+	if (!b->known || reset > b->reset) {	/* a new window */
+		b->known = 1;
+		b->limit = limit;
+		b->remaining = remaining;
+		b->reset = reset;
+	}
+	else if (reset == b->reset && remaining < b->remaining) {
+		b->remaining = remaining;
+	}
+	/* a response of an earlier window is late, and tells nothing */
+}
+
+/* ************************************
+ * static functions
+ */
+static struct _sched_bucket *_sched_bucket(sched s, char *key)
+{
+	struct _sched_bucket *b;
+
+	for (b = s->buckets; b != NULL; b = b->next)
+		if (!strcmp(b->key, key))
+			return b;
+
+	b = calloc(1, sizeof(*b));
+	if (b == NULL)
+		return NULL;
+	b->key = mystrdup(key);
+	if (b->key == NULL) {
+		free(b);
+		return NULL;
+	}
+
+	b->next = s->buckets;
+	s->buckets = b;
+	return b;
+}
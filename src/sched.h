@@ -0,0 +1,74 @@
+#ifndef __SCHED_H
+#define __SCHED_H
+#include "main.h"
+
+/** @file */
+
+/** The priorities of the requests, the most urgent first */
+enum sched_priority {
+
+	/** A command typed in, which may use up the whole window */
+	SCHED_UI,
+
+	/** One of a batch, eg. an account of the m command, which leaves
+	 * SCHED_BULK_RESERVE of the window to the commands */
+	SCHED_BULK,
+
+	/** Background polling, which leaves SCHED_POLL_RESERVE of the window
+	 * to the others, and is spread evenly over what's left of it */
+	SCHED_POLL
+};
+
+/** The part of the window (1/n of the limit) SCHED_BULK leaves unused */
+#define SCHED_BULK_RESERVE 10
+/** The part of the window (1/n of the limit) SCHED_POLL leaves unused */
+#define SCHED_POLL_RESERVE 4
+
+/** A scheduler of the requests, see sched_take() */
+typedef struct _sched *sched;
+
+/** The prototype of the clock of the scheduler
+ * @param arg the argument given to sched_create()
+ * @return the time in seconds since the epoch, the clock of the reset
+ * times the server reports */
+typedef double (*sched_clock_fn) (void *arg);
+
+/** Creates a scheduler
+ * @param clock the clock, which a simulation may replace
+ * @param arg passed to clock
+ * @return the scheduler, NULL if out of memory */
+sched sched_create(sched_clock_fn clock, void *arg);
+
+/** Frees a scheduler
+ * @param s the scheduler to free, may be NULL */
+void sched_free(sched s);
+
+/** Asks whether a request may be sent now without exceeding the rate limit
+ * of its endpoint. Each key (eg. the user and the endpoint) has a bucket
+ * of its own, which holds the requests left of the window as the server
+ * reported them with sched_done(), less the ones sent since.
+ *
+ * Until the server reports the limit of a key, or after its window ended,
+ * one request is let through at a time, so that the first response tells
+ * the limit before any more is sent.
+ * @param s the scheduler
+ * @param key the key of the bucket
+ * @param priority a value of enum sched_priority
+ * @return 0 if the request may be sent, in which case it's counted and
+ * sched_done() has to be called when it's done, otherwise the seconds to
+ * wait before asking again */
+double sched_take(sched s, char *key, int priority);
+
+/** Tells the scheduler that a request let through by sched_take() is done
+ * @param s the scheduler
+ * @param key the key of the bucket
+ * @param limit the count of requests allowed in a window as the response
+ * reported it, -1 if not reported (or no response arrived)
+ * @param remaining the count of requests left in the window
+ * @param reset the time the window ends, in seconds since the epoch
+ * @param refused true if the server refused the request for the rate limit
+ * (429), so nothing is sent until the window ends */
+void sched_done(sched s, char *key, long limit, long remaining, long reset,
+		int refused);
+
+#endif
@@ -0,0 +1,421 @@
+#define MEM_AREA MEM_STATUS
+#include "shmcache.h"
+#include "store.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** @file */
+
+/** Tells the file of a cache from anything else, and from a cache of
+ * another layout */
+#define SHMCACHE_MAGIC "twcache"
+#define SHMCACHE_VERSION 1
+
+/** The bytes of the file locked: by the writers, and by the process making
+ * the header */
+#define LOCK_WRITE 0
+#define LOCK_INIT 1
+
+/** A status in the ring */
+struct _shmcache_slot {
+
+	/** The IDs, as in a status_page */
+	unsigned long id;
+	unsigned long user_id;
+	unsigned long in_reply_to_id;
+
+	/** The time of posting, STATUS_NONE if missing */
+	long created_at;
+
+	/** The offsets of the strings, STATUS_NONE for the ones missing */
+	int screen_name;
+	int in_reply_to;
+	int text;
+
+	/** The strings, terminated one after the other */
+	char strings[SHMCACHE_STRINGS];
+};
+
+/** The start of the file */
+struct _shmcache_header {
+
+	/** SHMCACHE_MAGIC, written last when the header is made */
+	char magic[8];
+	long version;
+
+	/** The size of the file, the header included */
+	long size;
+
+	/** Odd while the header is switched to another page */
+	unsigned long seq;
+
+	/** The first slot of the last page, and the count of its slots */
+	long first;
+	long count;
+
+	/** About the last page, see struct shmcache_meta */
+	long fetched_at;
+	long pid;
+	unsigned long generation;
+};
+
+/** The cache */
+struct _shmcache {
+
+	/** The file, and its size */
+	int fd;
+	long size;
+
+	/** The mapping of the file: the header, and the slots after it */
+	struct _shmcache_header *header;
+	struct _shmcache_slot *slots;
+
+	/** True while the lock of the writers is held */
+	int locked;
+};
+
+/** Empties a header left half switched by a writer that died, the lock
+ * of the writers held
+ * @param c the cache */
+static void _shmcache_repair(shmcache c);
+
+/** Waits for a writer switching the header, see shmcache_read()
+ * @param c the cache
+ * @param tries the times waited so far
+ * @retval 0 to read again
+ * @retval -1 to give up */
+static int _shmcache_wait(shmcache c, int tries);
+
+/** Writes a status to a slot
+ * @param slot the slot
+ * @param page the page of the status
+ * @param row the row of the status */
+static void _shmcache_put(struct _shmcache_slot *slot, status_page page,
+			  long row);
+
+/** Appends a string to the strings of a slot, cut to the room left at the
+ * start of a UTF-8 character
+ * @param slot the slot
+ * @param len the length of the strings so far, updated
+ * @param str the string, NULL if missing
+ * @return the offset of the string, STATUS_NONE if missing or no room */
+static int _shmcache_string(struct _shmcache_slot *slot, int *len,
+			    char *str);
+
+/** Adds the status of a slot copied from the ring to a page
+ * @param page the page
+ * @param slot the slot, its last byte is overwritten
+ * @retval 0 if succeeded
+ * @retval -1 if out of memory */
+static int _shmcache_get(status_page page, struct _shmcache_slot *slot);
+
+/** Copies a string of a slot into the pool of a page
+ * @param page the page
+ * @param slot the slot, terminated
+ * @param off the offset of the string in the slot, anything if missing
+ * @param field the offset in the pool is stored here, STATUS_NONE if
+ * missing
+ * @retval 0 if succeeded
+ * @retval -1 if out of memory */
+static int _shmcache_field(status_page page, struct _shmcache_slot *slot,
+			   int off, long *field);
+
+shmcache shmcache_open(char *file)
+{
+	shmcache c = calloc(1, sizeof(*c));
+	struct _shmcache_header *h;
+	struct stat st;
+	void *map = MAP_FAILED;
+
+	if (c == NULL)
+		return NULL;
+
+	c->size = sizeof(struct _shmcache_header) +
+	    SHMCACHE_SLOTS * sizeof(struct _shmcache_slot);
+	c->fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (c->fd < 0) {
+		free(c);
+		return NULL;
+	}
+
+	/* sized before it's mapped, the mapping past the end of the file
+	 * can't be touched */
+	store_lock(c->fd, LOCK_INIT, F_WRLCK, 1);
+	if (fstat(c->fd, &st) == 0
+	    && (st.st_size == c->size || ftruncate(c->fd, c->size) == 0))
+		map = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   c->fd, 0);
+
+	/* new, of another layout, or made by a process that died meanwhile */
+	h = map;
+	if (map != MAP_FAILED
+	    && (memcmp(h->magic, SHMCACHE_MAGIC, sizeof(h->magic))
+		|| h->version != SHMCACHE_VERSION || h->size != c->size)) {
+		memset(h, 0, sizeof(*h));
+		h->version = SHMCACHE_VERSION;
+		h->size = c->size;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memcpy(h->magic, SHMCACHE_MAGIC, sizeof(h->magic));
+	}
+	store_lock(c->fd, LOCK_INIT, F_UNLCK, 1);
+
+	if (map == MAP_FAILED) {
+		close(c->fd);
+		free(c);
+		return NULL;
+	}
+	c->header = h;
+	c->slots = (struct _shmcache_slot *) (h + 1);
+	return c;
+}
+
+void shmcache_close(shmcache c)
+{
+	if (c == NULL)
+		return;
+
+	munmap(c->header, c->size);
+	close(c->fd);		/* the locks go with it */
+	free(c);
+}
+
+status_page shmcache_read(shmcache c, struct shmcache_meta *meta)
+{
+	struct _shmcache_header *h = c->header;
+	struct _shmcache_header head;
+	struct _shmcache_slot *slots = NULL;
+	status_page page;
+	unsigned long seq;
+	long room = 0;
+	long i;
+	int tries = 0;
+
+	meta->fetched_at = 0;
+	meta->pid = 0;
+	meta->generation = 0;
+
+	/* the slots are copied as they are, and only looked into once the
+	 * header is known not to have moved meanwhile */
+	for (;;) {
+		seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			if (_shmcache_wait(c, tries++) < 0) {
+				free(slots);
+				return NULL;
+			}
+			continue;
+		}
+
+		memcpy(&head, h, sizeof(head));
+		if (head.first < 0 || head.first >= SHMCACHE_SLOTS
+		    || head.count < 0 || head.count > SHMCACHE_SLOTS / 2)
+			head.count = 0;
+		if (head.count > room) {
+			free(slots);
+			room = head.count;
+			slots = malloc(room * sizeof(*slots));
+			if (slots == NULL)
+				return NULL;
+		}
+		for (i = 0; i < head.count; i++)
+			memcpy(&slots[i],
+			       &c->slots[(head.first + i) % SHMCACHE_SLOTS],
+			       sizeof(*slots));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	meta->fetched_at = head.fetched_at;
+	meta->pid = head.pid;
+	meta->generation = head.generation;
+	if (head.fetched_at == 0) {
+		free(slots);
+		return NULL;
+	}
+
+	page = status_create();
+	for (i = 0; page != NULL && i < head.count; i++) {
+		if (_shmcache_get(page, &slots[i]) < 0) {
+			status_free(page);
+			page = NULL;
+		}
+	}
+	free(slots);
+	return page;
+}
+
+int shmcache_lock(shmcache c)
+{
+	if (!c->locked && store_lock(c->fd, LOCK_WRITE, F_WRLCK, 1) == 0)
+		c->locked = 1;
+	return c->locked ? 0 : -1;
+}
+
+void shmcache_unlock(shmcache c)
+{
+	if (!c->locked)
+		return;
+
+	store_lock(c->fd, LOCK_WRITE, F_UNLCK, 1);
+	c->locked = 0;
+}
+
+int shmcache_publish(shmcache c, status_page page)
+{
+	struct _shmcache_header *h = c->header;
+	unsigned long seq;
+	long count = page->count;
+	long first = 0;
+	long i;
+
+	if (!c->locked)
+		return -1;
+	_shmcache_repair(c);
+
+	/* the API sends the newest statuses first */
+	if (count > SHMCACHE_SLOTS / 2)
+		count = SHMCACHE_SLOTS / 2;
+	if (h->first >= 0 && h->first < SHMCACHE_SLOTS && h->count >= 0
+	    && h->count <= SHMCACHE_SLOTS / 2)
+		first = (h->first + h->count) % SHMCACHE_SLOTS;
+
+	/* the slots after the last page may be those of the page before it,
+	 * which a reader may still be copying: it sees the switch to the last
+	 * page before any of them changes, and reads again */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (i = 0; i < count; i++)
+		_shmcache_put(&c->slots[(first + i) % SHMCACHE_SLOTS], page, i);
+
+	seq = __atomic_load_n(&h->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	h->first = first;
+	h->count = count;
+	h->fetched_at = time(NULL);
+	h->pid = getpid();
+	h->generation++;
+	__atomic_store_n(&h->seq, seq + 2, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* ************************************
+ * static functions
+ */
+static void _shmcache_repair(shmcache c)
+{
+	struct _shmcache_header *h = c->header;
+	unsigned long seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+
+	if (!(seq & 1))
+		return;
+
+	h->first = 0;
+	h->count = 0;
+	h->fetched_at = 0;
+	h->pid = 0;
+	__atomic_store_n(&h->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+static int _shmcache_wait(shmcache c, int tries)
+{
+	if (tries >= SHMCACHE_WAIT)
+		return -1;
+
+	/* no writer holds the lock, the one that switched died */
+	if (c->locked) {
+		_shmcache_repair(c);
+		return 0;
+	}
+	if (store_lock(c->fd, LOCK_WRITE, F_WRLCK, 0) == 0) {
+		_shmcache_repair(c);
+		store_lock(c->fd, LOCK_WRITE, F_UNLCK, 0);
+		return 0;
+	}
+
+	poll(NULL, 0, 1);
+	return 0;
+}
+
+static void _shmcache_put(struct _shmcache_slot *slot, status_page page,
+			  long row)
+{
+	int len = 0;
+
+	slot->id = page->id[row];
+	slot->user_id = page->user_id[row];
+	slot->in_reply_to_id = page->in_reply_to_id[row];
+	slot->created_at = page->created_at[row];
+
+	/* the text last, it's the one cut if anything is */
+	slot->screen_name = _shmcache_string(slot, &len,
+					     STATUS_STR(page,
+							page->screen_name[row]));
+	slot->in_reply_to = _shmcache_string(slot, &len,
+					     STATUS_STR(page,
+							page->in_reply_to[row]));
+	slot->text = _shmcache_string(slot, &len,
+				      STATUS_STR(page, page->text[row]));
+}
+
+static int _shmcache_string(struct _shmcache_slot *slot, int *len,
+			    char *str)
+{
+	long room = SHMCACHE_STRINGS - *len - 1;
+	long n;
+	int off = *len;
+
+	if (str == NULL || room < 0)
+		return STATUS_NONE;
+
+	n = strlen(str);
+	if (n > room) {
+		n = room;
+		while (n > 0 && (str[n] & 0xc0) == 0x80)
+			n--;
+	}
+	memcpy(slot->strings + off, str, n);
+	slot->strings[off + n] = 0;
+	*len += n + 1;
+	return off;
+}
+
+static int _shmcache_get(status_page page, struct _shmcache_slot *slot)
+{
+	long row = status_add(page);
+
+	if (row < 0)
+		return -1;
+
+	page->id[row] = slot->id;
+	page->user_id[row] = slot->user_id;
+	page->in_reply_to_id[row] = slot->in_reply_to_id;
+	page->created_at[row] = slot->created_at;
+
+	/* the slot is trusted no further than its bounds */
+	slot->strings[SHMCACHE_STRINGS - 1] = 0;
+	if (_shmcache_field(page, slot, slot->screen_name,
+			    &page->screen_name[row]) < 0
+	    || _shmcache_field(page, slot, slot->in_reply_to,
+			       &page->in_reply_to[row]) < 0
+	    || _shmcache_field(page, slot, slot->text, &page->text[row]) < 0)
+		return -1;
+	return 0;
+}
+
+static int _shmcache_field(status_page page, struct _shmcache_slot *slot,
+			   int off, long *field)
+{
+	*field = STATUS_NONE;
+	if (off < 0 || off >= SHMCACHE_STRINGS)
+		return 0;
+
+	*field = status_add_string(page, slot->strings + off);
+	return *field < 0 ? -1 : 0;
+}
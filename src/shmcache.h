@@ -0,0 +1,85 @@
+#ifndef __SHMCACHE_H
+#define __SHMCACHE_H
+#include "main.h"
+#include "status.h"
+
+/** @file */
+
+/** The statuses the ring of the cache holds. A page takes half of them at
+ * most, the newest statuses of a longer one are kept. */
+#define SHMCACHE_SLOTS 400
+
+/** The room for the strings of a status: its author, the user it replies
+ * to and its text, a longer text is cut */
+#define SHMCACHE_STRINGS 640
+
+/** The times (a millisecond each) a reader waits for a writer to finish
+ * before it gives up on the cache */
+#define SHMCACHE_WAIT 100
+
+/** The last timeline of an account fetched by any twitterm, in a file
+ * mapped into the memory of every one of them, see shmcache_open() */
+typedef struct _shmcache *shmcache;
+
+/** About the page in the cache, see shmcache_read() */
+struct shmcache_meta {
+
+	/** The time it was fetched at, 0 if none was */
+	long fetched_at;
+
+	/** The process that fetched it */
+	long pid;
+
+	/** The count of pages written to the cache */
+	unsigned long generation;
+};
+
+/** Opens the cache, creating the file if needed. The file is mapped
+ * shared, and holds a ring of fixed size slots, a status each, and a
+ * header telling which slots make the last page. A page is written to the
+ * slots after the last one, which no reader reads, and then the header is
+ * switched to it: only the switch is guarded by a sequence lock, so the
+ * readers don't lock anything, and read again if a switch went on
+ * meanwhile.
+ *
+ * The writers take a file lock, which the system drops when a process dies:
+ * a writer that dies writing the slots leaves the last page as it was, and
+ * a header it left half switched is found by the next reader or writer,
+ * and emptied. The statuses of protected accounts end up in it too, so the
+ * other users can't map it.
+ * @param file the name of the file
+ * @return the cache, NULL if the file couldn't be opened or mapped, or out
+ * of memory */
+shmcache shmcache_open(char *file);
+
+/** Closes the cache, and drops its lock
+ * @param c the cache, may be NULL */
+void shmcache_close(shmcache c);
+
+/** Reads the last page from the cache, without a lock, but it may wait
+ * SHMCACHE_WAIT milliseconds for a writer switching the header
+ * @param c the cache
+ * @param meta about the page, stored here; fetched_at is 0 if there is no
+ * page
+ * @return the page, NULL if out of memory, or there is no page */
+status_page shmcache_read(shmcache c, struct shmcache_meta *meta);
+
+/** Takes the lock of the writers, waiting for the process holding it: one
+ * process fetches a timeline, and the others wait to read it
+ * @param c the cache
+ * @retval 0 if succeeded
+ * @retval -1 if the lock couldn't be taken */
+int shmcache_lock(shmcache c);
+
+/** Drops the lock of the writers
+ * @param c the cache */
+void shmcache_unlock(shmcache c);
+
+/** Writes a page to the cache, as the last one, fetched now
+ * @param c the cache, locked by shmcache_lock()
+ * @param page the page
+ * @retval 0 if succeeded
+ * @retval -1 if the cache isn't locked */
+int shmcache_publish(shmcache c, status_page page);
+
+#endif
@@ -0,0 +1,570 @@
+#define MEM_AREA MEM_SPOOL
+#include "spool.h"
+#include "store.h"
+#include "http.h"
+#include "inflate.h"
+#include "transport.h"
+
+#include <stdio.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/** @file spool.c */
+
+/** The length of the type and the CRC at the start of a record */
+#define RECORD_HEAD 11
+
+/** The bytes of the file locked: while the records are read or appended,
+ * and while a flusher sends the posts, see _spool_round() */
+#define LOCK_RECORDS 0
+#define LOCK_FLUSH 1
+
+/** The time (ms) a flusher waits for the one sending the posts */
+#define SPOOL_BUSY 50
+
+/** The spool. The records are lines of the file:
+ * - "P crc user pwd body" for a post, user and pwd percent encoded, body
+ *   the form sent;
+ * - "D crc offset status" once the post at that offset is done,
+ *
+ * crc being the CRC32 of what follows it, in 8 hex digits. */
+struct _spool {
+
+	/** The file, opened for appending */
+	int fd;
+
+	/** The server and the file the posts are sent to */
+	char *domain;
+	char *path;
+
+	/** Our end of the socket the flusher is woken up through, -1 if there
+	 * is no flusher */
+	int notify;
+
+	/** The flusher */
+	pid_t flusher;
+};
+
+/** A post read from the spool */
+struct _spool_post {
+
+	/** The offset of its record */
+	long off;
+
+	/** The account, its password, and the body to send */
+	char *user;
+	char *pwd;
+	char *body;
+};
+
+/** Appends a record to the spool, completing a line torn by a crash first
+ * @param fd the file
+ * @param type the type of the record
+ * @param payload what follows the CRC
+ * @return the offset of the record, -1 if it couldn't be written */
+static long _spool_append(int fd, char type, char *payload);
+
+/** Checks a line of the spool
+ * @param line the line, its newline replaced by a 0
+ * @param len the length of the line
+ * @return the type of the record, 0 if the line is torn or corrupted */
+static char _spool_check(char *line, long len);
+
+/** Decodes a percent encoded string in place
+ * @param str the string */
+static void _spool_decode(char *str);
+
+/** Compares two offsets for qsort() and bsearch() */
+static int _offset_cmp(const void *a, const void *b);
+
+/** Reads the posts not done yet, and empties the spool if there are none
+ * and it's asked to, under the lock so that no post is appended meanwhile
+ * @param fd the file
+ * @param truncate true to empty the spool if no post is left
+ * @param posts the posts are stored here if not NULL, to be freed by
+ * _spool_free()
+ * @return the count of posts, -1 if the spool couldn't be read or out of
+ * memory */
+static long _spool_scan(int fd, int truncate, struct _spool_post **posts);
+
+/** Frees the posts read by _spool_scan()
+ * @param posts the posts
+ * @param count their count */
+static void _spool_free(struct _spool_post *posts, long count);
+
+/** Sends the posts not done yet, in order, and marks them done, the ones
+ * appended meanwhile included, and empties the spool then. A flusher does
+ * so only while no other one does, of this client or another one, else
+ * the posts would be sent twice.
+ * @param s the spool
+ * @return the count of posts left, because the server couldn't be reached
+ * or answered it's busy; -1 if another flusher is sending them */
+static long _spool_round(spool s);
+
+/** Starts the flusher
+ * @param s the spool
+ * @retval 0 if succeeded
+ * @retval -1 if it couldn't be forked */
+static int _spool_start(spool s);
+
+/** Sends posts in order, and marks them done
+ * @param s the spool
+ * @param posts the posts
+ * @param count the count of posts
+ * @return the count of posts sent, the ones after them are left for later
+ * because the server couldn't be reached or answered it's busy */
+static long _spool_send(spool s, struct _spool_post *posts, long count);
+
+/** The flusher: sends the posts whenever it's woken up, batching the posts
+ * that come close together, and tries again later the ones the server
+ * couldn't take. Doesn't return.
+ * @param s the spool
+ * @param sock its end of the socket it's woken up through */
+static void _spool_flusher(spool s, int sock);
+
+spool spool_open(char *file, char *domain, char *path)
+{
+	spool ret = calloc(1, sizeof(*ret));
+
+	if (ret == NULL)
+		return NULL;
+
+	ret->fd = open(file, O_RDWR | O_CREAT | O_APPEND, 0600);
+	if (ret->fd < 0) {
+		free(ret);
+		return NULL;
+	}
+	ret->domain = domain;
+	ret->path = path;
+	ret->notify = -1;
+
+	/* the posts an earlier run didn't send */
+	if (spool_pending(ret) > 0)
+		_spool_start(ret);
+	return ret;
+}
+
+int spool_post(spool s, char *user, char *pwd, char *status)
+{
+	char *euser = http_urlencode(user);
+	char *epwd = http_urlencode(pwd);
+	char *estatus = http_urlencode(status);
+	char *payload = NULL;
+	long ret = -1;
+
+	if (euser != NULL && epwd != NULL && estatus != NULL)
+		payload = malloc(strlen(euser) + strlen(epwd) +
+				 strlen(estatus) + 10);
+	if (payload != NULL) {
+		sprintf(payload, "%s %s status=%s", euser, epwd, estatus);
+		ret = _spool_append(s->fd, 'P', payload);
+	}
+	free(euser);
+	free(epwd);
+	free(estatus);
+	free(payload);
+	if (ret < 0)
+		return -1;
+
+	/* a flusher that died is started again, if it can't be the post
+	 * waits for the next run */
+	if (s->notify >= 0 && waitpid(s->flusher, NULL, WNOHANG) != 0) {
+		close(s->notify);
+		s->notify = -1;
+	}
+	if (s->notify >= 0 || _spool_start(s) == 0)
+		send(s->notify, "p", 1, SEND_FLAGS);
+	return 0;
+}
+
+long spool_pending(spool s)
+{
+	return _spool_scan(s->fd, 0, NULL);
+}
+
+void spool_close(spool s)
+{
+	if (s == NULL)
+		return;
+
+	/* the flusher sees the end of the socket, and lingers */
+	if (s->notify >= 0)
+		close(s->notify);
+	close(s->fd);
+	free(s);
+}
+
+/* ************************************
+ * static functions
+ */
+static long _spool_append(int fd, char type, char *payload)
+{
+	long len = strlen(payload);
+	char *line = malloc(len + RECORD_HEAD + 2);
+	char *ptr;
+	char last;
+	long off;
+	long left;
+	long n;
+
+	if (line == NULL)
+		return -1;
+	sprintf(line, "%c %08lx %s\n", type,
+		inflate_crc32(0, (unsigned char *) payload, len), payload);
+
+	store_lock(fd, LOCK_RECORDS, F_WRLCK, 1);
+	off = lseek(fd, 0, SEEK_END);
+	if (off > 0 && pread(fd, &last, 1, off - 1) == 1 && last != '\n') {
+		/* the torn line is left for _spool_check() to skip */
+		if (write(fd, "\n", 1) == 1)
+			off++;
+		else
+			off = -1;
+	}
+
+	for (ptr = line, left = len + RECORD_HEAD + 1; off >= 0 && left > 0;) {
+		n = write(fd, ptr, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			off = -1;
+		else {
+			ptr += n;
+			left -= n;
+		}
+	}
+	store_lock(fd, LOCK_RECORDS, F_UNLCK, 1);
+
+	free(line);
+	return off;
+}
+
+static char _spool_check(char *line, long len)
+{
+	char crc[9];
+	char *end;
+
+	if (len < RECORD_HEAD || line[1] != ' ' || line[10] != ' '
+	    || (line[0] != 'P' && line[0] != 'D'))
+		return 0;
+
+	memcpy(crc, line + 2, 8);
+	crc[8] = 0;
+	if (strtoul(crc, &end, 16) !=
+	    inflate_crc32(0, (unsigned char *) line + RECORD_HEAD,
+			  len - RECORD_HEAD) || end != crc + 8)
+		return 0;
+
+	return line[0];
+}
+
+static void _spool_decode(char *str)
+{
+	char *out = str;
+	char hex[3];
+
+	for (hex[2] = 0; *str != 0; str++) {
+		if (*str == '%' && isxdigit((unsigned char) str[1])
+		    && isxdigit((unsigned char) str[2])) {
+			hex[0] = str[1];
+			hex[1] = str[2];
+			*out++ = (char) strtol(hex, NULL, 16);
+			str += 2;
+		}
+		else
+			*out++ = *str;
+	}
+	*out = 0;
+}
+
+static int _offset_cmp(const void *a, const void *b)
+{
+	long x = *(long *) a;
+	long y = *(long *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static long _spool_scan(int fd, int truncate, struct _spool_post **posts)
+{
+	struct _spool_post *found = NULL;
+	char *data;
+	char *line;
+	char *next;
+	char *pwd;
+	char *body;
+	long *done = NULL;
+	long ndone = 0;
+	long count = 0;
+	long size;
+	long i;
+	long j;
+	int bad = 0;
+
+	store_lock(fd, LOCK_RECORDS, F_WRLCK, 1);
+	size = lseek(fd, 0, SEEK_END);
+	data = malloc(size + 1);
+	if (size < 0 || data == NULL
+	    || (size > 0 && pread(fd, data, size, 0) != size)) {
+		store_lock(fd, LOCK_RECORDS, F_UNLCK, 1);
+		free(data);
+		return -1;
+	}
+
+	/* at most a record a line: they are counted first */
+	for (line = data, i = 0; line < data + size; line = next + 1, i++)
+		if ((next = memchr(line, '\n', data + size - line)) == NULL)
+			break;
+	done = malloc((i > 0 ? i : 1) * sizeof(*done));
+	found = malloc((i > 0 ? i : 1) * sizeof(*found));
+	if (done == NULL || found == NULL)
+		bad = 1;
+
+	/* the last line, without its newline, is torn or being written */
+	for (line = data; !bad && line < data + size; line = next + 1) {
+		if ((next = memchr(line, '\n', data + size - line)) == NULL)
+			break;
+		*next = 0;
+
+		switch (_spool_check(line, next - line)) {
+		case 'D':
+			if (sscanf(line + RECORD_HEAD, "%ld", done + ndone) == 1)
+				ndone++;
+			break;
+		case 'P':
+			pwd = strchr(line + RECORD_HEAD, ' ');
+			body = pwd != NULL ? strchr(pwd + 1, ' ') : NULL;
+			if (body == NULL)
+				break;
+			*pwd++ = 0;
+			*body++ = 0;
+			found[count].off = line - data;
+			found[count].user = line + RECORD_HEAD;
+			found[count].pwd = pwd;
+			found[count].body = body;
+			count++;
+			break;
+		}
+	}
+
+	/* the posts that aren't done keep their order */
+	qsort(done, ndone, sizeof(*done), _offset_cmp);
+	for (i = j = 0; !bad && i < count; i++)
+		if (bsearch(&found[i].off, done, ndone, sizeof(*done),
+			    _offset_cmp) == NULL)
+			found[j++] = found[i];
+	count = j;
+
+	if (!bad && truncate && count == 0 && size > 0)
+		bad = ftruncate(fd, 0) < 0;
+	store_lock(fd, LOCK_RECORDS, F_UNLCK, 1);
+
+	/* copied out of the data */
+	for (i = 0; !bad && posts != NULL && i < count; i++) {
+		found[i].user = mystrdup(found[i].user);
+		found[i].pwd = mystrdup(found[i].pwd);
+		found[i].body = mystrdup(found[i].body);
+		if (found[i].user == NULL || found[i].pwd == NULL
+		    || found[i].body == NULL) {
+			_spool_free(found, i + 1);
+			found = NULL;
+			bad = 1;
+		}
+		else {
+			_spool_decode(found[i].user);
+			_spool_decode(found[i].pwd);
+		}
+	}
+
+	free(data);
+	free(done);
+	if (bad || posts == NULL) {
+		free(found);
+		return bad ? -1 : count;
+	}
+	*posts = found;
+	return count;
+}
+
+static void _spool_free(struct _spool_post *posts, long count)
+{
+	long i;
+
+	for (i = 0; i < count; i++) {
+		free(posts[i].user);
+		free(posts[i].pwd);
+		free(posts[i].body);
+	}
+	free(posts);
+}
+
+static long _spool_round(spool s)
+{
+	struct _spool_post *posts;
+	long count;
+	long sent;
+	long left;
+
+	/* held from the scan to the truncation: a flusher that scanned before
+	 * another one emptied the spool would mark the posts after it done */
+	if (store_lock(s->fd, LOCK_FLUSH, F_WRLCK, 0) < 0)
+		return -1;
+
+	do {
+		/* one sync makes every post appended so far durable */
+		fsync(s->fd);
+		count = _spool_scan(s->fd, 0, &posts);
+		if (count <= 0) {
+			left = count < 0;
+			break;
+		}
+		sent = _spool_send(s, posts, count);
+		_spool_free(posts, count);
+
+		if (sent > 0)
+			fsync(s->fd);
+		if (sent < count) {
+			left = count - sent;
+			break;
+		}
+
+		/* unless a post came meanwhile, which is sent as well */
+		left = _spool_scan(s->fd, 1, NULL);
+	} while (left > 0);
+
+	store_lock(s->fd, LOCK_FLUSH, F_UNLCK, 0);
+	return left < 0 ? 1 : left;
+}
+
+static long _spool_send(spool s, struct _spool_post *posts, long count)
+{
+	char done[64];
+	long sent;
+	int resp;
+
+	for (sent = 0; sent < count; sent++) {
+		resp = http_post_auth(s->domain, s->path, NULL,
+				      posts[sent].body, posts[sent].user,
+				      posts[sent].pwd);
+
+		/* tried again later */
+		if (resp < 0 || resp >= 500 || resp == 408 || resp == 429)
+			break;
+
+		/* sending it again wouldn't be any better */
+		if (resp != 200)
+			fprintf(stderr, "\nA queued tweet was refused: "
+				"HTTP error code: %d (%s)\n", resp,
+				http_strerror(resp));
+
+		sprintf(done, "%ld %d", posts[sent].off, resp);
+		if (_spool_append(s->fd, 'D', done) < 0)
+			break;
+	}
+	return sent;
+}
+
+static int _spool_start(spool s)
+{
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return -1;
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		_spool_flusher(s, sv[1]);
+	}
+
+	close(sv[1]);
+	fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+	s->notify = sv[0];
+	s->flusher = pid;
+	return 0;
+}
+
+static void _spool_flusher(spool s, int sock)
+{
+	struct pollfd fds;
+	char buf[64];
+	long delay = SPOOL_RETRY_BASE;
+	long left;
+	time_t deadline = 0;
+	int wait = 0;
+	int n;
+
+	/* a ^C at the prompt doesn't drop the posts being sent */
+	signal(SIGINT, SIG_IGN);
+	srand(getpid());
+	http_set_keepalive(1);
+
+	for (;;) {
+		fds.fd = sock;
+		fds.events = POLLIN;
+		if (sock >= 0 && poll(&fds, 1, wait) > 0) {
+			n = recv(sock, buf, sizeof(buf), 0);
+			if (n > 0) {
+				/* the posts typed right after it come along */
+				poll(NULL, 0, SPOOL_BATCH);
+				fcntl(sock, F_SETFL,
+				      fcntl(sock, F_GETFL) | O_NONBLOCK);
+				while (recv(sock, buf, sizeof(buf), 0) > 0) ;
+				fcntl(sock, F_SETFL,
+				      fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+			}
+			else if (n == 0 || errno != EINTR) {
+				/* the client exited */
+				close(sock);
+				sock = -1;
+				deadline = time(NULL) + SPOOL_LINGER;
+			}
+		}
+		else if (sock < 0 && wait > 0)
+			poll(NULL, 0, wait);
+
+		/* another flusher sends the posts, this one's too, unless it
+		 * was done already: which is seen once it's done */
+		left = _spool_round(s);
+		if (left < 0) {
+			wait = SPOOL_BUSY;
+			if (sock < 0 && time(NULL) >= deadline)
+				break;
+			continue;
+		}
+		if (left == 0)
+			delay = SPOOL_RETRY_BASE;
+		if (sock < 0 && (left == 0 || time(NULL) >= deadline))
+			break;
+		if (left == 0) {
+			wait = -1;
+			continue;
+		}
+
+		/* backing off, jittered so that clients don't come back at
+		 * once */
+		wait = delay / 2 + rand() % (delay / 2 + 1);
+		delay = delay * 2 < SPOOL_RETRY_CAP ? delay * 2 :
+		    SPOOL_RETRY_CAP;
+		if (sock < 0 && wait > (deadline - time(NULL)) * 1000)
+			wait = (deadline - time(NULL)) * 1000;
+	}
+
+	_exit(0);
+}
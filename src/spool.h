@@ -0,0 +1,57 @@
+#ifndef __SPOOL_H
+#define __SPOOL_H
+#include "main.h"
+
+/** @file */
+
+/** The time (ms) the flusher waits after a post for the ones typed right
+ * after it, so that one fsync() covers them all */
+#define SPOOL_BATCH 50
+
+/** The first and the longest delay (ms) before the posts are tried again
+ * when the server couldn't be reached */
+#define SPOOL_RETRY_BASE 1000
+#define SPOOL_RETRY_CAP 300000
+
+/** The time (s) the flusher goes on trying after the client has exited */
+#define SPOOL_LINGER 60
+
+/** The posts not sent yet, see spool_open() */
+typedef struct _spool *spool;
+
+/** Opens the spool, a write-ahead log of the posts: a post is appended to
+ * it, and sent by the flusher, a process of its own, which then marks it
+ * done. The spool is emptied once every post in it is done. The posts left
+ * in it by an earlier run are sent right away.
+ *
+ * The records are lines of text checked by a CRC, so a line torn by a crash
+ * is skipped. The posts are queued with the password of their account, so
+ * the file is created with the mode 0600.
+ * @param file the name of the file
+ * @param domain the server the posts are sent to
+ * @param path the file the posts are sent to
+ * @return the spool, NULL if the file couldn't be opened or out of memory */
+spool spool_open(char *file, char *domain, char *path);
+
+/** Appends a post to the spool, and wakes the flusher up. The post isn't
+ * synced to the disk here, but by the flusher before sending it, along with
+ * the ones typed meanwhile.
+ * @param s the spool
+ * @param user the account to post with
+ * @param pwd its password
+ * @param status the text of the status, encoded here
+ * @retval 0 if succeeded
+ * @retval -1 if the spool couldn't be written */
+int spool_post(spool s, char *user, char *pwd, char *status);
+
+/** Returns the count of the posts not sent yet
+ * @param s the spool
+ * @return the count of posts, -1 if the spool couldn't be read */
+long spool_pending(spool s);
+
+/** Closes the spool. The flusher goes on with the posts left for at most
+ * SPOOL_LINGER seconds, the rest is sent by the next run.
+ * @param s the spool, may be NULL */
+void spool_close(spool s);
+
+#endif
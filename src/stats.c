@@ -0,0 +1,178 @@
+#include "stats.h"
+#include <time.h>
+
+/** @file */
+
+/** Values are exact below 2^SUB_BITS, above that every power of two is
+ * split into 2^SUB_BITS buckets, which keeps the error under 7% */
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+/** The count of buckets needed for 32 bit values */
+#define BUCKETS ((32 - SUB_BITS + 1) * SUB_COUNT)
+/** The largest value recorded, greater ones are clamped (~71 minutes) */
+#define MAX_VALUE 4294967295.0
+
+/** The name of the environment variable that enables the measurements */
+#define STATS_ENV "TWITTERM_STATS"
+
+/** A fixed size, log-linear histogram */
+struct _histogram {
+
+	/** The counts of the buckets, see _bucket() */
+	unsigned long counts[BUCKETS];
+
+	/** The count of values recorded */
+	unsigned long total;
+
+	/** The greatest value recorded */
+	unsigned long max;
+
+	/** The sum of the bytes processed */
+	double bytes;
+};
+
+int stats_enabled = 0;
+
+/** The histograms of the stages */
+static struct _histogram histograms[STATS_STAGES];
+
+/** The names of the stages, as printed */
+static const char *stage_names[STATS_STAGES] = {
+	"dns", "connect", "first_byte", "transfer", "parse", "render",
+	"request"
+};
+
+/** The file the measurements are written to at exit */
+static char *stats_file = NULL;
+
+/** Returns the index of the bucket the value belongs to */
+static int _bucket(unsigned long value);
+
+/** Returns the greatest value that belongs to the bucket */
+static unsigned long _bucket_top(int bucket);
+
+/** Returns the value below which the given ratio of the values fall */
+static unsigned long _percentile(struct _histogram *h, double ratio);
+
+/** Writes the measurements to stats_file, registered with atexit() */
+static void _stats_write(void);
+
+void stats_init(void)
+{
+	char *env = getenv(STATS_ENV);
+
+	if (env == NULL || *env == 0)
+		return;
+
+	stats_file = env;
+	stats_enabled = 1;
+	atexit(_stats_write);
+}
+
+double stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void stats_record(stats_stage stage, double usec, long bytes)
+{
+	struct _histogram *h = &histograms[stage];
+	unsigned long value;
+
+	if (usec < 0)
+		usec = 0;
+	value = (unsigned long) (usec > MAX_VALUE ? MAX_VALUE : usec);
+
+	h->counts[_bucket(value)]++;
+	h->total++;
+	h->bytes += bytes;
+	if (value > h->max)
+		h->max = value;
+}
+
+void stats_reset(void)
+{
+	memset(histograms, 0, sizeof(histograms));
+}
+
+void stats_dump(FILE * fp)
+{
+	struct _histogram *h;
+	int i;
+
+	fprintf(fp, "%-12s %8s %10s %10s %10s %12s\n", "stage", "count",
+		"p50(us)", "p99(us)", "max(us)", "bytes");
+
+	for (i = 0; i < STATS_STAGES; i++) {
+		h = &histograms[i];
+		fprintf(fp, "%-12s %8lu %10lu %10lu %10lu %12.0f\n",
+			stage_names[i], h->total, _percentile(h, 0.50),
+			_percentile(h, 0.99), h->max, h->bytes);
+	}
+}
+
+/* ************************************
+ * static functions
+ */
+static int _bucket(unsigned long value)
+{
+	int magnitude = SUB_BITS;
+
+	if (value < SUB_COUNT)
+		return (int) value;
+
+	/* the position of the highest set bit */
+	while (magnitude < 31 && (value >> (magnitude + 1)) != 0)
+		magnitude++;
+
+	return (magnitude - SUB_BITS + 1) * SUB_COUNT +
+	    (int) ((value >> (magnitude - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+static unsigned long _bucket_top(int bucket)
+{
+	int shift;
+
+	if (bucket < SUB_COUNT)
+		return (unsigned long) bucket;
+
+	shift = bucket / SUB_COUNT - 1;
+	return (((unsigned long) (SUB_COUNT + bucket % SUB_COUNT) + 1) << shift)
+	    - 1;
+}
+
+static unsigned long _percentile(struct _histogram *h, double ratio)
+{
+	unsigned long seen = 0;
+	unsigned long rank;
+	int i;
+
+	if (h->total == 0)
+		return 0;
+
+	rank = (unsigned long) (h->total * ratio + 0.5);
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= rank)
+			return _bucket_top(i) < h->max ? _bucket_top(i) : h->max;
+	}
+
+	return h->max;
+}
+
+static void _stats_write(void)
+{
+	FILE *fp = fopen(stats_file, "w");
+
+	if (fp == NULL)
+		return;
+
+	stats_dump(fp);
+	fclose(fp);
+}
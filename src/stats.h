@@ -0,0 +1,63 @@
+#ifndef __STATS_H
+#define __STATS_H
+#include "main.h"
+#include <stdio.h>
+
+/** @file */
+
+/** The stages of a command whose latency is recorded */
+typedef enum _stats_stage {
+	STATS_DNS,
+	STATS_CONNECT,
+	STATS_FIRST_BYTE,
+	STATS_TRANSFER,
+	STATS_PARSE,
+	STATS_RENDER,
+
+	/** A whole request, from connecting to the last byte, retries included */
+	STATS_REQUEST,
+
+	/** The count of stages, not a stage */
+	STATS_STAGES
+} stats_stage;
+
+/** True if the measurements are recorded. Checked by STATS_BEGIN() before
+ * the clock is read, so that a disabled build only pays for a branch */
+extern int stats_enabled;
+
+/** Reads the clock if the measurements are enabled
+ * @return the start time to pass to STATS_END(), 0 if disabled */
+#define STATS_BEGIN() (stats_enabled ? stats_now() : 0.0)
+
+/** Records the time elapsed since STATS_BEGIN() for the stage
+ * @param stage the stats_stage measured
+ * @param start the value returned by STATS_BEGIN()
+ * @param bytes the count of bytes processed in the stage */
+#define STATS_END(stage, start, bytes) \
+	do { \
+		if (stats_enabled && (start) != 0.0) \
+			stats_record((stage), stats_now() - (start), (bytes)); \
+	} while (0)
+
+/** Enables the measurements if the TWITTERM_STATS environment variable is
+ * set, and arranges for them to be written to the file it names at exit */
+void stats_init(void);
+
+/** Returns the value of the monotonic clock
+ * @return the time in microseconds */
+double stats_now(void);
+
+/** Adds a measurement to the histogram of the stage
+ * @param stage the stage measured
+ * @param usec the time spent in the stage, in microseconds
+ * @param bytes the count of bytes processed */
+void stats_record(stats_stage stage, double usec, long bytes);
+
+/** Clears every histogram */
+void stats_reset(void);
+
+/** Writes the count, p50, p99, max and byte count of every stage
+ * @param fp the stream to write to */
+void stats_dump(FILE * fp);
+
+#endif
@@ -0,0 +1,614 @@
+#define MEM_AREA MEM_STATUS
+#include "status.h"
+#include "json.h"
+#include <limits.h>
+#include <stdio.h>
+#include <time.h>
+
+/** @file */
+
+/** The count of statuses a page has room for at first */
+#define PAGE_SIZE 32
+
+/** The length of a time in the format of the API */
+#define TIME_LEN 30
+
+/** True if c is a decimal digit */
+#define _IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/** The value of the 2 digits at str, which must be digits */
+#define _TWO_DIGITS(str) (((str)[0] - '0') * 10 + (str)[1] - '0')
+
+/** The fields decoded, in the order of their paths in status_fields */
+enum _status_field {
+	FIELD_ID,
+	FIELD_USER_ID,
+	FIELD_SCREEN_NAME,
+	FIELD_TEXT,
+	FIELD_CREATED_AT,
+	FIELD_IN_REPLY_TO,
+	FIELD_IN_REPLY_TO_ID
+};
+
+/** The paths of the fields, in the order of enum _status_field */
+static char *status_fields[] = {
+	"/*/id",
+	"/*/user/id",
+	"/*/user/screen_name",
+	"/*/text",
+	"/*/created_at",
+	"/*/in_reply_to_screen_name",
+	"/*/in_reply_to_status_id"
+};
+
+/** The compiled status_fields, see _status_projection() */
+static json_projection status_projection = NULL;
+
+/** The key statuses are merged by: newest first, and the same status
+ * (same time, same ID) from several pages next to each other */
+struct _status_key {
+
+	/** The time of the status */
+	long time;
+
+	/** The ID of the status */
+	unsigned long id;
+
+	/** The row of the status in its page */
+	long row;
+};
+
+/** A page being merged: the keys of its statuses not taken yet */
+struct _status_cursor {
+
+	/** The next key to take */
+	struct _status_key *next;
+
+	/** One past the last key */
+	struct _status_key *end;
+
+	/** The index of the page */
+	int page;
+};
+
+/** The state of status_decode() */
+struct _status_decoder {
+
+	/** The page decoded into */
+	status_page page;
+
+	/** The index of the status in the response the last field was in */
+	long record;
+};
+
+/** Returns the projection of the fields decoded, compiled on the first
+ * call
+ * @return the projection, NULL if out of memory */
+static json_projection _status_projection(void);
+
+/** Stores a field in the page, a json_field_fn
+ * @param field the field
+ * @param arg the struct _status_decoder
+ * @return 0 if succeeded, JSON_ERR_NOMEM if out of memory */
+static int _status_field(json_field field, void *arg);
+
+/** Doubles the count of statuses the page has room for
+ * @param page the page
+ * @return 0 if succeeded, -1 if out of memory */
+static int _status_grow(status_page page);
+
+/** Appends a string to the pool of the page, and terminates it
+ * @param page the page
+ * @param str the string
+ * @param len the length of the string
+ * @return the offset of the string in the pool, -1 if out of memory */
+static long _status_add_string(status_page page, char *str, long len);
+
+/** Returns the ID in the field, see status_parse_id()
+ * @param field the field
+ * @return the ID, 0 if the field isn't a positive integer */
+static unsigned long _status_id(json_field field);
+
+/** Returns the month of the abbreviation of the API
+ * @param str the abbreviation, eg. "Aug"
+ * @return the month, 1 to 12, -1 if not a month */
+static int _month(char *str);
+
+/** Compares two keys, a qsort() function
+ * @param a the first struct _status_key
+ * @param b the second struct _status_key
+ * @return negative if a comes first in the merge, positive if b does, 0 if
+ * they are the same status */
+static int _key_cmp(const void *a, const void *b);
+
+/** Compares the next keys of two cursors, the same status coming first
+ * from the first page
+ * @param a the first cursor
+ * @param b the second cursor
+ * @return negative if a is taken first, positive if b is */
+static int _cursor_cmp(struct _status_cursor *a, struct _status_cursor *b);
+
+/** Moves a cursor of the heap down to its place
+ * @param heap the heap of cursors, the one with the newest status on top
+ * @param count the count of cursors in the heap
+ * @param i the index of the cursor to move */
+static void _heap_down(struct _status_cursor *heap, int count, int i);
+
+/** Returns the days since 1970-01-01 of a date of the proleptic Gregorian
+ * calendar
+ * @param year the year
+ * @param month the month, 1 to 12
+ * @param day the day of the month
+ * @return the count of days, negative before 1970 */
+static long _days_from_civil(long year, int month, int day);
+
+status_page status_decode(char *str, long len, int *error, long *errpos)
+{
+	struct _status_decoder dec;
+	status_page page = NULL;
+	char *ptr;
+	long pos = -1;
+	int ret = JSON_OK;
+
+	/* a wildcard matches the members of an object too, but the statuses
+	 * come in an array */
+	for (ptr = str; ptr < str + len && (*ptr == ' ' || *ptr == '\t'
+					    || *ptr == '\r' || *ptr == '\n');
+	     ptr++) ;
+	if (ptr < str + len && *ptr != JSON_ARRAY) {
+		ret = JSON_ERR_SYNTAX;
+		pos = ptr - str;
+	}
+	else if (_status_projection() == NULL
+		 || (page = calloc(1, sizeof(*page))) == NULL) {
+		ret = JSON_ERR_NOMEM;
+		pos = 0;
+	}
+	else {
+		/* the text is most of what's kept, and never longer than in
+		 * the response */
+		page->pool_size = len / 4 + 1;
+		page->pool = malloc(page->pool_size);
+		if (page->pool == NULL || _status_grow(page) < 0) {
+			ret = JSON_ERR_NOMEM;
+			pos = 0;
+		}
+		else {
+			dec.page = page;
+			dec.record = -1;
+			ret = json_parse_fields(str, len, status_projection,
+						_status_field, &dec, &pos);
+		}
+	}
+
+	if (error != NULL)
+		*error = ret;
+	if (errpos != NULL)
+		*errpos = pos;
+
+	if (ret != JSON_OK) {
+		status_free(page);
+		return NULL;
+	}
+	return page;
+}
+
+void status_free(status_page page)
+{
+	if (page == NULL)
+		return;
+
+	free(page->id);		/* the arrays are one block, see _status_grow() */
+	free(page->pool);
+	free(page);
+}
+
+status_page status_create(void)
+{
+	status_page page = calloc(1, sizeof(*page));
+
+	if (page == NULL)
+		return NULL;
+
+	page->pool_size = PAGE_SIZE * 64;
+	page->pool = malloc(page->pool_size);
+	if (page->pool == NULL || _status_grow(page) < 0) {
+		status_free(page);
+		return NULL;
+	}
+	return page;
+}
+
+long status_add(status_page page)
+{
+	long i;
+
+	if (page->count == page->size && _status_grow(page) < 0)
+		return -1;
+
+	i = page->count++;
+	page->id[i] = 0;
+	page->user_id[i] = 0;
+	page->screen_name[i] = STATUS_NONE;
+	page->text[i] = STATUS_NONE;
+	page->created_at[i] = STATUS_NONE;
+	page->in_reply_to[i] = STATUS_NONE;
+	page->in_reply_to_id[i] = 0;
+	return i;
+}
+
+long status_add_string(status_page page, char *str)
+{
+	return _status_add_string(page, str, strlen(str));
+}
+
+char *status_format_time(long epoch, char *buf, long size)
+{
+	time_t t = epoch;
+	struct tm *tm = gmtime(&t);
+
+	if (tm == NULL || strftime(buf, size, "%a %b %d %H:%M:%S +0000 %Y",
+				   tm) == 0)
+		return "";
+	return buf;
+}
+
+unsigned long status_parse_id(char *str, long len)
+{
+	unsigned long id = 0;
+	long i;
+
+	for (i = 0; i < len; i++) {
+		if (str[i] < '0' || str[i] > '9'
+		    || id > (ULONG_MAX - (str[i] - '0')) / 10)
+			return 0;
+		id = id * 10 + (str[i] - '0');
+	}
+
+	return id;
+}
+
+long status_parse_time(char *str, long len)
+{
+	static const int digits[] = { 8, 9, 11, 12, 14, 15, 17, 18, 21, 22, 23,
+		24, 26, 27, 28, 29
+	};
+	long offset;
+	long year;
+	int month;
+	int day;
+	int hour;
+	int min;
+	int sec;
+	int i;
+
+	/* every field has a fixed width: "Wed Aug 27 13:08:45 +0000 2008" */
+	if (len != TIME_LEN || str[3] != ' ' || str[7] != ' ' || str[10] != ' '
+	    || str[13] != ':' || str[16] != ':' || str[19] != ' '
+	    || str[25] != ' ' || (str[20] != '+' && str[20] != '-'))
+		return STATUS_NONE;
+	for (i = 0; i < (int) (sizeof(digits) / sizeof(*digits)); i++)
+		if (!_IS_DIGIT(str[digits[i]]))
+			return STATUS_NONE;
+
+	month = _month(str + 4);
+	day = _TWO_DIGITS(str + 8);
+	hour = _TWO_DIGITS(str + 11);
+	min = _TWO_DIGITS(str + 14);
+	sec = _TWO_DIGITS(str + 17);
+	year = _TWO_DIGITS(str + 26) * 100 + _TWO_DIGITS(str + 28);
+	if (month < 0 || day < 1 || day > 31 || hour > 23 || min > 59
+	    || sec > 60)
+		return STATUS_NONE;
+
+	offset = _TWO_DIGITS(str + 21) * 3600 + _TWO_DIGITS(str + 23) * 60;
+	if (str[20] == '-')
+		offset = -offset;
+
+	return ((_days_from_civil(year, month, day) * 24 + hour) * 60 + min)
+	    * 60 + sec - offset;
+}
+
+status_view status_merge(status_page * pages, int count)
+{
+	struct _status_cursor *heap;
+	struct _status_key *keys;
+	struct _status_key *last = NULL;
+	status_view view;
+	long total = 0;
+	long row;
+	int used = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+		total += pages[i]->count;
+
+	/* the view is one block, the arrays after the struct */
+	view = malloc(sizeof(*view) + total * (sizeof(long) + sizeof(int)));
+	keys = malloc((total > 0 ? total : 1) * sizeof(*keys));
+	heap = malloc((count > 0 ? count : 1) * sizeof(*heap));
+	if (view == NULL || keys == NULL || heap == NULL) {
+		free(view);
+		free(keys);
+		free(heap);
+		return NULL;
+	}
+	view->count = 0;
+	view->pages = pages;
+	view->row = (long *) (view + 1);
+	view->page = (int *) (view->row + total);
+
+	/* the pages of the API are sorted already, the check is cheap */
+	for (i = 0, total = 0; i < count; i++) {
+		heap[used].next = keys + total;
+		heap[used].page = i;
+		for (row = 0; row < pages[i]->count; row++, total++) {
+			keys[total].time = pages[i]->created_at[row];
+			keys[total].id = pages[i]->id[row];
+			keys[total].row = row;
+		}
+		heap[used].end = keys + total;
+
+		for (last = heap[used].next; last + 1 < heap[used].end; last++)
+			if (_key_cmp(last, last + 1) > 0)
+				break;
+		if (last + 1 < heap[used].end)
+			qsort(heap[used].next, heap[used].end - heap[used].next,
+			      sizeof(*keys), _key_cmp);
+
+		if (heap[used].next < heap[used].end)
+			used++;
+	}
+	for (i = used / 2 - 1; i >= 0; i--)
+		_heap_down(heap, used, i);
+
+	/* take the newest of the pages until all are taken, skipping the
+	 * statuses already taken from another page */
+	for (last = NULL; used > 0;) {
+		if (last == NULL || _key_cmp(last, heap[0].next) != 0
+		    || heap[0].next->id == 0) {
+			last = heap[0].next;
+			view->page[view->count] = heap[0].page;
+			view->row[view->count] = last->row;
+			view->count++;
+		}
+
+		if (++heap[0].next == heap[0].end)
+			heap[0] = heap[--used];
+		_heap_down(heap, used, 0);
+	}
+
+	free(heap);
+	free(keys);
+	return view;
+}
+
+void status_view_free(status_view view)
+{
+	free(view);
+}
+
+void status_cleanup(void)
+{
+	json_projection_free(status_projection);
+	status_projection = NULL;
+}
+
+/* ************************************
+ * static functions
+ */
+static json_projection _status_projection(void)
+{
+	int count = sizeof(status_fields) / sizeof(*status_fields);
+
+	if (status_projection == NULL)
+		status_projection = json_projection_compile(status_fields,
+							    count);
+	return status_projection;
+}
+
+static int _status_field(json_field field, void *arg)
+{
+	struct _status_decoder *dec = arg;
+	status_page page = dec->page;
+	long *column;
+	long off;
+	long i;
+
+	/* the first field of the next status starts it */
+	if (field->record != dec->record) {
+		if (status_add(page) < 0)
+			return JSON_ERR_NOMEM;
+		dec->record = field->record;
+	}
+	i = page->count - 1;
+
+	switch (field->path) {
+	case FIELD_ID:
+		page->id[i] = _status_id(field);
+		return 0;
+	case FIELD_USER_ID:
+		page->user_id[i] = _status_id(field);
+		return 0;
+	case FIELD_IN_REPLY_TO_ID:
+		page->in_reply_to_id[i] = _status_id(field);
+		return 0;
+	case FIELD_CREATED_AT:
+		if (field->type == JSON_STRING)
+			page->created_at[i] = status_parse_time(field->str,
+								field->len);
+		return 0;
+	case FIELD_SCREEN_NAME:
+		column = page->screen_name;
+		break;
+	case FIELD_TEXT:
+		column = page->text;
+		break;
+	default:
+		column = page->in_reply_to;
+	}
+
+	/* anything else (usually null) counts as missing */
+	if (field->type != JSON_STRING)
+		return 0;
+
+	off = _status_add_string(page, field->str, field->len);
+	if (off < 0)
+		return JSON_ERR_NOMEM;
+	column[i] = off;
+	return 0;
+}
+
+static int _status_grow(status_page page)
+{
+	long size = page->size > 0 ? page->size * 2 : PAGE_SIZE;
+	unsigned long *block;
+	long *longs;
+
+	/* one block holds every array, the IDs first */
+	block = malloc(size * (3 * sizeof(unsigned long) + 4 * sizeof(long)));
+	if (block == NULL)
+		return -1;
+	longs = (long *) (block + 3 * size);
+
+	if (page->count > 0) {
+		memcpy(block, page->id, page->count * sizeof(*block));
+		memcpy(block + size, page->user_id,
+		       page->count * sizeof(*block));
+		memcpy(block + 2 * size, page->in_reply_to_id,
+		       page->count * sizeof(*block));
+		memcpy(longs, page->screen_name, page->count * sizeof(*longs));
+		memcpy(longs + size, page->text, page->count * sizeof(*longs));
+		memcpy(longs + 2 * size, page->created_at,
+		       page->count * sizeof(*longs));
+		memcpy(longs + 3 * size, page->in_reply_to,
+		       page->count * sizeof(*longs));
+	}
+	free(page->id);
+
+	page->id = block;
+	page->user_id = block + size;
+	page->in_reply_to_id = block + 2 * size;
+	page->screen_name = longs;
+	page->text = longs + size;
+	page->created_at = longs + 2 * size;
+	page->in_reply_to = longs + 3 * size;
+	page->size = size;
+
+	return 0;
+}
+
+static long _status_add_string(status_page page, char *str, long len)
+{
+	long size = page->pool_size;
+	char *tmp;
+
+	while (page->pool_len + len + 1 > size)
+		size *= 2;
+	if (size != page->pool_size) {
+		tmp = realloc(page->pool, size);
+		if (tmp == NULL)
+			return -1;
+		page->pool = tmp;
+		page->pool_size = size;
+	}
+
+	memcpy(page->pool + page->pool_len, str, len);
+	page->pool[page->pool_len + len] = 0;
+	page->pool_len += len + 1;
+
+	return page->pool_len - len - 1;
+}
+
+static unsigned long _status_id(json_field field)
+{
+	return field->type == JSON_NUM ?
+	    status_parse_id(field->str, field->len) : 0;
+}
+
+static int _month(char *str)
+{
+	/* one or two characters tell the month, the rest is checked */
+	switch (str[0]) {
+	case 'J':
+		if (str[1] == 'a')
+			return str[2] == 'n' ? 1 : -1;
+		if (str[1] != 'u')
+			return -1;
+		return str[2] == 'n' ? 6 : str[2] == 'l' ? 7 : -1;
+	case 'F':
+		return str[1] == 'e' && str[2] == 'b' ? 2 : -1;
+	case 'M':
+		if (str[1] != 'a')
+			return -1;
+		return str[2] == 'r' ? 3 : str[2] == 'y' ? 5 : -1;
+	case 'A':
+		if (str[1] == 'p')
+			return str[2] == 'r' ? 4 : -1;
+		return str[1] == 'u' && str[2] == 'g' ? 8 : -1;
+	case 'S':
+		return str[1] == 'e' && str[2] == 'p' ? 9 : -1;
+	case 'O':
+		return str[1] == 'c' && str[2] == 't' ? 10 : -1;
+	case 'N':
+		return str[1] == 'o' && str[2] == 'v' ? 11 : -1;
+	case 'D':
+		return str[1] == 'e' && str[2] == 'c' ? 12 : -1;
+	default:
+		return -1;
+	}
+}
+
+static int _key_cmp(const void *a, const void *b)
+{
+	const struct _status_key *ka = a;
+	const struct _status_key *kb = b;
+
+	if (ka->time != kb->time)
+		return ka->time > kb->time ? -1 : 1;
+	if (ka->id != kb->id)
+		return ka->id > kb->id ? -1 : 1;
+	return 0;
+}
+
+static int _cursor_cmp(struct _status_cursor *a, struct _status_cursor *b)
+{
+	int ret = _key_cmp(a->next, b->next);
+
+	return ret != 0 ? ret : a->page - b->page;
+}
+
+static void _heap_down(struct _status_cursor *heap, int count, int i)
+{
+	struct _status_cursor top = heap[i];
+	int child;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count
+		    && _cursor_cmp(heap + child + 1, heap + child) < 0)
+			child++;
+		if (_cursor_cmp(&top, heap + child) < 0)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = top;
+}
+
+static long _days_from_civil(long year, int month, int day)
+{
+	long era;
+	long yoe;
+	long doy;
+
+	/* the year is counted from March, so that the leap day is the last */
+	year -= month <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
@@ -0,0 +1,159 @@
+#ifndef __STATUS_H
+#define __STATUS_H
+#include "main.h"
+
+/** @file */
+
+/** Marks a missing string or time of a status */
+#define STATUS_NONE -1
+
+/** Returns the string at the offset in the pool of the page
+ * @param page the status_page
+ * @param off the offset, a value of one of the string fields
+ * @return the terminated string, NULL for STATUS_NONE */
+#define STATUS_STR(page, off) \
+	((off) == STATUS_NONE ? (char *) NULL : (page)->pool + (off))
+
+/** A page of statuses decoded by status_decode() */
+typedef struct _status_page *status_page;
+
+/** Pages merged by status_merge() */
+typedef struct _status_view *status_view;
+
+/** The statuses of a timeline page, stored field by field: the n-th status
+ * is made of the n-th element of every array. The arrays share one block,
+ * and the strings are offsets into the pool rather than pointers, so the
+ * pool is free to move when it grows. */
+struct _status_page {
+
+	/** The count of statuses */
+	long count;
+
+	/** The ID of the status, 0 if missing */
+	unsigned long *id;
+
+	/** The ID of the author, 0 if missing */
+	unsigned long *user_id;
+
+	/** The screen name of the author */
+	long *screen_name;
+
+	/** The text */
+	long *text;
+
+	/** The time of posting in seconds since the epoch, STATUS_NONE if
+	 * missing or malformed */
+	long *created_at;
+
+	/** The screen name of the user replied to */
+	long *in_reply_to;
+
+	/** The ID of the status replied to, 0 if it isn't a reply */
+	unsigned long *in_reply_to_id;
+
+	/** The strings, terminated one after the other */
+	char *pool;
+
+	/** The count of statuses the arrays have room for */
+	long size;
+
+	/** The length of the strings in the pool */
+	long pool_len;
+
+	/** The size of the pool */
+	long pool_size;
+};
+
+/** The statuses of several pages, newest first, each status once. The
+ * n-th status is the page[n]-th page's row[n]-th. */
+struct _status_view {
+
+	/** The count of statuses */
+	long count;
+
+	/** The pages merged, owned by the caller */
+	status_page *pages;
+
+	/** The index of the page of the status */
+	int *page;
+
+	/** The row of the status in its page */
+	long *row;
+};
+
+/** Decodes a timeline response (an array of statuses) into a page without
+ * building a parse tree. The fields it doesn't know are skipped over, see
+ * json_parse_fields().
+ * @param str the response
+ * @param len the length of the response
+ * @param error the json_error is stored here if not NULL, JSON_OK if
+ * succeeded
+ * @param errpos the offset of the error in str is stored here if not NULL,
+ * -1 if succeeded
+ * @return the page, NULL if failed */
+status_page status_decode(char *str, long len, int *error, long *errpos);
+
+/** Frees a page
+ * @param page the page to free, may be NULL */
+void status_free(status_page page);
+
+/** Creates an empty page, for statuses that weren't decoded from a
+ * response, see status_add()
+ * @return the page, NULL if out of memory */
+status_page status_create(void);
+
+/** Adds a status to a page, with every field missing
+ * @param page the page
+ * @return the row of the status, -1 if out of memory */
+long status_add(status_page page);
+
+/** Copies a string into the pool of a page
+ * @param page the page
+ * @param str the string
+ * @return the offset of the string, for a field of a status; -1 if out of
+ * memory */
+long status_add_string(status_page page, char *str);
+
+/** Merges pages (eg. the pages of a timeline, the history cached and the
+ * statuses just polled) into one view. The statuses are ordered by time,
+ * then by ID, both descending, and a status in several pages is taken
+ * from the first one that has it. Pages in order, as the API sends them,
+ * are merged in O(n log k) for n statuses in k pages.
+ * @param pages the pages, which must outlive the view
+ * @param count the count of pages
+ * @return the view, NULL if out of memory */
+status_view status_merge(status_page * pages, int count);
+
+/** Frees a view, but not the pages
+ * @param view the view to free, may be NULL */
+void status_view_free(status_view view);
+
+/** Frees what status_decode() keeps from one call to the next, it's
+ * compiled again if needed */
+void status_cleanup(void);
+
+/** Parses a time in the format of the API without allocating
+ * @param str the time, eg. "Wed Aug 27 13:08:45 +0000 2008", need not be
+ * terminated
+ * @param len the length of str
+ * @return the time in seconds since the epoch, STATUS_NONE if malformed */
+long status_parse_time(char *str, long len);
+
+/** Parses an ID from its decimal digits, as the API sends them: the IDs
+ * don't fit the 53 bits of a double. An ID that doesn't fit an unsigned
+ * long either, where it has 32 bits, is taken as missing rather than
+ * wrapped, so that it doesn't collide with another one.
+ * @param str the digits, need not be terminated
+ * @param len the length of str
+ * @return the ID, 0 if str isn't only digits or the ID doesn't fit */
+unsigned long status_parse_id(char *str, long len);
+
+/** Formats the time of a status the way the API does, eg. "Wed Aug 27
+ * 13:08:45 +0000 2008"
+ * @param epoch the time in seconds since the epoch
+ * @param buf the buffer to write to
+ * @param size the size of the buffer, 31 is enough
+ * @return buf, or "" if the time can't be represented */
+char *status_format_time(long epoch, char *buf, long size);
+
+#endif
@@ -0,0 +1,115 @@
+#define MEM_AREA MEM_LIST
+#include "store.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/** @file */
+
+int store_put_varint(unsigned char *out, unsigned long value)
+{
+	int n = 0;
+
+	for (; value >= 0x80; value >>= 7)
+		out[n++] = (unsigned char) (value | 0x80);
+	out[n++] = (unsigned char) value;
+	return n;
+}
+
+void store_write_varint(FILE * fp, unsigned long value)
+{
+	unsigned char buf[STORE_VARINT_MAX];
+
+	fwrite(buf, 1, store_put_varint(buf, value), fp);
+}
+
+int store_get_varint(unsigned char **ptr, unsigned char *end,
+		     unsigned long *value)
+{
+	unsigned int bits = sizeof(*value) * CHAR_BIT;
+	unsigned int shift;
+
+	*value = 0;
+	for (shift = 0; shift < 7 * STORE_VARINT_MAX; shift += 7) {
+		if (*ptr == end)
+			return -1;
+
+		/* the bits of the last byte beyond the word have to be 0: a
+		 * file written where a long is longer isn't wrapped */
+		if (shift + 7 > bits && (**ptr & 0x7f) >> (bits - shift) != 0)
+			return -1;
+		*value |= (unsigned long) (**ptr & 0x7f) << shift;
+		if (!(*(*ptr)++ & 0x80))
+			return 0;
+	}
+
+	return -1;
+}
+
+int store_write(char *file, char *magic, store_fn fn, void *arg)
+{
+	char *tmp = malloc(strlen(file) + 5);
+	FILE *fp;
+	int ret = -1;
+
+	if (tmp == NULL)
+		return -1;
+	sprintf(tmp, "%s.tmp", file);
+
+	fp = fopen(tmp, "wb");
+	if (fp != NULL) {
+		if (fputs(magic, fp) >= 0 && fn(fp, arg) == 0 && !ferror(fp))
+			ret = 0;
+		if (fclose(fp) != 0)
+			ret = -1;
+		if (ret == 0 && rename(tmp, file) != 0)
+			ret = -1;
+		if (ret < 0)
+			remove(tmp);
+	}
+
+	free(tmp);
+	return ret;
+}
+
+int store_lock(int fd, int byte, int type, int wait)
+{
+	struct flock lock;
+	int ret;
+
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = byte;
+	lock.l_len = 1;
+	while ((ret = fcntl(fd, wait ? F_SETLKW : F_SETLK, &lock)) < 0
+	       && errno == EINTR) ;
+	return ret < 0 ? -1 : 0;
+}
+
+unsigned char *store_read(char *file, char *magic, long *size)
+{
+	FILE *fp = fopen(file, "rb");
+	unsigned char *data;
+	long len = strlen(magic);
+
+	if (fp == NULL)
+		return NULL;
+
+	fseek(fp, 0, SEEK_END);
+	*size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = *size >= len ? malloc(*size > 0 ? *size : 1) : NULL;
+	if (data == NULL || fread(data, 1, *size, fp) != (size_t) *size
+	    || memcmp(data, magic, len) != 0) {
+		fclose(fp);
+		free(data);
+		return NULL;
+	}
+	fclose(fp);
+
+	*size -= len;
+	memmove(data, data + len, *size);
+	return data;
+}
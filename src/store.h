@@ -0,0 +1,68 @@
+#ifndef __STORE_H
+#define __STORE_H
+#include "main.h"
+#include <limits.h>
+#include <stdio.h>
+
+/** @file */
+
+/** The maximal size of a varint, see store_put_varint() */
+#define STORE_VARINT_MAX ((sizeof(unsigned long) * CHAR_BIT + 6) / 7)
+
+/** The prototype of the function store_write() calls to write the data
+ * @param fp the file to write to
+ * @param arg the argument given to store_write()
+ * @retval 0 if succeeded
+ * @retval -1 if the data couldn't be written */
+typedef int (*store_fn) (FILE * fp, void *arg);
+
+/** Stores a number as a varint: 7 bits a byte, the lowest first, the high
+ * bit set on every byte but the last
+ * @param out where to store it, STORE_VARINT_MAX bytes are enough
+ * @param value the number
+ * @return the count of bytes written */
+int store_put_varint(unsigned char *out, unsigned long value);
+
+/** Writes a number as a varint, see store_put_varint()
+ * @param fp the file
+ * @param value the number */
+void store_write_varint(FILE * fp, unsigned long value);
+
+/** Reads a varint, advancing the pointer
+ * @param ptr the pointer to the varint
+ * @param end the end of the data
+ * @param value the number is stored here
+ * @retval 0 if succeeded
+ * @retval -1 if the data ends, or the number doesn't fit */
+int store_get_varint(unsigned char **ptr, unsigned char *end,
+		     unsigned long *value);
+
+/** Saves data into a file: the data is written aside, into the file with
+ * ".tmp" appended to its name, and renamed, so a crash leaves the old file
+ * @param file the name of the file
+ * @param magic the first line of the file
+ * @param fn the function writing the data after the magic
+ * @param arg passed to fn
+ * @retval 0 if succeeded
+ * @retval -1 if the file couldn't be written, or fn failed */
+int store_write(char *file, char *magic, store_fn fn, void *arg);
+
+/** Locks or unlocks a byte of a file with fcntl(), for the processes
+ * sharing the file; the system drops the lock when its process dies
+ * @param fd the file
+ * @param byte the offset of the byte, one per kind of lock
+ * @param type F_WRLCK or F_UNLCK
+ * @param wait true to wait for the process holding it
+ * @retval 0 if succeeded
+ * @retval -1 if the byte is locked by another process, or failed */
+int store_lock(int fd, int byte, int type, int wait);
+
+/** Loads the data saved by store_write()
+ * @param file the name of the file
+ * @param magic the first line the file has to start with
+ * @param size the size of the data, after the magic, is stored here
+ * @return the data, to be freed, NULL if the file is missing, doesn't
+ * start with the magic, or out of memory */
+unsigned char *store_read(char *file, char *magic, long *size);
+
+#endif
@@ -0,0 +1,450 @@
+#define MEM_AREA MEM_STATUS
+#include "thread.h"
+
+/** @file */
+
+/** The count of slots of the hash table at first, a power of 2; the table
+ * doubles when it's three quarters full */
+#define THREAD_SLOTS 256
+
+/** The size of the pool of strings at first */
+#define THREAD_POOL 4096
+
+/** A status of the index */
+struct _thread_node {
+
+	/** The ID of the status, and of the status it replies to, 0 if none */
+	unsigned long id;
+	unsigned long parent;
+
+	/** The node of the status replied to, -1 if it isn't linked to it */
+	long up;
+
+	/** The node of the oldest reply, -1 if none */
+	long child;
+
+	/** The node of the next reply to the same status, -1 if none */
+	long sibling;
+
+	/** The offsets of the author and the text in the pool, -1 if the
+	 * status wasn't seen */
+	long screen_name;
+	long text;
+
+	/** The time of posting, STATUS_NONE if unknown */
+	long created_at;
+
+	/** True if the status couldn't be fetched, see thread_gone() */
+	int gone;
+};
+
+/** The index */
+struct _thread {
+
+	/** The nodes, in the order they were added, their count and the room
+	 * for them */
+	struct _thread_node *nodes;
+	long count;
+	long size;
+
+	/** The hash table: the index of a node plus one in every slot, 0 in
+	 * the empty ones, and the count of slots */
+	long *slots;
+	long nslots;
+
+	/** The count of statuses seen */
+	long seen;
+
+	/** The strings, terminated one after the other */
+	char *pool;
+	long pool_len;
+	long pool_size;
+};
+
+/** Mixes the bits of an ID, so that the low ones of the hash depend on
+ * all of them
+ * @param id the ID
+ * @return the hash */
+static unsigned long _thread_hash(unsigned long id);
+
+/** Looks a status up
+ * @param t the index
+ * @param id the ID
+ * @return the node, -1 if not in the index */
+static long _thread_find(thread t, unsigned long id);
+
+/** Looks a status up, and adds a node for it if it's not in the index
+ * @param t the index
+ * @param id the ID
+ * @return the node, -1 if out of memory */
+static long _thread_node(thread t, unsigned long id);
+
+/** Doubles the hash table, and puts the nodes in it again
+ * @param t the index
+ * @retval 0 if succeeded
+ * @retval -1 if out of memory */
+static int _thread_rehash(thread t);
+
+/** Appends a string to the pool
+ * @param t the index
+ * @param str the string, NULL for an empty one
+ * @return the offset of the string, -1 if out of memory */
+static long _thread_string(thread t, char *str);
+
+/** Links a node to the node of the status it replies to, among its
+ * replies by the time of posting, unless that would make a loop
+ * @param t the index
+ * @param node the node
+ * @param up the node replied to */
+static void _thread_link(thread t, long node, long up);
+
+/** Calls fn for a node and the nodes below it, see thread_each() */
+static int _thread_walk(thread t, long root, thread_fn fn, void *arg);
+
+thread thread_create(void)
+{
+	thread t = calloc(1, sizeof(struct _thread));
+
+	if (t == NULL)
+		return NULL;
+
+	t->nslots = THREAD_SLOTS;
+	t->slots = calloc(t->nslots, sizeof(*t->slots));
+	t->pool_size = THREAD_POOL;
+	t->pool = malloc(t->pool_size);
+	if (t->slots == NULL || t->pool == NULL) {
+		thread_free(t);
+		return NULL;
+	}
+	return t;
+}
+
+void thread_free(thread t)
+{
+	if (t == NULL)
+		return;
+
+	free(t->nodes);
+	free(t->slots);
+	free(t->pool);
+	free(t);
+}
+
+int thread_add(thread t, unsigned long id, unsigned long parent,
+	       char *screen_name, char *text, long created_at)
+{
+	struct _thread_node *n;
+	long node;
+	long up;
+
+	if (id == 0)
+		return 0;
+	node = _thread_node(t, id);
+	if (node < 0)
+		return -1;
+
+	if (t->nodes[node].text < 0) {
+		n = &t->nodes[node];
+		n->screen_name = _thread_string(t, screen_name);
+		n->text = n->screen_name < 0 ? -1 : _thread_string(t, text);
+		if (n->text < 0)
+			return -1;
+		n->created_at = created_at;
+		n->gone = 0;
+		t->seen++;
+	}
+	else if (t->nodes[node].parent != 0 || parent == 0) {
+		return 0;
+	}
+
+	/* the node may move while the one replied to is added */
+	if (parent != 0 && parent != id) {
+		t->nodes[node].parent = parent;
+		up = _thread_node(t, parent);
+		if (up < 0)
+			return -1;
+		_thread_link(t, node, up);
+	}
+	return 1;
+}
+
+long thread_add_page(thread t, status_page page)
+{
+	long count = 0;
+	long i;
+	int ret;
+
+	for (i = 0; i < page->count; i++) {
+		ret = thread_add(t, page->id[i], page->in_reply_to_id[i],
+				 STATUS_STR(page, page->screen_name[i]),
+				 STATUS_STR(page, page->text[i]),
+				 page->created_at[i]);
+		if (ret < 0)
+			return -1;
+		count += ret;
+	}
+
+	return count;
+}
+
+int thread_gone(thread t, unsigned long id)
+{
+	long node = _thread_node(t, id);
+
+	if (node < 0)
+		return -1;
+	if (t->nodes[node].text < 0)
+		t->nodes[node].gone = 1;
+	return 0;
+}
+
+long thread_count(thread t)
+{
+	return t->seen;
+}
+
+long thread_size(thread t)
+{
+	return sizeof(struct _thread) + t->size * sizeof(*t->nodes) +
+	    t->nslots * sizeof(*t->slots) + t->pool_size;
+}
+
+unsigned long thread_root(thread t, unsigned long id)
+{
+	long node = _thread_find(t, id);
+
+	if (node < 0)
+		return id;
+	while (t->nodes[node].up >= 0)
+		node = t->nodes[node].up;
+	return t->nodes[node].id;
+}
+
+int thread_missing(thread t, unsigned long id, unsigned long *ids,
+		   int size)
+{
+	struct _thread_node *n;
+	long node;
+	int count = 0;
+
+	if (size <= 0)
+		return 0;
+
+	if (id != 0) {
+		if (_thread_find(t, id) < 0) {
+			ids[0] = id;
+			return 1;
+		}
+		n = &t->nodes[_thread_find(t, thread_root(t, id))];
+		if (n->text >= 0 || n->gone)
+			return 0;
+		ids[0] = n->id;
+		return 1;
+	}
+
+	/* a node not seen is there because a node seen replies to it */
+	for (node = 0; node < t->count && count < size; node++) {
+		n = &t->nodes[node];
+		if (n->up < 0 && n->text < 0 && !n->gone)
+			ids[count++] = n->id;
+	}
+	return count;
+}
+
+int thread_each(thread t, unsigned long id, thread_fn fn, void *arg)
+{
+	long node;
+	int ret;
+
+	if (id != 0) {
+		node = _thread_find(t, thread_root(t, id));
+		return node < 0 ? 0 : _thread_walk(t, node, fn, arg);
+	}
+
+	for (node = 0; node < t->count; node++) {
+		if (t->nodes[node].up >= 0 || t->nodes[node].child < 0)
+			continue;
+		ret = _thread_walk(t, node, fn, arg);
+		if (ret != 0)
+			return ret;
+	}
+	return 0;
+}
+
+/* ************************************
+ * static functions
+ */
+static unsigned long _thread_hash(unsigned long id)
+{
+	unsigned long h = id;
+
+	/* in two steps, an unsigned long may have 32 bits only */
+	h ^= (h >> 16) >> 16;
+	h ^= h >> 16;
+	h *= 0x45d9f3bUL;
+	h ^= h >> 16;
+	h *= 0x45d9f3bUL;
+	h ^= h >> 16;
+	return h;
+}
+
+static long _thread_find(thread t, unsigned long id)
+{
+	unsigned long mask = t->nslots - 1;
+	unsigned long i = _thread_hash(id) & mask;
+
+	/* linear probing, there is always an empty slot */
+	for (; t->slots[i] != 0; i = (i + 1) & mask)
+		if (t->nodes[t->slots[i] - 1].id == id)
+			return t->slots[i] - 1;
+	return -1;
+}
+
+static long _thread_node(thread t, unsigned long id)
+{
+	struct _thread_node *nodes;
+	struct _thread_node *n;
+	unsigned long mask;
+	unsigned long i;
+	long node = _thread_find(t, id);
+	long size;
+
+	if (node >= 0)
+		return node;
+
+	if ((t->count + 1) * 4 > t->nslots * 3 && _thread_rehash(t) < 0)
+		return -1;
+	if (t->count == t->size) {
+		size = t->size > 0 ? t->size * 2 : THREAD_SLOTS / 2;
+		nodes = realloc(t->nodes, size * sizeof(*nodes));
+		if (nodes == NULL)
+			return -1;
+		t->nodes = nodes;
+		t->size = size;
+	}
+
+	node = t->count++;
+	n = &t->nodes[node];
+	n->id = id;
+	n->parent = 0;
+	n->up = -1;
+	n->child = -1;
+	n->sibling = -1;
+	n->screen_name = -1;
+	n->text = -1;
+	n->created_at = STATUS_NONE;
+	n->gone = 0;
+
+	mask = t->nslots - 1;
+	for (i = _thread_hash(id) & mask; t->slots[i] != 0; i = (i + 1) & mask) ;
+	t->slots[i] = node + 1;
+	return node;
+}
+
+static int _thread_rehash(thread t)
+{
+	long nslots = t->nslots * 2;
+	long *slots = calloc(nslots, sizeof(*slots));
+	unsigned long mask = nslots - 1;
+	unsigned long i;
+	long node;
+
+	if (slots == NULL)
+		return -1;
+
+	for (node = 0; node < t->count; node++) {
+		i = _thread_hash(t->nodes[node].id) & mask;
+		while (slots[i] != 0)
+			i = (i + 1) & mask;
+		slots[i] = node + 1;
+	}
+
+	free(t->slots);
+	t->slots = slots;
+	t->nslots = nslots;
+	return 0;
+}
+
+static long _thread_string(thread t, char *str)
+{
+	long len = str != NULL ? strlen(str) : 0;
+	long size = t->pool_size;
+	char *tmp;
+
+	while (t->pool_len + len + 1 > size)
+		size *= 2;
+	if (size != t->pool_size) {
+		tmp = realloc(t->pool, size);
+		if (tmp == NULL)
+			return -1;
+		t->pool = tmp;
+		t->pool_size = size;
+	}
+
+	if (len > 0)
+		memcpy(t->pool + t->pool_len, str, len);
+	t->pool[t->pool_len + len] = 0;
+	t->pool_len += len + 1;
+	return t->pool_len - len - 1;
+}
+
+static void _thread_link(thread t, long node, long up)
+{
+	struct _thread_node *n = &t->nodes[node];
+	struct _thread_node *s;
+	long *link;
+	long i;
+
+	/* IDs made up or mixed up could make a loop of replies */
+	for (i = up; i >= 0; i = t->nodes[i].up)
+		if (i == node)
+			return;
+
+	for (link = &t->nodes[up].child; *link >= 0; link = &s->sibling) {
+		s = &t->nodes[*link];
+		if (s->created_at > n->created_at
+		    || (s->created_at == n->created_at && s->id > n->id))
+			break;
+	}
+	n->sibling = *link;
+	*link = node;
+	n->up = up;
+}
+
+static int _thread_walk(thread t, long root, thread_fn fn, void *arg)
+{
+	struct thread_status status;
+	struct _thread_node *n;
+	long node = root;
+	int depth = 0;
+	int ret;
+
+	/* down to the first reply, else on to the next one, else up until
+	 * there is a next one; no stack, however deep the conversation */
+	for (;;) {
+		n = &t->nodes[node];
+		status.id = n->id;
+		status.parent = n->parent;
+		status.screen_name = n->text < 0 ? NULL :
+		    t->pool + n->screen_name;
+		status.text = n->text < 0 ? NULL : t->pool + n->text;
+		status.created_at = n->created_at;
+		status.depth = depth;
+		ret = fn(&status, arg);
+		if (ret != 0)
+			return ret;
+
+		if (n->child >= 0) {
+			node = n->child;
+			depth++;
+			continue;
+		}
+		while (node != root && t->nodes[node].sibling < 0) {
+			node = t->nodes[node].up;
+			depth--;
+		}
+		if (node == root)
+			return 0;
+		node = t->nodes[node].sibling;
+	}
+}
@@ -0,0 +1,121 @@
+#ifndef __THREAD_H
+#define __THREAD_H
+#include "main.h"
+#include "status.h"
+
+/** @file */
+
+/** The conversations of the statuses seen: every status with the one it
+ * replies to and the ones replying to it, see thread_create() */
+typedef struct _thread *thread;
+
+/** A status of a conversation, see thread_each() */
+struct thread_status {
+
+	/** The ID of the status */
+	unsigned long id;
+
+	/** The ID of the status replied to, 0 if none */
+	unsigned long parent;
+
+	/** The author and the text, NULL if the status was only replied to:
+	 * not fetched yet, or not available */
+	char *screen_name;
+	char *text;
+
+	/** The time of posting, STATUS_NONE if unknown */
+	long created_at;
+
+	/** The count of statuses between this one and the first of the
+	 * conversation */
+	int depth;
+};
+
+/** The prototype of the function thread_each() calls for the statuses
+ * @param status the status, valid during the call only
+ * @param arg the argument given to thread_each()
+ * @return 0 to go on, anything else to stop */
+typedef int (*thread_fn) (struct thread_status * status, void *arg);
+
+/** Creates an empty index. The statuses are kept in a hash table keyed by
+ * their ID, with open addressing, and each one is linked to the one it
+ * replies to and to the first of its replies, the replies to one status to
+ * each other, oldest first. A status replied to but not seen yet is in the
+ * table without a text, until it's added.
+ * @return the index, NULL if out of memory */
+thread thread_create(void);
+
+/** Frees an index
+ * @param t the index, may be NULL */
+void thread_free(thread t);
+
+/** Adds a status. A status added already is left alone, but for the one
+ * it replies to, if that wasn't known before.
+ * @param t the index
+ * @param id the ID of the status, not 0
+ * @param parent the ID of the status replied to, 0 if none
+ * @param screen_name the author
+ * @param text the text
+ * @param created_at the time of posting, STATUS_NONE if unknown
+ * @retval 1 if added
+ * @retval 0 if it was there already, or the ID is 0
+ * @retval -1 if out of memory */
+int thread_add(thread t, unsigned long id, unsigned long parent,
+	       char *screen_name, char *text, long created_at);
+
+/** Adds the statuses of a page, see thread_add()
+ * @param t the index
+ * @param page the page
+ * @return the count of statuses added, -1 if out of memory */
+long thread_add_page(thread t, status_page page);
+
+/** Marks a status replied to as one that can't be fetched, so that
+ * thread_missing() doesn't return it again
+ * @param t the index
+ * @param id the ID of the status
+ * @retval 0 if succeeded
+ * @retval -1 if out of memory */
+int thread_gone(thread t, unsigned long id);
+
+/** Returns the count of statuses in the index, the ones only replied to
+ * left out
+ * @param t the index
+ * @return the count */
+long thread_count(thread t);
+
+/** Returns the memory the index takes
+ * @param t the index
+ * @return the size in bytes */
+long thread_size(thread t);
+
+/** Returns the first status of the conversation of a status: the one it
+ * replies to, the one that one replies to, and so on
+ * @param t the index
+ * @param id the ID of the status
+ * @return the ID of the first status, id if it isn't in the index */
+unsigned long thread_root(thread t, unsigned long id);
+
+/** Returns the statuses to fetch to go on with conversations: the first
+ * ones of them that were replied to but weren't seen, nor marked gone.
+ * Fetched and added, they may reply to further statuses in turn.
+ * @param t the index
+ * @param id the ID of a status, for its conversation only, the status
+ * itself if it isn't in the index; 0 for every conversation
+ * @param ids the IDs are stored here
+ * @param size the room in ids
+ * @return the count of IDs stored */
+int thread_missing(thread t, unsigned long id, unsigned long *ids,
+		   int size);
+
+/** Calls fn for the statuses of a conversation, depth first: a status,
+ * then its replies, oldest first, each followed by its own replies
+ * @param t the index
+ * @param id the ID of a status of the conversation; 0 for every
+ * conversation of more than one status, in the order their first statuses
+ * were seen or replied to
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @return the non-zero value fn returned, 0 if it never did */
+int thread_each(thread t, unsigned long id, thread_fn fn, void *arg);
+
+#endif
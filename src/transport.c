@@ -0,0 +1,111 @@
+#define MEM_AREA MEM_HTTP
+#include "transport.h"
+#include "http.h"
+#include "stats.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/** @file transport.c */
+
+long transport_syscalls = 0;
+
+static int _posix_open(void);
+static int _posix_send(int sock, char *buf, int len, long long deadline);
+static int _posix_flush(int sock, long long deadline);
+static int _posix_recv(int sock, char *buf, int len, long long deadline,
+		       int timeout_err);
+static void _posix_drop(int sock);
+
+struct _transport transport_posix = {
+	"posix",
+	_posix_open,
+	_posix_send,
+	_posix_flush,
+	_posix_recv,
+	_posix_drop
+};
+
+int transport_wait(int sock, short events, long long deadline)
+{
+	struct pollfd pfd;
+	long long left;
+
+	pfd.fd = sock;
+	pfd.events = events;
+
+	for (;;) {
+		left = (deadline - (long long) stats_now() + 999) / 1000;
+		if (left <= 0)
+			return -1;
+
+		transport_syscalls++;
+		if (poll(&pfd, 1, (int) left) > 0)
+			return 0;	/* errors are reported by the next call */
+	}
+}
+
+/* ************************************
+ * static functions
+ */
+
+static int _posix_open(void)
+{
+	return 0;
+}
+
+static int _posix_send(int sock, char *buf, int len, long long deadline)
+{
+	int ret;
+
+	while (len > 0) {
+		transport_syscalls++;
+		ret = send(sock, buf, len, SEND_FLAGS);
+		if (ret > 0) {
+			buf += ret;
+			len -= ret;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if (transport_wait(sock, POLLOUT, deadline) < 0)
+				return HTTP_ERR_TIMEOUT;
+		}
+		else if (errno != EINTR) {
+			return HTTP_ERR_SEND;
+		}
+	}
+
+	return 0;
+}
+
+static int _posix_flush(int sock, long long deadline)
+{
+	return 0;		/* nothing is queued */
+}
+
+static int _posix_recv(int sock, char *buf, int len, long long deadline,
+		       int timeout_err)
+{
+	int ret;
+
+	for (;;) {
+		transport_syscalls++;
+		ret = recv(sock, buf, len, 0);
+		if (ret >= 0)
+			return ret;
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if (transport_wait(sock, POLLIN, deadline) < 0)
+				return timeout_err;
+		}
+		else if (errno != EINTR) {
+			return HTTP_ERR_READ;
+		}
+	}
+}
+
+static void _posix_drop(int sock)
+{
+}
@@ -0,0 +1,76 @@
+#ifndef __TRANSPORT_H
+#define __TRANSPORT_H
+#include "main.h"
+#include <sys/socket.h>
+
+/** @file */
+
+/** The flags of send(): a peer that hung up doesn't kill us with SIGPIPE,
+ * where possible */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+/** The socket I/O under the HTTP layer. The sockets are connected by the
+ * HTTP layer and non-blocking, and every call of a transport blocks until
+ * it's done or the deadline passes. */
+typedef struct _transport *transport;
+
+struct _transport {
+
+	/** The name given to http_set_transport() */
+	char *name;
+
+	/** Prepares the transport in the calling process. Called before every
+	 * request, so that a forked process sets up its own.
+	 * @retval 0 if the transport can be used
+	 * @retval -1 if not, then the next one is */
+	int (*open) (void);
+
+	/** Sends a buffer, or queues it to go out with the next recv() or
+	 * flush(); the buffer can be reused once it returns
+	 * @param sock the socket
+	 * @param buf the buffer
+	 * @param len its length
+	 * @param deadline the monotonic time (usec) to give up at
+	 * @return 0 or a negative enum http_error */
+	int (*send) (int sock, char *buf, int len, long long deadline);
+
+	/** Sends what's queued for the socket
+	 * @return 0 or a negative enum http_error */
+	int (*flush) (int sock, long long deadline);
+
+	/** Sends what's queued for the socket, then receives
+	 * @param timeout_err the error returned if the deadline passes
+	 * @return the count of bytes received, 0 at the end of the stream, or
+	 * a negative enum http_error */
+	int (*recv) (int sock, char *buf, int len, long long deadline,
+		     int timeout_err);
+
+	/** Forgets what's queued for a socket about to be closed */
+	void (*drop) (int sock);
+};
+
+/** Waits with poll() until a socket is ready, for the I/O made around
+ * the transports (sendfile()) as well, counted in transport_syscalls
+ * @param sock the socket
+ * @param events POLLIN or POLLOUT
+ * @param deadline the monotonic time (usec) to give up at
+ * @retval 0 if the socket is ready
+ * @retval -1 if the deadline has passed */
+int transport_wait(int sock, short events, long long deadline);
+
+/** The count of system calls the transports made for the I/O in this
+ * process, see http_syscalls() */
+extern long transport_syscalls;
+
+/** send() and recv(), waiting with poll(): the one that always works */
+extern struct _transport transport_posix;
+
+/** io_uring, where the kernel has it: the sends of a request are gathered,
+ * and go out with the first receive in one system call */
+extern struct _transport transport_uring;
+
+#endif
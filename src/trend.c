@@ -0,0 +1,508 @@
+#define MEM_AREA MEM_STATUS
+#include "trend.h"
+#include "status.h"
+#include <ctype.h>
+
+/** @file */
+
+/** The most characters of a mention, as the API allows for screen names */
+#define TREND_MENTION_MAX 15
+
+/** A term of a bucket, see _trend_slot_add() */
+struct _trend_slot {
+
+	/** The term */
+	char term[TREND_TERM_MAX];
+
+	/** The count, and how much of it may belong to the terms it took the
+	 * place of */
+	long count;
+	long error;
+};
+
+/** The counts of a span of time */
+struct _trend_bucket {
+
+	/** The time divided by the span, -1 if never used */
+	long period;
+
+	/** The count of terms counted in it */
+	long total;
+
+	/** The Count-Min sketch of the terms of every kind */
+	long sketch[TREND_DEPTH][TREND_WIDTH];
+
+	/** The terms counted most often, for each kind, and their count */
+	struct _trend_slot slots[TREND_KINDS][TREND_SLOTS];
+	int used[TREND_KINDS];
+};
+
+/** The counters */
+struct _trend {
+
+	/** The seconds of a bucket */
+	long span;
+
+	/** The buckets, the n-th period goes to the (n % nbuckets)-th */
+	struct _trend_bucket *buckets;
+	int nbuckets;
+
+	/** The IDs of the statuses counted last, by a hash of the ID */
+	unsigned long seen[TREND_SEEN];
+
+	/** The terms trend_top() looks through, room for all the slots of a
+	 * kind */
+	char **cand;
+};
+
+/** What _trend_count() counts a term with */
+struct _trend_ctx {
+	trend t;
+	long when;
+	long now;
+	int count;
+};
+
+/** Tells if a character may be part of a hashtag or a mention: an ASCII
+ * letter or digit, an underscore, or a byte of a UTF-8 sequence */
+static int _trend_word(char c);
+
+/** Tells if a string starts with a prefix, regardless of the case of the
+ * ASCII letters
+ * @param str the string
+ * @param prefix the prefix, in lower case
+ * @return true if it does */
+static int _trend_prefix(char *str, char *prefix);
+
+/** Computes the columns of a term in the rows of the sketch, from two
+ * hashes of the term
+ * @param kind the kind of the term
+ * @param term the term
+ * @param cols the columns are stored here, TREND_DEPTH of them */
+static void _trend_cols(int kind, char *term, unsigned long *cols);
+
+/** Returns the bucket of a time, emptied if it held an older period
+ * @param t the counters
+ * @param when the time
+ * @param now the time now
+ * @return the bucket, NULL if the time is before the window */
+static struct _trend_bucket *_trend_bucket(trend t, long when, long now);
+
+/** Counts a term among the ones counted most often of a bucket, taking the
+ * place of the one counted least if there is no room
+ * @param b the bucket
+ * @param kind the kind of the term
+ * @param term the term */
+static void _trend_slot_add(struct _trend_bucket *b, int kind, char *term);
+
+/** Returns the count of buckets a window is made of
+ * @param t the counters
+ * @param window the seconds
+ * @return the count, at least 1 and at most all the buckets */
+static int _trend_window(trend t, long window);
+
+/** The trend_fn of trend_add_status(), counting the terms */
+static int _trend_count(int kind, char *term, void *arg);
+
+/** Compares two terms for qsort() */
+static int _trend_cmp(const void *a, const void *b);
+
+trend trend_create(long span, int buckets)
+{
+	trend t;
+	int i;
+
+	if (span <= 0 || buckets <= 0)
+		return NULL;
+
+	t = calloc(1, sizeof(struct _trend));
+	if (t == NULL)
+		return NULL;
+	t->span = span;
+	t->nbuckets = buckets;
+	t->buckets = calloc(buckets, sizeof(struct _trend_bucket));
+	t->cand = malloc(buckets * TREND_SLOTS * sizeof(*t->cand));
+	if (t->buckets == NULL || t->cand == NULL) {
+		trend_free(t);
+		return NULL;
+	}
+
+	for (i = 0; i < buckets; i++)
+		t->buckets[i].period = -1;
+	return t;
+}
+
+void trend_free(trend t)
+{
+	if (t == NULL)
+		return;
+
+	free(t->buckets);
+	free(t->cand);
+	free(t);
+}
+
+long trend_size(trend t)
+{
+	return sizeof(struct _trend) +
+	    t->nbuckets * (sizeof(struct _trend_bucket) +
+			   TREND_SLOTS * sizeof(*t->cand));
+}
+
+int trend_terms(char *text, trend_fn fn, void *arg)
+{
+	char buf[TREND_TERM_MAX];
+	char *p = text;
+	char *q;
+	int kind;
+	int digits;
+	int ascii;
+	int ret;
+	long scheme;
+	long len;
+	long i;
+
+	while (*p != 0) {
+		/* an entity, like "&#39;", or an address isn't a term */
+		if ((*p == '#' || *p == '@')
+		    && (p == text || (!_trend_word(p[-1]) && p[-1] != '&'))) {
+			kind = *p == '#' ? TREND_HASHTAG : TREND_MENTION;
+			digits = 1;
+			ascii = 1;
+			for (q = p + 1; _trend_word(*q); q++) {
+				if (!isdigit((unsigned char) *q))
+					digits = 0;
+				if ((unsigned char) *q >= 0x80)
+					ascii = 0;
+			}
+			len = q - p;
+
+			if (len > 1 && len < TREND_TERM_MAX
+			    && (kind == TREND_HASHTAG ? !digits :
+				ascii && len - 1 <= TREND_MENTION_MAX)) {
+				for (i = 0; i < len; i++)
+					buf[i] = p[i] >= 'A' && p[i] <= 'Z' ?
+					    p[i] - 'A' + 'a' : p[i];
+				buf[len] = 0;
+				ret = fn(kind, buf, arg);
+				if (ret != 0)
+					return ret;
+			}
+			p = q;
+			continue;
+		}
+
+		if ((*p == 'h' || *p == 'H') && (p == text || !_trend_word(p[-1]))
+		    && (_trend_prefix(p, "http://")
+			|| _trend_prefix(p, "https://"))) {
+			q = strchr(p, ':') + 3;
+			scheme = q - p;
+			while (*q != 0 && !isspace((unsigned char) *q)
+			       && *q != '"' && *q != '<' && *q != '>')
+				q++;
+			len = q - p;
+			while (len > 0 && strchr(".,;:!?)'", p[len - 1]) != NULL)
+				len--;
+
+			if (len > scheme && len < TREND_TERM_MAX) {
+				memcpy(buf, p, len);
+				buf[len] = 0;
+				ret = fn(TREND_URL, buf, arg);
+				if (ret != 0)
+					return ret;
+			}
+			p = q;
+			continue;
+		}
+
+		p++;
+	}
+
+	return 0;
+}
+
+int trend_add(trend t, int kind, char *term, long when, long now)
+{
+	struct _trend_bucket *b;
+	unsigned long cols[TREND_DEPTH];
+	long min;
+	int i;
+
+	if (strlen(term) >= TREND_TERM_MAX)
+		return -1;
+	b = _trend_bucket(t, when, now);
+	if (b == NULL)
+		return -1;
+
+	/* the conservative update: only the counters at the minimum grow,
+	 * which is all the others can be sure of */
+	_trend_cols(kind, term, cols);
+	min = b->sketch[0][cols[0]];
+	for (i = 1; i < TREND_DEPTH; i++)
+		if (b->sketch[i][cols[i]] < min)
+			min = b->sketch[i][cols[i]];
+	for (i = 0; i < TREND_DEPTH; i++)
+		if (b->sketch[i][cols[i]] == min)
+			b->sketch[i][cols[i]]++;
+	b->total++;
+
+	_trend_slot_add(b, kind, term);
+	return 0;
+}
+
+int trend_add_status(trend t, unsigned long id, long when, char *text,
+		     long now)
+{
+	struct _trend_ctx ctx;
+	unsigned long *seen;
+
+	/* a status is counted again only if another one took its place in
+	 * the table in between; the IDs of the API have the time above the
+	 * 22nd bit, folded into the bits the table is indexed with */
+	if (id != 0) {
+		seen = &t->seen[((id ^ (id >> 22)) * 2654435761UL) % TREND_SEEN];
+		if (*seen == id)
+			return 0;
+		*seen = id;
+	}
+
+	ctx.t = t;
+	ctx.when = when == STATUS_NONE ? now : when;
+	ctx.now = now;
+	ctx.count = 0;
+	trend_terms(text, _trend_count, &ctx);
+	return ctx.count;
+}
+
+long trend_total(trend t, long now, long window)
+{
+	struct _trend_bucket *b;
+	long period = now / t->span;
+	long total = 0;
+	int n = _trend_window(t, window);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (period - i < 0)
+			break;
+		b = &t->buckets[(period - i) % t->nbuckets];
+		if (b->period == period - i)
+			total += b->total;
+	}
+
+	return total;
+}
+
+int trend_estimate(trend t, int kind, char *term, long now, long window,
+		   struct trend_item *item)
+{
+	struct _trend_bucket *b;
+	unsigned long cols[TREND_DEPTH];
+	long period = now / t->span;
+	long low = 0;
+	long high = 0;
+	long cm;
+	long ss;
+	long least;
+	int n = _trend_window(t, window);
+	int i;
+	int j;
+
+	if (strlen(term) >= TREND_TERM_MAX)
+		return -1;
+
+	_trend_cols(kind, term, cols);
+	for (i = 0; i < n; i++) {
+		if (period - i < 0)
+			break;
+		b = &t->buckets[(period - i) % t->nbuckets];
+		if (b->period != period - i)
+			continue;
+
+		cm = b->sketch[0][cols[0]];
+		for (j = 1; j < TREND_DEPTH; j++)
+			if (b->sketch[j][cols[j]] < cm)
+				cm = b->sketch[j][cols[j]];
+
+		/* a term left out of the slots was counted no more than the
+		 * one counted least, if they are all used */
+		least = 0;
+		ss = -1;
+		for (j = 0; j < b->used[kind]; j++) {
+			if (!strcmp(b->slots[kind][j].term, term)) {
+				ss = b->slots[kind][j].count;
+				low += ss - b->slots[kind][j].error;
+				break;
+			}
+			if (j == 0 || b->slots[kind][j].count < least)
+				least = b->slots[kind][j].count;
+		}
+		if (ss < 0)
+			ss = b->used[kind] < TREND_SLOTS ? 0 : least;
+
+		high += cm < ss ? cm : ss;
+	}
+
+	strcpy(item->term, term);
+	item->count = high;
+	item->error = high - low;
+	return 0;
+}
+
+int trend_top(trend t, int kind, long now, long window,
+	      struct trend_item *items, int n)
+{
+	struct _trend_bucket *b;
+	struct trend_item item;
+	long period = now / t->span;
+	long count = 0;
+	int buckets = _trend_window(t, window);
+	int found = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < buckets; i++) {
+		if (period - i < 0)
+			break;
+		b = &t->buckets[(period - i) % t->nbuckets];
+		if (b->period != period - i)
+			continue;
+		for (j = 0; j < b->used[kind]; j++)
+			t->cand[count++] = b->slots[kind][j].term;
+	}
+
+	/* a term counted more than 1 / TREND_SLOTS of the window was in
+	 * some bucket more than that, so it's among the candidates */
+	qsort(t->cand, count, sizeof(*t->cand), _trend_cmp);
+	for (i = 0; i < count; i++) {
+		if (i > 0 && !strcmp(t->cand[i], t->cand[i - 1]))
+			continue;
+		trend_estimate(t, kind, t->cand[i], now, window, &item);
+
+		/* into its place, the ties in the order of the terms */
+		for (j = found; j > 0 && items[j - 1].count < item.count; j--)
+			if (j < n)
+				items[j] = items[j - 1];
+		if (j < n) {
+			items[j] = item;
+			if (found < n)
+				found++;
+		}
+	}
+
+	return found;
+}
+
+/* ************************************
+ * static functions
+ */
+static int _trend_word(char c)
+{
+	return isalnum((unsigned char) c) || c == '_'
+	    || (unsigned char) c >= 0x80;
+}
+
+static int _trend_prefix(char *str, char *prefix)
+{
+	for (; *prefix != 0; str++, prefix++)
+		if (tolower((unsigned char) *str) != *prefix)
+			return 0;
+	return 1;
+}
+
+static void _trend_cols(int kind, char *term, unsigned long *cols)
+{
+	unsigned long h = 2166136261UL;
+	unsigned long g;
+	int i;
+
+	/* FNV-1a, whose low bits depend on the low bits of the bytes only, so
+	 * it's mixed by the finalizer of MurmurHash3 before it's split into
+	 * the two hashes; the columns are h + i * g, g odd so that the rows
+	 * differ */
+	h = ((h ^ (unsigned long) kind) * 16777619UL) & 0xffffffffUL;
+	for (; *term != 0; term++)
+		h = ((h ^ (unsigned char) *term) * 16777619UL) & 0xffffffffUL;
+	h ^= h >> 16;
+	h = (h * 0x85ebca6bUL) & 0xffffffffUL;
+	h ^= h >> 13;
+	h = (h * 0xc2b2ae35UL) & 0xffffffffUL;
+	h ^= h >> 16;
+	g = h ^ 0x9e3779b9UL;
+	g = (g * 0x85ebca6bUL) & 0xffffffffUL;
+	g ^= g >> 13;
+	g = ((g * 0xc2b2ae35UL) & 0xffffffffUL) | 1;
+
+	for (i = 0; i < TREND_DEPTH; i++)
+		cols[i] = ((h + i * g) & 0xffffffffUL) % TREND_WIDTH;
+}
+
+static struct _trend_bucket *_trend_bucket(trend t, long when, long now)
+{
+	struct _trend_bucket *b;
+	long period = (when < now ? when : now) / t->span;
+
+	if (period <= now / t->span - t->nbuckets || period < 0)
+		return NULL;
+
+	b = &t->buckets[period % t->nbuckets];
+	if (b->period > period)
+		return NULL;
+	if (b->period < period) {
+		memset(b, 0, sizeof(*b));
+		b->period = period;
+	}
+
+	return b;
+}
+
+static void _trend_slot_add(struct _trend_bucket *b, int kind, char *term)
+{
+	struct _trend_slot *slots = b->slots[kind];
+	int least = 0;
+	int i;
+
+	for (i = 0; i < b->used[kind]; i++) {
+		if (!strcmp(slots[i].term, term)) {
+			slots[i].count++;
+			return;
+		}
+		if (slots[i].count < slots[least].count)
+			least = i;
+	}
+
+	if (b->used[kind] < TREND_SLOTS) {
+		i = b->used[kind]++;
+		strcpy(slots[i].term, term);
+		slots[i].count = 1;
+		slots[i].error = 0;
+		return;
+	}
+
+	strcpy(slots[least].term, term);
+	slots[least].error = slots[least].count;
+	slots[least].count++;
+}
+
+static int _trend_window(trend t, long window)
+{
+	long n = (window + t->span - 1) / t->span;
+
+	if (n < 1)
+		return 1;
+	return n > t->nbuckets ? t->nbuckets : n;
+}
+
+static int _trend_count(int kind, char *term, void *arg)
+{
+	struct _trend_ctx *ctx = arg;
+
+	if (trend_add(ctx->t, kind, term, ctx->when, ctx->now) == 0)
+		ctx->count++;
+	return 0;
+}
+
+static int _trend_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char **) a, *(char **) b);
+}
@@ -0,0 +1,141 @@
+#ifndef __TREND_H
+#define __TREND_H
+#include "main.h"
+
+/** @file */
+
+/** The kinds of the terms counted, see trend_terms() */
+#define TREND_HASHTAG 0
+#define TREND_MENTION 1
+#define TREND_URL 2
+#define TREND_KINDS 3
+
+/** The size of a term, the terminating NUL included: the longer ones
+ * aren't counted */
+#define TREND_TERM_MAX 48
+
+/** The terms each bucket keeps the counts of for each kind, see
+ * trend_create() */
+#define TREND_SLOTS 32
+
+/** The rows and the columns of the Count-Min sketch of a bucket. A count
+ * is overestimated by more than e / TREND_WIDTH of the terms of the bucket
+ * with a probability of e^-TREND_DEPTH at most. */
+#define TREND_DEPTH 4
+#define TREND_WIDTH 512
+
+/** The IDs of the statuses counted last, so that a status fetched again
+ * isn't counted again, see trend_add_status() */
+#define TREND_SEEN 4096
+
+/** Counts the hashtags, the mentions and the URLs of the statuses in a
+ * sliding window, in fixed memory, see trend_create() */
+typedef struct _trend *trend;
+
+/** A term and its count in a window, see trend_top() */
+struct trend_item {
+
+	/** The term, with its '#' or '@' */
+	char term[TREND_TERM_MAX];
+
+	/** The count, which may be overestimated, but never underestimated */
+	long count;
+
+	/** How much the count may be overestimated: the term was seen
+	 * count - error times at least */
+	long error;
+};
+
+/** The prototype of the function trend_terms() calls for the terms
+ * @param kind the TREND_HASHTAG, TREND_MENTION or TREND_URL
+ * @param term the term, terminated, with the letters of a hashtag or a
+ * mention in lower case
+ * @param arg the argument given to trend_terms()
+ * @return 0 to go on, anything else to stop */
+typedef int (*trend_fn) (int kind, char *term, void *arg);
+
+/** Creates the counters of a window of buckets * span seconds. The window
+ * is split into buckets of span seconds each, which are reused once they
+ * slide out of it, and each bucket has a Count-Min sketch of the terms
+ * and, for each kind, the TREND_SLOTS terms counted most often, kept by
+ * the Space-Saving algorithm: a new term takes the place of the one
+ * counted least, and inherits its count as its error. Every term counted
+ * more than 1 / TREND_SLOTS of the times in a bucket is among them. All
+ * the memory is allocated here.
+ * @param span the seconds of a bucket
+ * @param buckets the count of buckets
+ * @return the counters, NULL if out of memory */
+trend trend_create(long span, int buckets);
+
+/** Frees the counters
+ * @param t the counters, may be NULL */
+void trend_free(trend t);
+
+/** Returns the memory the counters take, the same however many terms they
+ * counted
+ * @param t the counters
+ * @return the size in bytes */
+long trend_size(trend t);
+
+/** Calls fn for the hashtags, the mentions and the URLs of a text, in
+ * order. A hashtag or a mention starts with a '#' or an '@' that doesn't
+ * follow a letter, a digit or a '&', a hashtag isn't all digits, and a
+ * URL starts with "http://" or "https://" and goes on to the next space,
+ * without the punctuation at its end.
+ * @param text the text
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @return the non-zero value fn returned, 0 if it never did */
+int trend_terms(char *text, trend_fn fn, void *arg);
+
+/** Counts a term
+ * @param t the counters
+ * @param kind the TREND_HASHTAG, TREND_MENTION or TREND_URL
+ * @param term the term
+ * @param when the time it was seen at, in seconds since the epoch
+ * @param now the time now, the terms seen after it are counted as seen now
+ * @retval 0 if counted
+ * @retval -1 if the term is too long or before the window */
+int trend_add(trend t, int kind, char *term, long when, long now);
+
+/** Counts the terms of a status, unless it was counted already
+ * @param t the counters
+ * @param id the ID of the status, 0 if unknown
+ * @param when the time it was posted at, STATUS_NONE for now
+ * @param text the text of the status
+ * @param now the time now
+ * @return the count of terms counted */
+int trend_add_status(trend t, unsigned long id, long when, char *text,
+		     long now);
+
+/** Returns the count of terms counted in the last seconds
+ * @param t the counters
+ * @param now the time now
+ * @param window the seconds, they are rounded up to whole buckets
+ * @return the count */
+long trend_total(trend t, long now, long window);
+
+/** Returns the count of a term in the last seconds
+ * @param t the counters
+ * @param kind the kind of the term
+ * @param term the term
+ * @param now the time now
+ * @param window the seconds, they are rounded up to whole buckets
+ * @param item the count is stored here, with the term
+ * @retval 0 if succeeded
+ * @retval -1 if the term is too long */
+int trend_estimate(trend t, int kind, char *term, long now, long window,
+		   struct trend_item *item);
+
+/** Returns the terms of a kind counted most in the last seconds
+ * @param t the counters
+ * @param kind the TREND_HASHTAG, TREND_MENTION or TREND_URL
+ * @param now the time now
+ * @param window the seconds, they are rounded up to whole buckets
+ * @param items the terms are stored here, the most counted first
+ * @param n the room in items
+ * @return the count of terms stored */
+int trend_top(trend t, int kind, long now, long window,
+	      struct trend_item *items, int n);
+
+#endif
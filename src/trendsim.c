@@ -0,0 +1,348 @@
+#include "main.h"
+#include "trend.h"
+#include <stdio.h>
+
+/** @file
+ * Checks the error bounds of the trend counters against the exact counts
+ * of a simulated stream of statuses. The statuses mention hashtags, users
+ * and URLs picked from VOCABULARY of each with a Zipf distribution, whose
+ * ranks shift every few hours so that the terms come and go, and some of
+ * them are fetched again, as a timeline polled is. At the end of every
+ * hour, for the whole window and for the last few hours:
+ *
+ * - the count of terms is exact,
+ * - no count is underestimated, and no term was seen fewer times than its
+ *   count minus its error,
+ * - counts are overestimated by more than e / TREND_WIDTH of the terms in
+ *   the window no more often than e^-TREND_DEPTH of the time,
+ * - a term that is more than 1 / TREND_SLOTS of its kind is among the top
+ *   terms,
+ *
+ * and the memory of the counters never grows. Exits with 1 if any of
+ * these fails.
+ *
+ * Usage: trendsim [-h hours] [-s seed]
+ */
+
+/** The seconds of a bucket, and the count of them, as in the client */
+#define SPAN 3600
+#define BUCKETS 24
+/** The hours of the shorter window checked */
+#define SHORT_WINDOW 6
+/** The terms of each kind */
+#define VOCABULARY 5000
+/** The base of the natural logarithm, the bounds are powers of it */
+#define E 2.718281828459045
+/** The statuses posted an hour */
+#define RATE 2000
+/** The hours after which the ranks shift */
+#define SHIFT_PERIOD 6
+/** The statuses fetched again, one in REFETCH, from the last RECENT */
+#define REFETCH 10
+#define RECENT 1000
+/** The terms compared with the exact top ones */
+#define TOP 10
+/** The time the simulation starts at, at the start of a bucket */
+#define EPOCH (344444L * SPAN)
+
+/** A status posted, kept to be fetched again */
+struct _status {
+	unsigned long id;
+	long when;
+	char text[256];
+};
+
+/** The exact counts: for every hour, kind and term */
+static long *truth;
+
+/** The cumulative distribution of the ranks */
+static double cdf[VOCABULARY];
+
+/** The statuses posted last */
+static struct _status recent[RECENT];
+
+/** The results of the checks */
+static long checked = 0;
+static long over = 0;
+static long failures = 0;
+static double worst = 0;
+static long top_found = 0;
+static long top_total = 0;
+
+/** Returns the exact count of a term of an hour */
+#define TRUTH(hour, kind, term) \
+	truth[((long) (hour) * TREND_KINDS + (kind)) * VOCABULARY + (term)]
+
+/** Returns a term of a kind, picked by the distribution of the hour
+ * @param kind the kind
+ * @param hour the hour
+ * @return the index of the term */
+static int _pick(int kind, long hour);
+
+/** Writes a status of a few terms, counting them
+ * @param s the status
+ * @param hour the hour of the status */
+static void _post(struct _status *s, long hour);
+
+/** Returns the index of a term, from its name
+ * @param kind the kind
+ * @param term the term, eg. "#tag12"
+ * @return the index */
+static int _index(int kind, char *term);
+
+/** Checks the counters against the exact counts at the end of an hour
+ * @param t the counters
+ * @param hour the hour
+ * @param hours the hours of the window */
+static void _check(trend t, long hour, long hours);
+
+/** Returns a random number in [0, 1) */
+static double _random(void);
+
+int main(int argc, char **argv)
+{
+	trend t;
+	struct mem_stats before;
+	struct mem_stats after;
+	struct _status *s;
+	long hours = 48;
+	long hour;
+	long posted = 0;
+	long now;
+	double sum = 0;
+	double delta = 1;
+	int i;
+
+	srand(1);
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-h") && i + 1 < argc)
+			hours = atol(argv[++i]);
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			srand(atoi(argv[++i]));
+	}
+	if (hours < 1)
+		hours = 1;
+	for (i = 0; i < TREND_DEPTH; i++)
+		delta /= E;
+
+	for (i = 0; i < VOCABULARY; i++)
+		cdf[i] = sum += 1.0 / (i + 1);
+	for (i = 0; i < VOCABULARY; i++)
+		cdf[i] /= sum;
+
+	truth = calloc(hours * TREND_KINDS * VOCABULARY, sizeof(*truth));
+	t = trend_create(SPAN, BUCKETS);
+	if (truth == NULL || t == NULL) {
+		fprintf(stderr, "trendsim: out of memory\n");
+		return 1;
+	}
+	mem_get(MEM_STATUS, &before);
+
+	for (hour = 0; hour < hours; hour++) {
+		for (i = 0; i < RATE; i++) {
+			now = EPOCH + hour * SPAN + (long) i * SPAN / RATE;
+
+			/* fetched again, it isn't counted again */
+			if (posted > 0 && rand() % REFETCH == 0) {
+				s = &recent[rand() % (posted < RECENT ?
+						      posted : RECENT)];
+				if (trend_add_status(t, s->id, s->when, s->text,
+						     now) != 0) {
+					printf("FAIL: status %lu counted twice\n",
+					       s->id);
+					failures++;
+				}
+			}
+
+			s = &recent[posted % RECENT];
+			s->id = ++posted;
+			s->when = now;
+			_post(s, hour);
+			trend_add_status(t, s->id, s->when, s->text, now);
+		}
+
+		_check(t, hour, BUCKETS);
+		_check(t, hour, SHORT_WINDOW);
+	}
+
+	mem_get(MEM_STATUS, &after);
+	printf("simulated %ld hours, %ld statuses, %d terms of each kind\n",
+	       hours, posted, VOCABULARY);
+	printf("counters of %ld bytes, grown by %ld bytes\n", trend_size(t),
+	       after.live - before.live);
+	printf("%ld counts checked, %ld overestimated by more than e / %d of "
+	       "the window (at most %.2f%% allowed)\n", checked, over,
+	       TREND_WIDTH, 100 * delta);
+	printf("the worst overestimate: %.4f%% of the window\n", 100 * worst);
+	printf("%ld of %ld of the exact top %d terms found in the top %d\n",
+	       top_found, top_total, TOP, TOP);
+
+	if (after.live != before.live) {
+		printf("FAIL: the memory of the counters grew\n");
+		failures++;
+	}
+	if (over > checked * delta) {
+		printf("FAIL: counts overestimated too often\n");
+		failures++;
+	}
+
+	trend_free(t);
+	free(truth);
+	return failures > 0;
+}
+
+/* ************************************
+ * static functions
+ */
+static int _pick(int kind, long hour)
+{
+	double r = _random();
+	int lo = 0;
+	int hi = VOCABULARY - 1;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cdf[mid] < r)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* the popular terms of a kind change every SHIFT_PERIOD hours */
+	return (lo + (hour / SHIFT_PERIOD) * 37 * (kind + 1)) % VOCABULARY;
+}
+
+static void _post(struct _status *s, long hour)
+{
+	char *p = s->text;
+	int terms = 1 + rand() % 3;
+	int kind;
+	int term;
+	int i;
+
+	/* what isn't a term: an entity and an address */
+	p += sprintf(p, "it&#39;s for me@example.org:");
+	for (i = 0; i < terms; i++) {
+		kind = rand() % 10;
+		kind = kind < 5 ? TREND_HASHTAG : kind < 8 ? TREND_MENTION :
+		    TREND_URL;
+		term = _pick(kind, hour);
+		TRUTH(hour, kind, term)++;
+
+		if (kind == TREND_HASHTAG)
+			p += sprintf(p, " #Tag%d", term);
+		else if (kind == TREND_MENTION)
+			p += sprintf(p, " @user%d,", term);
+		else
+			p += sprintf(p, " see http://t.co/%d.", term);
+	}
+}
+
+static int _index(int kind, char *term)
+{
+	if (kind == TREND_HASHTAG)
+		return atoi(term + strlen("#tag"));
+	if (kind == TREND_MENTION)
+		return atoi(term + strlen("@user"));
+	return atoi(term + strlen("http://t.co/"));
+}
+
+static void _check(trend t, long hour, long hours)
+{
+	static struct trend_item items[BUCKETS * TREND_SLOTS];
+	static long counts[VOCABULARY];
+	static int found[VOCABULARY];
+	char term[TREND_TERM_MAX];
+	struct trend_item item;
+	long now = EPOCH + (hour + 1) * SPAN - 1;
+	long first;
+	long total = 0;
+	long kind_total;
+	long rank;
+	int kind;
+	int n;
+	int i;
+	int j;
+
+	first = hour - hours + 1 < 0 ? 0 : hour - hours + 1;
+	for (kind = 0; kind < TREND_KINDS; kind++)
+		for (i = 0; i < VOCABULARY; i++)
+			for (j = first; j <= hour; j++)
+				total += TRUTH(j, kind, i);
+	if (trend_total(t, now, hours * SPAN) != total) {
+		printf("FAIL: hour %ld: %ld terms counted of %ld\n", hour,
+		       trend_total(t, now, hours * SPAN), total);
+		failures++;
+	}
+
+	for (kind = 0; kind < TREND_KINDS; kind++) {
+		kind_total = 0;
+		for (i = 0; i < VOCABULARY; i++) {
+			counts[i] = 0;
+			for (j = first; j <= hour; j++)
+				counts[i] += TRUTH(j, kind, i);
+			kind_total += counts[i];
+			found[i] = 0;
+		}
+
+		for (i = 0; i < VOCABULARY; i++) {
+			if (counts[i] == 0)
+				continue;
+			if (kind == TREND_HASHTAG)
+				sprintf(term, "#tag%d", i);
+			else if (kind == TREND_MENTION)
+				sprintf(term, "@user%d", i);
+			else
+				sprintf(term, "http://t.co/%d", i);
+			trend_estimate(t, kind, term, now, hours * SPAN, &item);
+
+			if (item.count < counts[i]
+			    || item.count - item.error > counts[i]) {
+				printf("FAIL: hour %ld: %s seen %ld times, "
+				       "counted %ld-%ld\n", hour, term,
+				       counts[i], item.count - item.error,
+				       item.count);
+				failures++;
+			}
+			checked++;
+			if (item.count - counts[i] > E / TREND_WIDTH * total)
+				over++;
+			if ((double) (item.count - counts[i]) / total > worst)
+				worst = (double) (item.count - counts[i]) / total;
+		}
+
+		n = trend_top(t, kind, now, hours * SPAN, items,
+			      BUCKETS * TREND_SLOTS);
+		for (i = 0; i < n; i++)
+			found[_index(kind, items[i].term)] = i + 1;
+		for (i = 0; i < VOCABULARY; i++) {
+			if (counts[i] * TREND_SLOTS > kind_total && !found[i]) {
+				printf("FAIL: hour %ld: a term of kind %d seen "
+				       "%ld times of %ld is missing\n", hour,
+				       kind, counts[i], kind_total);
+				failures++;
+			}
+		}
+
+		/* the rank of a term is the count of terms seen more often */
+		for (i = 0; i < VOCABULARY; i++) {
+			if (counts[i] == 0)
+				continue;
+			rank = 0;
+			for (j = 0; j < VOCABULARY && rank < TOP; j++)
+				if (counts[j] > counts[i])
+					rank++;
+			if (rank < TOP) {
+				top_total++;
+				if (found[i] > 0 && found[i] <= TOP)
+					top_found++;
+			}
+		}
+	}
+}
+
+static double _random(void)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
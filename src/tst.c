@@ -0,0 +1,240 @@
+#define MEM_AREA MEM_UI
+#include "tst.h"
+
+/** @file */
+
+/** A node. Index 0 is no node, so the links of a new node are 0. */
+struct _tst_node {
+
+	/** The nodes of the characters below and above this one at the same
+	 * position, and of the ones after it */
+	unsigned int lo;
+	unsigned int eq;
+	unsigned int hi;
+
+	/** The character */
+	unsigned char c;
+
+	/** True if a word ends with this character */
+	unsigned char end;
+};
+
+/** The tree */
+struct _tst {
+
+	/** The nodes, the first one unused */
+	struct _tst_node *nodes;
+
+	/** The count of nodes used, and of the ones there is room for */
+	unsigned int used;
+	unsigned int size;
+
+	/** The count of words */
+	long count;
+};
+
+/** Makes room for more nodes
+ * @param t the tree
+ * @param more the count of nodes to make room for
+ * @retval 0 if succeeded
+ * @retval -1 if out of memory */
+static int _tst_reserve(tst t, long more);
+
+/** Looks the node of the last character of a prefix up
+ * @param t the tree
+ * @param prefix the prefix, not empty
+ * @return the index of the node, 0 if no word starts with the prefix */
+static unsigned int _tst_find(tst t, char *prefix);
+
+/** Calls fn for the words below a node in order, see tst_each_prefix()
+ * @param t the tree
+ * @param n the node
+ * @param buf the prefix of the words, TST_WORD_MAX long
+ * @param len the length of the prefix
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @return the non-zero value fn returned, 0 if it never did */
+static int _tst_walk(tst t, unsigned int n, char *buf, long len, tst_fn fn,
+		     void *arg);
+
+tst tst_create(void)
+{
+	tst ret = calloc(1, sizeof(*ret));
+
+	if (ret == NULL || _tst_reserve(ret, 1) < 0) {
+		tst_free(ret);
+		return NULL;
+	}
+	memset(ret->nodes, 0, sizeof(*ret->nodes));
+	ret->used = 1;
+	return ret;
+}
+
+void tst_free(tst t)
+{
+	if (t == NULL)
+		return;
+
+	free(t->nodes);
+	free(t);
+}
+
+int tst_insert(tst t, char *word)
+{
+	unsigned char *p = (unsigned char *) word;
+	unsigned int *link;
+	unsigned int n;
+	long len = strlen(word);
+
+	if (len == 0 || len >= TST_WORD_MAX)
+		return 0;
+
+	/* the links aren't moved by a reallocation halfway */
+	if (_tst_reserve(t, len) < 0)
+		return -1;
+
+	for (link = &t->nodes[0].eq;;) {
+		if (*link == 0) {
+			n = t->used++;
+			memset(&t->nodes[n], 0, sizeof(t->nodes[n]));
+			t->nodes[n].c = *p;
+			*link = n;
+		}
+
+		n = *link;
+		if (*p < t->nodes[n].c) {
+			link = &t->nodes[n].lo;
+		}
+		else if (*p > t->nodes[n].c) {
+			link = &t->nodes[n].hi;
+		}
+		else if (p[1] != 0) {
+			link = &t->nodes[n].eq;
+			p++;
+		}
+		else if (t->nodes[n].end) {
+			return 0;
+		}
+		else {
+			t->nodes[n].end = 1;
+			t->count++;
+			return 1;
+		}
+	}
+}
+
+long tst_count(tst t)
+{
+	return t->count;
+}
+
+long tst_size(tst t)
+{
+	return (long) t->size * sizeof(*t->nodes);
+}
+
+long tst_extend(tst t, char *prefix, char *buf, long size, int *unique)
+{
+	unsigned int n = _tst_find(t, prefix);
+	unsigned int next;
+	long len = 0;
+
+	*unique = 0;
+	if (n == 0)
+		return -1;
+
+	/* as long as the words go on one way only */
+	while (!t->nodes[n].end && len + 1 < size) {
+		next = t->nodes[n].eq;
+		if (next == 0 || t->nodes[next].lo != 0
+		    || t->nodes[next].hi != 0)
+			break;
+		buf[len++] = t->nodes[next].c;
+		n = next;
+	}
+	buf[len] = 0;
+
+	*unique = t->nodes[n].end && t->nodes[n].eq == 0;
+	return len;
+}
+
+int tst_each_prefix(tst t, char *prefix, tst_fn fn, void *arg)
+{
+	char buf[TST_WORD_MAX];
+	unsigned int n = _tst_find(t, prefix);
+	long len = strlen(prefix);
+	int ret;
+
+	if (n == 0 || len >= TST_WORD_MAX)
+		return 0;
+
+	memcpy(buf, prefix, len + 1);
+	if (t->nodes[n].end && (ret = fn(buf, arg)) != 0)
+		return ret;
+	return _tst_walk(t, t->nodes[n].eq, buf, len, fn, arg);
+}
+
+/* ************************************
+ * static functions
+ */
+static int _tst_reserve(tst t, long more)
+{
+	struct _tst_node *nodes;
+	unsigned int size = t->size;
+
+	while (size - t->used < (unsigned long) more)
+		size = size > 0 ? size * 2 : 256;
+	if (size == t->size)
+		return 0;
+
+	nodes = realloc(t->nodes, size * sizeof(*nodes));
+	if (nodes == NULL)
+		return -1;
+	t->nodes = nodes;
+	t->size = size;
+	return 0;
+}
+
+static unsigned int _tst_find(tst t, char *prefix)
+{
+	unsigned char *p = (unsigned char *) prefix;
+	unsigned int n = t->nodes[0].eq;
+
+	if (*p == 0)
+		return 0;
+
+	while (n != 0) {
+		if (*p < t->nodes[n].c)
+			n = t->nodes[n].lo;
+		else if (*p > t->nodes[n].c)
+			n = t->nodes[n].hi;
+		else if (*++p != 0)
+			n = t->nodes[n].eq;
+		else
+			return n;
+	}
+
+	return 0;
+}
+
+static int _tst_walk(tst t, unsigned int n, char *buf, long len, tst_fn fn,
+		     void *arg)
+{
+	int ret;
+
+	/* the nodes above are a loop, the ones below and after recursion */
+	for (; n != 0; n = t->nodes[n].hi) {
+		if ((ret = _tst_walk(t, t->nodes[n].lo, buf, len, fn, arg)) != 0)
+			return ret;
+
+		buf[len] = t->nodes[n].c;
+		buf[len + 1] = 0;
+		if (t->nodes[n].end && (ret = fn(buf, arg)) != 0)
+			return ret;
+		if ((ret = _tst_walk(t, t->nodes[n].eq, buf, len + 1, fn,
+				     arg)) != 0)
+			return ret;
+	}
+
+	return 0;
+}
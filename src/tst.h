@@ -0,0 +1,69 @@
+#ifndef __TST_H
+#define __TST_H
+#include "main.h"
+
+/** @file */
+
+/** The longest word a tree takes, longer ones are left out */
+#define TST_WORD_MAX 128
+
+/** A set of words for completing prefixes, see tst_create() */
+typedef struct _tst *tst;
+
+/** The prototype of the function tst_each_prefix() calls for the words
+ * @param word the word, only valid during the call
+ * @param arg the argument given to tst_each_prefix()
+ * @return 0 to go on, anything else to stop */
+typedef int (*tst_fn) (char *word, void *arg);
+
+/** Creates an empty ternary search tree: a node holds a character, the
+ * node of the words going on with it, and the nodes of the characters
+ * below and above it at the same position. The nodes are kept in one
+ * array, linked by their indices, so a node takes 16 bytes, and the
+ * words sharing a prefix share its nodes.
+ * @return the tree, NULL if out of memory */
+tst tst_create(void);
+
+/** Frees a tree
+ * @param t the tree to free, may be NULL */
+void tst_free(tst t);
+
+/** Adds a word
+ * @param t the tree
+ * @param word the word, at most TST_WORD_MAX - 1 bytes
+ * @retval 1 if it was added
+ * @retval 0 if it was there already, empty or too long
+ * @retval -1 if out of memory */
+int tst_insert(tst t, char *word);
+
+/** Returns the count of words in the tree
+ * @param t the tree
+ * @return the count of words */
+long tst_count(tst t);
+
+/** Returns the memory the nodes of the tree take
+ * @param t the tree
+ * @return the size in bytes */
+long tst_size(tst t);
+
+/** Extends a prefix as far as every word starting with it agrees
+ * @param t the tree
+ * @param prefix the prefix
+ * @param buf the characters the words go on with are stored here
+ * @param size the size of buf
+ * @param unique set to true if the prefix extended is the only word
+ * starting with the prefix
+ * @return the count of characters stored, -1 if no word starts with the
+ * prefix */
+long tst_extend(tst t, char *prefix, char *buf, long size, int *unique);
+
+/** Calls fn for the words starting with the prefix in order, until fn
+ * returns non-zero
+ * @param t the tree
+ * @param prefix the prefix
+ * @param fn the function to call
+ * @param arg passed to fn
+ * @return the non-zero value fn returned, 0 if it never did */
+int tst_each_prefix(tst t, char *prefix, tst_fn fn, void *arg);
+
+#endif
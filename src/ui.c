@@ -1,9 +1,23 @@
+#define MEM_AREA MEM_UI
 #include "ui.h"
 #include "main.h"
 #include "http.h"
+#include "idset.h"
 #include "json.h"
+#include "kwset.h"
+#include "lineedit.h"
+#include "namelist.h"
+#include "stats.h"
+#include "status.h"
+#include "sched.h"
+#include "shmcache.h"
+#include "spool.h"
+#include "thread.h"
+#include "trend.h"
+#include "tst.h"
 #include <ctype.h>
 #include <stdio.h>
+#include <time.h>
 
 /** @file */
 
@@ -13,38 +27,147 @@
 #define TW_HOST "twitter.com"
 #define TW_TIMELINE "/statuses/friends_timeline.json"
 #define TW_UPDATE "/statuses/update.xml"
+#define TW_IMAGE "/account/update_profile_image.json"
 #define TW_FRIENDS "/statuses/friends.json"
 #define TW_FOLLOWERS "/statuses/followers.json"
 #define TW_AUTH "/account/verify_credentials.json"
+#define TW_LOOKUP "/statuses/lookup.json"
+
+/** The environment variable that overrides TW_HOST, eg. to point the client
+ * to a mock server: TWITTERM_HOST=localhost:8642 */
+#define TW_HOST_ENV "TWITTERM_HOST"
+
+/** The environment variable choosing the transport of the requests, see
+ * http_set_transport() */
+#define TW_TRANSPORT_ENV "TWITTERM_TRANSPORT"
+
+/** The environment variable naming the directory the lists of friends and
+ * followers and the spool of the posts are saved in, $HOME unless set */
+#define TW_CACHE_ENV "TWITTERM_CACHE"
+
+/** The hashtags, mentions and links of the timelines fetched are counted
+ * for TREND_HOURS, by the hour, and the t command shows the TREND_SHOW
+ * counted most of each */
+#define TREND_HOURS 24
+#define TREND_SHOW 10
+
+/** The seconds a timeline fetched by any twitterm of the account is shown
+ * again instead of fetched, see _com_fetch() */
+#define TIMELINE_FRESH 30
+
+/** The most statuses looked up by a request, and the most requests made
+ * for a conversation, a level of replies each, see _com_thread() */
+#define THREAD_LOOKUP_MAX 100
+#define THREAD_ROUNDS 10
+
+/** The deepest level of replies indented further */
+#define THREAD_INDENT_MAX 16
 
 /** print an error message and then return (used in command functions)*/
 #define _OOPS(x) printf("ERROR: %s\n", (x)); return
 #define _OOPS_AUTH _OOPS("cannot authenticate with the server: "\
 		"no user-password pair is given\n")
-#define _OOPS_RESP(x) printf("HTTP error code: %d\n", (x)); \
+#define _OOPS_RESP(x) printf("HTTP error code: %d (%s)\n", (x), \
+		http_strerror(x)); \
 	_OOPS("could not download server response!\n");
+#define _OOPS_JSON(x, pos) printf("JSON error: %s at byte %ld\n", \
+		json_strerror(x), (pos)); \
+	_OOPS("could not parse server response!\n");
 #define _OOPS_AUTH_USAGE _OOPS("usage: a username password\n")
 #define _OOPS_CREAT_USAGE _OOPS("usage: c groupname comma,separated,list\n")
 
 /** Prototype command function, the full user input is passed as a parameter */
 typedef void (*command_fn) (char *full);
 
+/** The names of a list gathered page by page, see _com_list() */
+struct _list_names {
+
+	/** The names of the users, each allocated on the heap, and their IDs,
+	 * 0 if a user came without one */
+	char **names;
+	unsigned long *ids;
+
+	/** The count of users */
+	long count;
+
+	/** The size of names and ids */
+	long size;
+
+	/** The count of the users without an ID */
+	long noids;
+
+	/** The index of the user object the last user came from, in the
+	 * array of the page, -1 before the first one */
+	long record;
+
+	/** The cursor of the next page as the server sent it, "0" after the
+	 * last one */
+	char cursor[32];
+
+	/** True if a name couldn't be stored */
+	int nomem;
+
+	/** The HTTP status code of the last page asked for */
+	int status;
+};
+
+/** A user of a list, see _list_find() */
+struct _list_entry {
+
+	/** The ID */
+	unsigned long id;
+
+	/** The index of the name in the struct _list_names */
+	long index;
+};
+
+/** The users of a list ordered by ID, to name the gained ones of d */
+struct _list_index {
+
+	/** The list */
+	struct _list_names *list;
+
+	/** The users ordered by ID, NULL if out of memory */
+	struct _list_entry *entries;
+};
+
 /** Appends a json_element to the configuration tree
 	* @param elem the element to append
 	* @return elem */
 static json_element _config_append(json_element elem);
 
+/** Moves an element of the configuration tree to the front, or inserts it
+	* there if it isn't in the tree
+	* @param elem the element to move
+	* @return elem */
+static json_element _config_prepend(json_element elem);
+
 /** Reads the config given and sets the config variable to the JSON_ARRAY that was returned by json_parse()
 	* @param config the name of the parameter to read
 	* @retval true if succeeded
 	* @retval false if failed */
 static int _read_config(char *config);
 
-/** Looks up a JSON_STRING in the elem tree identified by name, and prints it to stdout with the given prefix
-	* @param elem the first element of the chain in which to search
-	* @param name the name field of the json_element
-	* @param prefix the prefix to print*/
-static void _print_json_string(json_element elem, char *name, char *prefix);
+/** Prints a string of a status to fp with the given prefix, if the status has it
+	* @param page the page of the status
+	* @param off the offset of the string in the pool of the page
+	* @param prefix the prefix to print
+	* @param fp the stream to print to */
+static void _print_status_string(status_page page, long off, char *prefix,
+				 FILE * fp);
+
+/** Prints a status the way the f command does, if its author passes the filter
+	* @param page the page of the status
+	* @param row the row of the status in the page
+	* @param tag printed in brackets before the status if not NULL
+	* @param group the name of the group whose members' statuses are printed, NULL for everyone
+	* @param fp the stream to print to */
+static void _print_status(status_page page, long row, char *tag, char *group,
+			  FILE * fp);
+
+/** Compiles the path and the projection of the fields printed of lists, on
+ * the first call */
+static void _compile_paths(void);
 
 /** Returns true, if depending on the parameter list the tweet by the given screen name should be printed, false otherwise
 	* @param params the parameter list returned by _get_param_list
@@ -60,14 +183,179 @@ static int _screen_name_filter(char *params, char *sname);
 	* @retval false if no user/password pair was found */
 static int _check_auth(json_element * user, json_element * pwd);
 
+/** Lists the user/password pairs of the config chain, in the order they are in
+	* @param reqs if not NULL, a timeline request of the account is stored in the n-th element
+	* @return the count of accounts */
+static int _list_accounts(http_request reqs);
+
+/** Returns the object of the config chain that holds the given user
+	* @param user the username to look for
+	* @return the object, or NULL if there is none */
+static json_element _find_account(char *user);
+
+/** Asks the scheduler whether a request may be sent to the endpoint for the user,
+	* and tells the user when it may be if it can't be now
+	* @param user the username
+	* @param file the endpoint
+	* @param priority a value of enum sched_priority
+	* @retval 0 if the request may be sent, _limit_done() has to be called then
+	* @retval -1 if the rate limit of the endpoint would be exceeded */
+static int _limit_take(char *user, char *file, int priority);
+
+/** Tells the scheduler that a request let through by _limit_take() is done
+	* @param user the username
+	* @param file the endpoint
+	* @param status the HTTP status code or a negative enum http_error
+	* @param limit the rate limit reported with the response, NULL for the one of the last request */
+static void _limit_done(char *user, char *file, int status,
+			struct _http_limit *limit);
+
+/** The clock of the scheduler: the wall clock, which the reset times of the server are measured by */
+static double _wall_clock(void *arg);
+
+/** Fetches a list page by page, the request for the next page sent before
+ * the names of the current one are printed. Prints what went wrong, but the
+ * HTTP error of the first page.
+ * @param user the account
+ * @param pwd its password
+ * @param followers true for the followers, false for the friends
+ * @param group the group to filter the names printed with, may be NULL
+ * @param print true to print the names as the pages arrive
+ * @param list the names and IDs are stored here, freed with _list_free()
+ * @return true if the whole list was fetched */
+static int _list_fetch(json_element user, json_element pwd, int followers,
+		       char *group, int print, struct _list_names *list);
+
+/** Saves a list fetched whole: its names, and the set of its IDs if every
+ * user came with one
+ * @param user the account
+ * @param followers true for the followers, false for the friends
+ * @param list the list
+ * @param ids the set of its IDs if built already, NULL otherwise */
+static void _list_save(char *user, int followers, struct _list_names *list,
+		       idset ids);
+
+/** Frees what _list_fetch() stored */
+static void _list_free(struct _list_names *list);
+
+/** The json_field_fn gathering the names, the IDs and the cursor of a page
+ * of a list into a struct _list_names */
+static int _list_field(json_field field, void *arg);
+
+/** Drops the users of a page that came without a name, and counts those
+ * without an ID
+ * @param list the list
+ * @param first the index of the first user of the page */
+static void _list_page(struct _list_names *list, long first);
+
+/** Returns the file the list of an account is saved in
+ * @param user the account
+ * @param followers true for the followers, false for the friends
+ * @param ext appended to the name, "" for the names, ".ids" for the IDs
+ * @return the name of the file allocated on the heap, NULL if there is no
+ * place for it */
+static char *_list_cache(char *user, int followers, char *ext);
+
+/** Compares two struct _list_entry by ID for qsort() and bsearch() */
+static int _list_entry_cmp(const void *a, const void *b);
+
+/** The idset_fn printing a gained user of d, named from the struct
+ * _list_index given as arg */
+static int _list_gained(unsigned long id, void *arg);
+
+/** The idset_fn printing a lost user of d */
+static int _list_lost(unsigned long id, void *arg);
+
+/** The namelist_fn printing the names of a saved list that pass the group
+ * filter given as arg */
+static int _list_print(char *name, void *arg);
+
+/** Returns the content type of an image by the extension of its file
+ * @param file the name of the file
+ * @return the type, NULL if it isn't an image the server takes */
+static char *_image_type(char *file);
+
+/** Adds a name to the ones completed on Tab
+ * @param name the name, without the '@' */
+static void _known_add(char *name);
+
+/** Adds the names of a comma separated list, the members of a group, to the
+ * ones completed on Tab
+ * @param names the list */
+static void _known_add_list(char *names);
+
+/** Adds the names in the configuration, the accounts, the groups and their
+ * members, to the ones completed on Tab */
+static void _known_config(void);
+
+/** Compiles the mute and highlight lists of the configuration into the
+ * filter, see _print_status() */
+static void _filter_config(void);
+
+/** Prints the text of a status with the keywords of the highlight list
+ * between highlight_on and highlight_off
+ * @param text the text
+ * @param fp the stream to print to */
+static void _print_highlighted(char *text, FILE * fp);
+
+/** The kwset_fn marking the bytes of a highlighted keyword in the array
+ * given as arg */
+static int _highlight_mark(int keyword, long end, void *arg);
+
+/** Counts the terms of the statuses of a page fetched, see _com_trend(),
+ * and adds them to their conversations, see _com_thread()
+ * @param page the page */
+static void _page_fetched(status_page page);
+
+/** Opens the timeline of an account shared by the twitterms running, see
+ * _com_fetch()
+ * @param user the account
+ * @return the cache, NULL if it couldn't be opened */
+static shmcache _timeline_share(char *user);
+
+/** Reads the timeline shared, if it was fetched in the last
+ * TIMELINE_FRESH seconds
+ * @param share the cache
+ * @return the page, NULL if there's none as fresh */
+static status_page _timeline_shared(shmcache share);
+
+/** Fetches statuses replied to in one request, and marks the ones the
+ * server didn't return as gone
+ * @param user the username
+ * @param pwd the password
+ * @param ids the IDs of the statuses
+ * @param count the count of IDs, THREAD_LOOKUP_MAX at most
+ * @retval 0 if succeeded
+ * @retval -1 if failed, the error is printed */
+static int _thread_lookup(char *user, char *pwd, unsigned long *ids,
+			  int count);
+
+/** The thread_fn printing a status of a conversation, indented by its
+ * depth, counting them in the int given as arg */
+static int _thread_print(struct thread_status *status, void *arg);
+
+/** The lineedit_fn completing the names known */
+static long _complete(char *word, char *buf, long size, int list, void *arg);
+
+/** The tst_fn printing the names a word can be completed to, counting them
+ * in the int given as arg */
+static int _complete_print(char *word, void *arg);
+
 static char *_get_param_list(char *full);
 
 static void _com_fetch(char *full);
+static void _com_multi(char *full);
 static void _com_post(char *full);
+static void _com_image(char *full);
 static void _com_list(char *full);
+static void _com_diff(char *full);
 static void _com_auth(char *full);
 static void _com_write(char *full);
 static void _com_creat(char *full);
+static void _com_stats(char *full);
+static void _com_mem(char *full);
+static void _com_trend(char *full);
+static void _com_thread(char *full);
 static void _com_inval(char *full);
 
 /** The data structure to hold the function pointers and their commands in */
@@ -83,30 +371,120 @@ struct __com_t {
 /** The array of the available commands. */
 static struct __com_t commands[] = {
 	{'f', _com_fetch},
+	{'m', _com_multi},
 	{'p', _com_post},
+	{'i', _com_image},
 	{'l', _com_list},
+	{'d', _com_diff},
 	{'a', _com_auth},
 	{'w', _com_write},
 	{'c', _com_creat},
+	{'s', _com_stats},
+	{'u', _com_mem},
+	{'t', _com_trend},
+	{'r', _com_thread},
 	{0, _com_inval}
 };
 
 /** The array to hold the configuration */
 static json_element config = NULL;
 
+/** The compiled path of the screen names of a list, see _compile_paths() */
+static json_path path_screen_name = NULL;
+
+/** The names, the IDs and the cursor of a page of a list, the rest isn't
+ * parsed */
+static json_projection proj_list = NULL;
+
+/** The scheduler the requests are spaced by, created on the first request */
+static sched scheduler = NULL;
+
+/** The server the requests are sent to, TW_HOST unless overridden */
+static char *tw_host = TW_HOST;
+
+/** The screen names and the groups seen so far, completed on Tab; NULL if
+ * out of memory */
+static tst known = NULL;
+
+/** The terms of the statuses fetched, NULL if out of memory */
+static trend trends = NULL;
+
+/** The conversations of the statuses fetched, NULL if out of memory */
+static thread threads = NULL;
+
+/** The flags of the keywords of the filter: the statuses with a keyword
+ * of the mute list aren't printed, the keywords of the highlight list are
+ * printed highlighted */
+#define FILTER_MUTE 1
+#define FILTER_HIGHLIGHT 2
+
+/** The keywords of the mute and highlight lists, NULL if there are none */
+static kwset filter = NULL;
+
+/** What a highlighted keyword is put between: bold on a terminal, and
+ * asterisks elsewhere */
+static char *highlight_on = "*";
+static char *highlight_off = "*";
+
+/** The posts not sent yet, NULL if the spool couldn't be opened, then the
+ * posts are sent at once */
+static spool post_spool = NULL;
+
 /** The size of the buffer to read from stdio */
 #define BUFSIZE 512
+
+/** The most names listed when Tab is pressed twice */
+#define COMPLETE_LIST 50
 void init_ui(char *conffile)
 {
+	lineedit le;
 	char buff[BUFSIZE];
+	char *dir = getenv(TW_CACHE_ENV);
+	char *file;
+	long pending;
 	int i;
 
-	if (conffile != NULL && _read_config(conffile) < 0)
+	if (getenv(TW_HOST_ENV) != NULL)
+		tw_host = getenv(TW_HOST_ENV);
+	if (getenv(TW_TRANSPORT_ENV) != NULL
+	    && http_set_transport(getenv(TW_TRANSPORT_ENV)) < 0)
+		printf("No transport %s, using the default\n",
+		       getenv(TW_TRANSPORT_ENV));
+
+	known = tst_create();
+	if (conffile != NULL && _read_config(conffile) < 0) {
+		tst_free(known);
+		known = NULL;
 		return;
+	}
+
+	if (dir == NULL)
+		dir = getenv("HOME");
+	file = dir != NULL ? malloc(strlen(dir) + 32) : NULL;
+	if (file != NULL) {
+		sprintf(file, "%s/.twitterm-spool", dir);
+		post_spool = spool_open(file, tw_host, TW_UPDATE);
+		free(file);
+	}
+	pending = post_spool != NULL ? spool_pending(post_spool) : 0;
+	if (pending > 0)
+		printf("Sending %ld tweet(s) queued earlier\n", pending);
+
+	le = lineedit_create(LINEEDIT_HISTORY);
+	if (le != NULL)
+		lineedit_complete(le, _complete, NULL);
+	trends = trend_create(3600, TREND_HOURS);
+	threads = thread_create();
+	if (lineedit_terminal()) {
+		highlight_on = "\x1b[1m";
+		highlight_off = "\x1b[0m";
+	}
 
 	while (!feof(stdin)) {
-		printf("twitterm> ");	/* print the prompt */
-		if (fgets(buff, BUFSIZE, stdin) == NULL || buff[0] == 'q')
+		if (le == NULL)
+			printf("twitterm> ");	/* print the prompt */
+		if ((le != NULL ? lineedit_read(le, "twitterm> ", buff, BUFSIZE)
+		     : fgets(buff, BUFSIZE, stdin)) == NULL || buff[0] == 'q')
 			break;	/* read; break on EOF, and 'q' command */
 
 		fflush(stdin);	/* just to be on the safe side */
@@ -121,6 +499,64 @@ void init_ui(char *conffile)
 	}
 
 	json_free(config);
+	sched_free(scheduler);
+	spool_close(post_spool);
+	lineedit_free(le);
+	tst_free(known);
+	known = NULL;
+	json_path_free(path_screen_name);
+	json_projection_free(proj_list);
+	path_screen_name = NULL;
+	proj_list = NULL;
+	status_cleanup();
+	http_flush_dns_cache();
+	kwset_free(filter);
+	filter = NULL;
+	trend_free(trends);
+	trends = NULL;
+	thread_free(threads);
+	threads = NULL;
+}
+
+int ui_read_config(char *conffile)
+{
+	json_free(config);
+	config = NULL;
+	return _read_config(conffile);
+}
+
+void ui_print_timeline(status_page timeline, char *group, FILE * fp)
+{
+	long i;
+
+	for (i = 0; i < timeline->count; i++)
+		_print_status(timeline, i, NULL, group, fp);
+}
+
+void ui_print_view(status_view view, char **tags, char *group, FILE * fp)
+{
+	long i;
+
+	for (i = 0; i < view->count; i++)
+		_print_status(view->pages[view->page[i]], view->row[i],
+			      tags[view->page[i]], group, fp);
+}
+
+void ui_print_list(json_element list, char *group, FILE * fp)
+{
+	json_element current;
+	char *sname;
+
+	_compile_paths();
+
+	for (current = list->data; current != NULL; current = current->next) {
+		sname = json_path_string(current, path_screen_name);
+		if (sname == NULL)
+			continue;
+
+		if (_screen_name_filter(group, sname))
+			fprintf(fp, "%s\n", sname);
+	}
 }
 
 void _com_inval(char *full)
@@ -132,44 +568,137 @@ void _com_inval(char *full)
 void _com_fetch(char *full)
 {
 	json_element user,
-	 pwd,
-	 timeline,
-	 current,
-	 tmp;
+	 pwd;
+	status_page timeline = NULL;
+	shmcache share;
 	char *resp;
 	int errcode;
+	long errpos;
+	double timer;
 
 	if (_check_auth(&user, &pwd) < 0) {
 		_OOPS_AUTH;
 	}
 
-	errcode =
-	    http_get_auth(TW_HOST, TW_TIMELINE, &resp, user->data, pwd->data);
-	if (errcode != 200) {
-		_OOPS_RESP(errcode);
+	/* a timeline another twitterm of the account has just fetched is
+	 * shown from the cache, and one being fetched is waited for */
+	share = _timeline_share(user->data);
+	if (share != NULL) {
+		timeline = _timeline_shared(share);
+		if (timeline == NULL && shmcache_lock(share) == 0)
+			timeline = _timeline_shared(share);
 	}
 
-	timeline = json_parse(resp);
-	free(resp);
+	if (timeline == NULL) {
+		if (_limit_take(user->data, TW_TIMELINE, SCHED_UI) < 0) {
+			shmcache_close(share);
+			return;
+		}
+		errcode = http_get_auth(tw_host, TW_TIMELINE, &resp,
+					user->data, pwd->data);
+		_limit_done(user->data, TW_TIMELINE, errcode, NULL);
+		if (errcode != 200) {
+			shmcache_close(share);
+			_OOPS_RESP(errcode);
+		}
 
-	/* no error handling since twitter always sends these correctly
-	 * if it didn't, the HTTP layer has already thrown up */
-	for (current = timeline->data; current != NULL; current = current->next) {
-		tmp = json_get_element_by_name(current, "user");
-		tmp = json_get_element_by_name(tmp, "screen_name");
-
-		if (_screen_name_filter
-		    (_get_param_list(full), (char *) tmp->data)) {
-			printf("-- %s: ", (char *) tmp->data);
-			_print_json_string(current, "text", "");
-			_print_json_string(current, "created_at", " -at: ");
-			_print_json_string(current, "in_reply_to_screen_name",
-					   " -in reply to: ");
-			putchar('\n');
+		/* decoded straight into a page, without a parse tree */
+		timeline = status_decode(resp, strlen(resp), &errcode, &errpos);
+		free(resp);
+		if (timeline == NULL) {
+			shmcache_close(share);
+			_OOPS_JSON(errcode, errpos);
 		}
+		if (share != NULL)
+			shmcache_publish(share, timeline);
 	}
+	shmcache_close(share);
+	_page_fetched(timeline);
 
-	json_free(timeline);
+	timer = STATS_BEGIN();
+	ui_print_timeline(timeline, _get_param_list(full), stdout);
+	STATS_END(STATS_RENDER, timer, 0);
+
+	status_free(timeline);
+}
+
+void _com_multi(char *full)
+{
+	http_request reqs;
+	status_page *pages;
+	status_view view;
+	char **tags;
+	int count;
+	int sent = 0;
+	int used = 0;
+	int errcode;
+	long errpos;
+	double timer;
+	int i;
+
+	count = _list_accounts(NULL);
+	if (count == 0) {
+		_OOPS_AUTH;
+	}
+
+	reqs = calloc(count, sizeof(*reqs));
+	pages = calloc(count, sizeof(*pages));
+	tags = calloc(count, sizeof(*tags));
+	if (reqs == NULL || pages == NULL || tags == NULL) {
+		free(reqs);
+		free(pages);
+		free(tags);
+		_OOPS("out of memory\n");
+	}
+	_list_accounts(reqs);
+
+	/* the accounts out of requests are left out, the rest is sent at once,
+	 * so that it takes about as long as f does */
+	for (i = 0; i < count; i++)
+		if (_limit_take(reqs[i].user, TW_TIMELINE, SCHED_BULK) == 0)
+			reqs[sent++] = reqs[i];
+	http_get_many(reqs, sent);
+
+	/* an account that fails is left out of the stream */
+	for (i = 0; i < sent; i++) {
+		_limit_done(reqs[i].user, TW_TIMELINE, reqs[i].status,
+			    &reqs[i].limit);
+		if (reqs[i].status != 200) {
+			printf("ERROR: account %s: HTTP error code: %d (%s)\n",
+			       reqs[i].user, reqs[i].status,
+			       http_strerror(reqs[i].status));
+			continue;
+		}
+
+		pages[used] = status_decode(reqs[i].output,
+					    strlen(reqs[i].output), &errcode,
+					    &errpos);
+		free(reqs[i].output);
+		if (pages[used] == NULL) {
+			printf("ERROR: account %s: JSON error: %s at byte %ld\n",
+			       reqs[i].user, json_strerror(errcode), errpos);
+			continue;
+		}
+		_page_fetched(pages[used]);
+		tags[used++] = reqs[i].user;
+	}
+
+	view = status_merge(pages, used);
+	if (view != NULL) {
+		timer = STATS_BEGIN();
+		ui_print_view(view, tags, _get_param_list(full), stdout);
+		STATS_END(STATS_RENDER, timer, 0);
+	}
+	else {
+		printf("ERROR: out of memory\n");
+	}
+
+	status_view_free(view);
+	for (i = 0; i < used; i++)
+		status_free(pages[i]);
+	free(pages);
+	free(tags);
+	free(reqs);
 }
 
 void _com_post(char *full)
@@ -178,22 +707,36 @@ void _com_post(char *full)
 	 pwd;
 	int resp;
 	char *param,
+	*status,
 	*data;
 
 	param = _get_param_list(full);
 	if (param == NULL) {
 		_OOPS("usage: p message\n");
 	}
-	data = calloc(8 + strlen(param), sizeof(*data));	/* status= + data + 1 */
-	sprintf(data, "%s%s", "status=", param);	/* constructing the message */
 
 	if (_check_auth(&user, &pwd) < 0) {
-		free(data);
 		_OOPS_AUTH;
 	}
 
+	/* the prompt comes back at once, the flusher sends it */
+	if (post_spool != NULL
+	    && spool_post(post_spool, user->data, pwd->data, param) == 0) {
+		printf("Your tweet is queued, it's sent in the background.\n");
+		return;
+	}
+
+	status = http_urlencode(param);
+	data = status != NULL ? malloc(8 + strlen(status)) : NULL;
+	if (data == NULL) {
+		free(status);
+		_OOPS("out of memory\n");
+	}
+	sprintf(data, "%s%s", "status=", status);	/* constructing the message */
+	free(status);
+
 	resp =
-	    http_post_auth(TW_HOST, TW_UPDATE, NULL, data, user->data,
+	    http_post_auth(tw_host, TW_UPDATE, NULL, data, user->data,
 			   pwd->data);
 	if (resp != 200) {
 		free(data);
@@ -204,50 +747,159 @@ void _com_post(char *full)
 	free(data);
 }
 
-void _com_list(char *full)
+void _com_image(char *full)
 {
+	struct _http_part part;
 	json_element user,
-	 pwd,
-	 list,
-	 current,
-	 tmp;
-	char *resp,
-	*page,
-	*params = _get_param_list(full);
-	int errcode;
+	 pwd;
+	char *param = full + 1 + strspn(full + 1, PARAM_SEPARATOR);
+	char *type;
+	int resp;
 
-	if (params != NULL && params[0] == 'o')
-		page = TW_FOLLOWERS;
-	else
-		page = TW_FRIENDS;
+	/* not _get_param_list(), a path may start with a slash or a dot */
+	param[strcspn(param, "\n")] = 0;
+	if (*param == 0) {
+		_OOPS("usage: i imagefile\n");
+	}
+	type = _image_type(param);
+	if (type == NULL) {
+		_OOPS("the image has to be a GIF, JPEG or PNG file\n");
+	}
 
 	if (_check_auth(&user, &pwd) < 0) {
 		_OOPS_AUTH;
 	}
 
-	errcode = http_get_auth(TW_HOST, page, &resp, user->data, pwd->data);
-	if (errcode != 200) {
-		_OOPS_RESP(errcode);
+	/* sent from the file as it's read, however large */
+	if (http_part_file(&part, "image", param, type) < 0) {
+		_OOPS("cannot open the image\n");
+	}
+	resp = http_post_parts(tw_host, TW_IMAGE, NULL, &part, 1, user->data,
+			       pwd->data);
+	http_part_close(&part);
+	if (resp != 200) {
+		_OOPS_RESP(resp);
 	}
 
-	list = json_parse(resp);	/* create the parse tree from the HTTP response */
-	free(resp);
+	printf("Your profile image is changed.\n");
+}
 
-	for (current = list->data; current != NULL; current = current->next) {
-		tmp = json_get_element_by_name(current, "screen_name");
+void _com_list(char *full)
+{
+	struct _list_names list;
+	json_element user,
+	 pwd;
+	namelist saved;
+	char *cache,
+	*group,
+	*params = _get_param_list(full);
+	int followers = params != NULL && params[0] == 'o';
 
-		if (params != NULL && params[0] == 'f') {
-			if (_screen_name_filter
-			    (_get_param_list(params), (char *) tmp->data)) {
-				printf("%s\n", (char *) tmp->data);
-			}
+	group = params != NULL && params[0] == 'f' ?
+	    _get_param_list(params) : NULL;
+
+	if (_check_auth(&user, &pwd) < 0) {
+		_OOPS_AUTH;
+	}
+
+	if (_list_fetch(user, pwd, followers, group, 1, &list)) {
+		_list_save(user->data, followers, &list, NULL);
+	}
+	else if (list.status != 200 && list.count == 0) {
+		cache = _list_cache(user->data, followers, "");
+		saved = cache != NULL ? namelist_read(cache) : NULL;
+		if (saved != NULL) {
+			printf("The list saved at %s:\n", cache);
+			namelist_each(saved, _list_print, group);
 		}
 		else {
-			printf("%s\n", (char *) tmp->data);
+			printf("ERROR: could not download server response!\n");
 		}
+		namelist_free(saved);
+		free(cache);
 	}
 
-	json_free(list);
+	_list_free(&list);
+}
+
+void _com_diff(char *full)
+{
+	struct _list_names list;
+	struct _list_index index;
+	json_element user,
+	 pwd;
+	idset now,
+	 then,
+	 gained = NULL,
+	 lost = NULL;
+	char *cache,
+	*params = _get_param_list(full);
+	int followers = params != NULL && params[0] == 'o';
+	long i;
+	double timer;
+
+	if (_check_auth(&user, &pwd) < 0) {
+		_OOPS_AUTH;
+	}
+
+	if (!_list_fetch(user, pwd, followers, NULL, 0, &list)) {
+		if (list.status != 200 && list.count == 0)
+			printf("ERROR: could not download server response!\n");
+		_list_free(&list);
+		return;
+	}
+	if (list.noids > 0) {
+		_list_free(&list);
+		_OOPS("the server sent users without IDs\n");
+	}
+
+	cache = _list_cache(user->data, followers, ".ids");
+	then = cache != NULL ? idset_read(cache) : NULL;
+	now = idset_build(list.ids, list.count);
+	if (then != NULL && now != NULL) {
+		gained = idset_difference(now, then);
+		lost = idset_difference(then, now);
+	}
+
+	timer = STATS_BEGIN();
+	if (now == NULL || (then != NULL && (gained == NULL || lost == NULL))) {
+		printf("ERROR: out of memory\n");
+	}
+	else if (then == NULL) {
+		printf("No earlier list of %s to compare with, %ld %s saved\n",
+		       followers ? "followers" : "friends", idset_count(now),
+		       followers ? "followers" : "friends");
+	}
+	else {
+		/* the names of the gained ones are looked up by ID */
+		index.list = &list;
+		index.entries = malloc((list.count > 0 ? list.count : 1) *
+				       sizeof(*index.entries));
+		for (i = 0; index.entries != NULL && i < list.count; i++) {
+			index.entries[i].id = list.ids[i];
+			index.entries[i].index = i;
+		}
+		if (index.entries != NULL)
+			qsort(index.entries, list.count, sizeof(*index.entries),
+			      _list_entry_cmp);
+
+		idset_each(gained, _list_gained, &index);
+		idset_each(lost, _list_lost, NULL);
+		printf("%ld gained, %ld lost since the list was saved\n",
+		       idset_count(gained), idset_count(lost));
+		free(index.entries);
+	}
+	STATS_END(STATS_RENDER, timer, 0);
+
+	if (now != NULL)
+		_list_save(user->data, followers, &list, now);
+
+	idset_free(now);
+	idset_free(then);
+	idset_free(gained);
+	idset_free(lost);
+	free(cache);
+	_list_free(&list);
 }
 
 void _com_auth(char *full)
@@ -266,20 +918,26 @@ void _com_auth(char *full)
 		_OOPS_AUTH_USAGE;
 	}
 
-	if (!_check_auth(&user, &pwd)) {
-		free(user->data);
+	/* the account given becomes the first, the one the commands use, but
+	 * the others are kept for m */
+	tmp = _find_account(userstr);
+	if (tmp != NULL) {
+		pwd = json_get_element_by_name(tmp, "pwd");
 		free(pwd->data);
-
-		user->data = mystrdup(userstr);
 		pwd->data = mystrdup(pwdstr);
+		user = json_get_element_by_name(tmp, "user");
+		_config_prepend(tmp);
 	}
 	else {
-		tmp = _config_append(json_create_element(JSON_OBJECT));
+		tmp = _config_prepend(json_create_element(JSON_OBJECT));
 		user = tmp->data = json_create_string("user", userstr);
 		pwd = json_append(tmp->data, json_create_string("pwd", pwdstr));
 	}
 
-	errcode = http_get_auth(TW_HOST, TW_AUTH, NULL, user->data, pwd->data);
+	if (_limit_take(user->data, TW_AUTH, SCHED_UI) < 0)
+		return;
+	errcode = http_get_auth(tw_host, TW_AUTH, NULL, user->data, pwd->data);
+	_limit_done(user->data, TW_AUTH, errcode, NULL);
 	if (errcode == 403) {
 		_OOPS("Authentication failure: no such user-password pair\n");
 	}
@@ -351,10 +1009,721 @@ void _com_creat(char *full)
 
 	current = json_create_string(name, data);
 	json_append(root->data, current);
+	_known_add(name);
+	_known_add_list(data);
 	printf("List \"%s\" successfully created with members:\n\t%s\n", name,
 	       data);
 }
 
+void _com_stats(char *full)
+{
+	char *param = _get_param_list(full);
+
+	if (param == NULL) {
+		if (!stats_enabled)
+			printf("Measurements are off, turn them on with: s on\n");
+		stats_dump(stdout);
+	}
+	else if (!strcmp(param, "on")) {
+		stats_enabled = 1;
+	}
+	else if (!strcmp(param, "off")) {
+		stats_enabled = 0;
+	}
+	else if (!strcmp(param, "reset")) {
+		stats_reset();
+	}
+	else {
+		_OOPS("usage: s (on/off/reset)\n");
+	}
+}
+
+void _com_mem(char *full)
+{
+	char *param = _get_param_list(full);
+
+	if (param == NULL) {
+		mem_dump(stdout);
+	}
+	else if (!strcmp(param, "leaks")) {
+		if (mem_leaks(stdout) == 0)
+			printf("The blocks are recorded if TWITTERM_MEMDEBUG "
+			       "is set\n");
+	}
+	else {
+		_OOPS("usage: u (leaks)\n");
+	}
+}
+
+void _com_trend(char *full)
+{
+	static char *kinds[] = { "hashtags", "mentions", "links" };
+	struct trend_item items[TREND_SHOW];
+	char *param = _get_param_list(full);
+	long hours = TREND_HOURS;
+	long now = time(NULL);
+	int kind;
+	int n;
+	int i;
+
+	if (param != NULL) {
+		hours = atol(param);
+		if (hours < 1 || hours > TREND_HOURS) {
+			printf("ERROR: usage: t (hours, 1 to %d)\n", TREND_HOURS);
+			return;
+		}
+	}
+	if (trends == NULL) {
+		_OOPS("out of memory\n");
+	}
+
+	printf("Trending in the last %ld hour(s), of %ld terms seen:\n", hours,
+	       trend_total(trends, now, hours * 3600));
+	for (kind = 0; kind < TREND_KINDS; kind++) {
+		n = trend_top(trends, kind, now, hours * 3600, items,
+			      TREND_SHOW);
+		if (n == 0)
+			continue;
+
+		/* the counts are upper bounds, exact unless an error is given */
+		printf("%s:\n", kinds[kind]);
+		for (i = 0; i < n; i++) {
+			printf("%8ld  %s", items[i].count, items[i].term);
+			if (items[i].error > 0)
+				printf(" (%ld at least)",
+				       items[i].count - items[i].error);
+			printf("\n");
+		}
+	}
+}
+
+void _com_thread(char *full)
+{
+	json_element user,
+	 pwd;
+	unsigned long ids[THREAD_LOOKUP_MAX];
+	char *param = _get_param_list(full);
+	unsigned long id = 0;
+	int count = 0;
+	int rounds;
+	int n;
+
+	if (param != NULL) {
+		id = status_parse_id(param, strcspn(param, " \t\r\n"));
+		if (id == 0) {
+			_OOPS("usage: r (status ID)\n");
+		}
+	}
+	if (threads == NULL) {
+		_OOPS("out of memory\n");
+	}
+	if (_check_auth(&user, &pwd) < 0) {
+		_OOPS_AUTH;
+	}
+
+	/* the statuses replied to are fetched only now, those of all the
+	 * conversations in one request a level of replies */
+	for (rounds = 0; rounds < THREAD_ROUNDS; rounds++) {
+		n = thread_missing(threads, id, ids, THREAD_LOOKUP_MAX);
+		if (n == 0 || _thread_lookup(user->data, pwd->data, ids, n) < 0)
+			break;
+	}
+
+	thread_each(threads, id, _thread_print, &count);
+	if (count == 0)
+		printf("No conversations in the statuses fetched\n");
+}
+
+int _thread_lookup(char *user, char *pwd, unsigned long *ids, int count)
+{
+	status_page page;
+	char *path;
+	char *resp;
+	char *ptr;
+	int errcode;
+	long errpos;
+	int i;
+
+	/* an ID is 20 digits at most, and a comma */
+	path = malloc(strlen(TW_LOOKUP) + 8 + count * 21);
+	if (path == NULL) {
+		printf("ERROR: out of memory\n");
+		return -1;
+	}
+	ptr = path + sprintf(path, "%s?id=", TW_LOOKUP);
+	for (i = 0; i < count; i++)
+		ptr += sprintf(ptr, i > 0 ? ",%lu" : "%lu", ids[i]);
+
+	if (_limit_take(user, TW_LOOKUP, SCHED_UI) < 0) {
+		free(path);
+		return -1;
+	}
+	errcode = http_get_auth(tw_host, path, &resp, user, pwd);
+	_limit_done(user, TW_LOOKUP, errcode, NULL);
+	free(path);
+	if (errcode != 200) {
+		printf("ERROR: lookup: HTTP error code: %d (%s)\n", errcode,
+		       http_strerror(errcode));
+		return -1;
+	}
+
+	page = status_decode(resp, strlen(resp), &errcode, &errpos);
+	free(resp);
+	if (page == NULL) {
+		printf("ERROR: lookup: JSON error: %s at byte %ld\n",
+		       json_strerror(errcode), errpos);
+		return -1;
+	}
+	_page_fetched(page);
+	status_free(page);
+
+	/* deleted or protected, they aren't asked for again */
+	for (i = 0; i < count && threads != NULL; i++)
+		if (thread_gone(threads, ids[i]) < 0)
+			break;
+	return threads != NULL ? 0 : -1;
+}
+
+int _thread_print(struct thread_status *status, void *arg)
+{
+	char buf[32];
+	int *count = arg;
+	int depth = status->depth < THREAD_INDENT_MAX ? status->depth :
+	    THREAD_INDENT_MAX;
+	int found = 0;
+
+	if (status->depth == 0 && *count > 0)
+		putchar('\n');
+	(*count)++;
+
+	printf("%*s-- ", 2 * depth, "");
+	if (filter != NULL && status->text != NULL)
+		found = kwset_scan(filter, status->text,
+				   strlen(status->text), FILTER_MUTE);
+	if (status->text == NULL)
+		printf("[not available]\n");
+	else if (found & FILTER_MUTE)
+		printf("%s: [muted]\n", status->screen_name);
+	else if (found & FILTER_HIGHLIGHT) {
+		printf("%s: ", status->screen_name);
+		_print_highlighted(status->text, stdout);
+	}
+	else
+		printf("%s: %s\n", status->screen_name, status->text);
+
+	if (status->created_at != STATUS_NONE)
+		printf("%*s -at: %s\n", 2 * depth, "",
+		       status_format_time(status->created_at, buf,
+					  sizeof(buf)));
+	printf("%*s -id: %lu\n", 2 * depth, "", status->id);
+	return 0;
+}
+
+int _limit_take(char *user, char *file, int priority)
+{
+	char *key = malloc(strlen(user) + strlen(file) + 2);
+	double wait = 0;
+
+	if (scheduler == NULL)
+		scheduler = sched_create(_wall_clock, NULL);
+
+	/* without memory to keep account, the server is the judge */
+	if (key != NULL && scheduler != NULL) {
+		sprintf(key, "%s %s", user, file);
+		wait = sched_take(scheduler, key, priority);
+	}
+	free(key);
+
+	if (wait > 0) {
+		printf("ERROR: %s: the rate limit of %s is reached, "
+		       "try again in %ld seconds\n", user, file,
+		       (long) wait + 1);
+		return -1;
+	}
+	return 0;
+}
+
+void _limit_done(char *user, char *file, int status,
+		 struct _http_limit *limit)
+{
+	struct _http_limit last;
+	char *key;
+
+	if (scheduler == NULL)
+		return;
+	if (limit == NULL) {
+		http_last_limit(&last);
+		limit = &last;
+	}
+
+	key = malloc(strlen(user) + strlen(file) + 2);
+	if (key == NULL)
+		return;
+	sprintf(key, "%s %s", user, file);
+	sched_done(scheduler, key, limit->limit, limit->remaining,
+		   limit->reset, status == 429);
+	free(key);
+}
+
+double _wall_clock(void *arg)
+{
+	return (double) time(NULL);
+}
+
+int _list_fetch(json_element user, json_element pwd, int followers,
+		char *group, int print, struct _list_names *list)
+{
+	struct _http_request req;
+	http_pending pending;
+	char file[BUFSIZE];
+	char *page = followers ? TW_FOLLOWERS : TW_FRIENDS;
+	int jsonerr = JSON_OK;
+	int complete = 0;
+	int more = 1;
+	long errpos = -1;
+	long first;
+	double timer;
+
+	memset(list, 0, sizeof(*list));
+	list->status = 200;
+	_compile_paths();
+	if (_limit_take(user->data, page, SCHED_UI) < 0)
+		return 0;
+
+	memset(&req, 0, sizeof(req));
+	req.domain = tw_host;
+	req.file = file;
+	req.user = user->data;
+	req.pwd = pwd->data;
+	sprintf(file, "%s?cursor=-1", page);
+	pending = http_get_start(&req);
+
+	/* a page is parsed, the next one is asked for, and only then is the
+	 * page printed, so that the next one arrives meanwhile */
+	while (more) {
+		list->status = http_get_finish(pending);
+		_limit_done(user->data, page, list->status, &req.limit);
+		if (list->status != 200)
+			break;
+
+		first = list->count;
+		list->record = -1;
+		strcpy(list->cursor, "0");
+		jsonerr = json_parse_fields(req.output, strlen(req.output),
+					    proj_list, _list_field, list,
+					    &errpos);
+		free(req.output);
+		_list_page(list, first);
+		if (jsonerr != JSON_OK || list->nomem)
+			break;
+
+		/* the cursor of the page just got is still in the URL */
+		complete = !strcmp(list->cursor, "0")
+		    || !strcmp(list->cursor, strchr(file, '=') + 1);
+		more = !complete
+		    && _limit_take(user->data, page, SCHED_UI) == 0;
+		if (more) {
+			sprintf(file, "%s?cursor=%s", page, list->cursor);
+			pending = http_get_start(&req);
+		}
+
+		timer = STATS_BEGIN();
+		for (; print && first < list->count; first++)
+			if (_screen_name_filter(group, list->names[first]))
+				printf("%s\n", list->names[first]);
+		STATS_END(STATS_RENDER, timer, 0);
+	}
+
+	if (complete)
+		return 1;
+
+	if (list->status != 200 && list->count == 0)
+		printf("HTTP error code: %d (%s)\n", list->status,
+		       http_strerror(list->status));
+	else if (list->status != 200)
+		printf("ERROR: HTTP error code: %d (%s), the list is "
+		       "incomplete\n", list->status,
+		       http_strerror(list->status));
+	else if (jsonerr != JSON_OK)
+		printf("ERROR: JSON error: %s at byte %ld, the list is "
+		       "incomplete\n", json_strerror(jsonerr), errpos);
+	else if (list->nomem)
+		printf("ERROR: out of memory, the list is incomplete\n");
+	return 0;
+}
+
+void _list_save(char *user, int followers, struct _list_names *list,
+		idset ids)
+{
+	namelist names = namelist_build(list->names, list->count);
+	char *cache = _list_cache(user, followers, "");
+	idset built = NULL;
+
+	/* only a whole list replaces the saved one */
+	if (names != NULL && cache != NULL)
+		namelist_write(names, cache);
+	namelist_free(names);
+	free(cache);
+
+	if (list->noids > 0)
+		return;
+	if (ids == NULL)
+		ids = built = idset_build(list->ids, list->count);
+	cache = _list_cache(user, followers, ".ids");
+	if (ids != NULL && cache != NULL)
+		idset_write(ids, cache);
+	idset_free(built);
+	free(cache);
+}
+
+void _list_free(struct _list_names *list)
+{
+	long i;
+
+	for (i = 0; i < list->count; i++)
+		free(list->names[i]);
+	free(list->names);
+	free(list->ids);
+}
+
+int _list_field(json_field field, void *arg)
+{
+	struct _list_names *list = arg;
+	char **names;
+	unsigned long *ids;
+	char *name;
+	long size;
+
+	if (field->path == 1) {
+		if (field->type == JSON_NUM
+		    && field->len < (long) sizeof(list->cursor)) {
+			memcpy(list->cursor, field->str, field->len);
+			list->cursor[field->len] = 0;
+		}
+		return 0;
+	}
+	if (field->type != (field->path > 2 ? JSON_NUM : JSON_STRING))
+		return 0;
+
+	/* the name and the ID of a user come from the same object */
+	if (field->record != list->record) {
+		if (list->count == list->size) {
+			size = list->size > 0 ? list->size * 2 : 128;
+			names = realloc(list->names, size * sizeof(*names));
+			if (names != NULL)
+				list->names = names;
+			ids = names == NULL ? NULL :
+			    realloc(list->ids, size * sizeof(*ids));
+			if (ids == NULL) {
+				list->nomem = 1;
+				return -1;
+			}
+			list->ids = ids;
+			list->size = size;
+		}
+		list->names[list->count] = NULL;
+		list->ids[list->count++] = 0;
+		list->record = field->record;
+	}
+
+	if (field->path > 2) {
+		list->ids[list->count - 1] =
+		    status_parse_id(field->str, field->len);
+		return 0;
+	}
+
+	name = malloc(field->len + 1);
+	if (name == NULL) {
+		list->nomem = 1;
+		return -1;
+	}
+	memcpy(name, field->str, field->len);
+	name[field->len] = 0;
+	free(list->names[list->count - 1]);
+	list->names[list->count - 1] = name;
+	return 0;
+}
+
+void _list_page(struct _list_names *list, long first)
+{
+	long i;
+
+	for (i = first; i < list->count; i++) {
+		if (list->names[i] == NULL)
+			continue;
+		if (list->ids[i] == 0)
+			list->noids++;
+		_known_add(list->names[i]);
+		list->names[first] = list->names[i];
+		list->ids[first++] = list->ids[i];
+	}
+	list->count = first;
+}
+
+char *_list_cache(char *user, int followers, char *ext)
+{
+	char *dir = getenv(TW_CACHE_ENV);
+	char *ret;
+
+	if (dir == NULL)
+		dir = getenv("HOME");
+	if (dir == NULL || strchr(user, '/') != NULL)
+		return NULL;
+
+	ret = malloc(strlen(dir) + strlen(user) + strlen(ext) + 32);
+	if (ret != NULL)
+		sprintf(ret, "%s/.twitterm-%s-%s%s", dir, user,
+			followers ? "followers" : "friends", ext);
+	return ret;
+}
+
+int _list_entry_cmp(const void *a, const void *b)
+{
+	unsigned long x = ((struct _list_entry *) a)->id;
+	unsigned long y = ((struct _list_entry *) b)->id;
+
+	return x < y ? -1 : x > y;
+}
+
+int _list_gained(unsigned long id, void *arg)
+{
+	struct _list_index *index = arg;
+	struct _list_entry key;
+	struct _list_entry *found = NULL;
+
+	key.id = id;
+	if (index->entries != NULL)
+		found = bsearch(&key, index->entries, index->list->count,
+				sizeof(key), _list_entry_cmp);
+
+	if (found != NULL)
+		printf("+ %s (%lu)\n", index->list->names[found->index], id);
+	else
+		printf("+ %lu\n", id);
+	return 0;
+}
+
+int _list_lost(unsigned long id, void *arg)
+{
+	printf("- %lu\n", id);
+	return 0;
+}
+
+int _list_print(char *name, void *arg)
+{
+	_known_add(name);
+	if (_screen_name_filter(arg, name))
+		printf("%s\n", name);
+	return 0;
+}
+
+char *_image_type(char *file)
+{
+	char ext[6];
+	char *dot = strrchr(file, '.');
+	int i;
+
+	if (dot == NULL || strlen(dot + 1) >= sizeof(ext))
+		return NULL;
+	for (i = 0; dot[i + 1] != 0; i++)
+		ext[i] = tolower((unsigned char) dot[i + 1]);
+	ext[i] = 0;
+
+	if (!strcmp(ext, "gif"))
+		return "image/gif";
+	if (!strcmp(ext, "jpg") || !strcmp(ext, "jpeg"))
+		return "image/jpeg";
+	if (!strcmp(ext, "png"))
+		return "image/png";
+	return NULL;
+}
+
+void _known_add(char *name)
+{
+	if (known != NULL && name != NULL && tst_insert(known, name) < 0) {
+		tst_free(known);	/* out of memory, nothing is completed */
+		known = NULL;
+	}
+}
+
+void _known_add_list(char *names)
+{
+	char name[TST_WORD_MAX];
+	long len;
+
+	while (*names != 0) {
+		len = strcspn(names, ",");
+		if (len < (long) sizeof(name)) {
+			memcpy(name, names, len);
+			name[len] = 0;
+			_known_add(name);
+		}
+		names += len;
+		if (*names == ',')
+			names++;
+	}
+}
+
+void _known_config(void)
+{
+	json_element current,
+	 tmp;
+
+	if (config == NULL)
+		return;
+
+	for (current = config->data; current != NULL; current = current->next) {
+		tmp = json_get_element_by_name(current, "user");
+		if (tmp != NULL && tmp->type == JSON_STRING)
+			_known_add(tmp->data);
+
+		/* the groups, as in _screen_name_filter() */
+		tmp = json_get_element_by_name(current, "groups");
+		if (tmp == NULL || tmp->type != JSON_TRUE)
+			continue;
+		for (tmp = current->data; tmp != NULL; tmp = tmp->next) {
+			if (tmp->type != JSON_STRING)
+				continue;
+			_known_add(tmp->name);
+			_known_add_list(tmp->data);
+		}
+	}
+}
+
+void _filter_config(void)
+{
+	static char *lists[] = { "mute", "highlight" };
+	static int flags[] = { FILTER_MUTE, FILTER_HIGHLIGHT };
+	json_element lists_found[2] = { NULL, NULL };
+	json_element current,
+	 tmp;
+	int i;
+
+	kwset_free(filter);
+	filter = NULL;
+	if (config == NULL)
+		return;
+
+	/* like the other definitions, only the first of each list counts */
+	for (current = config->data; current != NULL; current = current->next) {
+		for (i = 0; i < 2; i++) {
+			tmp = json_get_element_by_name(current, lists[i]);
+			if (lists_found[i] == NULL && tmp != NULL
+			    && tmp->type == JSON_ARRAY)
+				lists_found[i] = tmp;
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (lists_found[i] == NULL)
+			continue;
+		for (tmp = lists_found[i]->data; tmp != NULL; tmp = tmp->next) {
+			if (tmp->type != JSON_STRING)
+				continue;
+			if (filter == NULL && (filter = kwset_create()) == NULL)
+				return;
+			kwset_add(filter, tmp->data, flags[i]);
+		}
+	}
+
+	if (filter != NULL && kwset_compile(filter) < 0) {
+		kwset_free(filter);
+		filter = NULL;
+		printf("ERROR: out of memory, the mute and highlight lists "
+		       "aren't used\n");
+	}
+}
+
+void _page_fetched(status_page page)
+{
+	long now = time(NULL);
+	long i;
+
+	/* without memory for the index, the conversations are left out */
+	if (threads != NULL && thread_add_page(threads, page) < 0) {
+		thread_free(threads);
+		threads = NULL;
+	}
+	if (trends == NULL)
+		return;
+
+	for (i = 0; i < page->count; i++)
+		if (page->text[i] != STATUS_NONE)
+			trend_add_status(trends, page->id[i],
+					 page->created_at[i],
+					 STATUS_STR(page, page->text[i]), now);
+}
+
+shmcache _timeline_share(char *user)
+{
+	char *dir = getenv(TW_CACHE_ENV);
+	char *file;
+	shmcache ret;
+
+	if (dir == NULL)
+		dir = getenv("HOME");
+	if (dir == NULL || strchr(user, '/') != NULL)
+		return NULL;
+
+	file = malloc(strlen(dir) + strlen(user) + 32);
+	if (file == NULL)
+		return NULL;
+	sprintf(file, "%s/.twitterm-%s-timeline", dir, user);
+	ret = shmcache_open(file);
+	free(file);
+	return ret;
+}
+
+status_page _timeline_shared(shmcache share)
+{
+	struct shmcache_meta meta;
+	status_page page = shmcache_read(share, &meta);
+	long age = (long) time(NULL) - meta.fetched_at;
+
+	if (page != NULL && age >= 0 && age < TIMELINE_FRESH) {
+		printf("Fetched %ld second(s) ago by process %ld\n", age,
+		       meta.pid);
+		return page;
+	}
+	status_free(page);
+	return NULL;
+}
+
+long _complete(char *word, char *buf, long size, int list, void *arg)
+{
+	int count = 0;
+	int unique;
+	long ret;
+
+	if (known == NULL)
+		return -1;
+
+	if (list) {
+		tst_each_prefix(known, word, _complete_print, &count);
+		return 0;
+	}
+
+	/* room for the space after a complete name */
+	ret = tst_extend(known, word, buf, size - 1, &unique);
+	if (ret >= 0 && unique) {
+		buf[ret++] = ' ';
+		buf[ret] = 0;
+	}
+	return ret;
+}
+
+int _complete_print(char *word, void *arg)
+{
+	int *count = arg;
+
+	if (++*count > COMPLETE_LIST) {
+		printf("...\n");
+		return 1;
+	}
+	printf("%s\n", word);
+	return 0;
+}
+
 char *_get_param_list(char *full)
 {
 	char *ret;
@@ -388,6 +1757,26 @@ json_element _config_append(json_element elem)
 	return elem;
 }
 
+json_element _config_prepend(json_element elem)
+{
+	json_element *link;
+
+	if (config == NULL)
+		config = json_create_element(JSON_ARRAY);
+
+	for (link = (json_element *) & config->data; *link != NULL;
+	     link = &(*link)->next) {
+		if (*link == elem) {
+			*link = elem->next;
+			break;
+		}
+	}
+
+	elem->next = config->data;
+	config->data = elem;
+	return elem;
+}
+
 int _read_config(char *conffile)
 {
 	FILE *fp = fopen(conffile, "r");
@@ -407,12 +1796,15 @@ int _read_config(char *conffile)
 
 	if (fread(conf, sizeof(char), fsize, fp) != fsize / sizeof(char)) {
 		printf("ERROR: error while reading file: %s\n", conffile);
+		free(conf);
 		fclose(fp);
 		return -2;
 	}
 	fclose(fp);
 	config = json_parse(conf);
 	free(conf);
+	_known_config();
+	_filter_config();
 	return 0;
 }
 
@@ -436,12 +1828,154 @@ json_element current;
 	return -2;
 }
 
-void _print_json_string(json_element elem, char *name, char *prefix)
+int _list_accounts(http_request reqs)
 {
-	elem = json_get_element_by_name(elem, name);
-	if (elem != NULL && elem->type == JSON_STRING) {
-		printf("%s%s\n", prefix, (char *) elem->data);
+	json_element current,
+	 user,
+	 pwd;
+	int count = 0;
+
+	if (config == NULL)
+		return 0;
+
+	/* an object holds an account if it has both, as for _check_auth() */
+	for (current = config->data; current != NULL; current = current->next) {
+		user = json_get_element_by_name(current, "user");
+		pwd = json_get_element_by_name(current, "pwd");
+		if (user == NULL || pwd == NULL)
+			continue;
+
+		if (reqs != NULL) {
+			reqs[count].domain = tw_host;
+			reqs[count].file = TW_TIMELINE;
+			reqs[count].user = user->data;
+			reqs[count].pwd = pwd->data;
+		}
+		count++;
 	}
+
+	return count;
+}
+
+json_element _find_account(char *user)
+{
+	json_element current,
+	 tmp;
+
+	if (config == NULL)
+		return NULL;
+
+	for (current = config->data; current != NULL; current = current->next) {
+		tmp = json_get_element_by_name(current, "user");
+		if (tmp != NULL && tmp->type == JSON_STRING
+		    && json_get_element_by_name(current, "pwd") != NULL
+		    && !strcmp(tmp->data, user))
+			return current;
+	}
+
+	return NULL;
+}
+
+void _print_status(status_page page, long row, char *tag, char *group,
+		   FILE * fp)
+{
+	char buf[32];
+	char *sname;
+	char *text;
+	char *at;
+	int found = 0;
+
+	/* the response is valid JSON, but anything may be missing from it */
+	sname = STATUS_STR(page, page->screen_name[row]);
+	if (sname == NULL || !_screen_name_filter(group, sname))
+		return;
+
+	/* one pass over the text, whatever the length of the lists; it's
+	 * whole unless a muted keyword stops it */
+	text = STATUS_STR(page, page->text[row]);
+	if (filter != NULL && text != NULL)
+		found = kwset_scan(filter, text, strlen(text), FILTER_MUTE);
+	if (found & FILTER_MUTE)
+		return;
+	_known_add(sname);
+	_known_add(STATUS_STR(page, page->in_reply_to[row]));
+
+	if (tag != NULL)
+		fprintf(fp, "[%s] ", tag);
+	fprintf(fp, "-- %s: ", sname);
+	if (found & FILTER_HIGHLIGHT)
+		_print_highlighted(text, fp);
+	else
+		_print_status_string(page, page->text[row], "", fp);
+	if (page->created_at[row] != STATUS_NONE) {
+		at = status_format_time(page->created_at[row], buf,
+					sizeof(buf));
+		fprintf(fp, " -at: %s\n", at);
+	}
+	if (page->id[row] != 0)
+		fprintf(fp, " -id: %lu\n", page->id[row]);
+	_print_status_string(page, page->in_reply_to[row], " -in reply to: ",
+			     fp);
+	putc('\n', fp);
+}
+
+void _print_highlighted(char *text, FILE * fp)
+{
+	long len = strlen(text);
+	char *marks = calloc(len + 1, 1);
+	long i;
+
+	if (marks == NULL) {
+		fprintf(fp, "%s\n", text);
+		return;
+	}
+
+	/* the keywords may overlap, the bytes of any of them are marked */
+	kwset_match(filter, text, len, _highlight_mark, marks);
+	for (i = 0; i < len; i++) {
+		if (marks[i] && (i == 0 || !marks[i - 1]))
+			fputs(highlight_on, fp);
+		putc(text[i], fp);
+		if (marks[i] && !marks[i + 1])
+			fputs(highlight_off, fp);
+	}
+	putc('\n', fp);
+	free(marks);
+}
+
+int _highlight_mark(int keyword, long end, void *arg)
+{
+	char *marks = arg;
+	long len = kwset_length(filter, keyword);
+
+	if (kwset_flags(filter, keyword) & FILTER_HIGHLIGHT)
+		memset(marks + end - len, 1, len);
+	return 0;
+}
+
+void _print_status_string(status_page page, long off, char *prefix,
+			  FILE * fp)
+{
+	char *str = STATUS_STR(page, off);
+
+	if (str != NULL) {
+		fprintf(fp, "%s%s\n", prefix, str);
+	}
+}
+
+void _compile_paths(void)
+{
+	/* the names before a wildcard, so that the users aren't matched by
+	 * it; the cursor is kept as text, since a double would round it */
+	static char *list_fields[] = { "/users/*/screen_name", "/next_cursor",
+		"/*/screen_name", "/users/*/id", "/*/id"
+	};
+
+	if (path_screen_name != NULL)
+		return;
+
+	path_screen_name = json_path_compile("/screen_name");
+	proj_list = json_projection_compile(list_fields, 5);
 }
 
 int _screen_name_filter(char *params, char *sname)
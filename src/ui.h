@@ -1,5 +1,8 @@
 #ifndef __UI_H
 #define __UI_H
+#include "json.h"
+#include "status.h"
+#include <stdio.h>
 
 /** @file */
 
@@ -11,4 +14,30 @@
 	* @param conffile if the parameter isn't NULL, reads the file determined by the parameter and creates the parse tree */
 void init_ui(char *conffile);
 
+/** Replaces the configuration with the one read from the given file
+	* @param conffile the name of the file to read
+	* @retval 0 if succeeded
+	* @retval negative value if failed */
+int ui_read_config(char *conffile);
+
+/** Prints the statuses of a timeline the way the f command does
+	* @param timeline the decoded timeline, see status_decode()
+	* @param group the name of the group whose members' statuses are printed, NULL for everyone
+	* @param fp the stream to print to */
+void ui_print_timeline(status_page timeline, char *group, FILE * fp);
+
+/** Prints the statuses of merged timelines the way the m command does: like
+	* ui_print_timeline(), each tagged with the account whose page it was taken from
+	* @param view the merged timelines, see status_merge()
+	* @param tags the tag of each page of the view, eg. the username
+	* @param group the name of the group whose members' statuses are printed, NULL for everyone
+	* @param fp the stream to print to */
+void ui_print_view(status_view view, char **tags, char *group, FILE * fp);
+
+/** Prints the screen names of a friend or follower list the way the l command does
+	* @param list the parse tree of the list
+	* @param group the name of the group whose members are printed, NULL for everyone
+	* @param fp the stream to print to */
+void ui_print_list(json_element list, char *group, FILE * fp);
+
 #endif
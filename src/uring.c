@@ -0,0 +1,452 @@
+#define MEM_AREA MEM_HTTP
+#include "transport.h"
+#include "http.h"
+#include "stats.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/** @file uring.c
+ * The io_uring transport, talking to the kernel with the raw system calls.
+ * The sends of a request (the header, the authorization, a small body) are
+ * gathered into a buffer, and the first receive submits them along with
+ * itself and its timeout as one linked chain: a request that fits in the
+ * buffer costs one system call to send and to wait for the first byte of
+ * the response, and one per fragment of the response after that. */
+
+/* the header appeared in 5.1, the operations used here by 5.7, checked by
+ * IORING_FEAT_FAST_POLL at run time */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_URING
+#endif
+#endif
+
+#ifdef HAVE_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/** The count of entries of the rings, more than the longest chain */
+#define URING_ENTRIES 8
+
+/** The size of the buffer the sends are gathered in. Sent without a
+ * timeout of its own along with a receive, so it's kept smaller than the
+ * send buffer of a socket. */
+#define URING_QUEUE 16384
+
+/** The ring of the process */
+static struct _ring {
+
+	/** The file descriptor of the ring, -1 if not set up */
+	int fd;
+
+	/** The process that set it up, a forked one sets up its own */
+	pid_t pid;
+
+	/** The submission queue */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	/** The completion queue */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/** The mappings of the rings and of the submission entries */
+	void *rings;
+	size_t rings_len;
+	size_t sqes_len;
+
+	/** The sends gathered, and the socket they are for */
+	char queue[URING_QUEUE];
+	int queued;
+	int sock;
+} ring = { -1 };
+
+/** Unmaps and closes the ring */
+static void _uring_close(void);
+
+/** Fills the next submission entry in, without submitting it
+ * @param n the count of entries filled in before it since the last
+ * submission, also its user_data
+ * @param op the operation
+ * @param sock the socket
+ * @param addr the buffer
+ * @param len the size of the buffer
+ * @return the entry, the flags and the specifics left to the caller */
+static struct io_uring_sqe *_uring_prep(int n, int op, int sock, void *addr,
+					unsigned len);
+
+/** Links a timeout to the deadline after the n-1-th entry, whose flags
+ * get IOSQE_IO_LINK
+ * @param n the index of the timeout
+ * @param ts where the timeout is kept until the completion
+ * @param deadline the monotonic time (usec)
+ * @retval 0 if succeeded
+ * @retval -1 if the deadline has passed */
+static int _uring_timeout(int n, struct __kernel_timespec *ts,
+			  long long deadline);
+
+/** Submits the n entries filled in, and waits for all of them to complete
+ * @param n the count of entries
+ * @param res the results are stored here, by user_data
+ * @retval 0 if succeeded
+ * @retval -1 if the ring failed */
+static int _uring_run(int n, int *res);
+
+/** Waits until the socket is ready
+ * @param sock the socket
+ * @param events POLLIN or POLLOUT
+ * @param deadline the monotonic time (usec) to give up at
+ * @retval 0 if the socket is ready
+ * @retval -1 if the deadline has passed or the ring failed */
+static int _uring_wait(int sock, short events, long long deadline);
+
+/** Sends a buffer whole
+ * @return 0 or a negative enum http_error */
+static int _uring_send_all(int sock, char *buf, int len, long long deadline);
+#endif
+
+static int _uring_open(void);
+static int _uring_send(int sock, char *buf, int len, long long deadline);
+static int _uring_flush(int sock, long long deadline);
+static int _uring_recv(int sock, char *buf, int len, long long deadline,
+		       int timeout_err);
+static void _uring_drop(int sock);
+
+struct _transport transport_uring = {
+	"uring",
+	_uring_open,
+	_uring_send,
+	_uring_flush,
+	_uring_recv,
+	_uring_drop
+};
+
+/* ************************************
+ * static functions
+ */
+#ifdef HAVE_URING
+static int _uring_open(void)
+{
+	struct io_uring_params p;
+	size_t cq_len;
+
+	if (ring.fd >= 0 && ring.pid == getpid())
+		return 0;
+
+	/* the mappings inherited through fork() are shared with the parent */
+	if (ring.fd >= 0)
+		_uring_close();
+
+	memset(&p, 0, sizeof(p));
+	transport_syscalls++;
+	ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring.fd < 0)
+		return -1;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)
+	    || !(p.features & IORING_FEAT_FAST_POLL)) {
+		_uring_close();
+		return -1;
+	}
+
+	/* both rings are in one mapping */
+	ring.rings_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_len > ring.rings_len)
+		ring.rings_len = cq_len;
+	ring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	transport_syscalls += 2;
+	ring.rings = mmap(NULL, ring.rings_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring.fd,
+			  IORING_OFF_SQ_RING);
+	ring.sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if (ring.rings == MAP_FAILED || ring.sqes == MAP_FAILED) {
+		_uring_close();
+		return -1;
+	}
+
+	ring.sq_head = (unsigned *) ((char *) ring.rings + p.sq_off.head);
+	ring.sq_tail = (unsigned *) ((char *) ring.rings + p.sq_off.tail);
+	ring.sq_mask = (unsigned *) ((char *) ring.rings + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned *) ((char *) ring.rings + p.sq_off.array);
+	ring.cq_head = (unsigned *) ((char *) ring.rings + p.cq_off.head);
+	ring.cq_tail = (unsigned *) ((char *) ring.rings + p.cq_off.tail);
+	ring.cq_mask = (unsigned *) ((char *) ring.rings + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *) ((char *) ring.rings +
+					     p.cq_off.cqes);
+
+	ring.pid = getpid();
+	ring.queued = 0;
+	return 0;
+}
+
+static int _uring_send(int sock, char *buf, int len, long long deadline)
+{
+	int ret;
+
+	if (ring.queued > 0 && ring.sock != sock)
+		ring.queued = 0;	/* dropped along with its socket */
+
+	if (ring.queued + len > URING_QUEUE
+	    && (ret = _uring_flush(sock, deadline)) < 0)
+		return ret;
+	if (len > URING_QUEUE)
+		return _uring_send_all(sock, buf, len, deadline);
+
+	memcpy(ring.queue + ring.queued, buf, len);
+	ring.queued += len;
+	ring.sock = sock;
+	return 0;
+}
+
+static int _uring_flush(int sock, long long deadline)
+{
+	int ret;
+
+	if (ring.queued == 0 || ring.sock != sock)
+		return 0;
+
+	ret = _uring_send_all(sock, ring.queue, ring.queued, deadline);
+	ring.queued = 0;
+	return ret;
+}
+
+static int _uring_recv(int sock, char *buf, int len, long long deadline,
+		       int timeout_err)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+	int res[3];
+	int n;
+
+	if (ring.queued > 0 && ring.sock != sock)
+		ring.queued = 0;
+
+	for (;;) {
+		/* the sends gathered, the receive, and its timeout */
+		n = 0;
+		if (ring.queued > 0) {
+			sqe = _uring_prep(n++, IORING_OP_SEND, sock,
+					  ring.queue, ring.queued);
+			sqe->msg_flags = MSG_NOSIGNAL;
+			sqe->flags = IOSQE_IO_LINK;
+		}
+		_uring_prep(n++, IORING_OP_RECV, sock, buf, len);
+		if (_uring_timeout(n++, &ts, deadline) < 0)
+			return ring.queued > 0 ? HTTP_ERR_TIMEOUT : timeout_err;
+		if (_uring_run(n, res) < 0)
+			return HTTP_ERR_READ;
+
+		/* a short send breaks the chain, the rest goes again */
+		if (ring.queued > 0) {
+			if (res[0] < 0 && res[0] != -EINTR
+			    && res[0] != -EAGAIN) {
+				ring.queued = 0;
+				return HTTP_ERR_SEND;
+			}
+			if (res[0] > 0) {
+				ring.queued -= res[0];
+				memmove(ring.queue, ring.queue + res[0],
+					ring.queued);
+			}
+			if (ring.queued > 0) {
+				if (res[0] == -EAGAIN
+				    && _uring_wait(sock, POLLOUT,
+						   deadline) < 0)
+					return HTTP_ERR_TIMEOUT;
+				continue;
+			}
+		}
+
+		if (res[n - 2] >= 0)
+			return res[n - 2];
+		if (res[n - 2] == -ECANCELED && res[n - 1] == -ETIME)
+			return timeout_err;
+		if (res[n - 2] == -EAGAIN && _uring_wait(sock, POLLIN,
+							 deadline) < 0)
+			return timeout_err;
+		if (res[n - 2] != -EAGAIN && res[n - 2] != -EINTR
+		    && res[n - 2] != -ECANCELED)
+			return HTTP_ERR_READ;
+	}
+}
+
+static void _uring_drop(int sock)
+{
+	if (ring.sock == sock)
+		ring.queued = 0;
+}
+
+static void _uring_close(void)
+{
+	if (ring.rings != NULL && ring.rings != MAP_FAILED)
+		munmap(ring.rings, ring.rings_len);
+	if (ring.sqes != NULL && ring.sqes != MAP_FAILED)
+		munmap(ring.sqes, ring.sqes_len);
+	close(ring.fd);
+
+	ring.rings = NULL;
+	ring.sqes = NULL;
+	ring.fd = -1;
+	ring.queued = 0;
+}
+
+static struct io_uring_sqe *_uring_prep(int n, int op, int sock, void *addr,
+					unsigned len)
+{
+	unsigned index = (*ring.sq_tail + n) & *ring.sq_mask;
+	struct io_uring_sqe *sqe = &ring.sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = sock;
+	sqe->addr = (unsigned long) addr;
+	sqe->len = len;
+	sqe->user_data = n;
+	ring.sq_array[index] = index;
+	return sqe;
+}
+
+static int _uring_timeout(int n, struct __kernel_timespec *ts,
+			  long long deadline)
+{
+	long long left = deadline - (long long) stats_now();
+
+	if (left <= 0)
+		return -1;
+
+	ts->tv_sec = left / 1000000;
+	ts->tv_nsec = left % 1000000 * 1000;
+	ring.sqes[(*ring.sq_tail + n - 1) & *ring.sq_mask].flags |=
+	    IOSQE_IO_LINK;
+	_uring_prep(n, IORING_OP_LINK_TIMEOUT, -1, ts, 1);
+	return 0;
+}
+
+static int _uring_run(int n, int *res)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	unsigned tail;
+	unsigned pending;
+	int done = 0;
+
+	/* the entries are written before the tail is */
+	__atomic_store_n(ring.sq_tail, *ring.sq_tail + n, __ATOMIC_RELEASE);
+
+	/* every entry completes before returning, the buffers and the
+	 * timeouts are on the stack of the callers */
+	while (done < n) {
+		pending = *ring.sq_tail -
+		    __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+		transport_syscalls++;
+		if (syscall(__NR_io_uring_enter, ring.fd, pending, n - done,
+			    IORING_ENTER_GETEVENTS, NULL, 0) < 0
+		    && errno != EINTR) {
+			_uring_close();
+			return -1;
+		}
+
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++, done++) {
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			if (cqe->user_data < (unsigned) n)
+				res[cqe->user_data] = cqe->res;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+static int _uring_wait(int sock, short events, long long deadline)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+	int res[2];
+
+	for (;;) {
+		sqe = _uring_prep(0, IORING_OP_POLL_ADD, sock, NULL, 0);
+		sqe->poll32_events = events;
+		if (_uring_timeout(1, &ts, deadline) < 0
+		    || _uring_run(2, res) < 0)
+			return -1;
+
+		if (res[0] >= 0)
+			return 0;	/* errors are reported by the next call */
+		if (res[1] == -ETIME)
+			return -1;
+	}
+}
+
+static int _uring_send_all(int sock, char *buf, int len, long long deadline)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+	int res[2];
+
+	while (len > 0) {
+		sqe = _uring_prep(0, IORING_OP_SEND, sock, buf, len);
+		sqe->msg_flags = MSG_NOSIGNAL;
+		if (_uring_timeout(1, &ts, deadline) < 0)
+			return HTTP_ERR_TIMEOUT;
+		if (_uring_run(2, res) < 0)
+			return HTTP_ERR_SEND;
+
+		if (res[0] > 0) {
+			buf += res[0];
+			len -= res[0];
+		}
+		else if (res[0] == -ECANCELED && res[1] == -ETIME) {
+			return HTTP_ERR_TIMEOUT;
+		}
+		else if (res[0] == -EAGAIN) {
+			if (_uring_wait(sock, POLLOUT, deadline) < 0)
+				return HTTP_ERR_TIMEOUT;
+		}
+		else if (res[0] != -EINTR) {
+			return HTTP_ERR_SEND;
+		}
+	}
+
+	return 0;
+}
+
+#else
+static int _uring_open(void)
+{
+	return -1;		/* not built in, the next transport is used */
+}
+
+static int _uring_send(int sock, char *buf, int len, long long deadline)
+{
+	return HTTP_ERR_SEND;
+}
+
+static int _uring_flush(int sock, long long deadline)
+{
+	return HTTP_ERR_SEND;
+}
+
+static int _uring_recv(int sock, char *buf, int len, long long deadline,
+		       int timeout_err)
+{
+	return HTTP_ERR_READ;
+}
+
+static void _uring_drop(int sock)
+{
+}
+#endif